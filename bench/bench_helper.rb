@@ -0,0 +1,147 @@
+# frozen_string_literal: true
+
+require "etc"
+require "fileutils"
+require "json"
+require "time"
+require "tmpdir"
+
+require "xmp_toolkit_ruby"
+
+# Measurement helpers shared by the benchmarks in bench/.
+module XmpBench
+  FIXTURES_DIR = File.expand_path("../spec/fixtures", __dir__)
+  TESTFILES_DIR = File.join(FIXTURES_DIR, "XMP-Toolkit-SDK", "testfiles")
+
+  FIXTURES = {
+    "psd" => File.join(TESTFILES_DIR, "BlueSquare.psd"),
+    "eps" => File.join(TESTFILES_DIR, "BlueSquare.eps"),
+    "ai" => File.join(TESTFILES_DIR, "BlueSquare.ai"),
+    "jpg" => File.join(TESTFILES_DIR, "Image2.jpg"),
+    "pdf" => File.join(FIXTURES_DIR, "sample.pdf")
+  }.freeze
+
+  # Items written to dc:subject of the synthetic large-packet fixture
+  LARGE_PACKET_ITEMS = 5000
+  # Bytes appended after the image data of the synthetic large-file fixture
+  LARGE_FILE_PADDING = 64 * 1024 * 1024
+
+  module_function
+
+  def iterations
+    Integer(ENV.fetch("BENCH_ITERATIONS", "200"))
+  end
+
+  def thread_counts
+    ENV.fetch("BENCH_THREADS", "1,2,4,8").split(",").map { |count| Integer(count) }
+  end
+
+  def monotonic
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  # Resident set size of this process in KiB.
+  def rss_kb
+    status = "/proc/self/status"
+    return File.read(status)[/^VmRSS:\s+(\d+)/, 1].to_i if File.readable?(status)
+
+    `ps -o rss= -p #{Process.pid}`.to_i
+  end
+
+  def percentile(sorted, fraction)
+    return 0.0 if sorted.empty?
+
+    sorted[((sorted.size - 1) * fraction).round]
+  end
+
+  # Summarizes per-call latencies (seconds) into microsecond percentiles and calls per second.
+  def summarize(samples, allocated_objects:, rss_kb_delta:)
+    sorted = samples.sort
+    total = samples.sum
+
+    {
+      "iterations" => samples.size,
+      "mean_us" => (total / samples.size * 1e6).round(2),
+      "p50_us" => (percentile(sorted, 0.50) * 1e6).round(2),
+      "p90_us" => (percentile(sorted, 0.90) * 1e6).round(2),
+      "p99_us" => (percentile(sorted, 0.99) * 1e6).round(2),
+      "max_us" => (sorted.last * 1e6).round(2),
+      "ops_per_second" => total.positive? ? (samples.size / total).round(1) : nil,
+      "allocated_objects_per_op" => (allocated_objects.to_f / samples.size).round(1),
+      "rss_kb_delta" => rss_kb_delta
+    }
+  end
+
+  # Times block once per iteration, after a short warmup.
+  def measure(count = iterations, warmup: [count / 10, 1].max)
+    warmup.times { |i| yield i }
+    GC.start
+
+    rss_before = rss_kb
+    allocated_before = GC.stat(:total_allocated_objects)
+    samples = Array.new(count) do |i|
+      started = monotonic
+      yield i
+      monotonic - started
+    end
+
+    summarize(samples, allocated_objects: GC.stat(:total_allocated_objects) - allocated_before,
+                       rss_kb_delta: rss_kb - rss_before)
+  end
+
+  # Times each phase of a multi-step operation separately. The block receives a
+  # recorder and wraps every phase in `recorder.call(name) { ... }`.
+  def measure_phases(count = iterations, warmup: [count / 10, 1].max)
+    noop = ->(_name, &phase) { phase.call }
+    warmup.times { |i| yield noop, i }
+    GC.start
+
+    samples = Hash.new { |hash, name| hash[name] = [] }
+    allocations = Hash.new(0)
+    rss = Hash.new(0)
+    recorder = lambda do |name, &phase|
+      rss_before = rss_kb
+      allocated_before = GC.stat(:total_allocated_objects)
+      started = monotonic
+      phase.call
+      samples[name] << (monotonic - started)
+      allocations[name] += GC.stat(:total_allocated_objects) - allocated_before
+      rss[name] += rss_kb - rss_before
+    end
+
+    count.times { |i| yield recorder, i }
+
+    samples.to_h do |name, phase_samples|
+      [name, summarize(phase_samples, allocated_objects: allocations[name], rss_kb_delta: rss[name])]
+    end
+  end
+
+  # Builds the synthetic fixtures in dir and returns them with the regular ones.
+  def fixtures(dir)
+    large_packet = File.join(dir, "large_packet.jpg")
+    FileUtils.cp(FIXTURES["jpg"], large_packet)
+    update_flags = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler)
+    XmpToolkitRuby::XmpFile.with_xmp_file(large_packet, open_flags: update_flags,
+                                                        auto_terminate_toolkit: false) do |xmp_file|
+      items = Array.new(LARGE_PACKET_ITEMS) { |i| "keyword #{i}" }
+      xmp_file.update_array_property(XmpToolkitRuby::XmpPath.parse("dc:subject"), items, form: :bag)
+    end
+
+    large_file = File.join(dir, "large_file.jpg")
+    FileUtils.cp(FIXTURES["jpg"], large_file)
+    File.open(large_file, "ab") { |file| file.write("\0" * LARGE_FILE_PADDING) }
+
+    FIXTURES.merge("large_packet_jpg" => large_packet, "large_file_jpg" => large_file)
+  end
+
+  def environment
+    {
+      "ruby" => RUBY_DESCRIPTION,
+      "gem_version" => XmpToolkitRuby::VERSION,
+      "platform" => RUBY_PLATFORM,
+      "processors" => Etc.nprocessors,
+      "iterations" => iterations,
+      "time" => Time.now.utc.iso8601
+    }
+  end
+end
@@ -0,0 +1,31 @@
+# frozen_string_literal: true
+
+# Prints the change of every p50 latency and throughput between two bench runs.
+#
+#   ruby bench/compare.rb before.json after.json
+
+require "json"
+
+abort "Usage: ruby #{$PROGRAM_NAME} BEFORE.json AFTER.json" unless ARGV.size == 2
+
+# Flattens nested results into "fixture/section/phase/metric" => value.
+def flatten(hash, prefix = nil, out = {})
+  hash.each do |key, value|
+    name = [prefix, key].compact.join("/")
+    if value.is_a?(Hash)
+      flatten(value, name, out)
+    elsif value.is_a?(Numeric)
+      out[name] = value
+    end
+  end
+  out
+end
+
+before, after = ARGV.map { |path| flatten(JSON.parse(File.read(path)).except("environment")) }
+
+(before.keys & after.keys).grep(%r{/(p50_us|ops_per_second|files_per_second)\z}).each do |key|
+  next if before[key].zero?
+
+  change = (after[key] - before[key]) / before[key].to_f * 100
+  puts format("%-70s %12.2f -> %12.2f  %+7.1f%%", key, before[key], after[key], change)
+end
@@ -0,0 +1,104 @@
+# frozen_string_literal: true
+
+# Measures latency, throughput, allocations and RSS of the Ruby API per fixture,
+# plus thread scaling of xmp_from_file, and prints the results as JSON.
+#
+#   bundle exec rake bench
+#   BENCH_ITERATIONS=1000 BENCH_THREADS=1,4,16 BENCH_OUTPUT=before.json bundle exec rake bench
+#
+# Compare two runs with `bench/compare.rb before.json after.json`.
+
+require_relative "bench_helper"
+
+READ_FLAGS = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)
+SCAN_FLAGS = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+UPDATE_FLAGS = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler)
+UPDATE_SCAN_FLAGS = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_packet_scanning)
+
+CREATOR_TOOL = XmpToolkitRuby::XmpPath.parse("xmp:CreatorTool")
+UPDATE_XML = <<~XML
+  <x:xmpmeta xmlns:x="adobe:ns:meta/">
+    <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+      <rdf:Description rdf:about="" xmlns:xmp="http://ns.adobe.com/xap/1.0/">
+        <xmp:Label>bench %d</xmp:Label>
+      </rdf:Description>
+    </rdf:RDF>
+  </x:xmpmeta>
+XML
+
+# Read path: open, meta, property and close of an unmodified file.
+def bench_read(path)
+  XmpBench.measure_phases do |record, _i|
+    xmp_file = XmpToolkitRuby::XmpFile.new(path, open_flags: READ_FLAGS, fallback_flags: SCAN_FLAGS)
+    record.call("open") { xmp_file.open }
+    record.call("meta") { xmp_file.meta }
+    record.call("property") { xmp_file.property(CREATOR_TOOL) }
+    record.call("close") { xmp_file.close }
+  end
+end
+
+# Write path on a private copy: every iteration changes xmp:Label, so write always rewrites the file.
+def bench_write(path, dir)
+  copy = File.join(dir, "write-#{File.basename(path)}")
+  FileUtils.cp(path, copy)
+
+  XmpBench.measure_phases do |record, i|
+    xmp_file = XmpToolkitRuby::XmpFile.new(copy, open_flags: UPDATE_FLAGS, fallback_flags: UPDATE_SCAN_FLAGS)
+    record.call("open") { xmp_file.open }
+    record.call("update_meta") { xmp_file.update_meta(format(UPDATE_XML, i)) }
+    record.call("write") { xmp_file.write }
+    record.call("close") { xmp_file.close }
+  end
+ensure
+  FileUtils.rm_f(copy)
+end
+
+def bench_xmp_from_file(path)
+  XmpBench.measure { XmpToolkitRuby.xmp_from_file(path) }
+end
+
+# Files per second of xmp_from_file over all fixtures with N threads.
+def bench_thread_scaling(paths)
+  per_thread = [XmpBench.iterations / 4, 1].max
+
+  XmpBench.thread_counts.to_h do |threads|
+    started = XmpBench.monotonic
+    Array.new(threads) do
+      Thread.new { per_thread.times { |i| XmpToolkitRuby.xmp_from_file(paths[i % paths.size]) } }
+    end.each(&:join)
+    elapsed = XmpBench.monotonic - started
+
+    [threads.to_s, { "files" => threads * per_thread,
+                     "seconds" => elapsed.round(3),
+                     "files_per_second" => (threads * per_thread / elapsed).round(1) }]
+  end
+end
+
+results = { "environment" => XmpBench.environment, "fixtures" => {} }
+
+Dir.mktmpdir("xmp_bench") do |dir|
+  XmpToolkitRuby.with_init do
+    fixtures = XmpBench.fixtures(dir)
+
+    fixtures.each do |name, path|
+      warn "bench: #{name}"
+      results["fixtures"][name] = {
+        "bytes" => File.size(path),
+        "xmp_from_file" => bench_xmp_from_file(path),
+        "xmp_file_read" => bench_read(path),
+        "xmp_file_write" => bench_write(path, dir)
+      }
+    end
+
+    warn "bench: thread scaling"
+    results["thread_scaling"] = bench_thread_scaling(fixtures.values)
+  end
+end
+
+json = JSON.pretty_generate(results)
+if ENV["BENCH_OUTPUT"]
+  File.write(ENV["BENCH_OUTPUT"], json)
+  warn "bench: results written to #{ENV["BENCH_OUTPUT"]}"
+else
+  puts json
+end
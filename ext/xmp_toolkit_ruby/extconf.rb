@@ -24,6 +24,9 @@ XML_TOOLKIT_RUBY_HELP_MESSAGE = <<~HELP.freeze
 
     --with-xmp-include=DIRECTORY
         Look for headers in DIRECTORY.
+
+    --disable-usdt
+        Leave out the USDT probes, even if sys/sdt.h is installed.
 HELP
 
 def do_help
@@ -97,5 +100,38 @@ $defs << "-DXMP_COMPONENTS_VERSION=0x60000000"
 $defs << "-DXMP_PUBLIC_APIS=1"
 $defs << "-DBUILDING_XMPCOMMON=1"
 
+# Optional: compresses MetadataIndex records. HAVE_ZLIB_H is only defined once -lz links.
+have_library("z", "compress2", "zlib.h") && have_header("zlib.h")
+
+# Optional: USDT probes for bpftrace/perf (see xmp_probes.hpp). sys/sdt.h is
+# header-only and ships with systemtap-sdt-dev(el); it defines HAVE_SYS_SDT_H.
+have_header("sys/sdt.h") if enable_config("usdt", true)
+
+# Optional: heap statistics and trimming of glibc (see xmp_heap.hpp)
+have_func("mallinfo2", "malloc.h")
+have_func("malloc_trim", "malloc.h")
+
+# Optional: wakes fibers waiting for offloaded SDK calls; a pipe otherwise (see xmp_fiber_offload.hpp)
+have_func("eventfd", "sys/eventfd.h")
+
+$cleanfiles << "xmptool" << "xmpbench"
+
 # Create the Makefile
 create_makefile(extension_name)
+
+# Standalone programs sharing the SDK layer and libraries of the extension, but
+# not libruby: the xmptool command-line tool and the xmpbench SDK benchmark.
+# mkmf only compiles the top-level sources into the extension, so tool/ stays
+# out of it. Build with `make xmptool xmpbench` (or `rake xmptool xmpbench`).
+File.open("Makefile", "a") do |makefile|
+  %w[xmptool xmpbench].each do |tool|
+    sources = "$(srcdir)/tool/#{tool}.cpp $(srcdir)/xmp_sdk_ops.cpp $(srcdir)/xmp_heap.cpp"
+
+    makefile.puts <<~MAKE
+
+      #{tool}: #{sources} $(srcdir)/xmp_sdk_ops.hpp $(srcdir)/xmp_heap.hpp
+      \t$(ECHO) linking #{tool}
+      \t$(Q) $(CXX) $(INCFLAGS) $(CPPFLAGS) $(CXXFLAGS) $(optflags) -o $@ #{sources} $(ldflags) -lpthread -ldl
+    MAKE
+  end
+end
@@ -0,0 +1,353 @@
+// xmpbench: times the SDK calls behind XmpFile directly, without Ruby.
+//
+// Reports latency percentiles and cycles per packet byte of OpenFile, GetXMP,
+// SerializeToBuffer, ApplyTemplate, PutXMP and CloseFile for every file given.
+// Compared with the numbers of `rake bench`, the difference is the cost of the
+// binding layer. Build it with `rake xmpbench` or `make xmpbench` in the
+// extension build directory.
+//
+// With --soak it instead reads the files round-robin, e.g. a million times, and
+// samples RSS and heap fragmentation along the way, with and without trimming
+// the heap every --trim-every files (XmpToolkit.heap_trim_interval).
+
+#include "../xmp_heap.hpp"
+#include "../xmp_sdk_ops.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define XMPBENCH_HAVE_TSC 1
+#endif
+
+static const char *USAGE =
+    "Usage: xmpbench [--plugins DIR] [--iterations N] [--template FILE] FILE...\n"
+    "       xmpbench [--plugins DIR] --soak N [--trim-every K] FILE...\n"
+    "\n"
+    "Prints one JSON line per FILE with p50/p90/p99/max latency in nanoseconds and\n"
+    "median cycles per packet byte of each SDK call. The write phases run on a copy.\n"
+    "\n"
+    "--soak reads the FILEs round-robin N times and prints a JSON line with RSS and\n"
+    "heap fragmentation every N/100 files; --trim-every trims the heap every K files.\n";
+
+static const char *DEFAULT_TEMPLATE =
+    "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"><rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+    "<rdf:Description rdf:about=\"\" xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\">"
+    "<xmp:Label>xmpbench</xmp:Label></rdf:Description></rdf:RDF></x:xmpmeta>";
+
+struct Sample {
+  double nanos;
+  double cycles;
+};
+
+// Samples of every timed call, by SDK function name.
+using Samples = std::map<std::string, std::vector<Sample>>;
+
+static inline unsigned long long read_cycles() {
+#ifdef XMPBENCH_HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Runs fn and records its wall time and TSC cycles under name.
+template <typename Fn>
+static auto timed(Samples *samples, const char *name, Fn fn) -> decltype(fn()) {
+  auto started = std::chrono::steady_clock::now();
+  unsigned long long cycles = read_cycles();
+
+  struct Record {
+    Samples *samples;
+    const char *name;
+    std::chrono::steady_clock::time_point started;
+    unsigned long long cycles;
+    ~Record() {
+      unsigned long long elapsedCycles = read_cycles() - cycles;
+      double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+      (*samples)[name].push_back({nanos, static_cast<double>(elapsedCycles)});
+    }
+  } record{samples, name, started, cycles};
+
+  return fn();
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[static_cast<size_t>((sorted.size() - 1) * fraction + 0.5)];
+}
+
+static std::string json_escape(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  return escaped;
+}
+
+static void print_phase(const std::string &name, std::vector<Sample> samples, XMP_Int32 packetBytes, bool first) {
+  std::vector<double> nanos, cycles;
+  for (const Sample &sample : samples) {
+    nanos.push_back(sample.nanos);
+    cycles.push_back(sample.cycles);
+  }
+  std::sort(nanos.begin(), nanos.end());
+  std::sort(cycles.begin(), cycles.end());
+
+  std::printf("%s\"%s\":{\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"max_ns\":%.0f", first ? "" : ",",
+              name.c_str(), percentile(nanos, 0.5), percentile(nanos, 0.9), percentile(nanos, 0.99), nanos.back());
+
+#ifdef XMPBENCH_HAVE_TSC
+  if (packetBytes > 0) {
+    std::printf(",\"cycles_per_byte\":%.2f", percentile(cycles, 0.5) / packetBytes);
+  } else {
+    std::printf(",\"cycles_per_byte\":null");
+  }
+#else
+  std::printf(",\"cycles_per_byte\":null");
+#endif
+
+  std::printf("}");
+}
+
+static bool open_file(SXMPFiles *file, const std::string &path, XMP_OptionBits access) {
+  try {
+    if (file->OpenFile(path, kXMP_UnknownFile, access | kXMPFiles_OpenUseSmartHandler)) {
+      return true;
+    }
+  } catch (const XMP_Error &) {
+    // Retried with packet scanning, like XmpFile#open with fallback_flags
+  }
+  return file->OpenFile(path, kXMP_UnknownFile, access | kXMPFiles_OpenUsePacketScanning);
+}
+
+// Read path of XmpToolkitRuby.xmp_from_file.
+static void bench_read(const std::string &path, Samples *samples, XMP_PacketInfo *packet) {
+  SXMPFiles file;
+  SXMPMeta meta;
+  std::string serialized;
+
+  if (!timed(samples, "OpenFile", [&] { return open_file(&file, path, kXMPFiles_OpenForRead); })) {
+    throw std::runtime_error("Failed to open file " + path);
+  }
+  timed(samples, "GetXMP", [&] { return file.GetXMP(&meta, 0, packet); });
+  timed(samples, "SerializeToBuffer", [&] { meta.SerializeToBuffer(&serialized); });
+  timed(samples, "CloseFile", [&] { file.CloseFile(); });
+}
+
+// Write path of XmpFile#apply_template and #write. Every iteration stamps a new
+// xmp:MetadataDate so PutXMP and CloseFile always rewrite the file.
+static void bench_write(const std::string &path, const SXMPMeta &templateMeta, Samples *samples) {
+  SXMPFiles file;
+  SXMPMeta meta;
+
+  if (!open_file(&file, path, kXMPFiles_OpenForUpdate)) {
+    throw std::runtime_error("Failed to open file for update " + path);
+  }
+  file.GetXMP(&meta, 0, 0);
+
+  timed(samples, "ApplyTemplate", [&] {
+    SXMPUtils::ApplyTemplate(&meta, templateMeta,
+                             kXMPTemplate_AddNewProperties | kXMPTemplate_ReplaceExistingProperties);
+  });
+
+  XMP_DateTime now;
+  SXMPUtils::CurrentDateTime(&now);
+  meta.SetProperty_Date(kXMP_NS_XMP, "MetadataDate", now, 0);
+
+  if (file.CanPutXMP(meta)) {
+    timed(samples, "PutXMP", [&] { file.PutXMP(meta); });
+  }
+  timed(samples, "CloseFile(update)", [&] { file.CloseFile(); });
+}
+
+static bool bench_file(const std::string &path, int iterations, const SXMPMeta &templateMeta) {
+  Samples samples;
+  XMP_PacketInfo packet;
+  std::string copyName =
+      "xmpbench-" + std::to_string(::getpid()) + "-" + std::filesystem::path(path).filename().string();
+  std::string copy = (std::filesystem::temp_directory_path() / copyName).string();
+
+  try {
+    int warmup = std::max(iterations / 10, 1);
+    for (int i = 0; i < warmup + iterations; i++) {
+      if (i == warmup) {
+        samples.clear();
+      }
+      bench_read(path, &samples, &packet);
+    }
+
+    std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing);
+    for (int i = 0; i < iterations; i++) {
+      bench_write(copy, templateMeta, &samples);
+    }
+    std::filesystem::remove(copy);
+  } catch (const XMP_Error &e) {
+    std::filesystem::remove(copy);
+    std::fprintf(stderr, "xmpbench: %s: XMP SDK error: %s\n", path.c_str(), e.GetErrMsg());
+    return false;
+  } catch (const std::exception &e) {
+    std::filesystem::remove(copy);
+    std::fprintf(stderr, "xmpbench: %s: %s\n", path.c_str(), e.what());
+    return false;
+  }
+
+  std::printf("{\"path\":\"%s\",\"bytes\":%llu,\"packet_bytes\":%d,\"iterations\":%d,\"calls\":{",
+              json_escape(path).c_str(), static_cast<unsigned long long>(std::filesystem::file_size(path)),
+              packet.length, iterations);
+  bool first = true;
+  for (auto &entry : samples) {
+    print_phase(entry.first, std::move(entry.second), packet.length, first);
+    first = false;
+  }
+  std::printf("}}\n");
+  std::fflush(stdout);
+
+  return true;
+}
+
+static void print_heap(long files, std::chrono::steady_clock::time_point started) {
+  HeapStats heap;
+  bool available = heap_stats(&heap);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  std::printf("{\"files\":%ld,\"seconds\":%.3f,\"rss\":%zu", files, seconds, heap.rss);
+  if (available) {
+    std::printf(",\"heap\":%zu,\"in_use\":%zu,\"free\":%zu,\"fragmentation\":%.4f", heap.heap, heap.inUse,
+                heap.free, heap.fragmentation());
+  }
+  std::printf("}\n");
+  std::fflush(stdout);
+}
+
+// Reads files round-robin count times, like a long-lived worker going through a
+// large tree, sampling the heap a hundred times along the way.
+static bool soak(const std::vector<std::string> &files, long count, long trimEvery) {
+  long every = std::max(count / 100, 1L);
+  auto started = std::chrono::steady_clock::now();
+  Samples samples;
+  XMP_PacketInfo packet;
+
+  print_heap(0, started);
+  for (long i = 1; i <= count; i++) {
+    const std::string &path = files[(i - 1) % files.size()];
+    try {
+      bench_read(path, &samples, &packet);
+    } catch (const XMP_Error &e) {
+      std::fprintf(stderr, "xmpbench: %s: XMP SDK error: %s\n", path.c_str(), e.GetErrMsg());
+      return false;
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "xmpbench: %s: %s\n", path.c_str(), e.what());
+      return false;
+    }
+    samples.clear();
+
+    if (trimEvery > 0 && i % trimEvery == 0) {
+      heap_trim();
+    }
+    if (i % every == 0) {
+      print_heap(i, started);
+    }
+  }
+
+  return true;
+}
+
+static bool read_text_file(const char *path, std::string *out) {
+  FILE *file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  char buffer[65536];
+  size_t read;
+  while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    out->append(buffer, read);
+  }
+  std::fclose(file);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *pluginPath = std::getenv("XMP_TOOLKIT_PLUGINS_PATH");
+  int iterations = 200;
+  long soakCount = 0;
+  long trimEvery = 0;
+  std::string templateXml = DEFAULT_TEMPLATE;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--plugins") == 0 && i + 1 < argc) {
+      pluginPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = std::max(std::atoi(argv[++i]), 1);
+    } else if (std::strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+      soakCount = std::max(std::atol(argv[++i]), 1L);
+    } else if (std::strcmp(argv[i], "--trim-every") == 0 && i + 1 < argc) {
+      trimEvery = std::max(std::atol(argv[++i]), 0L);
+    } else if (std::strcmp(argv[i], "--template") == 0 && i + 1 < argc) {
+      templateXml.clear();
+      if (!read_text_file(argv[++i], &templateXml)) {
+        std::fprintf(stderr, "xmpbench: cannot read template %s\n", argv[i]);
+        return 2;
+      }
+    } else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+      std::fputs(USAGE, stdout);
+      return 0;
+    } else {
+      files.emplace_back(argv[i]);
+    }
+  }
+
+  if (files.empty()) {
+    std::fputs(USAGE, stderr);
+    return 2;
+  }
+
+  if (pluginPath != nullptr && *pluginPath == '\0') {
+    pluginPath = nullptr;
+  }
+
+  std::string error;
+  if (!sdk_initialize(pluginPath, &error)) {
+    std::fprintf(stderr, "xmpbench: %s\n", error.c_str());
+    return 1;
+  }
+
+  int status = 0;
+  if (soakCount > 0) {
+    status = soak(files, soakCount, trimEvery) ? 0 : 1;
+    sdk_terminate();
+    return status;
+  }
+
+  try {
+    SXMPMeta templateMeta(templateXml.data(), static_cast<XMP_StringLen>(templateXml.size()));
+    for (const std::string &file : files) {
+      if (!bench_file(file, iterations, templateMeta)) {
+        status = 1;
+      }
+    }
+  } catch (const XMP_Error &e) {
+    std::fprintf(stderr, "xmpbench: invalid template: %s\n", e.GetErrMsg());
+    status = 2;
+  }
+
+  sdk_terminate();
+  return status;
+}
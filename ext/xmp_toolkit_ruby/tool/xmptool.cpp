@@ -0,0 +1,408 @@
+// xmptool: standalone command-line front end for the XMP Toolkit SDK.
+//
+// Built from the same SDK layer (xmp_sdk_ops) and libraries as the Ruby
+// extension, so reads and writes behave exactly like the gem, but without
+// starting a Ruby VM. Build it with `rake xmptool` or `make xmptool` in the
+// extension build directory.
+
+#include "../xmp_sdk_ops.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const char *USAGE =
+    "Usage: xmptool [--plugins DIR] COMMAND [ARGS]\n"
+    "\n"
+    "Commands:\n"
+    "  read FILE...                 Print file info, packet info and XMP of each FILE as JSON lines\n"
+    "  dump FILE                    Print the raw XMP packet as stored in FILE\n"
+    "  get FILE prefix:Name         Print the value of a property\n"
+    "  set FILE prefix:Name VALUE   Set a property and write FILE if it changed\n"
+    "  batch                        Run tab-separated commands from stdin, one JSON line per command\n"
+    "\n"
+    "Plugins (the PDF handler) are loaded from DIR or $XMP_TOOLKIT_PLUGINS_PATH.\n";
+
+// Outcome of one command. Commands print their own output and report failures here.
+struct CommandResult {
+  bool ok = true;
+  std::string error;
+};
+
+static void append_json_string(std::string *out, const std::string &value) {
+  out->push_back('"');
+  for (unsigned char c : value) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      default:
+        if (c < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out->append(escaped);
+        } else {
+          out->push_back(static_cast<char>(c));
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+// Small builder for the flat JSON objects xmptool prints.
+class JsonLine {
+ public:
+  JsonLine &str(const char *key, const std::string &value) {
+    add_key(key);
+    append_json_string(&buffer_, value);
+    return *this;
+  }
+
+  JsonLine &num(const char *key, long long value) {
+    add_key(key);
+    buffer_.append(std::to_string(value));
+    return *this;
+  }
+
+  JsonLine &boolean(const char *key, bool value) {
+    add_key(key);
+    buffer_.append(value ? "true" : "false");
+    return *this;
+  }
+
+  void print() {
+    buffer_.append("}\n");
+    std::fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+  }
+
+ private:
+  void add_key(const char *key) {
+    buffer_.push_back(buffer_.empty() ? '{' : ',');
+    append_json_string(&buffer_, key);
+    buffer_.push_back(':');
+  }
+
+  std::string buffer_;
+};
+
+// Resolves "prefix:Name" against the registered namespaces, like XmpPath.parse.
+static bool parse_property(const std::string &ref, std::string *ns, std::string *prop, std::string *error) {
+  size_t colon = ref.find(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == ref.size()) {
+    *error = "Invalid property '" + ref + "', expected prefix:Name";
+    return false;
+  }
+
+  if (!SXMPMeta::GetNamespaceURI(ref.substr(0, colon).c_str(), ns)) {
+    *error = "Unknown namespace prefix '" + ref.substr(0, colon) + "'";
+    return false;
+  }
+
+  *prop = ref.substr(colon + 1);
+  return true;
+}
+
+static bool read_metadata(const std::string &path, FileMetadata *metadata, std::string *error) {
+  if (!read_file_metadata(path.c_str(), metadata)) {
+    *error = "Failed to open file " + path;
+    return false;
+  }
+  if (!metadata->hasXMP) {
+    *error = "Failed to get XMP metadata";
+    return false;
+  }
+  return true;
+}
+
+static CommandResult cmd_read(const std::string &path, JsonLine *line) {
+  CommandResult result;
+  FileMetadata metadata;
+  if (!read_metadata(path, &metadata, &result.error)) {
+    result.ok = false;
+    return result;
+  }
+
+  // Same keys as XmpFile#file_info, #packet_info and #meta
+  line->num("format", metadata.format)
+      .num("handler_flags", metadata.handlerFlags)
+      .num("open_flags", metadata.openFlags)
+      .num("offset", metadata.packetInfo.offset)
+      .num("length", metadata.packetInfo.length)
+      .num("pad_size", metadata.packetInfo.padSize)
+      .num("char_form", metadata.packetInfo.charForm)
+      .boolean("writeable", metadata.packetInfo.writeable)
+      .boolean("has_wrapper", metadata.packetInfo.hasWrapper)
+      .num("pad", metadata.packetInfo.pad)
+      .str("xmp_data", metadata.serialized);
+
+  return result;
+}
+
+static CommandResult cmd_dump(const std::string &path, std::string *packet) {
+  CommandResult result;
+  FileMetadata metadata;
+  result.ok = read_metadata(path, &metadata, &result.error);
+  *packet = metadata.rawPacket;
+  return result;
+}
+
+static CommandResult cmd_get(const std::string &path, const std::string &ref, bool *exists, std::string *value) {
+  CommandResult result;
+  std::string ns, prop;
+  FileMetadata metadata;
+
+  if (!parse_property(ref, &ns, &prop, &result.error) || !read_metadata(path, &metadata, &result.error)) {
+    result.ok = false;
+    return result;
+  }
+
+  SXMPMeta meta(metadata.serialized.data(), static_cast<XMP_StringLen>(metadata.serialized.size()));
+  *exists = meta.GetProperty(ns.c_str(), prop.c_str(), value, 0);
+
+  return result;
+}
+
+static bool open_for_update(SXMPFiles *file, const std::string &path) {
+  try {
+    if (file->OpenFile(path, kXMP_UnknownFile, kXMPFiles_OpenForUpdate | kXMPFiles_OpenUseSmartHandler)) {
+      return true;
+    }
+  } catch (const XMP_Error &) {
+    // Retried with packet scanning, like XmpFile#open with fallback_flags
+  }
+
+  return file->OpenFile(path, kXMP_UnknownFile, kXMPFiles_OpenForUpdate | kXMPFiles_OpenUsePacketScanning);
+}
+
+// Mirrors XmpFile#update_property followed by #write: the file is only
+// rewritten when the property subtree actually changed.
+static CommandResult cmd_set(const std::string &path, const std::string &ref, const std::string &value,
+                             bool *changed) {
+  CommandResult result;
+  std::string ns, prop;
+  *changed = false;
+
+  if (!parse_property(ref, &ns, &prop, &result.error)) {
+    result.ok = false;
+    return result;
+  }
+
+  SXMPFiles file;
+  if (!open_for_update(&file, path)) {
+    result.ok = false;
+    result.error = "Failed to open file " + path;
+    return result;
+  }
+
+  SXMPMeta meta;
+  file.GetXMP(&meta, 0, 0);
+
+  std::string before = meta_fingerprint(meta, ns.c_str(), prop.c_str());
+  meta.SetProperty(ns.c_str(), prop.c_str(), value, 0);
+
+  if (!meta_matches_fingerprint(meta, ns.c_str(), prop.c_str(), before)) {
+    if (!file.CanPutXMP(meta)) {
+      file.CloseFile();
+      result.ok = false;
+      result.error = "Can't update XMP new Data";
+      return result;
+    }
+    file.PutXMP(meta);
+    *changed = true;
+  }
+
+  file.CloseFile();
+  return result;
+}
+
+static std::vector<std::string> split_tabs(const std::string &line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true) {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+    if (tab == std::string::npos) {
+      return fields;
+    }
+    start = tab + 1;
+  }
+}
+
+// Runs one command and prints its JSON line. Used by read and batch.
+static bool run_json_command(const std::vector<std::string> &args) {
+  JsonLine line;
+  CommandResult result;
+  const std::string &command = args.empty() ? std::string() : args[0];
+
+  line.str("command", command);
+  if (args.size() > 1) {
+    line.str("path", args[1]);
+  }
+
+  try {
+    if (command == "read" && args.size() == 2) {
+      result = cmd_read(args[1], &line);
+    } else if (command == "dump" && args.size() == 2) {
+      std::string packet;
+      result = cmd_dump(args[1], &packet);
+      if (result.ok) {
+        line.str("packet", packet);
+      }
+    } else if (command == "get" && args.size() == 3) {
+      bool exists = false;
+      std::string value;
+      result = cmd_get(args[1], args[2], &exists, &value);
+      if (result.ok) {
+        line.boolean("exists", exists).str("value", value);
+      }
+    } else if (command == "set" && args.size() == 4) {
+      bool changed = false;
+      result = cmd_set(args[1], args[2], args[3], &changed);
+      if (result.ok) {
+        line.boolean("changed", changed);
+      }
+    } else {
+      result.ok = false;
+      result.error = "Invalid command";
+    }
+  } catch (const XMP_Error &e) {
+    result.ok = false;
+    result.error = std::string("XMP SDK error: ") + e.GetErrMsg();
+  }
+
+  if (!result.ok) {
+    line.str("error", result.error);
+  }
+  line.print();
+
+  return result.ok;
+}
+
+static int run_batch() {
+  int status = 0;
+  std::string input;
+  while (std::getline(std::cin, input)) {
+    if (!input.empty() && input.back() == '\r') {
+      input.pop_back();
+    }
+    if (input.empty()) {
+      continue;
+    }
+    if (!run_json_command(split_tabs(input))) {
+      status = 1;
+    }
+  }
+  std::fflush(stdout);
+  return status;
+}
+
+// Plain (non-JSON) output for single dump, get and set invocations.
+static int run_plain(const std::vector<std::string> &args) {
+  CommandResult result;
+  const std::string &command = args[0];
+
+  try {
+    if (command == "dump" && args.size() == 2) {
+      std::string packet;
+      result = cmd_dump(args[1], &packet);
+      std::fwrite(packet.data(), 1, packet.size(), stdout);
+    } else if (command == "get" && args.size() == 3) {
+      bool exists = false;
+      std::string value;
+      result = cmd_get(args[1], args[2], &exists, &value);
+      if (result.ok && !exists) {
+        return 1;
+      }
+      std::printf("%s\n", value.c_str());
+    } else if (command == "set" && args.size() == 4) {
+      bool changed = false;
+      result = cmd_set(args[1], args[2], args[3], &changed);
+      if (result.ok) {
+        std::printf("%s\n", changed ? "changed" : "unchanged");
+      }
+    } else {
+      std::fputs(USAGE, stderr);
+      return 2;
+    }
+  } catch (const XMP_Error &e) {
+    result.ok = false;
+    result.error = std::string("XMP SDK error: ") + e.GetErrMsg();
+  }
+
+  if (!result.ok) {
+    std::fprintf(stderr, "xmptool: %s\n", result.error.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+static int run(const std::vector<std::string> &args) {
+  const std::string &command = args[0];
+
+  if (command == "batch" && args.size() == 1) {
+    return run_batch();
+  }
+
+  if (command == "read" && args.size() > 1) {
+    int status = 0;
+    for (size_t i = 1; i < args.size(); i++) {
+      if (!run_json_command({"read", args[i]})) {
+        status = 1;
+      }
+    }
+    return status;
+  }
+
+  return run_plain(args);
+}
+
+int main(int argc, char **argv) {
+  const char *pluginPath = std::getenv("XMP_TOOLKIT_PLUGINS_PATH");
+  std::vector<std::string> args;
+
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--plugins") == 0 && i + 1 < argc) {
+      pluginPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+      std::fputs(USAGE, stdout);
+      return 0;
+    } else {
+      args.emplace_back(argv[i]);
+    }
+  }
+
+  if (args.empty()) {
+    std::fputs(USAGE, stderr);
+    return 2;
+  }
+
+  if (pluginPath != nullptr && *pluginPath == '\0') {
+    pluginPath = nullptr;
+  }
+
+  std::string error;
+  if (!sdk_initialize(pluginPath, &error)) {
+    std::fprintf(stderr, "xmptool: %s\n", error.c_str());
+    return 1;
+  }
+
+  int status = run(args);
+
+  sdk_terminate();
+  return status;
+}
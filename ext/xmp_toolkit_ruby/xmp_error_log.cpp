@@ -0,0 +1,185 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_error_log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// Errors of SXMPMeta and SXMPFiles objects that belong to no XmpWrapper
+// (templates, cache parses, format checks); drained by every report.
+static ErrorLog default_error_log(kErrorLogCapacity);
+
+// Log of the SDK call running on this thread, see ErrorLogScope
+static thread_local ErrorLog *scoped_error_log = nullptr;
+
+static std::atomic<long> error_log_rate{10};
+
+// Warnings emitted in the current one second window, shared by all threads
+static std::mutex limiter_mutex;
+static std::chrono::steady_clock::time_point window_start;
+static long window_count = 0;
+static size_t suppressed = 0;
+
+static const char *severity_name(XMP_ErrorSeverity severity) {
+  switch (severity) {
+    case kXMPErrSev_Recoverable:
+      return "recoverable";
+    case kXMPErrSev_OperationFatal:
+      return "operation_fatal";
+    case kXMPErrSev_FileFatal:
+      return "file_fatal";
+    case kXMPErrSev_ProcessFatal:
+      return "process_fatal";
+  }
+  return "unknown";
+}
+
+static void error_log_record(ErrorLog *log, XMP_StringPtr filePath, XMP_ErrorSeverity severity, XMP_Int32 cause,
+                             XMP_StringPtr message) {
+  std::lock_guard<std::mutex> guard(log->mutex);
+
+  if (log->entries.size() >= log->capacity) {
+    log->dropped++;
+    return;
+  }
+  log->entries.push_back(SdkError{severity, cause, filePath ? filePath : log->path, message ? message : ""});
+}
+
+static ErrorLog *callback_log(void *context) {
+  if (context) {
+    return static_cast<ErrorLog *>(context);
+  }
+  return scoped_error_log ? scoped_error_log : &default_error_log;
+}
+
+bool error_log_meta_callback(void *context, XMP_ErrorSeverity severity, XMP_Int32 cause, XMP_StringPtr message) {
+  ErrorLog *log = callback_log(context);
+  error_log_record(log, nullptr, severity, cause, message);
+
+  return severity == kXMPErrSev_Recoverable;
+}
+
+bool error_log_file_callback(void *context, XMP_StringPtr filePath, XMP_ErrorSeverity severity, XMP_Int32 cause,
+                             XMP_StringPtr message) {
+  ErrorLog *log = callback_log(context);
+  error_log_record(log, filePath, severity, cause, message);
+
+  return severity == kXMPErrSev_Recoverable;
+}
+
+ErrorLogScope::ErrorLogScope(ErrorLog *log) : previous(scoped_error_log) { scoped_error_log = log; }
+
+ErrorLogScope::~ErrorLogScope() { scoped_error_log = previous; }
+
+void error_log_reset(ErrorLog *log, const std::string &path) {
+  std::lock_guard<std::mutex> guard(log->mutex);
+
+  log->path = path;
+  log->entries.clear();
+  log->reported = 0;
+  log->dropped = 0;
+}
+
+// Moves the entries not reported yet out of log; drain empties it for the next ones.
+static size_t take_unreported(ErrorLog *log, bool drain, std::vector<SdkError> *out) {
+  std::lock_guard<std::mutex> guard(log->mutex);
+
+  out->insert(out->end(), log->entries.begin() + log->reported, log->entries.end());
+  size_t dropped = log->dropped;
+  log->dropped = 0;
+  if (drain) {
+    log->entries.clear();
+  } else {
+    log->reported = log->entries.size();
+  }
+
+  return dropped;
+}
+
+void error_log_report(ErrorLog *log) {
+  // The entries leave C++ as Ruby strings before any warning: Warning.warn may raise, and
+  // unwinding past the vector would leak it
+  VALUE warnings;
+  {
+    std::vector<SdkError> pending;
+    size_t dropped = take_unreported(&default_error_log, true, &pending);
+    if (log) {
+      dropped += take_unreported(log, false, &pending);
+    }
+
+    long rate = error_log_rate.load(std::memory_order_relaxed);
+    if (rate <= 0 || (pending.empty() && dropped == 0)) {
+      return;
+    }
+
+    // Decide what to emit under the lock, warn without it
+    size_t emit = 0;
+    size_t summary = 0;
+    {
+      std::lock_guard<std::mutex> guard(limiter_mutex);
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - window_start >= std::chrono::seconds(1)) {
+        summary = suppressed;
+        suppressed = 0;
+        window_start = now;
+        window_count = 0;
+      }
+      emit = std::min(pending.size(), static_cast<size_t>(rate - std::min(rate, window_count)));
+      window_count += emit;
+      suppressed += pending.size() - emit + dropped;
+    }
+
+    warnings = rb_ary_new_capa(emit + 1);
+    if (summary > 0) {
+      rb_ary_push(warnings, rb_sprintf("XMP SDK: %lu more errors not logged", static_cast<unsigned long>(summary)));
+    }
+    for (size_t i = 0; i < emit; i++) {
+      const SdkError &error = pending[i];
+      rb_ary_push(warnings, rb_sprintf("XMP SDK %s error %d%s%s: %s", severity_name(error.severity), error.cause,
+                                       error.path.empty() ? "" : " in ", error.path.c_str(), error.message.c_str()));
+    }
+  }
+
+  for (long i = 0; i < RARRAY_LEN(warnings); i++) {
+    rb_warn("%" PRIsVALUE, RARRAY_AREF(warnings, i));
+  }
+}
+
+VALUE
+error_log_array(ErrorLog *log) {
+  std::vector<SdkError> entries;
+  {
+    std::lock_guard<std::mutex> guard(log->mutex);
+    entries = log->entries;
+  }
+
+  VALUE result = rb_ary_new_capa(entries.size());
+  for (const SdkError &error : entries) {
+    VALUE entry = rb_hash_new();
+    rb_hash_aset(entry, rb_str_new_cstr("severity"), ID2SYM(rb_intern(severity_name(error.severity))));
+    rb_hash_aset(entry, rb_str_new_cstr("cause"), INT2NUM(error.cause));
+    rb_hash_aset(entry, rb_str_new_cstr("path"), error.path.empty() ? Qnil : rb_str_new_cstr(error.path.c_str()));
+    rb_hash_aset(entry, rb_str_new_cstr("message"), rb_utf8_str_new_cstr(error.message.c_str()));
+    rb_ary_push(result, entry);
+  }
+
+  return result;
+}
+
+VALUE
+xmp_error_log_rate(VALUE self) { return LONG2NUM(error_log_rate.load(std::memory_order_relaxed)); }
+
+// XmpToolkit.error_log_rate = 10
+// Warnings about SDK errors emitted per second; 0 turns them off. XmpFile#warnings
+// collects the errors either way.
+VALUE
+xmp_set_error_log_rate(VALUE self, VALUE rate) {
+  long value = NUM2LONG(rate);
+  if (value < 0) {
+    rb_raise(rb_eArgError, "error_log_rate must not be negative");
+  }
+  error_log_rate.store(value, std::memory_order_relaxed);
+
+  return rate;
+}
@@ -0,0 +1,69 @@
+#ifndef XMP_ERROR_LOG_HPP
+#define XMP_ERROR_LOG_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Errors the SDK reported through its error callbacks. The callbacks run inside
+// SDK calls, often without the GVL, so they only copy the error into a bounded
+// buffer; nothing is printed there. Ruby reports new entries as warnings later,
+// rate limited across the process (see error_log_report).
+
+struct SdkError {
+  XMP_ErrorSeverity severity;
+  XMP_Int32 cause;  // XMP_Error id, e.g. kXMPErr_BadXMP
+  std::string path;
+  std::string message;
+};
+
+struct ErrorLog {
+  explicit ErrorLog(size_t capacity) : capacity(capacity) {}
+
+  const size_t capacity;
+  std::string path;  // Reported for errors of the SXMPMeta, which doesn't know the file
+  std::vector<SdkError> entries;
+  size_t reported = 0;  // Entries already handed to error_log_report
+  size_t dropped = 0;   // Errors after the buffer was full, only counted
+  std::mutex mutex;
+};
+
+// Entries kept per XmpWrapper
+constexpr size_t kErrorLogCapacity = 64;
+
+// Callbacks for SetErrorCallback/SetDefaultErrorCallback. context is the
+// ErrorLog to record into, or null for objects that belong to no XmpWrapper:
+// those go to the log of the ErrorLogScope on the thread, if any, else to the
+// process wide one. Recoverable errors are recovered from, all others are
+// thrown back to the caller as XMP_Error.
+bool error_log_meta_callback(void *context, XMP_ErrorSeverity severity, XMP_Int32 cause, XMP_StringPtr message);
+bool error_log_file_callback(void *context, XMP_StringPtr filePath, XMP_ErrorSeverity severity, XMP_Int32 cause,
+                             XMP_StringPtr message);
+
+// Records the errors of objects without a log of their own, such as the SXMPMeta
+// a file handler parses the packet into, in log while it lives on this thread.
+class ErrorLogScope {
+ public:
+  explicit ErrorLogScope(ErrorLog *log);
+  ~ErrorLogScope();
+
+ private:
+  ErrorLog *previous;
+};
+
+// Empties log for the file at path.
+void error_log_reset(ErrorLog *log, const std::string &path);
+
+// Emits the entries of log and of the process wide log that were not reported
+// yet through rb_warn, at most XmpToolkit.error_log_rate per second; the rest
+// is summed up in one warning by the first report of a later second. Needs the GVL.
+void error_log_report(ErrorLog *log);
+
+// [{"severity", "cause", "path", "message"}, ...] in the order they were reported
+VALUE error_log_array(ErrorLog *log);
+
+VALUE xmp_error_log_rate(VALUE self);
+VALUE xmp_set_error_log_rate(VALUE self, VALUE rate);
+
+#endif
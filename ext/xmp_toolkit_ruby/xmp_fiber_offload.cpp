@@ -0,0 +1,160 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_fiber_offload.hpp"
+#include "xmp_worker_pool.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include <ruby/fiber/scheduler.h>
+#include <ruby/io.h>
+
+struct OffloadCall {
+  void (*job)(void *);
+  void *data;
+  int readFd;
+  int writeFd;
+  std::atomic<bool> done{false};
+};
+
+// Opens the descriptor the worker signals: fds[0] is waited on, fds[1] written.
+static bool notify_open(int fds[2]) {
+#ifdef HAVE_EVENTFD
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  fds[0] = fds[1] = fd;
+  return fd >= 0;
+#else
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+  }
+  return true;
+#endif
+}
+
+static void notify_signal(int fd) {
+#ifdef HAVE_EVENTFD
+  uint64_t one = 1;
+#else
+  char one = 1;
+#endif
+  ssize_t written;
+  do {
+    written = write(fd, &one, sizeof(one));
+  } while (written < 0 && errno == EINTR);
+}
+
+// Runs on the worker. The descriptor stays readable until it is closed, so a
+// waiter woken before done is set just waits again; call is not touched after it.
+static void run_offload_call(OffloadCall *call) {
+  call->job(call->data);
+  notify_signal(call->writeFd);
+  call->done.store(true, std::memory_order_release);
+}
+
+// Runs the job on the calling thread, blocking it as a plain call_without_gvl would.
+static void run_blocking(void (*job)(void *), void *data) {
+  OffloadCall call{job, data, -1, -1};
+  rb_thread_call_without_gvl(
+      [](void *c) -> void * {
+        OffloadCall *call = static_cast<OffloadCall *>(c);
+        call->job(call->data);
+        return nullptr;
+      },
+      &call, nullptr, nullptr);
+}
+
+static VALUE wait_readable(VALUE io) { return rb_io_wait(io, RB_INT2NUM(RUBY_IO_READABLE), Qnil); }
+
+// Blocks the thread, without the GVL, until the worker finished.
+static void *wait_done(void *data) {
+  OffloadCall *call = static_cast<OffloadCall *>(data);
+  struct pollfd pfd = {call->readFd, POLLIN, 0};
+
+  while (!call->done.load(std::memory_order_acquire)) {
+    poll(&pfd, 1, 10);
+  }
+  return nullptr;
+}
+
+bool fiber_scheduler_active() { return !NIL_P(rb_fiber_scheduler_current()); }
+
+int offload_to_worker(void (*job)(void *), void *data, rb_unblock_function_t *ubf, void *arg, VALUE *raised) {
+  *raised = Qnil;
+  int fds[2];
+  if (!notify_open(fds)) {
+    // Out of descriptors
+    run_blocking(job, data);
+    return 0;
+  }
+
+  OffloadCall call{job, data, fds[0], fds[1]};
+  VALUE io = rb_io_fdopen(fds[0], O_RDONLY, nullptr);
+  if (!worker_pool_submit([&call]() { run_offload_call(&call); })) {
+    // Out of threads, with no worker to take the job
+    rb_io_close(io);
+    if (fds[1] != fds[0]) {
+      close(fds[1]);
+    }
+    run_blocking(job, data);
+    return 0;
+  }
+
+  int state = 0;
+  while (!call.done.load(std::memory_order_acquire)) {
+    rb_protect(wait_readable, io, &state);
+    if (state) {
+      break;
+    }
+  }
+
+  if (state) {
+    // throw, break and Fiber#kill leave internal jump data instead of an exception,
+    // which rb_jump_tag needs in $! to carry on
+    *raised = rb_errinfo();
+    bool isException = !RB_SPECIAL_CONST_P(*raised) && RB_BUILTIN_TYPE(*raised) == T_OBJECT &&
+                       rb_obj_is_kind_of(*raised, rb_eException);
+    if (isException) {
+      rb_set_errinfo(Qnil);
+    }
+    if (ubf) {
+      ubf(arg);
+    }
+    // The job works on the caller's stack, so it has to end before the caller does
+    rb_thread_call_without_gvl(wait_done, &call, nullptr, nullptr);
+  }
+
+  rb_io_close(io);
+  if (fds[1] != fds[0]) {
+    close(fds[1]);
+  }
+
+  return state;
+}
+
+VALUE
+xmp_worker_threads(VALUE self) { return SIZET2NUM(worker_pool_limit()); }
+
+// XmpToolkit.worker_threads = 8
+// Threads running the SDK calls of fibers under a Fiber.scheduler at the same
+// time; further calls wait for one of them.
+VALUE
+xmp_set_worker_threads(VALUE self, VALUE threads) {
+  long value = NUM2LONG(threads);
+  if (value < 1) {
+    rb_raise(rb_eArgError, "worker_threads must be at least 1");
+  }
+  worker_pool_set_limit(static_cast<size_t>(value));
+
+  return threads;
+}
@@ -0,0 +1,53 @@
+#ifndef XMP_FIBER_OFFLOAD_HPP
+#define XMP_FIBER_OFFLOAD_HPP
+
+#include <string>
+
+// SDK calls of fibers that run under a Fiber.scheduler. Releasing the GVL would
+// still block the scheduler's thread, and with it every other fiber, for the
+// whole call; instead the call runs on the native worker pool while the fiber
+// waits for an eventfd (a pipe where there is none) through the scheduler's
+// io_wait, so one reactor thread keeps many operations in flight.
+
+// Whether the calling fiber is non-blocking and has a scheduler to yield to.
+bool fiber_scheduler_active();
+
+// Runs job(data) on a worker thread and suspends the calling fiber until it
+// finished; without descriptors or worker threads it blocks the thread instead. If the fiber is stopped meanwhile, ubf(arg) is called when given so
+// the job ends early, the job is waited for without yielding, and the tag it was
+// stopped with is returned, as rb_protect reports it, for the caller to pass to
+// rb_jump_tag once it has cleaned up; 0 if the job ran to the end. raised is the
+// exception, taken out of $!, or the jump data throw, break and Fiber#kill leave
+// in $!, which stays there for rb_jump_tag. Needs the GVL.
+int offload_to_worker(void (*job)(void *), void *data, rb_unblock_function_t *ubf, void *arg, VALUE *raised);
+
+// Like call_without_gvl(fn, error, ubf, arg) through offload_to_worker; how the
+// fiber was stopped is stored in state and raised.
+template <typename Fn>
+bool call_offloaded(Fn fn, std::string *error, rb_unblock_function_t *ubf, void *arg, int *state, VALUE *raised) {
+  struct Call {
+    Fn *fn;
+    bool result;
+    std::string *error;
+  } call{&fn, false, error};
+
+  *state = offload_to_worker(
+      [](void *data) {
+        Call *c = static_cast<Call *>(data);
+        try {
+          c->result = (*c->fn)();
+        } catch (const XMP_Error &e) {
+          *c->error = e.GetErrMsg();
+        } catch (const std::exception &e) {
+          *c->error = e.what();
+        }
+      },
+      &call, ubf, arg, raised);
+
+  return call.result;
+}
+
+VALUE xmp_worker_threads(VALUE self);
+VALUE xmp_set_worker_threads(VALUE self, VALUE threads);
+
+#endif
@@ -0,0 +1,185 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_file_queries.hpp"
+
+#include <ctime>
+
+// Parses (file_path, format: nil, force_handler: false) as accepted by all handler queries.
+static void scan_query_args(int argc, VALUE *argv, const char **file_path, XMP_FileFormat *format,
+                            XMP_OptionBits *options) {
+  VALUE rb_file_path, kwargs;
+  rb_scan_args(argc, argv, "1:", &rb_file_path, &kwargs);
+
+  ID kw_table[2];
+  kw_table[0] = rb_intern("format");
+  kw_table[1] = rb_intern("force_handler");
+
+  VALUE kw_values[2];
+  rb_get_kwargs(kwargs, kw_table, 0, 2, kw_values);
+
+  *file_path = StringValueCStr(rb_file_path);
+
+  *format = kXMP_UnknownFile;
+  if (kw_values[0] != Qundef && !NIL_P(kw_values[0])) {
+    *format = NUM2UINT(kw_values[0]);
+  }
+
+  *options = 0;
+  if (kw_values[1] != Qundef && RTEST(kw_values[1])) {
+    *options |= kXMPFiles_ForceGivenHandler;
+  }
+}
+
+static VALUE date_to_time(XMP_DateTime date) {
+  if (date.hasTimeZone) {
+    SXMPUtils::ConvertToUTCTime(&date);
+  }
+
+  struct tm parts;
+  memset(&parts, 0, sizeof(parts));
+  parts.tm_year = date.year - 1900;
+  parts.tm_mon = date.month - 1;
+  parts.tm_mday = date.day;
+  parts.tm_hour = date.hour;
+  parts.tm_min = date.minute;
+  parts.tm_sec = date.second;
+
+  VALUE time = rb_time_nano_new(timegm(&parts), date.nanoSecond);
+  return rb_funcall(time, rb_intern("utc"), 0);
+}
+
+// XmpWrapper.file_mod_date(path, format: nil, force_handler: false)
+// Newest modification time over all resources of the file (sidecars, clip
+// folders), as a UTC Time, or nil if no smart handler would be selected.
+VALUE
+xmpfiles_file_mod_date(int argc, VALUE *argv, VALUE self) {
+  const char *file_path;
+  XMP_FileFormat format;
+  XMP_OptionBits options;
+  scan_query_args(argc, argv, &file_path, &format, &options);
+
+  ensure_sdk_initialized();
+
+  XMP_DateTime mod_date;
+  bool found = false;
+  ErrorText failure;
+  try {
+    found = SXMPFiles::GetFileModDate(file_path, &mod_date, &format, options);
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return found ? date_to_time(mod_date) : Qnil;
+}
+
+// XmpWrapper.associated_resources(path, format: nil, force_handler: false)
+// Every file and folder that belongs to the file's metadata, or nil if no smart
+// handler would be selected. For folder based formats the root folder comes first.
+VALUE
+xmpfiles_associated_resources(int argc, VALUE *argv, VALUE self) {
+  const char *file_path;
+  XMP_FileFormat format;
+  XMP_OptionBits options;
+  scan_query_args(argc, argv, &file_path, &format, &options);
+
+  ensure_sdk_initialized();
+
+  VALUE result = Qnil;
+  ErrorText failure;
+  {
+    std::vector<std::string> resources;
+    bool found = false;
+    try {
+      found = SXMPFiles::GetAssociatedResources(file_path, &resources, format, options);
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+
+    if (found) {
+      result = rb_ary_new_capa(static_cast<long>(resources.size()));
+      for (const std::string &resource : resources) {
+        rb_ary_push(result, rb_utf8_str_new(resource.data(), resource.size()));
+      }
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+// XmpWrapper.metadata_writable?(path, format: nil, force_handler: false)
+// For folder based formats true only if every metadata file can be written;
+// nil if no smart handler would be selected.
+VALUE
+xmpfiles_is_metadata_writable(int argc, VALUE *argv, VALUE self) {
+  const char *file_path;
+  XMP_FileFormat format;
+  XMP_OptionBits options;
+  scan_query_args(argc, argv, &file_path, &format, &options);
+
+  ensure_sdk_initialized();
+
+  bool writable = false;
+  bool found = false;
+  ErrorText failure;
+  try {
+    found = SXMPFiles::IsMetadataWritable(file_path, &writable, format, options);
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  if (!found) {
+    return Qnil;
+  }
+
+  return writable ? Qtrue : Qfalse;
+}
+
+// Format a smart handler would be selected for, kXMP_UnknownFile otherwise.
+VALUE
+xmpfiles_check_file_format(VALUE self, VALUE rb_file_path) {
+  const char *file_path = StringValueCStr(rb_file_path);
+
+  ensure_sdk_initialized();
+
+  XMP_FileFormat format = kXMP_UnknownFile;
+  ErrorText failure;
+  try {
+    format = SXMPFiles::CheckFileFormat(file_path);
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return UINT2NUM(format);
+}
+
+// Format of a package given its top-level folder (P2, XDCAM, AVCHD, ...), kXMP_UnknownFile otherwise.
+VALUE
+xmpfiles_check_package_format(VALUE self, VALUE rb_folder_path) {
+  const char *folder_path = StringValueCStr(rb_folder_path);
+
+  ensure_sdk_initialized();
+
+  XMP_FileFormat format = kXMP_UnknownFile;
+  ErrorText failure;
+  try {
+    format = SXMPFiles::CheckPackageFormat(folder_path);
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return UINT2NUM(format);
+}
@@ -0,0 +1,13 @@
+#ifndef XMP_FILE_QUERIES_HPP
+#define XMP_FILE_QUERIES_HPP
+
+// Questions about a file that XMPFiles answers from handler selection and
+// stat(2) alone, without opening the file or parsing its metadata.
+
+VALUE xmpfiles_file_mod_date(int argc, VALUE *argv, VALUE self);
+VALUE xmpfiles_associated_resources(int argc, VALUE *argv, VALUE self);
+VALUE xmpfiles_is_metadata_writable(int argc, VALUE *argv, VALUE self);
+VALUE xmpfiles_check_file_format(VALUE self, VALUE rb_file_path);
+VALUE xmpfiles_check_package_format(VALUE self, VALUE rb_folder_path);
+
+#endif
@@ -0,0 +1,535 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_future.hpp"
+#include "xmp_operation_control.hpp"
+#include "xmp_sdk_ops.hpp"
+#include "xmp_worker_pool.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+struct CompletionChannel;
+
+// One read, shared by its XmpFuture and the worker running it.
+struct FutureState {
+  // Settings, fixed before the read is submitted
+  std::string path;
+  double timeout = 0;  // Seconds the read may take from XmpFuture.read, 0 for no limit
+  std::chrono::steady_clock::time_point deadline;
+  std::shared_ptr<std::atomic<bool>> token;  // Flag of the CancellationToken, if any
+  std::shared_ptr<CompletionChannel> channel;
+  std::atomic<bool> cancelled{false};  // Set by XmpFuture#cancel
+
+  // The outcome, written by the worker before it sets done
+  std::mutex mutex;
+  std::condition_variable finished;
+  bool done = false;
+  OperationAbort reason = kOperationNotAborted;
+  bool opened = false;
+  std::string error;
+  FileMetadata metadata;
+};
+
+// Completed reads waiting for CompletionQueue#pop. Workers hold it through
+// their FutureState, so it outlives a queue that is collected first.
+struct CompletionChannel {
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<FutureState *> done;
+  bool closed = false;
+};
+
+struct CompletionQueue {
+  std::shared_ptr<CompletionChannel> channel = std::make_shared<CompletionChannel>();
+  // The XmpFuture of every read given this queue and not popped yet, keeping
+  // the FutureStates in channel->done alive; only used with the GVL
+  std::unordered_map<FutureState *, VALUE> futures;
+};
+
+struct XmpFuture {
+  std::shared_ptr<FutureState> state;
+};
+
+// Reads queued or running, so terminating the toolkit can cancel them and wait
+// for them to end first. A worker removes its read once it left the session.
+struct ReadsInFlight {
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::unordered_set<FutureState *> reads;
+};
+
+// Never destroyed: workers may still finish reads while the process exits
+static ReadsInFlight *reads_in_flight() {
+  static ReadsInFlight *reads = new ReadsInFlight();
+  return reads;
+}
+
+static void xmpfuture_free(void *ptr) { delete static_cast<XmpFuture *>(ptr); }
+
+static size_t xmpfuture_memsize(const void *ptr) {
+  FutureState *state = static_cast<const XmpFuture *>(ptr)->state.get();
+  std::lock_guard<std::mutex> guard(state->mutex);
+  return sizeof(XmpFuture) + sizeof(FutureState) + state->path.capacity() + state->metadata.rawPacket.capacity() +
+         state->metadata.serialized.capacity();
+}
+
+static const rb_data_type_t xmpfuture_data_type = {"XmpFuture",
+                                                   {
+                                                       0,
+                                                       xmpfuture_free,
+                                                       xmpfuture_memsize,
+                                                   },
+                                                   0,
+                                                   0,
+                                                   RUBY_TYPED_FREE_IMMEDIATELY};
+
+static void completion_queue_mark(void *ptr) {
+  for (const auto &entry : static_cast<CompletionQueue *>(ptr)->futures) {
+    rb_gc_mark(entry.second);
+  }
+}
+
+static void completion_queue_free(void *ptr) { delete static_cast<CompletionQueue *>(ptr); }
+
+static size_t completion_queue_memsize(const void *ptr) {
+  const CompletionQueue *queue = static_cast<const CompletionQueue *>(ptr);
+  return sizeof(CompletionQueue) + sizeof(CompletionChannel) +
+         queue->futures.size() * (sizeof(FutureState *) + sizeof(VALUE) + sizeof(void *));
+}
+
+static const rb_data_type_t completion_queue_data_type = {"CompletionQueue",
+                                                          {
+                                                              completion_queue_mark,
+                                                              completion_queue_free,
+                                                              completion_queue_memsize,
+                                                          },
+                                                          0,
+                                                          0,
+                                                          RUBY_TYPED_FREE_IMMEDIATELY};
+
+static FutureState *get_state(VALUE self) {
+  XmpFuture *future;
+  TypedData_Get_Struct(self, XmpFuture, &xmpfuture_data_type, future);
+  return future->state.get();
+}
+
+static CompletionQueue *get_queue(VALUE self) {
+  CompletionQueue *queue;
+  TypedData_Get_Struct(self, CompletionQueue, &completion_queue_data_type, queue);
+  return queue;
+}
+
+static OperationAbort future_abort_reason(const FutureState *state) {
+  if (state->cancelled.load(std::memory_order_relaxed) ||
+      (state->token && state->token->load(std::memory_order_relaxed))) {
+    return kOperationCancelled;
+  }
+  if (state->timeout > 0 && std::chrono::steady_clock::now() >= state->deadline) {
+    return kOperationDeadline;
+  }
+  return kOperationNotAborted;
+}
+
+// XMP_AbortProc; true makes the SDK throw kXMPErr_UserAbort
+static bool future_abort_proc(void *arg) {
+  return future_abort_reason(static_cast<FutureState *>(arg)) != kOperationNotAborted;
+}
+
+// Runs on a worker thread. A read that waited for a worker past its deadline,
+// or was cancelled meanwhile, never opens the file.
+static void run_read(FutureState *state) {
+  OperationAbort reason = future_abort_reason(state);
+  bool opened = false;
+  std::string error;
+  FileMetadata metadata;
+
+  if (reason == kOperationNotAborted) {
+    try {
+      opened = read_file_metadata(state->path.c_str(), &metadata, future_abort_proc, state);
+    } catch (const XMP_Error &e) {
+      if (e.GetID() == kXMPErr_UserAbort) {
+        reason = future_abort_reason(state);
+      }
+      error = e.GetErrMsg();
+    } catch (const std::exception &e) {
+      error = e.what();
+    } catch (...) {
+      // Whatever the read threw, the future has to end
+      error = "unknown error";
+    }
+  }
+  sdk_session_leave();
+
+  {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    state->reason = reason;
+    state->opened = opened;
+    state->error = std::move(error);
+    state->metadata = std::move(metadata);
+    state->done = true;
+  }
+  state->finished.notify_all();
+
+  if (state->channel) {
+    CompletionChannel *channel = state->channel.get();
+    {
+      std::lock_guard<std::mutex> guard(channel->mutex);
+      channel->done.push_back(state);
+    }
+    channel->ready.notify_one();
+  }
+
+  ReadsInFlight *reads = reads_in_flight();
+  {
+    std::lock_guard<std::mutex> guard(reads->mutex);
+    reads->reads.erase(state);
+  }
+  reads->finished.notify_all();
+}
+
+// A wait for ready(arg) on cond, without the GVL.
+struct BlockingWait {
+  std::mutex *mutex;
+  std::condition_variable *cond;
+  bool (*ready)(void *);
+  void *arg;
+  bool timed;
+  std::chrono::steady_clock::time_point until;
+  bool woken;  // Set by the unblocking function, guarded by mutex
+};
+
+static void *blocking_wait(void *data) {
+  BlockingWait *wait = static_cast<BlockingWait *>(data);
+  std::unique_lock<std::mutex> lock(*wait->mutex);
+  auto stop = [wait]() { return wait->woken || wait->ready(wait->arg); };
+
+  if (wait->timed) {
+    wait->cond->wait_until(lock, wait->until, stop);
+  } else {
+    wait->cond->wait(lock, stop);
+  }
+  return nullptr;
+}
+
+static void blocking_wait_unblock(void *data) {
+  BlockingWait *wait = static_cast<BlockingWait *>(data);
+  {
+    std::lock_guard<std::mutex> guard(*wait->mutex);
+    wait->woken = true;
+  }
+  wait->cond->notify_all();
+}
+
+// Blocks until ready(arg) holds, for at most timeout seconds unless timeout is
+// nil, and returns whether it does. Interrupts are handled between waits, so
+// Thread#raise and Timeout raise from here. Nothing that needs cleaning up may
+// live on the caller's stack.
+static bool wait_without_gvl(std::mutex *mutex, std::condition_variable *cond, bool (*ready)(void *), void *arg,
+                             VALUE timeout) {
+  BlockingWait wait{mutex, cond, ready, arg, !NIL_P(timeout), {}, false};
+  if (wait.timed) {
+    double seconds = NUM2DBL(timeout);
+    if (seconds < 0) {
+      rb_raise(rb_eArgError, "timeout must not be negative");
+    }
+    wait.until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                        std::chrono::duration<double>(seconds));
+  }
+
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(*mutex);
+      if (ready(arg)) {
+        return true;
+      }
+      if (wait.timed && std::chrono::steady_clock::now() >= wait.until) {
+        return false;
+      }
+      wait.woken = false;
+    }
+    rb_thread_call_without_gvl2(blocking_wait, &wait, blocking_wait_unblock, &wait);
+    rb_thread_check_ints();
+  }
+}
+
+// state->mutex must be held
+static bool future_done(void *state) { return static_cast<FutureState *>(state)->done; }
+
+// channel->mutex must be held
+static bool channel_ready(void *channel) {
+  CompletionChannel *self = static_cast<CompletionChannel *>(channel);
+  return !self->done.empty() || self->closed;
+}
+
+static VALUE packet_info_hash(const XMP_PacketInfo &packet) {
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("offset"), LONG2NUM(packet.offset));
+  rb_hash_aset(result, rb_str_new_cstr("length"), LONG2NUM(packet.length));
+  rb_hash_aset(result, rb_str_new_cstr("pad_size"), LONG2NUM(packet.padSize));
+  rb_hash_aset(result, rb_str_new_cstr("char_form"), UINT2NUM(packet.charForm));
+  rb_hash_aset(result, rb_str_new_cstr("writeable"), packet.writeable ? Qtrue : Qfalse);
+  rb_hash_aset(result, rb_str_new_cstr("has_wrapper"), packet.hasWrapper ? Qtrue : Qfalse);
+  rb_hash_aset(result, rb_str_new_cstr("pad"), UINT2NUM(packet.pad));
+  return result;
+}
+
+VALUE
+xmpfuture_read(int argc, VALUE *argv, VALUE klass) {
+  VALUE rb_file_path, kwargs;
+  rb_scan_args(argc, argv, "1:", &rb_file_path, &kwargs);
+
+  ID kw_table[3];
+  kw_table[0] = rb_intern("timeout");
+  kw_table[1] = rb_intern("cancellation");
+  kw_table[2] = rb_intern("queue");
+
+  VALUE kw_values[3];
+  rb_get_kwargs(kwargs, kw_table, 0, 3, kw_values);
+
+  const char *file_path = StringValueCStr(rb_file_path);
+
+  double timeout = 0;
+  if (kw_values[0] != Qundef && !NIL_P(kw_values[0])) {
+    timeout = NUM2DBL(kw_values[0]);
+    if (timeout <= 0) {
+      rb_raise(rb_eArgError, "timeout must be positive");
+    }
+  }
+
+  VALUE token = kw_values[1] != Qundef ? kw_values[1] : Qnil;
+  if (!NIL_P(token) && !cancellation_token_flag(token)) {
+    rb_raise(rb_eTypeError, "expected a CancellationToken");
+  }
+
+  CompletionQueue *queue = nullptr;
+  if (kw_values[2] != Qundef && !NIL_P(kw_values[2])) {
+    queue = get_queue(kw_values[2]);
+    if (RTEST(completion_queue_is_closed(kw_values[2]))) {
+      rb_raise(rb_const_get(rb_cObject, rb_intern("ClosedQueueError")), "queue closed");
+    }
+  }
+
+  XmpFuture *future = new XmpFuture();
+  VALUE self = TypedData_Wrap_Struct(klass, &xmpfuture_data_type, future);
+  future->state = std::make_shared<FutureState>();
+  FutureState *state = future->state.get();
+  state->path = file_path;
+
+  // The worker leaves the session once the read ended
+  sdk_session_acquire();
+
+  state->timeout = timeout;
+  if (timeout > 0) {
+    state->deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                             std::chrono::duration<double>(timeout));
+  }
+  if (!NIL_P(token)) {
+    state->token = cancellation_token_flag(token);
+  }
+  if (queue) {
+    state->channel = queue->channel;
+    queue->futures[state] = self;
+  }
+
+  {
+    ReadsInFlight *reads = reads_in_flight();
+    std::lock_guard<std::mutex> guard(reads->mutex);
+    reads->reads.insert(state);
+  }
+
+  std::shared_ptr<FutureState> shared = future->state;
+  if (!worker_pool_submit([shared]() { run_read(shared.get()); })) {
+    // No worker thread could be started: read on this one, so the future still ends
+    rb_thread_call_without_gvl(
+        [](void *data) -> void * {
+          run_read(static_cast<FutureState *>(data));
+          return nullptr;
+        },
+        state,
+        [](void *data) { static_cast<FutureState *>(data)->cancelled.store(true, std::memory_order_relaxed); },
+        state);
+  }
+
+  return self;
+}
+
+// reads->mutex must be held
+static bool reads_ended(void *reads) { return static_cast<ReadsInFlight *>(reads)->reads.empty(); }
+
+void future_reads_cancel_and_wait() {
+  ReadsInFlight *reads = reads_in_flight();
+  {
+    std::lock_guard<std::mutex> guard(reads->mutex);
+    for (FutureState *state : reads->reads) {
+      state->cancelled.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  wait_without_gvl(&reads->mutex, &reads->finished, reads_ended, reads, Qnil);
+}
+
+// ready?
+// Whether the read ended, successfully or not; never blocks.
+VALUE
+xmpfuture_is_ready(VALUE self) {
+  FutureState *state = get_state(self);
+  std::lock_guard<std::mutex> guard(state->mutex);
+  return state->done ? Qtrue : Qfalse;
+}
+
+// wait(timeout = nil)
+// Blocks, without the GVL, until the read ended or timeout seconds passed.
+// Returns whether it ended.
+VALUE
+xmpfuture_wait(int argc, VALUE *argv, VALUE self) {
+  VALUE timeout;
+  rb_scan_args(argc, argv, "01", &timeout);
+
+  FutureState *state = get_state(self);
+  return wait_without_gvl(&state->mutex, &state->finished, future_done, state, timeout) ? Qtrue : Qfalse;
+}
+
+// result
+// Waits for the read and returns {"format", "handler_flags", "open_flags",
+// "packet_info", "meta"}, the last two nil for a file without XMP; raises
+// CancelledError, DeadlineExceededError, IOError or the SDK error otherwise.
+VALUE
+xmpfuture_result(VALUE self) {
+  FutureState *state = get_state(self);
+  wait_without_gvl(&state->mutex, &state->finished, future_done, state, Qnil);
+
+  // Written once before done, so it is read without the lock from here on
+  const FileMetadata &metadata = state->metadata;
+  VALUE mXmpToolkitRuby = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
+  switch (state->reason) {
+    case kOperationCancelled:
+      rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("CancelledError")), "Read cancelled");
+    case kOperationDeadline:
+      rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("DeadlineExceededError")),
+               "Read took longer than %.3f seconds", state->timeout);
+    default:
+      break;
+  }
+  if (!state->error.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", state->error.c_str());
+  }
+  if (!state->opened) {
+    rb_raise(rb_eIOError, "Failed to open file %s", state->path.c_str());
+  }
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("format"), UINT2NUM(metadata.format));
+  rb_hash_aset(result, rb_str_new_cstr("handler_flags"), UINT2NUM(metadata.handlerFlags));
+  rb_hash_aset(result, rb_str_new_cstr("open_flags"), UINT2NUM(metadata.openFlags));
+  rb_hash_aset(result, rb_str_new_cstr("packet_info"), metadata.hasXMP ? packet_info_hash(metadata.packetInfo) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("meta"),
+               metadata.hasXMP ? rb_str_new(metadata.serialized.data(), metadata.serialized.size()) : Qnil);
+
+  return result;
+}
+
+// cancel
+// Aborts the read at the SDK's next poll, or before it starts if it still waits
+// for a worker; a read that already ended keeps its result.
+VALUE
+xmpfuture_cancel(VALUE self) {
+  get_state(self)->cancelled.store(true, std::memory_order_relaxed);
+  return self;
+}
+
+VALUE
+xmpfuture_path(VALUE self) { return rb_str_new_cstr(get_state(self)->path.c_str()); }
+
+VALUE
+completion_queue_allocate(VALUE klass) {
+  CompletionQueue *queue = new CompletionQueue();
+  return TypedData_Wrap_Struct(klass, &completion_queue_data_type, queue);
+}
+
+// pop(non_block = false, timeout: nil)
+// Next XmpFuture whose read ended, like Thread::Queue#pop: blocks, without the
+// GVL, until there is one; nil after timeout seconds, or once the queue is
+// closed and empty. Raises ThreadError when empty and non_block is true.
+VALUE
+completion_queue_pop(int argc, VALUE *argv, VALUE self) {
+  VALUE non_block, kwargs;
+  rb_scan_args(argc, argv, "01:", &non_block, &kwargs);
+
+  ID kw_table[1];
+  kw_table[0] = rb_intern("timeout");
+
+  VALUE kw_values[1];
+  rb_get_kwargs(kwargs, kw_table, 0, 1, kw_values);
+  VALUE timeout = kw_values[0] != Qundef ? kw_values[0] : Qnil;
+
+  if (RTEST(non_block) && !NIL_P(timeout)) {
+    rb_raise(rb_eArgError, "can't set a timeout if non_block is enabled");
+  }
+
+  CompletionQueue *queue = get_queue(self);
+  CompletionChannel *channel = queue->channel.get();
+  if (!RTEST(non_block)) {
+    wait_without_gvl(&channel->mutex, &channel->ready, channel_ready, channel, timeout);
+  }
+
+  FutureState *state = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(channel->mutex);
+    if (!channel->done.empty()) {
+      state = channel->done.front();
+      channel->done.pop_front();
+    }
+  }
+
+  if (!state) {
+    if (RTEST(non_block)) {
+      rb_raise(rb_eThreadError, "queue empty");
+    }
+    return Qnil;
+  }
+
+  auto entry = queue->futures.find(state);
+  VALUE future = entry->second;
+  queue->futures.erase(entry);
+  return future;
+}
+
+// size
+// Completed reads not popped yet.
+VALUE
+completion_queue_size(VALUE self) {
+  CompletionChannel *channel = get_queue(self)->channel.get();
+  std::lock_guard<std::mutex> guard(channel->mutex);
+  return SIZET2NUM(channel->done.size());
+}
+
+VALUE
+completion_queue_is_empty(VALUE self) {
+  CompletionChannel *channel = get_queue(self)->channel.get();
+  std::lock_guard<std::mutex> guard(channel->mutex);
+  return channel->done.empty() ? Qtrue : Qfalse;
+}
+
+// close
+// Wakes the threads waiting in pop, which return nil once the queue is empty,
+// and makes XmpFuture.read refuse the queue. Reads already started still
+// deliver their futures.
+VALUE
+completion_queue_close(VALUE self) {
+  CompletionChannel *channel = get_queue(self)->channel.get();
+  {
+    std::lock_guard<std::mutex> guard(channel->mutex);
+    channel->closed = true;
+  }
+  channel->ready.notify_all();
+  return self;
+}
+
+VALUE
+completion_queue_is_closed(VALUE self) {
+  CompletionChannel *channel = get_queue(self)->channel.get();
+  std::lock_guard<std::mutex> guard(channel->mutex);
+  return channel->closed ? Qtrue : Qfalse;
+}
@@ -0,0 +1,31 @@
+#ifndef XMP_FUTURE_HPP
+#define XMP_FUTURE_HPP
+
+// Reads started by XmpToolkitRuby.read_async. Each runs read_file_metadata on
+// the native worker pool without the GVL and fills an XmpFuture, which Ruby
+// waits for, polls or cancels. A CompletionQueue, given to several reads,
+// receives each XmpFuture when its read ended, in completion order, and offers
+// the blocking part of the Thread::Queue interface for fan-in.
+
+// XmpFuture.read(path, timeout: nil, cancellation: nil, queue: nil)
+// Starts the read; see XmpToolkitRuby.read_async.
+VALUE xmpfuture_read(int argc, VALUE *argv, VALUE klass);
+
+// Cancels every read that is queued or running, like XmpFuture#cancel, and
+// blocks without the GVL until all of them ended and left their sessions.
+void future_reads_cancel_and_wait();
+
+VALUE xmpfuture_is_ready(VALUE self);
+VALUE xmpfuture_wait(int argc, VALUE *argv, VALUE self);
+VALUE xmpfuture_result(VALUE self);
+VALUE xmpfuture_cancel(VALUE self);
+VALUE xmpfuture_path(VALUE self);
+
+VALUE completion_queue_allocate(VALUE klass);
+VALUE completion_queue_pop(int argc, VALUE *argv, VALUE self);
+VALUE completion_queue_size(VALUE self);
+VALUE completion_queue_is_empty(VALUE self);
+VALUE completion_queue_close(VALUE self);
+VALUE completion_queue_is_closed(VALUE self);
+
+#endif
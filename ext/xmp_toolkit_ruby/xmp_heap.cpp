@@ -0,0 +1,47 @@
+#include "xmp_heap.hpp"
+
+#include <cstdio>
+
+#include <unistd.h>
+
+#if defined(HAVE_MALLINFO2) || defined(HAVE_MALLOC_TRIM)
+#include <malloc.h>
+#endif
+
+static size_t resident_bytes() {
+  FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (statm == nullptr) {
+    return 0;
+  }
+
+  unsigned long size = 0, resident = 0;
+  int fields = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+
+  return fields == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+bool heap_stats(HeapStats *stats) {
+  *stats = HeapStats{};
+  stats->rss = resident_bytes();
+
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 info = mallinfo2();
+  stats->heap = info.arena + info.hblkhd;
+  stats->inUse = info.uordblks + info.hblkhd;
+  stats->free = info.fordblks;
+  stats->releasable = info.keepcost;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool heap_trim() {
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim(0);
+  return true;
+#else
+  return false;
+#endif
+}
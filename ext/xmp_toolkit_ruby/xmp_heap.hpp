@@ -0,0 +1,32 @@
+#ifndef XMP_HEAP_HPP
+#define XMP_HEAP_HPP
+
+#include <cstddef>
+
+// The process heap as the C library sees it, without any Ruby dependency, so
+// the extension and xmpbench measure fragmentation the same way.
+//
+// The SDK parses every file into many small nodes on the general-purpose heap.
+// Freed after each file, they leave holes that glibc keeps mapped, which is what
+// makes long-lived workers grow. heap_trim hands the free pages back in one go.
+
+struct HeapStats {
+  size_t rss;         // Resident set size of the process
+  size_t heap;        // Bytes malloc obtained from the system, including mmapped blocks
+  size_t inUse;       // Bytes of live allocations
+  size_t free;        // Bytes malloc holds but doesn't hand out: the fragmentation
+  size_t releasable;  // Free bytes at the top of the main arena, released by a trim
+
+  // Share of the heap that is free but still mapped
+  double fragmentation() const { return heap > 0 ? static_cast<double>(free) / heap : 0; }
+};
+
+// Fills stats. Returns false where the C library doesn't report them
+// (no mallinfo2); rss is still set where /proc/self/statm exists.
+bool heap_stats(HeapStats *stats);
+
+// Returns free pages of all malloc arenas to the system (malloc_trim). Returns
+// whether the C library supports it.
+bool heap_trim();
+
+#endif
@@ -0,0 +1,312 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_io_accounting.hpp"
+#include "xmp_stats.hpp"
+
+#include <cerrno>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Plain POSIX file behind the counting decorator. The SDK only needs the
+// XMP_IO contract; safe updates go through DeriveTemp/AbsorbTemp, which write
+// a temporary file next to the original and rename it over it.
+class PosixFileIO : public XMP_IO {
+ public:
+  PosixFileIO(int fd, std::string path, bool writable) : fd_(fd), path_(std::move(path)), writable_(writable) {}
+
+  ~PosixFileIO() override {
+    DeleteTemp();
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  XMP_Uns32 Read(void *buffer, XMP_Uns32 count, bool readAll) override {
+    XMP_Uns32 total = 0;
+    while (total < count) {
+      ssize_t got = ::read(fd_, static_cast<char *>(buffer) + total, count - total);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got < 0) {
+        throw XMP_Error(kXMPErr_ExternalFailure, "Failure reading file");
+      }
+      if (got == 0) {
+        break;
+      }
+      total += static_cast<XMP_Uns32>(got);
+    }
+    if (readAll && total < count) {
+      throw XMP_Error(kXMPErr_EnforceFailure, "Not enough data in file");
+    }
+    return total;
+  }
+
+  void Write(const void *buffer, XMP_Uns32 count) override {
+    if (!writable_) {
+      throw XMP_Error(kXMPErr_FilePermission, "File is open for read only");
+    }
+    XMP_Uns32 total = 0;
+    while (total < count) {
+      ssize_t put = ::write(fd_, static_cast<const char *>(buffer) + total, count - total);
+      if (put < 0 && errno == EINTR) {
+        continue;
+      }
+      if (put < 0) {
+        throw XMP_Error(kXMPErr_ExternalFailure, "Failure writing file");
+      }
+      total += static_cast<XMP_Uns32>(put);
+    }
+  }
+
+  XMP_Int64 Seek(XMP_Int64 offset, SeekMode mode) override {
+    int whence = mode == kXMP_SeekFromStart ? SEEK_SET : mode == kXMP_SeekFromCurrent ? SEEK_CUR : SEEK_END;
+    off_t position = ::lseek(fd_, offset, whence);
+    if (position < 0) {
+      throw XMP_Error(kXMPErr_ExternalFailure, "Failure seeking in file");
+    }
+    return position;
+  }
+
+  XMP_Int64 Length() override {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      throw XMP_Error(kXMPErr_ExternalFailure, "Failure getting file length");
+    }
+    return st.st_size;
+  }
+
+  void Truncate(XMP_Int64 length) override {
+    if (!writable_ || ::ftruncate(fd_, length) != 0) {
+      throw XMP_Error(kXMPErr_ExternalFailure, "Failure truncating file");
+    }
+  }
+
+  XMP_IO *DeriveTemp() override {
+    if (temp_) {
+      return temp_.get();
+    }
+    if (!writable_) {
+      throw XMP_Error(kXMPErr_FilePermission, "Can't derive a temporary file for read only access");
+    }
+
+    std::string pattern = path_ + "._xmptmp_XXXXXX";
+    std::vector<char> tempPath(pattern.begin(), pattern.end());
+    tempPath.push_back('\0');
+    int fd = ::mkstemp(tempPath.data());
+    if (fd < 0) {
+      throw XMP_Error(kXMPErr_ExternalFailure, "Failure creating temporary file");
+    }
+
+    temp_.reset(new PosixFileIO(fd, tempPath.data(), true));
+    return temp_.get();
+  }
+
+  // Replaces the original with the temporary file and continues on its descriptor.
+  void AbsorbTemp() override {
+    if (!temp_) {
+      throw XMP_Error(kXMPErr_InternalFailure, "AbsorbTemp called without a temporary file");
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) == 0) {
+      ::fchmod(temp_->fd_, st.st_mode & 07777);
+    }
+    if (::rename(temp_->path_.c_str(), path_.c_str()) != 0) {
+      throw XMP_Error(kXMPErr_ExternalFailure, "Failure replacing file with temporary file");
+    }
+
+    ::close(fd_);
+    fd_ = temp_->fd_;
+    temp_->fd_ = -1;
+    temp_.reset();
+  }
+
+  void DeleteTemp() override {
+    if (temp_) {
+      ::unlink(temp_->path_.c_str());
+      temp_.reset();
+    }
+  }
+
+ private:
+  int fd_;
+  std::string path_;
+  bool writable_;
+  std::unique_ptr<PosixFileIO> temp_;
+};
+
+// Decorator counting every call and byte that passes through to the inner XMP_IO.
+class CountingIO : public XMP_IO {
+ public:
+  CountingIO(XMP_IO *inner, std::unique_ptr<XMP_IO> owned, std::shared_ptr<IOCounters> counters)
+      : inner_(inner), owned_(std::move(owned)), counters_(std::move(counters)) {}
+
+  XMP_Uns32 Read(void *buffer, XMP_Uns32 count, bool readAll) override {
+    XMP_Uns32 got = inner_->Read(buffer, count, readAll);
+    counters_->reads.fetch_add(1, std::memory_order_relaxed);
+    counters_->bytesRead.fetch_add(got, std::memory_order_relaxed);
+    return got;
+  }
+
+  void Write(const void *buffer, XMP_Uns32 count) override {
+    inner_->Write(buffer, count);
+    counters_->writes.fetch_add(1, std::memory_order_relaxed);
+    counters_->bytesWritten.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  // Offset(), Rewind() and ToEOF() are seeks too; the SDK uses them to query the position
+  XMP_Int64 Seek(XMP_Int64 offset, SeekMode mode) override {
+    counters_->seeks.fetch_add(1, std::memory_order_relaxed);
+    return inner_->Seek(offset, mode);
+  }
+
+  XMP_Int64 Length() override { return inner_->Length(); }
+
+  void Truncate(XMP_Int64 length) override { inner_->Truncate(length); }
+
+  // The temporary file of a safe update is counted into the same counters
+  XMP_IO *DeriveTemp() override {
+    if (!temp_) {
+      temp_.reset(new CountingIO(inner_->DeriveTemp(), nullptr, counters_));
+    }
+    return temp_.get();
+  }
+
+  void AbsorbTemp() override {
+    inner_->AbsorbTemp();
+    temp_.reset();
+  }
+
+  void DeleteTemp() override {
+    inner_->DeleteTemp();
+    temp_.reset();
+  }
+
+ private:
+  XMP_IO *inner_;
+  std::unique_ptr<XMP_IO> owned_;  // inner_ when this decorator owns it; temporaries belong to their parent
+  std::shared_ptr<IOCounters> counters_;
+  std::unique_ptr<CountingIO> temp_;
+};
+
+std::unique_ptr<XMP_IO> counting_file_io(const std::string &path, bool forUpdate,
+                                         std::shared_ptr<IOCounters> counters) {
+  int fd = ::open(path.c_str(), (forUpdate ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<XMP_IO> file(new PosixFileIO(fd, path, forUpdate));
+  XMP_IO *inner = file.get();
+  return std::unique_ptr<XMP_IO>(new CountingIO(inner, std::move(file), std::move(counters)));
+}
+
+// Process totals, by format and open strategy
+struct IOTotals {
+  uint64_t files;
+  uint64_t reads;
+  uint64_t bytesRead;
+  uint64_t writes;
+  uint64_t bytesWritten;
+  uint64_t seeks;
+  uint64_t packetBytes;
+};
+
+static std::atomic<bool> io_accounting{false};
+static std::mutex io_totals_mutex;
+static std::map<std::tuple<XMP_FileFormat, int>, IOTotals> io_totals;
+
+bool io_accounting_enabled() { return io_accounting.load(std::memory_order_relaxed); }
+
+void io_accounting_add(XMP_FileFormat format, XMP_OptionBits openFlags, const IOCounters &counters) {
+  std::lock_guard<std::mutex> guard(io_totals_mutex);
+
+  IOTotals &totals = io_totals[std::make_tuple(format, static_cast<int>(stats_strategy(openFlags)))];
+  totals.files++;
+  totals.reads += counters.reads.load(std::memory_order_relaxed);
+  totals.bytesRead += counters.bytesRead.load(std::memory_order_relaxed);
+  totals.writes += counters.writes.load(std::memory_order_relaxed);
+  totals.bytesWritten += counters.bytesWritten.load(std::memory_order_relaxed);
+  totals.seeks += counters.seeks.load(std::memory_order_relaxed);
+  totals.packetBytes += counters.packetBytes.load(std::memory_order_relaxed);
+}
+
+static VALUE write_amplification(uint64_t bytesWritten, uint64_t packetBytes) {
+  return packetBytes > 0 ? DBL2NUM(static_cast<double>(bytesWritten) / packetBytes) : Qnil;
+}
+
+VALUE
+io_counters_hash(const IOCounters &counters) {
+  uint64_t bytesWritten = counters.bytesWritten.load(std::memory_order_relaxed);
+  uint64_t packetBytes = counters.packetBytes.load(std::memory_order_relaxed);
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("reads"), ULL2NUM(counters.reads.load(std::memory_order_relaxed)));
+  rb_hash_aset(result, rb_str_new_cstr("bytes_read"), ULL2NUM(counters.bytesRead.load(std::memory_order_relaxed)));
+  rb_hash_aset(result, rb_str_new_cstr("writes"), ULL2NUM(counters.writes.load(std::memory_order_relaxed)));
+  rb_hash_aset(result, rb_str_new_cstr("bytes_written"), ULL2NUM(bytesWritten));
+  rb_hash_aset(result, rb_str_new_cstr("seeks"), ULL2NUM(counters.seeks.load(std::memory_order_relaxed)));
+  rb_hash_aset(result, rb_str_new_cstr("packet_bytes"), ULL2NUM(packetBytes));
+  rb_hash_aset(result, rb_str_new_cstr("write_amplification"), write_amplification(bytesWritten, packetBytes));
+  return result;
+}
+
+VALUE
+xmp_io_accounting(VALUE self) { return io_accounting_enabled() ? Qtrue : Qfalse; }
+
+// XmpToolkit.io_accounting = true
+// Opens files through the counting XMP_IO from now on. Files whose handler
+// needs the path itself (folder based formats, plugins) are opened as before.
+VALUE
+xmp_set_io_accounting(VALUE self, VALUE enabled) {
+  io_accounting.store(RTEST(enabled), std::memory_order_relaxed);
+  return enabled;
+}
+
+// XmpToolkit.io_stats
+// One Hash per format and open strategy with "files" and the summed counters of the closed files.
+VALUE
+xmp_io_stats(VALUE self) {
+  std::vector<std::pair<std::tuple<XMP_FileFormat, int>, IOTotals>> snapshot;
+  {
+    std::lock_guard<std::mutex> guard(io_totals_mutex);
+    snapshot.assign(io_totals.begin(), io_totals.end());
+  }
+
+  static const char *const STRATEGY_NAMES[kStatsStrategyCount] = {nullptr, "smart_handler", "packet_scanning"};
+
+  VALUE result = rb_ary_new();
+  for (const auto &entry : snapshot) {
+    const IOTotals &totals = entry.second;
+    int strategy = std::get<1>(entry.first);
+
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, rb_str_new_cstr("format"), UINT2NUM(std::get<0>(entry.first)));
+    rb_hash_aset(hash, rb_str_new_cstr("strategy"),
+                 STRATEGY_NAMES[strategy] ? ID2SYM(rb_intern(STRATEGY_NAMES[strategy])) : Qnil);
+    rb_hash_aset(hash, rb_str_new_cstr("files"), ULL2NUM(totals.files));
+    rb_hash_aset(hash, rb_str_new_cstr("reads"), ULL2NUM(totals.reads));
+    rb_hash_aset(hash, rb_str_new_cstr("bytes_read"), ULL2NUM(totals.bytesRead));
+    rb_hash_aset(hash, rb_str_new_cstr("writes"), ULL2NUM(totals.writes));
+    rb_hash_aset(hash, rb_str_new_cstr("bytes_written"), ULL2NUM(totals.bytesWritten));
+    rb_hash_aset(hash, rb_str_new_cstr("seeks"), ULL2NUM(totals.seeks));
+    rb_hash_aset(hash, rb_str_new_cstr("packet_bytes"), ULL2NUM(totals.packetBytes));
+    rb_hash_aset(hash, rb_str_new_cstr("write_amplification"),
+                 write_amplification(totals.bytesWritten, totals.packetBytes));
+    rb_ary_push(result, hash);
+  }
+
+  return result;
+}
+
+VALUE
+xmp_reset_io_stats(VALUE self) {
+  std::lock_guard<std::mutex> guard(io_totals_mutex);
+  io_totals.clear();
+  return Qtrue;
+}
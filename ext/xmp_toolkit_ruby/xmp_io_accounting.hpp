@@ -0,0 +1,40 @@
+#ifndef XMP_IO_ACCOUNTING_HPP
+#define XMP_IO_ACCOUNTING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "XMP_IO.hpp"
+
+// I/O a handler did on one file, including the temporary file of a safe update.
+// Written by the SDK (possibly without the GVL) and read by Ruby, hence atomic.
+struct IOCounters {
+  std::atomic<uint64_t> reads{0};
+  std::atomic<uint64_t> bytesRead{0};
+  std::atomic<uint64_t> writes{0};
+  std::atomic<uint64_t> bytesWritten{0};
+  std::atomic<uint64_t> seeks{0};
+  std::atomic<uint64_t> packetBytes{0};  // Size of the XMP packet, the denominator of write amplification
+};
+
+// Opens path as a counting XMP_IO for OpenFile(XMP_IO *, ...). Returns nullptr
+// if the file cannot be opened, so the caller can fall back to opening by path.
+std::unique_ptr<XMP_IO> counting_file_io(const std::string &path, bool forUpdate,
+                                         std::shared_ptr<IOCounters> counters);
+
+bool io_accounting_enabled();
+
+// Adds the counters of a closed file to the process totals of its format and open strategy.
+void io_accounting_add(XMP_FileFormat format, XMP_OptionBits openFlags, const IOCounters &counters);
+
+// {"reads", "bytes_read", "writes", "bytes_written", "seeks", "packet_bytes", "write_amplification"}
+VALUE io_counters_hash(const IOCounters &counters);
+
+VALUE xmp_io_accounting(VALUE self);
+VALUE xmp_set_io_accounting(VALUE self, VALUE enabled);
+VALUE xmp_io_stats(VALUE self);
+VALUE xmp_reset_io_stats(VALUE self);
+
+#endif
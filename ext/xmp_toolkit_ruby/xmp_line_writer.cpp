@@ -0,0 +1,172 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_line_writer.hpp"
+
+#include <unistd.h>
+
+#include <cerrno>
+
+static const size_t default_capacity = 64 * 1024;
+
+static void line_writer_free(void *ptr) {
+  LineWriter *writer = static_cast<LineWriter *>(ptr);
+  delete writer;
+}
+
+static size_t line_writer_memsize(const void *ptr) {
+  const LineWriter *writer = static_cast<const LineWriter *>(ptr);
+  return sizeof(LineWriter) + writer->buffer.capacity();
+}
+
+static const rb_data_type_t line_writer_data_type = {"LineWriter",
+                                                     {
+                                                         0,
+                                                         line_writer_free,
+                                                         line_writer_memsize,
+                                                     },
+                                                     0,
+                                                     0,
+                                                     RUBY_TYPED_FREE_IMMEDIATELY};
+
+static LineWriter *get_writer(VALUE self) {
+  LineWriter *writer;
+  TypedData_Get_Struct(self, LineWriter, &line_writer_data_type, writer);
+  return writer;
+}
+
+static LineWriter *get_open_writer(VALUE self) {
+  LineWriter *writer = get_writer(self);
+  if (writer->fd < 0) {
+    rb_raise(rb_eIOError, "closed line writer");
+  }
+  return writer;
+}
+
+VALUE
+line_writer_allocate(VALUE klass) {
+  LineWriter *writer = new LineWriter();
+  writer->fd = -1;
+  writer->capacity = default_capacity;
+  writer->lines = 0;
+  return TypedData_Wrap_Struct(klass, &line_writer_data_type, writer);
+}
+
+// LineWriter.new(fd, buffer_bytes: 64 KiB)
+VALUE
+line_writer_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE rb_fd, kwargs;
+  rb_scan_args(argc, argv, "1:", &rb_fd, &kwargs);
+
+  ID kw_table[1];
+  kw_table[0] = rb_intern("buffer_bytes");
+
+  VALUE kw_values[1];
+  rb_get_kwargs(kwargs, kw_table, 0, 1, kw_values);
+
+  LineWriter *writer = get_writer(self);
+  writer->fd = NUM2INT(rb_fd);
+
+  if (kw_values[0] != Qundef && !NIL_P(kw_values[0])) {
+    writer->capacity = NUM2SIZET(kw_values[0]);
+  }
+  writer->buffer.reserve(writer->capacity);
+
+  return self;
+}
+
+// Hands the buffered lines to the fd. Runs without the GVL; returns 0 or an errno.
+static int flush_buffer(LineWriter *writer) {
+  std::lock_guard<std::mutex> write_guard(writer->writeMutex);
+
+  std::string chunk;
+  {
+    std::lock_guard<std::mutex> guard(writer->bufferMutex);
+    chunk.swap(writer->buffer);
+    writer->buffer.reserve(writer->capacity);
+  }
+
+  const char *data = chunk.data();
+  size_t remaining = chunk.size();
+
+  while (remaining > 0) {
+    ssize_t written = write(writer->fd, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+
+    data += written;
+    remaining -= static_cast<size_t>(written);
+  }
+
+  return 0;
+}
+
+static void flush_without_gvl(LineWriter *writer) {
+  int err = 0;
+  {
+    std::string error;
+    call_without_gvl(
+        [writer, &err]() {
+          err = flush_buffer(writer);
+          return err == 0;
+        },
+        &error);
+  }
+
+  if (err != 0) {
+    rb_syserr_fail(err, "LineWriter");
+  }
+}
+
+// Appends line, adding the newline if it has none; flushes once the buffer is full.
+VALUE
+line_writer_write_line(VALUE self, VALUE rb_line) {
+  LineWriter *writer = get_open_writer(self);
+  Check_Type(rb_line, T_STRING);
+
+  const char *line = RSTRING_PTR(rb_line);
+  long length = RSTRING_LEN(rb_line);
+  bool full;
+
+  {
+    std::lock_guard<std::mutex> guard(writer->bufferMutex);
+    writer->buffer.append(line, length);
+    if (length == 0 || line[length - 1] != '\n') {
+      writer->buffer.push_back('\n');
+    }
+    writer->lines++;
+    full = writer->buffer.size() >= writer->capacity;
+  }
+
+  if (full) {
+    flush_without_gvl(writer);
+  }
+
+  return self;
+}
+
+VALUE
+line_writer_flush(VALUE self) {
+  flush_without_gvl(get_open_writer(self));
+  return self;
+}
+
+VALUE
+line_writer_lines(VALUE self) {
+  LineWriter *writer = get_writer(self);
+  std::lock_guard<std::mutex> guard(writer->bufferMutex);
+  return SIZET2NUM(writer->lines);
+}
+
+// Flushes and detaches from the fd, which stays open.
+VALUE
+line_writer_close(VALUE self) {
+  LineWriter *writer = get_writer(self);
+  if (writer->fd >= 0) {
+    flush_without_gvl(writer);
+    writer->fd = -1;
+  }
+  return Qnil;
+}
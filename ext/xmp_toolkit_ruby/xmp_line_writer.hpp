@@ -0,0 +1,27 @@
+#ifndef XMP_LINE_WRITER_HPP
+#define XMP_LINE_WRITER_HPP
+
+#include <mutex>
+#include <string>
+
+// Buffered, thread-safe writer of whole lines to a file descriptor. Lines are
+// collected in memory and written with write(2) outside the GVL, so worker
+// threads emitting NDJSON neither interleave partial lines nor wait on the
+// output while they hold the GVL.
+struct LineWriter {
+  int fd;                 // Not owned; the Ruby IO it came from closes it
+  size_t capacity;        // Flush once the buffer reaches this many bytes
+  std::string buffer;     // Complete lines not yet written
+  size_t lines;           // Lines accepted so far
+  std::mutex bufferMutex; // Guards buffer and lines
+  std::mutex writeMutex;  // Serializes flushes so chunks reach the fd in order
+};
+
+VALUE line_writer_allocate(VALUE klass);
+VALUE line_writer_initialize(int argc, VALUE *argv, VALUE self);
+VALUE line_writer_write_line(VALUE self, VALUE rb_line);
+VALUE line_writer_flush(VALUE self);
+VALUE line_writer_lines(VALUE self);
+VALUE line_writer_close(VALUE self);
+
+#endif
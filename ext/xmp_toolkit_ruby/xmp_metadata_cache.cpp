@@ -0,0 +1,315 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_shared_cache.hpp"
+
+#include <sys/stat.h>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+static const size_t default_max_bytes = 64 * 1024 * 1024;
+static const size_t default_slot_bytes = 32 * 1024;
+
+// Files are keyed by (dev, inode); size and mtime are checked on lookup so a
+// modified file replaces its own entry instead of leaving a stale one behind.
+struct FileKey {
+  uint64_t dev;
+  uint64_t ino;
+
+  bool operator==(const FileKey &other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct FileKeyHash {
+  size_t operator()(const FileKey &key) const {
+    return std::hash<uint64_t>()(key.dev * 0x9E3779B97F4A7C15ULL ^ key.ino);
+  }
+};
+
+struct CacheEntry {
+  FileKey key;
+  FileIdentity identity;
+  std::shared_ptr<const CachedPacket> packet;
+  size_t bytes;
+};
+
+// Most recently used entries are kept at the front of lru.
+static std::mutex cache_mutex;
+static bool cache_enabled = false;
+static bool shared_backend = false;  // Entries live in the mapped region of xmp_shared_cache.cpp
+static std::string shared_path;
+static size_t max_bytes = default_max_bytes;
+static size_t used_bytes = 0;
+static std::list<CacheEntry> lru;
+static std::unordered_map<FileKey, std::list<CacheEntry>::iterator, FileKeyHash> index_by_file;
+
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t evictions = 0;
+
+bool file_identity(const char *path, FileIdentity *identity) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return false;
+  }
+
+  identity->dev = static_cast<uint64_t>(st.st_dev);
+  identity->ino = static_cast<uint64_t>(st.st_ino);
+  identity->size = static_cast<int64_t>(st.st_size);
+#ifdef __APPLE__
+  identity->mtimeNs = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+  identity->mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+
+  return true;
+}
+
+static size_t entry_bytes(const CachedPacket &packet) {
+  return sizeof(CacheEntry) + sizeof(CachedPacket) + packet.serialized.size();
+}
+
+// Caller holds cache_mutex.
+static void erase_entry(std::list<CacheEntry>::iterator it) {
+  used_bytes -= it->bytes;
+  index_by_file.erase(it->key);
+  lru.erase(it);
+}
+
+// Caller holds cache_mutex.
+static void evict_to(size_t budget) {
+  while (used_bytes > budget && !lru.empty()) {
+    erase_entry(std::prev(lru.end()));
+    evictions++;
+  }
+}
+
+// Caller holds cache_mutex.
+static void clear_entries() {
+  lru.clear();
+  index_by_file.clear();
+  used_bytes = 0;
+}
+
+bool metadata_cache_enabled() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  return cache_enabled;
+}
+
+size_t metadata_cache_bytes() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  return used_bytes;
+}
+
+static bool using_shared_backend() {
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  return cache_enabled && shared_backend;
+}
+
+std::shared_ptr<const CachedPacket> metadata_cache_lookup(const FileIdentity &identity, XMP_OptionBits openFlags) {
+  if (using_shared_backend()) {
+    return shared_cache_lookup(identity, openFlags);
+  }
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+
+  if (!cache_enabled) {
+    return nullptr;
+  }
+
+  auto it = index_by_file.find(FileKey{identity.dev, identity.ino});
+  if (it == index_by_file.end() || it->second->identity != identity || it->second->packet->requestFlags != openFlags) {
+    return nullptr;
+  }
+
+  lru.splice(lru.begin(), lru, it->second);
+  hits++;
+
+  return it->second->packet;
+}
+
+void metadata_cache_count_miss() {
+  if (using_shared_backend()) {
+    shared_cache_count_miss();
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  misses++;
+}
+
+void metadata_cache_store(const FileIdentity &identity, std::shared_ptr<const CachedPacket> packet) {
+  if (using_shared_backend()) {
+    shared_cache_store(identity, *packet);
+    return;
+  }
+
+  size_t bytes = entry_bytes(*packet);
+  FileKey key{identity.dev, identity.ino};
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+
+  if (!cache_enabled || bytes > max_bytes) {
+    return;
+  }
+
+  auto it = index_by_file.find(key);
+  if (it != index_by_file.end()) {
+    erase_entry(it->second);
+  }
+
+  evict_to(max_bytes - bytes);
+
+  lru.push_front(CacheEntry{key, identity, std::move(packet), bytes});
+  index_by_file[key] = lru.begin();
+  used_bytes += bytes;
+}
+
+void metadata_cache_invalidate(const FileIdentity &identity) {
+  // Invalidate the shared region even if this process has not enabled it; another
+  // worker may still serve the old version from there
+  shared_cache_invalidate(identity);
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+
+  auto it = index_by_file.find(FileKey{identity.dev, identity.ino});
+  if (it != index_by_file.end()) {
+    erase_entry(it->second);
+  }
+}
+
+// MetadataCache.enable(max_bytes: 64 MiB, shared_path: nil, slot_bytes: 32 KiB)
+// Turns on caching of read-only opens. Calling it again only changes the budget.
+// With shared_path the entries live in a file mapped by every process that enables
+// the same path, e.g. forked workers; an existing file keeps its size and layout.
+VALUE
+metadata_cache_enable(int argc, VALUE *argv, VALUE self) {
+  VALUE kwargs;
+  rb_scan_args(argc, argv, ":", &kwargs);
+
+  ID kw_table[3];
+  kw_table[0] = rb_intern("max_bytes");
+  kw_table[1] = rb_intern("shared_path");
+  kw_table[2] = rb_intern("slot_bytes");
+
+  VALUE kw_values[3];
+  rb_get_kwargs(kwargs, kw_table, 0, 3, kw_values);
+
+  size_t budget = default_max_bytes;
+  if (kw_values[0] != Qundef && !NIL_P(kw_values[0])) {
+    budget = NUM2SIZET(kw_values[0]);
+  }
+
+  size_t slot_bytes = default_slot_bytes;
+  if (kw_values[2] != Qundef && !NIL_P(kw_values[2])) {
+    slot_bytes = NUM2SIZET(kw_values[2]);
+  }
+
+  if (kw_values[1] != Qundef && !NIL_P(kw_values[1])) {
+    const char *path = StringValueCStr(kw_values[1]);
+    ErrorText failure;
+    {
+      std::string error;
+      if (!shared_cache_open(path, budget, slot_bytes, &error)) {
+        failure.set(error);
+      }
+    }
+    if (!failure.empty()) {
+      rb_raise(rb_eRuntimeError, "Cannot open shared metadata cache: %s", failure.c_str());
+    }
+
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    cache_enabled = true;
+    shared_backend = true;
+    shared_path = path;
+    clear_entries();
+
+    return Qtrue;
+  }
+
+  shared_cache_close();
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  cache_enabled = true;
+  shared_backend = false;
+  shared_path.clear();
+  max_bytes = budget;
+  evict_to(max_bytes);
+
+  return Qtrue;
+}
+
+VALUE
+metadata_cache_disable(VALUE self) {
+  shared_cache_close();
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  cache_enabled = false;
+  shared_backend = false;
+  shared_path.clear();
+  clear_entries();
+  return Qtrue;
+}
+
+VALUE
+metadata_cache_is_enabled(VALUE self) { return metadata_cache_enabled() ? Qtrue : Qfalse; }
+
+// With the shared backend this empties the region for every process mapping it.
+VALUE
+metadata_cache_clear(VALUE self) {
+  shared_cache_clear();
+
+  std::lock_guard<std::mutex> guard(cache_mutex);
+  clear_entries();
+  hits = misses = evictions = 0;
+  return Qtrue;
+}
+
+VALUE
+metadata_cache_stats(VALUE self) {
+  bool enabled, shared;
+  std::string path;
+  size_t entries, bytes, budget;
+  uint64_t hit_count, miss_count, eviction_count;
+
+  // Copy under the lock; building the Hash may raise and must not happen while holding it
+  {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    enabled = cache_enabled;
+    shared = shared_backend;
+    path = shared_path;
+    entries = index_by_file.size();
+    bytes = used_bytes;
+    budget = max_bytes;
+    hit_count = hits;
+    miss_count = misses;
+    eviction_count = evictions;
+  }
+
+  // Counters of the shared region are totals over all processes using it
+  if (shared) {
+    SharedCacheStats region;
+    shared_cache_stats(&region);
+    entries = region.entries;
+    bytes = region.bytes;
+    budget = region.maxBytes;
+    hit_count = region.hits;
+    miss_count = region.misses;
+    eviction_count = region.evictions;
+  }
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("enabled"), enabled ? Qtrue : Qfalse);
+  rb_hash_aset(result, rb_str_new_cstr("backend"), rb_str_new_cstr(shared ? "shared" : "process"));
+  if (shared) {
+    rb_hash_aset(result, rb_str_new_cstr("shared_path"), rb_str_new_cstr(path.c_str()));
+  }
+  rb_hash_aset(result, rb_str_new_cstr("entries"), SIZET2NUM(entries));
+  rb_hash_aset(result, rb_str_new_cstr("bytes"), SIZET2NUM(bytes));
+  rb_hash_aset(result, rb_str_new_cstr("max_bytes"), SIZET2NUM(budget));
+  rb_hash_aset(result, rb_str_new_cstr("hits"), ULL2NUM(hit_count));
+  rb_hash_aset(result, rb_str_new_cstr("misses"), ULL2NUM(miss_count));
+  rb_hash_aset(result, rb_str_new_cstr("evictions"), ULL2NUM(eviction_count));
+
+  return result;
+}
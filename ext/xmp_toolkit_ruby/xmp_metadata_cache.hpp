@@ -0,0 +1,57 @@
+#ifndef XMP_METADATA_CACHE_HPP
+#define XMP_METADATA_CACHE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Identity of a file on disk, taken from a single stat(2). Any change to the
+// file's content through a write, truncate or replace changes one of the fields.
+struct FileIdentity {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtimeNs;
+
+  bool operator==(const FileIdentity &other) const {
+    return dev == other.dev && ino == other.ino && size == other.size && mtimeNs == other.mtimeNs;
+  }
+  bool operator!=(const FileIdentity &other) const { return !(*this == other); }
+};
+
+// Everything a read-only XmpWrapper hands out, captured once per file version.
+struct CachedPacket {
+  XMP_OptionBits requestFlags;  // Flags passed to OpenFile, part of the lookup key
+  XMP_OptionBits openFlags;     // From GetFileInfo
+  XMP_FileFormat format;        // From GetFileInfo
+  XMP_OptionBits handlerFlags;  // From GetFileInfo
+  XMP_PacketInfo packetInfo;    // From GetXMP
+  std::string serialized;       // SerializeToBuffer output with default options, as returned by XmpWrapper#meta
+};
+
+bool file_identity(const char *path, FileIdentity *identity);
+
+bool metadata_cache_enabled();
+
+// Bytes the entries of the in-process cache take; 0 with the shared backend.
+size_t metadata_cache_bytes();
+
+// Returns the cached packet for identity if it was stored with the same open flags.
+std::shared_ptr<const CachedPacket> metadata_cache_lookup(const FileIdentity &identity, XMP_OptionBits openFlags);
+
+// Counts a read that had to go to the file. Lookups alone don't count, since
+// one open may probe the cache with several flag combinations.
+void metadata_cache_count_miss();
+
+void metadata_cache_store(const FileIdentity &identity, std::shared_ptr<const CachedPacket> packet);
+
+// Drops every entry of the file (any version), e.g. after this library wrote it.
+void metadata_cache_invalidate(const FileIdentity &identity);
+
+VALUE metadata_cache_enable(int argc, VALUE *argv, VALUE self);
+VALUE metadata_cache_disable(VALUE self);
+VALUE metadata_cache_is_enabled(VALUE self);
+VALUE metadata_cache_clear(VALUE self);
+VALUE metadata_cache_stats(VALUE self);
+
+#endif
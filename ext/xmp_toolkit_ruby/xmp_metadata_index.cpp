@@ -0,0 +1,779 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_metadata_index.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <utility>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+static const uint64_t index_magic = 0x31584449504D5852ULL;  // "RXMPIDX1"
+static const uint32_t index_version = 1;
+static const uint32_t record_magic = 0x52504D58;  // "XMPR"
+
+static const uint32_t record_compressed = 1;
+static const uint32_t record_deleted = 2;
+
+// Set in the header of a file compact renamed another one over; readers then reopen the path.
+static const uint32_t header_superseded = 1;
+
+// Packets below this size are stored as they are; zlib gains little on them.
+static const size_t compress_threshold = 512;
+
+struct IndexFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+};
+
+struct IndexRecord {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t pathLength;
+  uint32_t storedLength;  // Payload bytes as written
+  uint32_t rawLength;     // Payload bytes after decompression
+  uint32_t checksum;      // FNV-1a over path and payload, detects a torn tail after a crash
+  FileIdentity identity;
+  // Path, payload and padding follow
+};
+
+static uint64_t fnv1a(const void *data, size_t length, uint64_t hash = 0xCBF29CE484222325ULL) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static size_t padded(size_t length) { return (length + 7) & ~static_cast<size_t>(7); }
+
+static size_t record_bytes(const IndexRecord *record) {
+  return padded(sizeof(IndexRecord) + record->pathLength + record->storedLength);
+}
+
+static const IndexRecord *record_at(const MetadataIndex *index, uint64_t offset) {
+  return reinterpret_cast<const IndexRecord *>(index->base + offset);
+}
+
+static const char *record_path(const IndexRecord *record) {
+  return reinterpret_cast<const char *>(record) + sizeof(IndexRecord);
+}
+
+static const uint8_t *record_payload(const IndexRecord *record) {
+  return reinterpret_cast<const uint8_t *>(record) + sizeof(IndexRecord) + record->pathLength;
+}
+
+static uint32_t record_checksum(const IndexRecord *record) {
+  uint64_t hash = fnv1a(record_path(record), record->pathLength);
+  hash = fnv1a(record_payload(record), record->storedLength, hash);
+  return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+static void unmap_view(MetadataIndex *index) {
+  if (index->base != nullptr) {
+    munmap(index->base, index->mappedBytes);
+    index->base = nullptr;
+    index->mappedBytes = 0;
+  }
+}
+
+// Makes the view cover at least bytes. The view is over-sized so that appends
+// rarely need a new mapping; pages past the end of the file are never touched.
+static bool map_view(MetadataIndex *index, size_t bytes) {
+  if (index->base != nullptr && bytes <= index->mappedBytes) {
+    return true;
+  }
+
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t size = bytes < (1 << 20) ? (1 << 20) : bytes * 2;
+  size = (size + page - 1) / page * page;
+
+  unmap_view(index);
+
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, index->fd, 0);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  index->base = static_cast<uint8_t *>(mapped);
+  index->mappedBytes = size;
+  return true;
+}
+
+// Returns the slot holding path, or the free slot where it belongs.
+static size_t find_slot(const MetadataIndex *index, uint64_t hash, const char *path, size_t length) {
+  size_t mask = index->slotOffsets.size() - 1;
+
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint64_t offset = index->slotOffsets[slot];
+    if (offset == 0) {
+      return slot;
+    }
+
+    if (index->slotHashes[slot] == hash) {
+      const IndexRecord *record = record_at(index, offset - 1);
+      if (record->pathLength == length && memcmp(record_path(record), path, length) == 0) {
+        return slot;
+      }
+    }
+  }
+}
+
+static void grow_table(MetadataIndex *index) {
+  std::vector<uint64_t> hashes(index->slotHashes.size() * 2, 0);
+  std::vector<uint64_t> offsets(index->slotOffsets.size() * 2, 0);
+  size_t mask = offsets.size() - 1;
+
+  for (size_t i = 0; i < index->slotOffsets.size(); i++) {
+    if (index->slotOffsets[i] == 0) {
+      continue;
+    }
+
+    size_t slot = index->slotHashes[i] & mask;
+    while (offsets[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    hashes[slot] = index->slotHashes[i];
+    offsets[slot] = index->slotOffsets[i];
+  }
+
+  index->slotHashes.swap(hashes);
+  index->slotOffsets.swap(offsets);
+}
+
+// Points path at the record at offset, superseding whatever it pointed at before.
+static void put_record(MetadataIndex *index, uint64_t offset) {
+  const IndexRecord *record = record_at(index, offset);
+  uint64_t hash = fnv1a(record_path(record), record->pathLength);
+  size_t slot = find_slot(index, hash, record_path(record), record->pathLength);
+
+  if (index->slotOffsets[slot] != 0) {
+    const IndexRecord *previous = record_at(index, index->slotOffsets[slot] - 1);
+    index->garbageBytes += record_bytes(previous);
+    if (!(previous->flags & record_deleted)) {
+      index->liveEntries--;
+    }
+  } else {
+    index->usedSlots++;
+    index->slotHashes[slot] = hash;
+  }
+
+  index->slotOffsets[slot] = offset + 1;
+  if (!(record->flags & record_deleted)) {
+    index->liveEntries++;
+  }
+
+  if (index->usedSlots * 10 >= index->slotOffsets.size() * 7) {
+    grow_table(index);
+  }
+}
+
+static void reset_table(MetadataIndex *index) {
+  index->slotHashes.assign(1024, 0);
+  index->slotOffsets.assign(1024, 0);
+  index->usedSlots = 0;
+  index->liveEntries = 0;
+  index->garbageBytes = 0;
+}
+
+// Maps the file and indexes its records. A torn record at the end (a crash
+// during append) ends the scan and, for writers, is cut off. Returns 0 or an errno.
+static int load_index(MetadataIndex *index) {
+  struct stat st;
+  if (fstat(index->fd, &st) != 0) {
+    return errno;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+
+  if (size < sizeof(IndexFileHeader)) {
+    if (index->readonly) {
+      return EINVAL;
+    }
+
+    IndexFileHeader header{index_magic, index_version, 0};
+    if (ftruncate(index->fd, 0) != 0 ||
+        pwrite(index->fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+      return errno;
+    }
+    size = sizeof(header);
+  }
+
+  if (!map_view(index, size)) {
+    return errno;
+  }
+
+  const IndexFileHeader *header = reinterpret_cast<const IndexFileHeader *>(index->base);
+  if (header->magic != index_magic || header->version != index_version) {
+    return EINVAL;
+  }
+
+  reset_table(index);
+
+  size_t offset = sizeof(IndexFileHeader);
+  while (offset + sizeof(IndexRecord) <= size) {
+    const IndexRecord *record = record_at(index, offset);
+    if (record->magic != record_magic || offset + record_bytes(record) > size ||
+        record->checksum != record_checksum(record)) {
+      break;
+    }
+
+    put_record(index, offset);
+    offset += record_bytes(record);
+  }
+
+  if (offset < size && !index->readonly && ftruncate(index->fd, offset) != 0) {
+    return errno;
+  }
+
+  index->fileBytes = offset;
+  return 0;
+}
+
+static void close_index(MetadataIndex *index);
+
+// Writes one record at the end of the file and indexes it. Returns 0 or an errno.
+static int append_record(MetadataIndex *index, const std::string &path, const FileIdentity &identity,
+                         uint32_t flags, const std::string &payload, size_t rawLength) {
+  IndexRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = record_magic;
+  record.flags = flags;
+  record.pathLength = static_cast<uint32_t>(path.size());
+  record.storedLength = static_cast<uint32_t>(payload.size());
+  record.rawLength = static_cast<uint32_t>(rawLength);
+  record.identity = identity;
+
+  std::string buffer(padded(sizeof(IndexRecord) + path.size() + payload.size()), '\0');
+  memcpy(&buffer[sizeof(IndexRecord)], path.data(), path.size());
+  memcpy(&buffer[sizeof(IndexRecord) + path.size()], payload.data(), payload.size());
+
+  uint64_t hash = fnv1a(path.data(), path.size());
+  hash = fnv1a(payload.data(), payload.size(), hash);
+  record.checksum = static_cast<uint32_t>(hash ^ (hash >> 32));
+  memcpy(&buffer[0], &record, sizeof(record));
+
+  if (pwrite(index->fd, buffer.data(), buffer.size(), index->fileBytes) != static_cast<ssize_t>(buffer.size())) {
+    int err = errno;
+    // Leave no partial record behind for the next append to follow
+    if (ftruncate(index->fd, index->fileBytes) != 0) {
+      return errno;
+    }
+    return err == 0 ? ENOSPC : err;
+  }
+
+  uint64_t offset = index->fileBytes;
+  index->fileBytes += buffer.size();
+
+  if (!map_view(index, index->fileBytes)) {
+    int err = errno;
+    close_index(index);
+    return err;
+  }
+
+  put_record(index, offset);
+  return 0;
+}
+
+// Looks up the live record of path; caller holds the index mutex.
+static const IndexRecord *find_record(const MetadataIndex *index, const std::string &path) {
+  uint64_t hash = fnv1a(path.data(), path.size());
+  size_t slot = find_slot(index, hash, path.data(), path.size());
+
+  if (index->slotOffsets[slot] == 0) {
+    return nullptr;
+  }
+
+  const IndexRecord *record = record_at(index, index->slotOffsets[slot] - 1);
+  return (record->flags & record_deleted) ? nullptr : record;
+}
+
+static void close_index(MetadataIndex *index) {
+  unmap_view(index);
+
+  if (index->fd >= 0) {
+    close(index->fd);
+    index->fd = -1;
+  }
+
+  index->slotHashes.clear();
+  index->slotOffsets.clear();
+}
+
+static void metadata_index_free(void *ptr) {
+  MetadataIndex *index = static_cast<MetadataIndex *>(ptr);
+  close_index(index);
+  delete index;
+}
+
+static size_t metadata_index_memsize(const void *ptr) {
+  const MetadataIndex *index = static_cast<const MetadataIndex *>(ptr);
+  return sizeof(MetadataIndex) + index->path.capacity() +
+         (index->slotHashes.capacity() + index->slotOffsets.capacity()) * sizeof(uint64_t);
+}
+
+static const rb_data_type_t metadata_index_data_type = {"MetadataIndex",
+                                                        {
+                                                            0,
+                                                            metadata_index_free,
+                                                            metadata_index_memsize,
+                                                        },
+                                                        0,
+                                                        0,
+                                                        RUBY_TYPED_FREE_IMMEDIATELY};
+
+static MetadataIndex *get_index(VALUE self) {
+  MetadataIndex *index;
+  TypedData_Get_Struct(self, MetadataIndex, &metadata_index_data_type, index);
+  return index;
+}
+
+// Index of the receiver; raises IOError once it was closed.
+static MetadataIndex *get_open_index(VALUE self) {
+  MetadataIndex *index = get_index(self);
+  if (index->fd < 0) {
+    rb_raise(rb_eIOError, "closed metadata index");
+  }
+  return index;
+}
+
+VALUE
+metadata_index_allocate(VALUE klass) {
+  MetadataIndex *index = new MetadataIndex();
+  index->fd = -1;
+  index->readonly = true;
+  index->base = nullptr;
+  index->mappedBytes = 0;
+  index->fileBytes = 0;
+  index->usedSlots = 0;
+  index->liveEntries = 0;
+  index->garbageBytes = 0;
+
+  return TypedData_Wrap_Struct(klass, &metadata_index_data_type, index);
+}
+
+// Opens path for reading and appending, or with readonly: true only for reading.
+// A writer holds an exclusive lock on the file; readers see the records that
+// existed when they opened it, until a compaction replaces the file.
+static int open_index(MetadataIndex *index, const std::string &path, bool readonly) {
+  int fd = open(path.c_str(), readonly ? (O_RDONLY | O_CLOEXEC) : (O_RDWR | O_CREAT | O_CLOEXEC), 0644);
+  if (fd < 0) {
+    return errno;
+  }
+
+  if (!readonly && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+
+  index->path = path;
+  index->fd = fd;
+  index->readonly = readonly;
+
+  int err = load_index(index);
+  if (err != 0) {
+    close_index(index);
+  }
+  return err;
+}
+
+// MetadataIndex.new(path, readonly: false)
+VALUE
+metadata_index_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE rb_path, kwargs;
+  rb_scan_args(argc, argv, "1:", &rb_path, &kwargs);
+
+  ID kw_table[1];
+  kw_table[0] = rb_intern("readonly");
+
+  VALUE kw_values[1];
+  rb_get_kwargs(kwargs, kw_table, 0, 1, kw_values);
+
+  bool readonly = kw_values[0] != Qundef && RTEST(kw_values[0]);
+
+  MetadataIndex *index = get_index(self);
+  const char *path = StringValueCStr(rb_path);
+
+  int err;
+  {
+    std::lock_guard<std::mutex> guard(index->mutex);
+    close_index(index);
+    err = open_index(index, path, readonly);
+  }
+
+  if (err == EINVAL) {
+    rb_raise(rb_eArgError, "Not a metadata index: %s", path);
+  }
+  if (err == EWOULDBLOCK) {
+    rb_raise(rb_eIOError, "Metadata index %s is already opened for writing", path);
+  }
+  if (err != 0) {
+    rb_syserr_fail(err, path);
+  }
+
+  return self;
+}
+
+// A reader whose file was replaced by compact switches to the new file at path.
+// If that can't be opened it keeps serving its snapshot, which is still consistent.
+// Caller holds the index mutex.
+static void follow_compaction(MetadataIndex *index) {
+  if (!index->readonly || index->base == nullptr ||
+      !(reinterpret_cast<const IndexFileHeader *>(index->base)->flags & header_superseded)) {
+    return;
+  }
+
+  MetadataIndex fresh;
+  fresh.path = index->path;
+  fresh.fd = open(index->path.c_str(), O_RDONLY | O_CLOEXEC);
+  fresh.readonly = true;
+  fresh.base = nullptr;
+  fresh.mappedBytes = 0;
+
+  if (fresh.fd < 0) {
+    return;
+  }
+  if (load_index(&fresh) != 0) {
+    close_index(&fresh);
+    return;
+  }
+
+  std::swap(index->fd, fresh.fd);
+  std::swap(index->base, fresh.base);
+  std::swap(index->mappedBytes, fresh.mappedBytes);
+  index->fileBytes = fresh.fileBytes;
+  index->slotHashes.swap(fresh.slotHashes);
+  index->slotOffsets.swap(fresh.slotOffsets);
+  index->usedSlots = fresh.usedSlots;
+  index->liveEntries = fresh.liveEntries;
+  index->garbageBytes = fresh.garbageBytes;
+
+  close_index(&fresh);
+}
+
+// Returns the packet stored for file_path without looking at the file itself.
+// Raises IOError if the stored payload does not decompress to what was stored.
+VALUE
+metadata_index_get(VALUE self, VALUE rb_file_path) {
+  MetadataIndex *index = get_open_index(self);
+  const char *file_path = StringValueCStr(rb_file_path);
+
+  VALUE result = Qnil;
+  bool unsupported = false;
+  int zlib_error = 0;
+
+  // The packet is gone before anything below raises
+  {
+    std::string packet;
+    bool found = false;
+    {
+      std::lock_guard<std::mutex> guard(index->mutex);
+      follow_compaction(index);
+      const IndexRecord *record = find_record(index, file_path);
+
+      if (record != nullptr && !(record->flags & record_compressed)) {
+        packet.assign(reinterpret_cast<const char *>(record_payload(record)), record->storedLength);
+        found = true;
+      } else if (record != nullptr) {
+#ifdef HAVE_ZLIB_H
+        packet.resize(record->rawLength);
+        uLongf length = record->rawLength;
+        zlib_error = uncompress(reinterpret_cast<Bytef *>(&packet[0]), &length, record_payload(record),
+                                record->storedLength);
+        if (zlib_error == Z_OK && length != record->rawLength) {
+          zlib_error = Z_DATA_ERROR;
+        }
+        found = zlib_error == Z_OK;
+#else
+        unsupported = true;
+#endif
+      }
+    }
+
+    if (found) {
+      result = rb_utf8_str_new(packet.data(), packet.size());
+    }
+  }
+
+  if (unsupported) {
+    rb_raise(rb_eNotImpError, "Metadata index entry for %s is compressed, but zlib support is not built in",
+             file_path);
+  }
+  if (zlib_error != 0) {
+    rb_raise(rb_eIOError, "Metadata index entry for %s in %s is corrupt (zlib error %d)", file_path,
+             index->path.c_str(), zlib_error);
+  }
+
+  return result;
+}
+
+// True if file_path has an entry and the file still has the identity it was stored with.
+VALUE
+metadata_index_is_fresh(VALUE self, VALUE rb_file_path) {
+  MetadataIndex *index = get_open_index(self);
+  std::string file_path = StringValueCStr(rb_file_path);
+
+  FileIdentity current;
+  if (!file_identity(file_path.c_str(), &current)) {
+    return Qfalse;
+  }
+
+  std::lock_guard<std::mutex> guard(index->mutex);
+  follow_compaction(index);
+  const IndexRecord *record = find_record(index, file_path);
+
+  return record != nullptr && record->identity == current ? Qtrue : Qfalse;
+}
+
+// Appends packet as the new entry of file_path, stamped with the file's current identity.
+VALUE
+metadata_index_store(VALUE self, VALUE rb_file_path, VALUE rb_packet) {
+  MetadataIndex *index = get_open_index(self);
+  const char *file_path = StringValueCStr(rb_file_path);
+  Check_Type(rb_packet, T_STRING);
+
+  if (index->readonly) {
+    rb_raise(rb_eIOError, "metadata index %s is opened readonly", index->path.c_str());
+  }
+
+  FileIdentity identity;
+  if (!file_identity(file_path, &identity)) {
+    rb_sys_fail(file_path);
+  }
+
+  int err;
+  {
+    std::string packet(RSTRING_PTR(rb_packet), RSTRING_LEN(rb_packet));
+    uint32_t flags = 0;
+    std::string payload;
+
+#ifdef HAVE_ZLIB_H
+    if (packet.size() >= compress_threshold) {
+      uLongf length = compressBound(packet.size());
+      payload.resize(length);
+      if (compress2(reinterpret_cast<Bytef *>(&payload[0]), &length, reinterpret_cast<const Bytef *>(packet.data()),
+                    packet.size(), Z_DEFAULT_COMPRESSION) == Z_OK &&
+          length < packet.size()) {
+        payload.resize(length);
+        flags |= record_compressed;
+      }
+    }
+#endif
+
+    if (!(flags & record_compressed)) {
+      payload = packet;
+    }
+
+    std::lock_guard<std::mutex> guard(index->mutex);
+    err = append_record(index, file_path, identity, flags, payload, packet.size());
+  }
+
+  if (err != 0) {
+    rb_syserr_fail(err, index->path.c_str());
+  }
+
+  return Qtrue;
+}
+
+// Appends a deletion for file_path. Returns false if it had no entry.
+VALUE
+metadata_index_delete(VALUE self, VALUE rb_file_path) {
+  MetadataIndex *index = get_open_index(self);
+  const char *path = StringValueCStr(rb_file_path);
+
+  if (index->readonly) {
+    rb_raise(rb_eIOError, "metadata index %s is opened readonly", index->path.c_str());
+  }
+
+  int err = 0;
+  bool existed;
+  {
+    std::string file_path = path;
+    std::lock_guard<std::mutex> guard(index->mutex);
+    const IndexRecord *record = find_record(index, file_path);
+    existed = record != nullptr;
+
+    if (existed) {
+      FileIdentity identity = record->identity;
+      err = append_record(index, file_path, identity, record_deleted, std::string(), 0);
+    }
+  }
+
+  if (err != 0) {
+    rb_syserr_fail(err, index->path.c_str());
+  }
+
+  return existed ? Qtrue : Qfalse;
+}
+
+VALUE
+metadata_index_size(VALUE self) {
+  MetadataIndex *index = get_open_index(self);
+  std::lock_guard<std::mutex> guard(index->mutex);
+  follow_compaction(index);
+  return SIZET2NUM(index->liveEntries);
+}
+
+// Paths with a live entry, in no particular order.
+VALUE
+metadata_index_paths(VALUE self) {
+  MetadataIndex *index = get_open_index(self);
+  std::vector<std::string> paths;
+
+  {
+    std::lock_guard<std::mutex> guard(index->mutex);
+    follow_compaction(index);
+    paths.reserve(index->liveEntries);
+
+    for (uint64_t offset : index->slotOffsets) {
+      if (offset == 0) {
+        continue;
+      }
+
+      const IndexRecord *record = record_at(index, offset - 1);
+      if (!(record->flags & record_deleted)) {
+        paths.emplace_back(record_path(record), record->pathLength);
+      }
+    }
+  }
+
+  VALUE result = rb_ary_new_capa(static_cast<long>(paths.size()));
+  for (const std::string &path : paths) {
+    rb_ary_push(result, rb_utf8_str_new(path.data(), path.size()));
+  }
+
+  return result;
+}
+
+VALUE
+metadata_index_stats(VALUE self) {
+  MetadataIndex *index = get_open_index(self);
+  size_t entries, bytes, garbage;
+
+  {
+    std::lock_guard<std::mutex> guard(index->mutex);
+    follow_compaction(index);
+    entries = index->liveEntries;
+    bytes = index->fileBytes;
+    garbage = index->garbageBytes;
+  }
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("entries"), SIZET2NUM(entries));
+  rb_hash_aset(result, rb_str_new_cstr("bytes"), SIZET2NUM(bytes));
+  rb_hash_aset(result, rb_str_new_cstr("garbage_bytes"), SIZET2NUM(garbage));
+#ifdef HAVE_ZLIB_H
+  rb_hash_aset(result, rb_str_new_cstr("compression"), Qtrue);
+#else
+  rb_hash_aset(result, rb_str_new_cstr("compression"), Qfalse);
+#endif
+
+  return result;
+}
+
+// Writes the live records to a new file and renames it over the index, then
+// flags the old file so readers mapping it switch to the new one on their next call.
+static int compact_index(MetadataIndex *index) {
+  std::string tmp_path = index->path + ".compact";
+
+  int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+
+  std::string buffer;
+  IndexFileHeader header{index_magic, index_version, 0};
+  buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  int err = 0;
+  for (uint64_t offset : index->slotOffsets) {
+    if (offset == 0) {
+      continue;
+    }
+
+    const IndexRecord *record = record_at(index, offset - 1);
+    if (!(record->flags & record_deleted)) {
+      buffer.append(reinterpret_cast<const char *>(record), record_bytes(record));
+    }
+
+    if (buffer.size() >= (1 << 20)) {
+      if (write(fd, buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size())) {
+        err = errno == 0 ? ENOSPC : errno;
+        break;
+      }
+      buffer.clear();
+    }
+  }
+
+  if (err == 0 && !buffer.empty() && write(fd, buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size())) {
+    err = errno == 0 ? ENOSPC : errno;
+  }
+  if (err == 0 && (fsync(fd) != 0 || flock(fd, LOCK_EX | LOCK_NB) != 0)) {
+    err = errno;
+  }
+  if (err == 0 && rename(tmp_path.c_str(), index->path.c_str()) != 0) {
+    err = errno;
+  }
+
+  if (err != 0) {
+    close(fd);
+    unlink(tmp_path.c_str());
+    return err;
+  }
+
+  // Tell readers still mapping the old file to reopen the path
+  uint32_t flags = reinterpret_cast<const IndexFileHeader *>(index->base)->flags | header_superseded;
+  if (pwrite(index->fd, &flags, sizeof(flags), offsetof(IndexFileHeader, flags)) !=
+      static_cast<ssize_t>(sizeof(flags))) {
+    // Readers then keep serving the records they opened, which stay consistent
+  }
+
+  close_index(index);
+  index->fd = fd;
+  index->readonly = false;
+
+  err = load_index(index);
+  if (err != 0) {
+    close_index(index);
+  }
+  return err;
+}
+
+VALUE
+metadata_index_compact(VALUE self) {
+  MetadataIndex *index = get_open_index(self);
+
+  if (index->readonly) {
+    rb_raise(rb_eIOError, "metadata index %s is opened readonly", index->path.c_str());
+  }
+
+  int err;
+  {
+    std::lock_guard<std::mutex> guard(index->mutex);
+    err = compact_index(index);
+  }
+
+  if (err != 0) {
+    rb_syserr_fail(err, index->path.c_str());
+  }
+
+  return self;
+}
+
+VALUE
+metadata_index_close(VALUE self) {
+  MetadataIndex *index = get_index(self);
+  std::lock_guard<std::mutex> guard(index->mutex);
+  close_index(index);
+  return Qnil;
+}
@@ -0,0 +1,47 @@
+#ifndef XMP_METADATA_INDEX_HPP
+#define XMP_METADATA_INDEX_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Append-only file of (path, file identity, packet) records, loaded by mapping
+// it instead of reading it. A later record for a path supersedes the earlier
+// ones; deletions are appended as records without payload.
+//
+// Layout: IndexFileHeader, then records, each an IndexRecord followed by the
+// path, the (optionally zlib-compressed) payload and padding to 8 bytes.
+struct MetadataIndex {
+  std::string path;
+  int fd;
+  bool readonly;
+
+  uint8_t *base;        // Read-only MAP_SHARED view, may reach past the end of the file
+  size_t mappedBytes;   // Size of the view
+  size_t fileBytes;     // Valid records end here
+
+  // Open-addressing table from path hash to record offset + 1 (0 marks a free slot).
+  // Offsets stay valid when the view is remapped at a new address.
+  std::vector<uint64_t> slotHashes;
+  std::vector<uint64_t> slotOffsets;
+  size_t usedSlots;
+  size_t liveEntries;
+  size_t garbageBytes;  // Bytes in superseded records, reclaimed by compact
+
+  std::mutex mutex;
+};
+
+VALUE metadata_index_allocate(VALUE klass);
+VALUE metadata_index_initialize(int argc, VALUE *argv, VALUE self);
+VALUE metadata_index_get(VALUE self, VALUE rb_file_path);
+VALUE metadata_index_is_fresh(VALUE self, VALUE rb_file_path);
+VALUE metadata_index_store(VALUE self, VALUE rb_file_path, VALUE rb_packet);
+VALUE metadata_index_delete(VALUE self, VALUE rb_file_path);
+VALUE metadata_index_size(VALUE self);
+VALUE metadata_index_paths(VALUE self);
+VALUE metadata_index_stats(VALUE self);
+VALUE metadata_index_compact(VALUE self);
+VALUE metadata_index_close(VALUE self);
+
+#endif
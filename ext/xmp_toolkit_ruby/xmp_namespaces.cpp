@@ -0,0 +1,204 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_namespaces.hpp"
+
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+static std::shared_mutex cache_mutex;
+static std::unordered_map<std::string, std::string> prefix_by_uri;
+static std::unordered_map<std::string, std::string> uri_by_prefix;
+
+// Namespaces registered in bulk; kept across SDK sessions so every
+// initialization starts with the same registry.
+static std::mutex preload_mutex;
+static std::vector<std::pair<std::string, std::string>> preloaded_namespaces;
+
+static std::string normalize_prefix(const char *prefix) {
+  std::string normalized(prefix);
+  if (normalized.empty() || normalized.back() != ':') {
+    normalized.push_back(':');
+  }
+  return normalized;
+}
+
+static void cache_store(const std::string &namespaceURI, const std::string &prefix) {
+  std::unique_lock<std::shared_mutex> guard(cache_mutex);
+  prefix_by_uri[namespaceURI] = prefix;
+  uri_by_prefix[prefix] = namespaceURI;
+}
+
+bool cached_namespace_prefix(const char *namespaceURI, std::string *prefix) {
+  {
+    std::shared_lock<std::shared_mutex> guard(cache_mutex);
+    auto it = prefix_by_uri.find(namespaceURI);
+    if (it != prefix_by_uri.end()) {
+      *prefix = it->second;
+      return true;
+    }
+  }
+
+  if (!SXMPMeta::GetNamespacePrefix(namespaceURI, prefix)) {
+    return false;
+  }
+
+  cache_store(namespaceURI, *prefix);
+  return true;
+}
+
+bool cached_namespace_uri(const char *prefix, std::string *namespaceURI) {
+  std::string key = normalize_prefix(prefix);
+
+  {
+    std::shared_lock<std::shared_mutex> guard(cache_mutex);
+    auto it = uri_by_prefix.find(key);
+    if (it != uri_by_prefix.end()) {
+      *namespaceURI = it->second;
+      return true;
+    }
+  }
+
+  if (!SXMPMeta::GetNamespaceURI(key.c_str(), namespaceURI)) {
+    return false;
+  }
+
+  cache_store(*namespaceURI, key);
+  return true;
+}
+
+void namespace_cache_clear() {
+  std::unique_lock<std::shared_mutex> guard(cache_mutex);
+  prefix_by_uri.clear();
+  uri_by_prefix.clear();
+}
+
+// Registers namespaceURI unless it is already known and returns the prefix in use.
+// Already registered namespaces are returned silently. usedSuggested is set when
+// the namespace was registered now under the suggested prefix.
+static std::string register_cached(const char *namespaceURI, const char *suggestedPrefix,
+                                   bool *usedSuggested = nullptr) {
+  std::string registeredPrefix;
+
+  if (cached_namespace_prefix(namespaceURI, &registeredPrefix)) {
+    return registeredPrefix;
+  }
+
+  bool isSuggestedPrefix = SXMPMeta::RegisterNamespace(namespaceURI, suggestedPrefix, &registeredPrefix);
+  cache_store(namespaceURI, registeredPrefix);
+
+  if (usedSuggested != nullptr) {
+    *usedSuggested = isSuggestedPrefix;
+  }
+
+  return registeredPrefix;
+}
+
+void namespace_cache_replay() {
+  std::lock_guard<std::mutex> guard(preload_mutex);
+
+  for (const auto &entry : preloaded_namespaces) {
+    try {
+      register_cached(entry.first.c_str(), entry.second.c_str());
+    } catch (const XMP_Error &) {
+      // Entries were validated when they were added; a failure here only
+      // means another registration took the suggested prefix first.
+    }
+  }
+}
+
+VALUE
+register_namespace(VALUE self, VALUE rb_namespaceURI, VALUE rb_suggestedPrefix) {
+  const char *namespaceURI = StringValueCStr(rb_namespaceURI);
+  const char *suggestedPrefix = StringValueCStr(rb_suggestedPrefix);
+
+  ensure_sdk_initialized();
+
+  VALUE result = rb_suggestedPrefix;
+  ErrorText failure;
+  {
+    std::string registeredPrefix;
+    bool isSuggestedPrefix = false;
+    try {
+      registeredPrefix = register_cached(namespaceURI, suggestedPrefix, &isSuggestedPrefix);
+      if (!isSuggestedPrefix) {
+        result = rb_str_new_cstr(registeredPrefix.c_str());
+      }
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+// register_namespaces({ uri => suggested_prefix, ... })
+// Registers every entry, remembers the table for later SDK sessions and
+// returns a Hash of uri => registered prefix.
+VALUE
+register_namespaces(VALUE self, VALUE rb_table) {
+  Check_Type(rb_table, T_HASH);
+
+  ensure_sdk_initialized();
+
+  VALUE rb_pairs = rb_funcall(rb_table, rb_intern("to_a"), 0);
+  long count = RARRAY_LEN(rb_pairs);
+
+  // Checked before any C++ container holds them, see ErrorText
+  for (long i = 0; i < count; i++) {
+    VALUE rb_pair = rb_ary_entry(rb_pairs, i);
+    VALUE rb_uri = rb_ary_entry(rb_pair, 0);
+    VALUE rb_prefix = rb_ary_entry(rb_pair, 1);
+
+    Check_Type(rb_uri, T_STRING);
+    Check_Type(rb_prefix, T_STRING);
+    StringValueCStr(rb_uri);
+    StringValueCStr(rb_prefix);
+  }
+
+  VALUE result = rb_hash_new();
+  ErrorText failure;
+  {
+    std::vector<std::pair<std::string, std::string>> entries;
+    entries.reserve(count);
+
+    for (long i = 0; i < count; i++) {
+      VALUE rb_pair = rb_ary_entry(rb_pairs, i);
+      entries.emplace_back(RSTRING_PTR(rb_ary_entry(rb_pair, 0)), RSTRING_PTR(rb_ary_entry(rb_pair, 1)));
+    }
+
+    for (const auto &entry : entries) {
+      std::string registeredPrefix;
+      try {
+        registeredPrefix = register_cached(entry.first.c_str(), entry.second.c_str());
+      } catch (const XMP_Error &e) {
+        failure.format("Cannot register namespace '%s' as '%s': %s", entry.first.c_str(), entry.second.c_str(),
+                       e.GetErrMsg());
+        break;
+      }
+
+      rb_hash_aset(result, rb_str_new_cstr(entry.first.c_str()), rb_str_new_cstr(registeredPrefix.c_str()));
+    }
+
+    if (failure.empty()) {
+      std::lock_guard<std::mutex> guard(preload_mutex);
+      for (auto &entry : entries) {
+        bool known = false;
+        for (const auto &preloaded : preloaded_namespaces) {
+          known = known || preloaded.first == entry.first;
+        }
+        if (!known) {
+          preloaded_namespaces.push_back(std::move(entry));
+        }
+      }
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "%s", failure.c_str());
+  }
+
+  return result;
+}
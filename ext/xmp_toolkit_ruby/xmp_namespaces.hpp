@@ -0,0 +1,25 @@
+#ifndef XMP_NAMESPACES_HPP
+#define XMP_NAMESPACES_HPP
+
+#include <string>
+
+// Read-mostly URI <-> prefix cache in front of the SDK's global namespace
+// registry. Prefixes are stored the way the SDK returns them, with a trailing
+// colon ("dc:").
+
+// Looks up the prefix of a namespace URI, asking the SDK on a cache miss.
+bool cached_namespace_prefix(const char *namespaceURI, std::string *prefix);
+
+// Looks up the URI of a prefix (with or without trailing colon), asking the SDK on a cache miss.
+bool cached_namespace_uri(const char *prefix, std::string *namespaceURI);
+
+// Drops all cached entries; called when the SDK terminates.
+void namespace_cache_clear();
+
+// Re-registers namespaces added through register_namespaces after the SDK was (re)initialized.
+void namespace_cache_replay();
+
+VALUE register_namespace(VALUE self, VALUE rb_namespaceURI, VALUE rb_suggestedPrefix);
+VALUE register_namespaces(VALUE self, VALUE rb_table);
+
+#endif
@@ -0,0 +1,161 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_heap.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_native_memory.hpp"
+
+#include <atomic>
+
+// XMP_Node with its name and value strings, child and qualifier vectors, the
+// malloc header and the pointer in its parent's vector
+static const size_t node_bytes = 160;
+
+// libstdc++ keeps up to 15 characters inside the std::string itself
+static const size_t small_string_chars = 15;
+
+static std::atomic<size_t> meta_bytes{0};
+static std::atomic<size_t> file_bytes{0};
+static std::atomic<size_t> wrappers{0};
+
+static std::atomic<unsigned long> heap_trim_interval{0};
+static std::atomic<unsigned long> files_closed{0};
+static std::atomic<unsigned long> heap_trims{0};
+
+static size_t string_bytes(const std::string &value) {
+  return value.size() > small_string_chars ? value.size() + 1 : 0;
+}
+
+size_t meta_memory_estimate(const SXMPMeta &meta) {
+  size_t bytes = sizeof(SXMPMeta);
+
+  // Leaf names keep the iterator from composing a full path for every node
+  try {
+    SXMPIterator iter(meta, kXMP_IterJustLeafName);
+    std::string ns, name, value;
+    while (iter.Next(&ns, &name, &value)) {
+      bytes += node_bytes + string_bytes(name) + string_bytes(value);
+    }
+  } catch (const XMP_Error &) {
+    // What was counted so far is the best estimate there is
+  }
+
+  return bytes;
+}
+
+void native_memory_update(NativeMemory *current, const NativeMemory &next) {
+  if (current->total() == 0 && next.total() > 0) {
+    wrappers.fetch_add(1, std::memory_order_relaxed);
+  } else if (current->total() > 0 && next.total() == 0) {
+    wrappers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  meta_bytes.fetch_add(next.meta - current->meta, std::memory_order_relaxed);
+  file_bytes.fetch_add(next.file - current->file, std::memory_order_relaxed);
+
+  ssize_t diff = static_cast<ssize_t>(next.total()) - static_cast<ssize_t>(current->total());
+  *current = next;
+
+  if (diff != 0) {
+    rb_gc_adjust_memory_usage(diff);
+  }
+}
+
+// XmpToolkit.native_memory
+// Estimated native memory by owner, in bytes. "meta" and "file" are what the
+// open XmpWrappers hold and what the GC was told about; "metadata_cache" is the
+// in-process metadata cache (a shared cache lives in its mapped file instead).
+VALUE
+xmp_native_memory(VALUE self) {
+  size_t meta = meta_bytes.load(std::memory_order_relaxed);
+  size_t file = file_bytes.load(std::memory_order_relaxed);
+  size_t cache = metadata_cache_bytes();
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("wrappers"), SIZET2NUM(wrappers.load(std::memory_order_relaxed)));
+  rb_hash_aset(result, rb_str_new_cstr("meta"), SIZET2NUM(meta));
+  rb_hash_aset(result, rb_str_new_cstr("file"), SIZET2NUM(file));
+  rb_hash_aset(result, rb_str_new_cstr("metadata_cache"), SIZET2NUM(cache));
+  rb_hash_aset(result, rb_str_new_cstr("total"), SIZET2NUM(meta + file + cache));
+
+  return result;
+}
+
+// Trims without the GVL: with a large fragmented heap malloc_trim takes milliseconds.
+// Returns whether the C library can trim; released is what the resident set shrank by.
+static bool trim_heap_without_gvl(size_t *released) {
+  std::string error;
+  *released = 0;
+  return call_without_gvl(
+      [released]() {
+        HeapStats before, after;
+        heap_stats(&before);
+        if (!heap_trim()) {
+          return false;
+        }
+        heap_trims.fetch_add(1, std::memory_order_relaxed);
+        heap_stats(&after);
+        *released = before.rss > after.rss ? before.rss - after.rss : 0;
+        return true;
+      },
+      &error);
+}
+
+void native_memory_file_closed() {
+  unsigned long interval = heap_trim_interval.load(std::memory_order_relaxed);
+  unsigned long closed = files_closed.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (interval > 0 && closed % interval == 0) {
+    size_t released;
+    trim_heap_without_gvl(&released);
+  }
+}
+
+// XmpToolkit.heap_stats
+// The process heap as glibc reports it: "rss", "heap", "in_use", "free",
+// "releasable" (bytes) and "fragmentation" (free share of the heap). All but
+// "rss" and "trims" are nil where the C library has no mallinfo2. "trims" counts
+// the heap trims so far, by trim_heap and by heap_trim_interval.
+VALUE
+xmp_heap_stats(VALUE self) {
+  HeapStats stats;
+  bool available = heap_stats(&stats);
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, rb_str_new_cstr("rss"), stats.rss > 0 ? SIZET2NUM(stats.rss) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("heap"), available ? SIZET2NUM(stats.heap) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("in_use"), available ? SIZET2NUM(stats.inUse) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("free"), available ? SIZET2NUM(stats.free) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("releasable"), available ? SIZET2NUM(stats.releasable) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("fragmentation"), available ? DBL2NUM(stats.fragmentation()) : Qnil);
+  rb_hash_aset(result, rb_str_new_cstr("trims"), ULONG2NUM(heap_trims.load(std::memory_order_relaxed)));
+
+  return result;
+}
+
+// XmpToolkit.trim_heap
+// Returns the free pages of the heap to the system now. Returns the bytes the
+// resident set shrank by, or nil where the C library can't trim.
+VALUE
+xmp_trim_heap(VALUE self) {
+  size_t released;
+  if (!trim_heap_without_gvl(&released)) {
+    return Qnil;
+  }
+
+  return SIZET2NUM(released);
+}
+
+VALUE
+xmp_heap_trim_interval(VALUE self) { return ULONG2NUM(heap_trim_interval.load(std::memory_order_relaxed)); }
+
+// XmpToolkit.heap_trim_interval = 1
+// Trims the heap after every interval closed files, so a batch job releases
+// what each file's tree left behind; 0 (the default) leaves it to malloc.
+VALUE
+xmp_set_heap_trim_interval(VALUE self, VALUE interval) {
+  long value = NUM2LONG(interval);
+  if (value < 0) {
+    rb_raise(rb_eArgError, "heap_trim_interval must not be negative");
+  }
+  heap_trim_interval.store(static_cast<unsigned long>(value), std::memory_order_relaxed);
+
+  return interval;
+}
@@ -0,0 +1,41 @@
+#ifndef XMP_NATIVE_MEMORY_HPP
+#define XMP_NATIVE_MEMORY_HPP
+
+#include <cstddef>
+
+// Native memory held by one XmpWrapper. The SDK allocates with plain operator
+// new, so the sizes are estimated from the parsed tree at the points where it
+// changes as a whole (open, GetXMP, PutXMP, close) rather than counted per
+// allocation. Every change is passed on to the GC with rb_gc_adjust_memory_usage,
+// so a worker holding many large packets collects before it balloons.
+struct NativeMemory {
+  size_t meta = 0;  // The wrapper's parsed SXMPMeta
+  size_t file = 0;  // SXMPFiles: the handler's own copy of the tree and of the raw packet
+
+  size_t total() const { return meta + file; }
+};
+
+// Heap a handler holds for an open file before its packet size is known
+constexpr size_t kOpenFileBytes = 16 * 1024;
+
+// Estimated heap of meta's node tree: a fixed size per node plus the names and
+// values too long for the small string buffer. Walks the tree, so it is only
+// called where the tree was just built or written.
+size_t meta_memory_estimate(const SXMPMeta &meta);
+
+// Replaces *current by next, moving the process totals and telling the GC the
+// difference. Needs the GVL; a growth may run the GC, so no lock may be held.
+// Shrinking is allowed from a free function.
+void native_memory_update(NativeMemory *current, const NativeMemory &next);
+
+// Counts a closed XmpWrapper and, every XmpToolkit.heap_trim_interval files,
+// trims the heap without the GVL. Never raises.
+void native_memory_file_closed();
+
+VALUE xmp_native_memory(VALUE self);
+VALUE xmp_heap_stats(VALUE self);
+VALUE xmp_trim_heap(VALUE self);
+VALUE xmp_heap_trim_interval(VALUE self);
+VALUE xmp_set_heap_trim_interval(VALUE self, VALUE interval);
+
+#endif
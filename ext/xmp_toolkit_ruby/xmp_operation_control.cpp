@@ -0,0 +1,227 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_operation_control.hpp"
+
+static OperationAbort abort_reason(const OperationControl *control) {
+  if (control->interrupted.load(std::memory_order_relaxed)) {
+    return kOperationInterrupted;
+  }
+  if (control->token && control->token->load(std::memory_order_relaxed)) {
+    return kOperationCancelled;
+  }
+  if (control->timeout > 0 && std::chrono::steady_clock::now() >= control->deadline) {
+    return kOperationDeadline;
+  }
+  return kOperationNotAborted;
+}
+
+// XMP_AbortProc; true makes the SDK throw kXMPErr_UserAbort
+static bool operation_abort_proc(void *arg) {
+  OperationControl *control = static_cast<OperationControl *>(arg);
+  if (!control->active || !control->abortable) {
+    return false;
+  }
+
+  if (control->reason == kOperationNotAborted) {
+    control->reason = abort_reason(control);
+  }
+  return control->reason != kOperationNotAborted;
+}
+
+struct ProgressCall {
+  OperationControl *control;
+  float elapsed;
+  float fractionDone;
+  float secondsToGo;
+};
+
+static VALUE invoke_progress(VALUE arg) {
+  ProgressCall *call = reinterpret_cast<ProgressCall *>(arg);
+  return rb_funcall(call->control->progress, rb_intern("call"), 3, DBL2NUM(call->fractionDone),
+                    DBL2NUM(call->elapsed), DBL2NUM(call->secondsToGo));
+}
+
+static void *call_progress(void *data) {
+  ProgressCall *call = static_cast<ProgressCall *>(data);
+
+  int state = 0;
+  rb_protect(invoke_progress, reinterpret_cast<VALUE>(call), &state);
+  if (state) {
+    // throw and break leave internal jump data instead of an exception
+    VALUE error = rb_errinfo();
+    bool isException = !RB_SPECIAL_CONST_P(error) && RB_BUILTIN_TYPE(error) == T_OBJECT &&
+                       rb_obj_is_kind_of(error, rb_eException);
+    call->control->error = isException ? error : Qnil;
+    call->control->reason = kOperationProgressError;
+    rb_set_errinfo(Qnil);
+  }
+
+  return nullptr;
+}
+
+// XMP_ProgressReportProc, called at most every progressInterval seconds; false makes the SDK throw.
+// When the operation is not abortable, what the callable raised is only kept for operation_raise.
+static bool operation_progress_proc(void *context, float elapsed, float fractionDone, float secondsToGo) {
+  OperationControl *control = static_cast<OperationControl *>(context);
+  if (!control->active) {
+    return true;
+  }
+  if (control->reason != kOperationNotAborted) {
+    // Aborted, or the callable raised during an update that can't stop: no more reports
+    return !control->abortable;
+  }
+  if (operation_abort_proc(control)) {
+    return false;
+  }
+
+  ProgressCall call{control, elapsed, fractionDone, secondsToGo};
+  rb_thread_call_with_gvl(call_progress, &call);
+
+  return !control->abortable || control->reason == kOperationNotAborted;
+}
+
+void operation_control_attach(OperationControl *control, SXMPFiles *file) {
+  file->SetAbortProc(operation_abort_proc, control);
+
+  if (NIL_P(control->progress)) {
+    file->SetProgressCallback(0, 0);
+  } else {
+    file->SetProgressCallback(operation_progress_proc, control, control->progressInterval, true);
+  }
+}
+
+bool operation_cancellable(const OperationControl &control) {
+  return control.abortable && (control.timeout > 0 || control.token);
+}
+
+bool operation_begin(OperationControl *control) {
+  control->interrupted.store(false, std::memory_order_relaxed);
+  control->reason = kOperationNotAborted;
+  control->error = Qnil;
+  control->jumpTag = 0;
+  if (control->timeout > 0) {
+    control->deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(control->timeout));
+  }
+  // Checked here rather than through the abort proc, so nothing starts once aborted, abortable or not
+  control->reason = abort_reason(control);
+  control->active = true;
+
+  return control->reason == kOperationNotAborted;
+}
+
+bool operation_end(OperationControl *control) {
+  control->active = false;
+
+  // An interrupt that arrived after the SDK's last poll still counts
+  if (control->reason == kOperationNotAborted && control->interrupted.load(std::memory_order_relaxed)) {
+    control->reason = kOperationInterrupted;
+  }
+  return control->reason != kOperationNotAborted;
+}
+
+void operation_unblock(void *control) {
+  static_cast<OperationControl *>(control)->interrupted.store(true, std::memory_order_relaxed);
+}
+
+void operation_raise(OperationControl *control) {
+  VALUE mXmpToolkitRuby = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
+
+  // Whatever the reason, the error doesn't outlive the operation
+  VALUE error = control->error;
+  int jumpTag = control->jumpTag;
+  control->error = Qnil;
+  control->jumpTag = 0;
+
+  switch (control->reason) {
+    case kOperationNotAborted:
+      return;
+    case kOperationCancelled:
+      rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("CancelledError")), "Operation cancelled");
+    case kOperationDeadline:
+      rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("DeadlineExceededError")),
+               "Operation took longer than %.3f seconds", control->timeout);
+    case kOperationInterrupted: {
+      // What stopped a fiber that waited for the call on a worker thread. The jump
+      // data is still in $! unless the cleanup replaced it, e.g. with a failing stats hook.
+      if (jumpTag != 0) {
+        if (rb_errinfo() == error) {
+          rb_jump_tag(jumpTag);
+        }
+        rb_raise(rb_eRuntimeError, "Fiber left the XMP SDK call it waited for");
+      }
+      if (!NIL_P(error)) {
+        rb_exc_raise(error);
+      }
+      // Raises what interrupted the thread; a signal trap that doesn't raise still leaves the operation aborted
+      rb_thread_check_ints();
+      rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("CancelledError")), "Operation interrupted");
+    }
+    case kOperationProgressError: {
+      if (!NIL_P(error)) {
+        rb_exc_raise(error);
+      }
+      rb_raise(rb_eLocalJumpError, "progress callable jumped out of the operation; raise an exception to abort it");
+    }
+  }
+}
+
+void operation_control_mark(const OperationControl &control) {
+  rb_gc_mark(control.progress);
+  rb_gc_mark(control.error);
+}
+
+// CancellationToken: a flag that can be set from any thread and is polled by the
+// SDK of every XmpFile it was given to. The object itself never changes, so it
+// is frozen and can be passed to other Ractors.
+struct CancellationToken {
+  std::shared_ptr<std::atomic<bool>> flag;
+};
+
+static void cancellation_token_free(void *ptr) { delete static_cast<CancellationToken *>(ptr); }
+
+static size_t cancellation_token_memsize(const void *ptr) {
+  return sizeof(CancellationToken) + sizeof(std::atomic<bool>);
+}
+
+static const rb_data_type_t cancellation_token_data_type = {"CancellationToken",
+                                                            {
+                                                                0,
+                                                                cancellation_token_free,
+                                                                cancellation_token_memsize,
+                                                            },
+                                                            0,
+                                                            0,
+                                                            RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE};
+
+std::shared_ptr<std::atomic<bool>> cancellation_token_flag(VALUE obj) {
+  if (!rb_typeddata_is_kind_of(obj, &cancellation_token_data_type)) {
+    return nullptr;
+  }
+
+  return static_cast<CancellationToken *>(RTYPEDDATA_DATA(obj))->flag;
+}
+
+VALUE
+cancellation_token_allocate(VALUE klass) {
+  CancellationToken *token = new CancellationToken();
+  token->flag = std::make_shared<std::atomic<bool>>(false);
+  return rb_obj_freeze(TypedData_Wrap_Struct(klass, &cancellation_token_data_type, token));
+}
+
+// cancel
+// Aborts the running and all future operations of the files using this token.
+VALUE
+cancellation_token_cancel(VALUE self) {
+  CancellationToken *token;
+  TypedData_Get_Struct(self, CancellationToken, &cancellation_token_data_type, token);
+  token->flag->store(true, std::memory_order_relaxed);
+  return self;
+}
+
+VALUE
+cancellation_token_is_cancelled(VALUE self) {
+  CancellationToken *token;
+  TypedData_Get_Struct(self, CancellationToken, &cancellation_token_data_type, token);
+  return token->flag->load(std::memory_order_relaxed) ? Qtrue : Qfalse;
+}
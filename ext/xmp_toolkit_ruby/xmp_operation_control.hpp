@@ -0,0 +1,73 @@
+#ifndef XMP_OPERATION_CONTROL_HPP
+#define XMP_OPERATION_CONTROL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Progress reporting and cancellation of the SDK calls of one XmpWrapper. The
+// SDK polls the abort proc, and calls the progress proc during updates, on the
+// thread running the call, which has released the GVL. Both only act while an
+// operation is running (between operation_begin and operation_end), so a
+// CloseFile from the GC's free function never calls Ruby or aborts.
+
+enum OperationAbort {
+  kOperationNotAborted,
+  kOperationCancelled,    // The CancellationToken was cancelled
+  kOperationDeadline,     // The operation took longer than its timeout
+  kOperationInterrupted,  // Thread#raise, Timeout, Thread#kill or a signal
+  kOperationProgressError  // The progress callable raised
+};
+
+struct OperationControl {
+  // Settings, kept across operations
+  VALUE progress = Qnil;  // Called with (fraction_done, elapsed, seconds_to_go); marked by the wrapper
+  float progressInterval = 1.0f;
+  double timeout = 0;                        // Seconds each operation may take, 0 for no limit
+  std::shared_ptr<std::atomic<bool>> token;  // Flag of the CancellationToken, if any
+  bool abortable = true;  // Cleared while an update is written in place, which must not stop halfway
+
+  // The running operation
+  bool active = false;
+  std::chrono::steady_clock::time_point deadline;
+  std::atomic<bool> interrupted{false};  // Set by operation_unblock from another thread
+  OperationAbort reason = kOperationNotAborted;
+  VALUE error = Qnil;  // What the progress callable raised or stopped the fiber; marked by the wrapper
+  int jumpTag = 0;     // Set with error when throw, break or Fiber#kill stopped the fiber
+};
+
+// Installs the abort proc and, if set, the progress callback on file.
+void operation_control_attach(OperationControl *control, SXMPFiles *file);
+
+// Whether Ruby may interrupt the operations: only with a timeout or a
+// cancellation token, so signal traps don't abort reads elsewhere, and never
+// while the operation is not abortable.
+bool operation_cancellable(const OperationControl &control);
+
+// Arms the deadline and clears the outcome of the previous operation. Returns
+// false, without starting it, if the operation is aborted before it began
+// (a token that is already cancelled), abortable or not.
+bool operation_begin(OperationControl *control);
+
+// Ends the operation. Returns whether it was aborted.
+bool operation_end(OperationControl *control);
+
+// Unblocking function for call_without_gvl; async-signal-safe.
+void operation_unblock(void *control);
+
+// Raises the exception for an aborted operation, once the caller has cleaned up:
+// CancelledError, DeadlineExceededError, the pending interrupt, or what the
+// progress callable raised. A throw, break or Fiber#kill that stopped the fiber
+// carries on with rb_jump_tag.
+void operation_raise(OperationControl *control);
+
+void operation_control_mark(const OperationControl &control);
+
+// Flag of a CancellationToken, or null if obj is not one.
+std::shared_ptr<std::atomic<bool>> cancellation_token_flag(VALUE obj);
+
+VALUE cancellation_token_allocate(VALUE klass);
+VALUE cancellation_token_cancel(VALUE self);
+VALUE cancellation_token_is_cancelled(VALUE self);
+
+#endif
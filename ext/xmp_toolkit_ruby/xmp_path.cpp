@@ -0,0 +1,253 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_namespaces.hpp"
+#include "xmp_path.hpp"
+
+static void xmppath_free(void *ptr) {
+  XMPPath *path = static_cast<XMPPath *>(ptr);
+  delete path;
+}
+
+static size_t xmppath_memsize(const void *ptr) {
+  const XMPPath *path = static_cast<const XMPPath *>(ptr);
+  return sizeof(XMPPath) + path->schemaNS.capacity() + path->propPath.capacity();
+}
+
+static const rb_data_type_t xmppath_data_type = {"XMPPath",
+                                                 {
+                                                     0,
+                                                     xmppath_free,
+                                                     xmppath_memsize,
+                                                 },
+                                                 0,
+                                                 0,
+                                                 RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE};
+
+const XMPPath *xmppath_get(VALUE obj) {
+  if (!rb_typeddata_is_kind_of(obj, &xmppath_data_type)) {
+    return nullptr;
+  }
+
+  return static_cast<const XMPPath *>(RTYPEDDATA_DATA(obj));
+}
+
+static XMPPath *get_path(VALUE self) {
+  XMPPath *path;
+  TypedData_Get_Struct(self, XMPPath, &xmppath_data_type, path);
+  return path;
+}
+
+VALUE
+xmppath_allocate(VALUE klass) {
+  XMPPath *path = new XMPPath();
+  return TypedData_Wrap_Struct(klass, &xmppath_data_type, path);
+}
+
+// Runs the SDK path expansion once against an empty object, so malformed
+// expressions fail here rather than on every later lookup.
+static void validate_path(const XMPPath *path) {
+  ErrorText failure;
+  try {
+    SXMPMeta probe;
+    probe.DoesPropertyExist(path->schemaNS.c_str(), path->propPath.c_str());
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Invalid XMP path '%s': %s", path->propPath.c_str(), failure.c_str());
+  }
+}
+
+// Builds a frozen XmpPath of the same class as origin from already composed parts.
+static VALUE derive_path(VALUE origin, const std::string &schema_ns, const std::string &prop_path) {
+  VALUE obj = xmppath_allocate(rb_obj_class(origin));
+  XMPPath *path = get_path(obj);
+
+  path->schemaNS = schema_ns;
+  path->propPath = prop_path;
+
+  return rb_obj_freeze(obj);
+}
+
+VALUE
+xmppath_initialize(VALUE self, VALUE rb_schema_ns, VALUE rb_prop_name) {
+  // Frozen paths may be shared with other Ractors, so they are never reinitialized
+  rb_check_frozen(self);
+  ensure_sdk_initialized();
+
+  Check_Type(rb_schema_ns, T_STRING);
+  Check_Type(rb_prop_name, T_STRING);
+
+  XMPPath *path = get_path(self);
+  path->schemaNS = StringValueCStr(rb_schema_ns);
+  path->propPath = StringValueCStr(rb_prop_name);
+
+  validate_path(path);
+
+  rb_obj_freeze(self);
+  return self;
+}
+
+// Parses an expression such as "dc:subject[2]" or "xmpMM:History[1]/stEvt:action".
+// The schema namespace is resolved from the prefix of the first step.
+VALUE
+xmppath_parse(VALUE klass, VALUE rb_expression) {
+  ensure_sdk_initialized();
+
+  Check_Type(rb_expression, T_STRING);
+  const char *expression = StringValueCStr(rb_expression);
+
+  const char *step_end = expression + strcspn(expression, "/[");
+  const char *colon = static_cast<const char *>(memchr(expression, ':', step_end - expression));
+  if (colon == nullptr || colon == expression) {
+    rb_raise(rb_eArgError, "XMP path '%s' must start with a prefixed property name like 'dc:title'", expression);
+  }
+
+  VALUE obj = xmppath_allocate(klass);
+  XMPPath *path = get_path(obj);
+
+  bool known;
+  {
+    std::string prefix(expression, colon - expression);
+    known = cached_namespace_uri(prefix.c_str(), &path->schemaNS);
+  }
+  if (!known) {
+    rb_raise(rb_eArgError, "Unknown namespace prefix '%.*s' in XMP path '%s'", static_cast<int>(colon - expression),
+             expression, expression);
+  }
+
+  path->propPath = expression;
+
+  validate_path(path);
+
+  return rb_obj_freeze(obj);
+}
+
+VALUE
+xmppath_array_item(VALUE self, VALUE rb_index) {
+  const XMPPath *path = get_path(self);
+
+  XMP_Index index;
+  if (RB_TYPE_P(rb_index, T_SYMBOL) && SYM2ID(rb_index) == rb_intern("last")) {
+    index = kXMP_ArrayLastItem;
+  } else {
+    index = NUM2INT(rb_index);
+  }
+
+  VALUE result = Qnil;
+  ErrorText failure;
+  {
+    std::string item_path;
+    try {
+      SXMPUtils::ComposeArrayItemPath(path->schemaNS.c_str(), path->propPath.c_str(), index, &item_path);
+      result = derive_path(self, path->schemaNS, item_path);
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Cannot compose array item path: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+VALUE
+xmppath_struct_field(VALUE self, VALUE rb_field_ns, VALUE rb_field_name) {
+  const XMPPath *path = get_path(self);
+
+  Check_Type(rb_field_ns, T_STRING);
+  Check_Type(rb_field_name, T_STRING);
+
+  const char *field_ns = StringValueCStr(rb_field_ns);
+  const char *field_name = StringValueCStr(rb_field_name);
+
+  VALUE result = Qnil;
+  ErrorText failure;
+  {
+    std::string field_path;
+    try {
+      SXMPUtils::ComposeStructFieldPath(path->schemaNS.c_str(), path->propPath.c_str(), field_ns, field_name,
+                                        &field_path);
+      result = derive_path(self, path->schemaNS, field_path);
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Cannot compose struct field path: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+VALUE
+xmppath_qualifier(VALUE self, VALUE rb_qual_ns, VALUE rb_qual_name) {
+  const XMPPath *path = get_path(self);
+
+  Check_Type(rb_qual_ns, T_STRING);
+  Check_Type(rb_qual_name, T_STRING);
+
+  const char *qual_ns = StringValueCStr(rb_qual_ns);
+  const char *qual_name = StringValueCStr(rb_qual_name);
+
+  VALUE result = Qnil;
+  ErrorText failure;
+  {
+    std::string qual_path;
+    try {
+      SXMPUtils::ComposeQualifierPath(path->schemaNS.c_str(), path->propPath.c_str(), qual_ns, qual_name, &qual_path);
+      result = derive_path(self, path->schemaNS, qual_path);
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Cannot compose qualifier path: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+VALUE
+xmppath_lang_selector(VALUE self, VALUE rb_lang) {
+  const XMPPath *path = get_path(self);
+
+  Check_Type(rb_lang, T_STRING);
+
+  const char *lang = StringValueCStr(rb_lang);
+
+  VALUE result = Qnil;
+  ErrorText failure;
+  {
+    std::string lang_path;
+    try {
+      SXMPUtils::ComposeLangSelector(path->schemaNS.c_str(), path->propPath.c_str(), lang, &lang_path);
+      result = derive_path(self, path->schemaNS, lang_path);
+    } catch (const XMP_Error &e) {
+      failure.set(e.GetErrMsg());
+    }
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Cannot compose language selector: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+VALUE
+xmppath_schema_ns(VALUE self) {
+  const XMPPath *path = get_path(self);
+  return rb_str_new_cstr(path->schemaNS.c_str());
+}
+
+VALUE
+xmppath_path(VALUE self) {
+  const XMPPath *path = get_path(self);
+  return rb_str_new_cstr(path->propPath.c_str());
+}
+
+VALUE
+xmppath_inspect(VALUE self) {
+  const XMPPath *path = get_path(self);
+  return rb_sprintf("#<%" PRIsVALUE " %s (%s)>", rb_obj_class(self), path->propPath.c_str(), path->schemaNS.c_str());
+}
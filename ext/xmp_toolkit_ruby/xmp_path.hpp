@@ -0,0 +1,28 @@
+#ifndef XMP_PATH_HPP
+#define XMP_PATH_HPP
+
+#include <string>
+
+// A property address composed once through TXMPUtils and reused for every getter/setter call.
+struct XMPPath {
+  std::string schemaNS;  // Namespace URI of the top-level property
+  std::string propPath;  // Composed path expression, e.g. "dc:title[?xml:lang='en-US']"
+};
+
+// Returns the native path of an XmpPath instance, or nullptr if obj is not an XmpPath.
+const XMPPath *xmppath_get(VALUE obj);
+
+VALUE xmppath_allocate(VALUE klass);
+VALUE xmppath_initialize(VALUE self, VALUE rb_schema_ns, VALUE rb_prop_name);
+VALUE xmppath_parse(VALUE klass, VALUE rb_expression);
+
+VALUE xmppath_array_item(VALUE self, VALUE rb_index);
+VALUE xmppath_struct_field(VALUE self, VALUE rb_field_ns, VALUE rb_field_name);
+VALUE xmppath_qualifier(VALUE self, VALUE rb_qual_ns, VALUE rb_qual_name);
+VALUE xmppath_lang_selector(VALUE self, VALUE rb_lang);
+
+VALUE xmppath_schema_ns(VALUE self);
+VALUE xmppath_path(VALUE self);
+VALUE xmppath_inspect(VALUE self);
+
+#endif
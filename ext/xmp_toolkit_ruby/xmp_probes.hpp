@@ -0,0 +1,38 @@
+#ifndef XMP_PROBES_HPP
+#define XMP_PROBES_HPP
+
+// USDT probes around the SDK calls of XmpWrapper, for bpftrace, perf and
+// SystemTap on live processes. Compiled in when extconf.rb finds sys/sdt.h
+// (systemtap-sdt-dev / systemtap-sdt-devel); a disabled probe is a single nop.
+//
+// Every operation has an <op>__start and an <op>__done probe in the
+// xmp_toolkit_ruby provider:
+//
+//   <op>__start(const char *path, uint32 format)
+//   <op>__done(const char *path, uint32 format, int64 bytes, int ok)
+//
+// format is the XMP_FileFormat (0x20202020 while unknown, e.g. before open);
+// bytes is what the operation moved, as listed in the README.
+//
+//   bpftrace -e 'usdt:./xmp_toolkit_ruby.so:xmp_toolkit_ruby:open__start { @t[tid] = nsecs; }
+//                usdt:./xmp_toolkit_ruby.so:xmp_toolkit_ruby:open__done /@t[tid]/ {
+//                  printf("%s %d us\n", str(arg0), (nsecs - @t[tid]) / 1000); delete(@t[tid]); }'
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define XMP_PROBE_START(op, path, format) \
+  STAP_PROBE2(xmp_toolkit_ruby, op##__start, (const char *)(path), (uint32_t)(format))
+#define XMP_PROBE_DONE(op, path, format, bytes, ok)                                                         \
+  STAP_PROBE4(xmp_toolkit_ruby, op##__done, (const char *)(path), (uint32_t)(format), (int64_t)(bytes), \
+              (int)(ok))
+#else
+#define XMP_PROBE_START(op, path, format) \
+  do {                                    \
+  } while (0)
+#define XMP_PROBE_DONE(op, path, format, bytes, ok) \
+  do {                                              \
+  } while (0)
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#include "xmp_sdk_ops.hpp"
+
+#include <vector>
+
+bool sdk_initialize(const char *pluginPath, std::string *error) {
+  try {
+    if (!SXMPMeta::Initialize()) {
+      *error = "Failed to initialize XMP Toolkit metadata";
+      return false;
+    }
+
+    XMP_OptionBits options = 0;
+    options |= kXMPFiles_ServerMode;
+
+    bool ok = pluginPath ? SXMPFiles::Initialize(options, pluginPath) : SXMPFiles::Initialize(options);
+    if (!ok) {
+      SXMPMeta::Terminate();
+      *error = pluginPath ? "Failed to initialize XMP Files with plugin path"
+                          : "Failed to initialize XMP Files without plugin path";
+      return false;
+    }
+
+    return true;
+  } catch (const XMP_Error &e) {
+    *error = std::string("XMP Error during initialization: ") + e.GetErrMsg();
+  } catch (const std::exception &e) {
+    *error = std::string("C++ exception during initialization: ") + e.what();
+  } catch (...) {
+    *error = "Unknown error during XMP initialization";
+  }
+
+  return false;
+}
+
+void sdk_terminate() {
+  SXMPFiles::Terminate();
+  SXMPMeta::Terminate();
+}
+
+static bool read_with_flags(const char *path, XMP_OptionBits openFlags, FileMetadata *out, XMP_AbortProc abortProc,
+                            void *abortArg) {
+  SXMPFiles file;
+  if (abortProc != nullptr) {
+    file.SetAbortProc(abortProc, abortArg);
+  }
+  if (!file.OpenFile(path, kXMP_UnknownFile, openFlags)) {
+    return false;
+  }
+
+  SXMPMeta meta;
+  out->packetInfo = XMP_PacketInfo();
+  out->rawPacket.clear();
+  out->hasXMP = file.GetXMP(&meta, &out->rawPacket, &out->packetInfo);
+  file.GetFileInfo(0, &out->openFlags, &out->format, &out->handlerFlags);
+  meta.SerializeToBuffer(&out->serialized);
+  file.CloseFile();
+
+  return true;
+}
+
+bool read_file_metadata(const char *path, FileMetadata *out, XMP_AbortProc abortProc, void *abortArg) {
+  try {
+    if (read_with_flags(path, kXMPFiles_OpenForRead | kXMPFiles_OpenUseSmartHandler, out, abortProc, abortArg)) {
+      return true;
+    }
+  } catch (const XMP_Error &e) {
+    // Same as XmpFile#open: a failing smart handler is retried with packet scanning, unless it was aborted
+    if (e.GetID() == kXMPErr_UserAbort) {
+      throw;
+    }
+  }
+
+  return read_with_flags(path, kXMPFiles_OpenForRead | kXMPFiles_OpenUsePacketScanning, out, abortProc, abortArg);
+}
+
+namespace {
+
+// Feeds the path, value and options triples of a subtree (or the whole tree when ns
+// is nullptr) to append(data, size), stopping early once append returns false.
+template <typename Append>
+void walk_fingerprint(const SXMPMeta &meta, const char *ns, const char *prop, Append append) {
+  if (ns != nullptr && !meta.DoesPropertyExist(ns, prop)) {
+    return;
+  }
+
+  SXMPIterator iter = ns != nullptr ? SXMPIterator(meta, ns, prop) : SXMPIterator(meta);
+
+  std::string schema, path, value;
+  XMP_OptionBits options;
+  while (iter.Next(&schema, &path, &value, &options)) {
+    if (!append(schema.c_str(), schema.size() + 1) || !append(path.c_str(), path.size() + 1) ||
+        !append(value.c_str(), value.size() + 1) ||
+        !append(reinterpret_cast<const char *>(&options), sizeof(options))) {
+      return;
+    }
+  }
+}
+
+// A top-level property of a template, by schema namespace and "prefix:name" path.
+struct PropertyFingerprint {
+  std::string ns;
+  std::string path;
+  std::string fingerprint;
+};
+
+// Fingerprints in target every top-level property source names. Without
+// kXMPTemplate_ClearUnnamedProperties, ApplyTemplate can't touch anything else.
+std::vector<PropertyFingerprint> touched_fingerprints(const SXMPMeta &target, const SXMPMeta &source) {
+  std::vector<PropertyFingerprint> touched;
+
+  SXMPIterator schemas(source, kXMP_IterJustChildren);
+  std::string schema, path, value;
+  XMP_OptionBits options;
+  while (schemas.Next(&schema, &path, &value, &options)) {
+    SXMPIterator props(source, schema.c_str(), kXMP_IterJustChildren);
+    std::string propSchema, propPath;
+    while (props.Next(&propSchema, &propPath, &value, &options)) {
+      touched.push_back({schema, propPath, meta_fingerprint(target, schema.c_str(), propPath.c_str())});
+    }
+  }
+
+  return touched;
+}
+
+}  // namespace
+
+std::string meta_fingerprint(const SXMPMeta &meta, const char *ns, const char *prop) {
+  std::string fingerprint;
+  walk_fingerprint(meta, ns, prop, [&](const char *data, size_t size) {
+    fingerprint.append(data, size);
+    return true;
+  });
+  return fingerprint;
+}
+
+bool meta_matches_fingerprint(const SXMPMeta &meta, const char *ns, const char *prop, const std::string &fingerprint) {
+  size_t pos = 0;
+  bool same = true;
+  walk_fingerprint(meta, ns, prop, [&](const char *data, size_t size) {
+    same = size <= fingerprint.size() - pos && fingerprint.compare(pos, size, data, size) == 0;
+    pos += size;
+    return same;
+  });
+  return same && pos == fingerprint.size();
+}
+
+bool merge_meta(SXMPMeta *target, const SXMPMeta &source, XMP_OptionBits templateFlags, bool override, bool stamp) {
+  bool changed = false;
+
+  if (override || (templateFlags & kXMPTemplate_ClearUnnamedProperties) != 0) {
+    // Anything in target may go, so the whole tree is compared, walking it a second
+    // time against the fingerprint taken before rather than building another one.
+    std::string before = meta_fingerprint(*target, nullptr, nullptr);
+    if (override) {
+      target->Erase();
+    }
+    SXMPUtils::ApplyTemplate(target, source, templateFlags);
+    changed = !meta_matches_fingerprint(*target, nullptr, nullptr, before);
+  } else {
+    std::vector<PropertyFingerprint> touched = touched_fingerprints(*target, source);
+    SXMPUtils::ApplyTemplate(target, source, templateFlags);
+    for (const PropertyFingerprint &property : touched) {
+      if (!meta_matches_fingerprint(*target, property.ns.c_str(), property.path.c_str(), property.fingerprint)) {
+        changed = true;
+        break;
+      }
+    }
+  }
+
+  if (!changed) {
+    return false;
+  }
+
+  if (stamp) {
+    XMP_DateTime dt;
+    SXMPUtils::CurrentDateTime(&dt);
+    target->SetProperty_Date(kXMP_NS_XMP, "MetadataDate", dt, 0);
+  }
+
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef XMP_SDK_OPS_HPP
+#define XMP_SDK_OPS_HPP
+
+// SDK operations without any Ruby dependency, shared by the extension and the
+// standalone xmptool so both initialize the toolkit, read files and decide
+// what counts as a change in exactly the same way.
+
+#include <string>
+
+// Must be defined to instantiate template classes
+#define TXMP_STRING_TYPE std::string
+// Must be defined to give access to XMPFiles
+#define XMP_INCLUDE_XMPFILES 1
+
+#include "XMP.incl_cpp"
+#include "XMP.hpp"
+
+// Initializes XMPCore and XMPFiles in server mode, loading plugins (the PDF
+// handler) from pluginPath when given. Returns false and sets error on failure,
+// leaving the toolkit terminated.
+bool sdk_initialize(const char *pluginPath, std::string *error);
+void sdk_terminate();
+
+// What a read-only open yields, as reported by XmpWrapper#file_info, #packet_info and #meta.
+struct FileMetadata {
+  XMP_FileFormat format;
+  XMP_OptionBits openFlags;
+  XMP_OptionBits handlerFlags;
+  XMP_PacketInfo packetInfo;
+  bool hasXMP;             // False if the file carries no XMP packet
+  std::string rawPacket;   // Packet exactly as stored in the file
+  std::string serialized;  // SerializeToBuffer output with default options
+};
+
+// Reads path with the smart handler, falling back to packet scanning like
+// XmpToolkitRuby.xmp_from_file. Returns false if neither can open the file.
+// Throws XMP_Error, kXMPErr_UserAbort once abortProc(abortArg) returns true.
+bool read_file_metadata(const char *path, FileMetadata *out, XMP_AbortProc abortProc = nullptr,
+                        void *abortArg = nullptr);
+
+// Flattens a property subtree (or the whole tree when ns is nullptr) into a
+// comparable string of path, value and options triples. Setters compare the
+// fingerprint before and after a change to decide whether the file is dirty.
+std::string meta_fingerprint(const SXMPMeta &meta, const char *ns, const char *prop);
+
+// Whether the subtree still flattens to fingerprint, compared while walking it
+// instead of building a second fingerprint to compare.
+bool meta_matches_fingerprint(const SXMPMeta &meta, const char *ns, const char *prop, const std::string &fingerprint);
+
+// Applies source to target with ApplyTemplate, erasing target first on override.
+// Returns whether target changed; if so and stamp is set, xmp:MetadataDate is updated.
+// Only the properties source names are compared unless override or
+// kXMPTemplate_ClearUnnamedProperties can change the rest of the tree.
+bool merge_meta(SXMPMeta *target, const SXMPMeta &source, XMP_OptionBits templateFlags, bool override, bool stamp);
+
+#endif
@@ -0,0 +1,533 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_shared_cache.hpp"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+
+static const uint64_t shared_cache_magic = 0x31434D58504D5852ULL;  // "RXMPXMC1"
+static const uint32_t shared_cache_version = 2;
+static const uint32_t ways_per_set = 8;
+static const size_t min_slot_bytes = 1024;                   // Smallest packet capacity of a slot
+static const size_t max_slot_bytes = 64 * 1024 * 1024;       // Sanity bound for a foreign header
+static const std::chrono::milliseconds invalidate_patience(100);  // Before a live writer's lock is taken over
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared cache needs lock-free 32-bit atomics");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared cache needs lock-free 64-bit atomics");
+
+struct SharedCacheHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t setCount;
+  uint64_t slotBytes;  // Size of one slot including its SlotHeader
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> evictions;
+};
+
+// The lock word of a slot: the sequence in the low half, odd while a writer owns the
+// slot, and that writer's pid in the high half, so a lock left by a dead process can
+// be taken over with a single CAS.
+static uint32_t lock_seq(uint64_t word) { return static_cast<uint32_t>(word); }
+static uint32_t lock_owner(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+static uint64_t lock_word(uint32_t owner, uint32_t seq) { return static_cast<uint64_t>(owner) << 32 | seq; }
+
+struct SlotHeader {
+  std::atomic<uint64_t> lock;        // See lock_word
+  std::atomic<uint8_t> referenced;   // Clock bit, set on every hit
+  uint8_t used;                      // Written last by a store, so a set flag means a complete entry
+  uint16_t reserved;
+  uint32_t reserved2;
+  FileIdentity identity;
+  XMP_OptionBits requestFlags;
+  XMP_OptionBits openFlags;
+  XMP_FileFormat format;
+  XMP_OptionBits handlerFlags;
+  XMP_PacketInfo packetInfo;
+  uint64_t dataLength;
+  // Serialized packet follows
+};
+
+// Per-set clock hands live in the shared region right after the header.
+struct SetHand {
+  std::atomic<uint32_t> hand;
+};
+
+// Geometry of the region as validated when it was mapped. Slots are located from
+// this private copy, never from the shared header another process could overwrite.
+struct SharedMapping {
+  uint8_t *base;
+  size_t size;
+  uint32_t setCount;
+  size_t slotBytes;
+};
+
+// open and close swap mappings under mapping_mutex; lookups and stores only load
+// current_mapping. A reader announces itself in the users counter of the current
+// epoch before loading the pointer, and a retired mapping is unmapped once the
+// readers of the epoch it was published in are gone. The epoch is checked again
+// after announcing: a reader that stalled across a retire would otherwise count
+// itself in an epoch nobody waits on any more.
+static std::mutex mapping_mutex;
+static std::atomic<SharedMapping *> current_mapping{nullptr};
+static std::atomic<uint32_t> mapping_epoch{0};
+static std::atomic<uint32_t> mapping_users[2];
+
+// Pins the current mapping (or nullptr) for the lifetime of the guard.
+class MappingGuard {
+ public:
+  MappingGuard() {
+    for (;;) {
+      epoch_ = mapping_epoch.load() & 1;
+      mapping_users[epoch_].fetch_add(1);
+      if ((mapping_epoch.load() & 1) == epoch_) {
+        break;
+      }
+      mapping_users[epoch_].fetch_sub(1, std::memory_order_release);
+    }
+    mapping_ = current_mapping.load();
+  }
+  ~MappingGuard() { mapping_users[epoch_].fetch_sub(1, std::memory_order_release); }
+  MappingGuard(const MappingGuard &) = delete;
+  MappingGuard &operator=(const MappingGuard &) = delete;
+
+  const SharedMapping *get() const { return mapping_; }
+
+ private:
+  uint32_t epoch_;
+  const SharedMapping *mapping_;
+};
+
+// Unpublishes the current mapping and unmaps it once no reader can still hold it.
+// Called with mapping_mutex held.
+static void retire_mapping() {
+  SharedMapping *old = current_mapping.exchange(nullptr);
+  if (old == nullptr) {
+    return;
+  }
+
+  uint32_t epoch = mapping_epoch.fetch_add(1) & 1;
+  while (mapping_users[epoch].load(std::memory_order_acquire) != 0) {
+    sched_yield();
+  }
+
+  munmap(old->base, old->size);
+  delete old;
+}
+
+static SharedCacheHeader *header(const SharedMapping *m) { return reinterpret_cast<SharedCacheHeader *>(m->base); }
+
+static size_t hands_offset() { return (sizeof(SharedCacheHeader) + 63) & ~static_cast<size_t>(63); }
+
+static size_t slots_offset(uint32_t setCount) {
+  return (hands_offset() + setCount * sizeof(SetHand) + 63) & ~static_cast<size_t>(63);
+}
+
+static SetHand *set_hand(const SharedMapping *m, uint32_t set) {
+  return reinterpret_cast<SetHand *>(m->base + hands_offset()) + set;
+}
+
+static SlotHeader *slot_at(const SharedMapping *m, uint32_t set, uint32_t way) {
+  size_t index = static_cast<size_t>(set) * ways_per_set + way;
+  return reinterpret_cast<SlotHeader *>(m->base + slots_offset(m->setCount) + index * m->slotBytes);
+}
+
+static uint8_t *slot_data(SlotHeader *slot) { return reinterpret_cast<uint8_t *>(slot) + sizeof(SlotHeader); }
+
+static size_t slot_capacity(const SharedMapping *m) { return m->slotBytes - sizeof(SlotHeader); }
+
+static uint32_t set_for(const SharedMapping *m, const FileIdentity &identity) {
+  uint64_t h = identity.dev * 0x9E3779B97F4A7C15ULL ^ identity.ino;
+  h ^= h >> 31;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 29;
+  return static_cast<uint32_t>(h % m->setCount);
+}
+
+static bool same_file(const FileIdentity &a, const FileIdentity &b) { return a.dev == b.dev && a.ino == b.ino; }
+
+// Takes the slot's sequence lock; false if another writer holds it.
+static bool try_lock_slot(SlotHeader *slot, uint64_t *word) {
+  uint64_t current = slot->lock.load(std::memory_order_relaxed);
+  if (lock_seq(current) & 1) {
+    return false;
+  }
+
+  uint64_t locked = lock_word(static_cast<uint32_t>(getpid()), lock_seq(current) + 1);
+  if (!slot->lock.compare_exchange_strong(current, locked, std::memory_order_acquire)) {
+    return false;
+  }
+
+  std::atomic_thread_fence(std::memory_order_release);
+  *word = locked;
+  return true;
+}
+
+// Whether the process holding the lock word no longer exists.
+static bool owner_is_gone(uint64_t word) {
+  pid_t owner = static_cast<pid_t>(lock_owner(word));
+  return owner > 0 && kill(owner, 0) != 0 && errno == ESRCH;
+}
+
+// Takes over a lock held as word, keeping the sequence odd but moving it on so
+// readers of the abandoned write retry. False if the lock changed hands meanwhile.
+static bool steal_slot(SlotHeader *slot, uint64_t held, uint64_t *word) {
+  uint64_t stolen = lock_word(static_cast<uint32_t>(getpid()), lock_seq(held) + 2);
+  if (!slot->lock.compare_exchange_strong(held, stolen, std::memory_order_acquire)) {
+    return false;
+  }
+
+  std::atomic_thread_fence(std::memory_order_release);
+  *word = stolen;
+  return true;
+}
+
+// Releases the lock unless it was taken over meanwhile; false in that case, and
+// whatever was written must be treated as lost.
+static bool unlock_slot(SlotHeader *slot, uint64_t word) {
+  return slot->lock.compare_exchange_strong(word, lock_word(0, lock_seq(word) + 1), std::memory_order_release,
+                                            std::memory_order_relaxed);
+}
+
+// Size of the region laid out for setCount sets of slotBytes slots, or 0 if that
+// does not fit a size_t.
+static size_t region_size(uint32_t setCount, size_t slotBytes) {
+  size_t slots = static_cast<size_t>(setCount) * ways_per_set;
+  if (slotBytes != 0 && slots > (SIZE_MAX - slots_offset(setCount)) / slotBytes) {
+    return 0;
+  }
+  return slots_offset(setCount) + slots * slotBytes;
+}
+
+bool shared_cache_open(const char *path, size_t maxBytes, size_t slotBytes, std::string *error) {
+  std::lock_guard<std::mutex> guard(mapping_mutex);
+
+  retire_mapping();
+
+  if (slotBytes < sizeof(SlotHeader) + min_slot_bytes || slotBytes > max_slot_bytes) {
+    *error = slotBytes < sizeof(SlotHeader) + min_slot_bytes ? "slot_bytes is too small" : "slot_bytes is too large";
+    return false;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    *error = std::string("cannot open ") + path + ": " + strerror(errno);
+    return false;
+  }
+
+  // Only one process lays out a new region; the others wait and adopt its geometry
+  flock(fd, LOCK_EX);
+
+  auto fail = [&](const std::string &message) {
+    *error = message;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return false;
+  };
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return fail(std::string("cannot stat ") + path + ": " + strerror(errno));
+  }
+
+  // An empty file, or one whose creator died before writing the header (magic is
+  // written last), is laid out afresh. Anything else must be a region of this version:
+  // the file is someone's data or another release's cache, and is left alone.
+  SharedCacheHeader existing = SharedCacheHeader();
+  bool fresh = st.st_size == 0 ||
+               (static_cast<size_t>(st.st_size) >= sizeof(existing) &&
+                pread(fd, &existing, sizeof(existing), 0) == static_cast<ssize_t>(sizeof(existing)) &&
+                existing.magic == 0 && existing.version == 0 && existing.setCount == 0 && existing.slotBytes == 0);
+
+  if (!fresh && (static_cast<size_t>(st.st_size) < sizeof(existing) || existing.magic != shared_cache_magic ||
+                 existing.version != shared_cache_version)) {
+    return fail(std::string(path) + " is not a shared metadata cache of this version; remove it or use another path");
+  }
+
+  uint32_t setCount;
+  if (fresh) {
+    size_t slots = maxBytes / slotBytes;
+    setCount = static_cast<uint32_t>(std::min<size_t>(slots / ways_per_set, UINT32_MAX / ways_per_set));
+    if (setCount == 0) {
+      setCount = 1;
+    }
+  } else {
+    setCount = existing.setCount;
+    slotBytes = existing.slotBytes;
+  }
+
+  size_t size = region_size(setCount, slotBytes);
+
+  if (!fresh && (setCount == 0 || slotBytes < sizeof(SlotHeader) + min_slot_bytes || slotBytes > max_slot_bytes ||
+                 size == 0 || static_cast<size_t>(st.st_size) < size)) {
+    return fail(std::string(path) + " has an invalid shared metadata cache layout; remove it or use another path");
+  }
+
+  if (size == 0) {
+    return fail("max_bytes is too large");
+  }
+
+  // A fresh region starts as zeros: every slot empty and unlocked
+  if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+    return fail(std::string("cannot size ") + path + ": " + strerror(errno));
+  }
+
+  void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    return fail(std::string("cannot map ") + path + ": " + strerror(errno));
+  }
+
+  if (fresh) {
+    SharedCacheHeader *created = static_cast<SharedCacheHeader *>(mapped);
+    created->setCount = setCount;
+    created->slotBytes = slotBytes;
+    created->version = shared_cache_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    created->magic = shared_cache_magic;
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  current_mapping.store(new SharedMapping{static_cast<uint8_t *>(mapped), size, setCount, slotBytes});
+  return true;
+}
+
+void shared_cache_close() {
+  std::lock_guard<std::mutex> guard(mapping_mutex);
+  retire_mapping();
+}
+
+bool shared_cache_is_open() { return current_mapping.load(std::memory_order_acquire) != nullptr; }
+
+std::shared_ptr<const CachedPacket> shared_cache_lookup(const FileIdentity &identity, XMP_OptionBits openFlags) {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  if (m == nullptr) {
+    return nullptr;
+  }
+
+  uint32_t set = set_for(m, identity);
+  size_t capacity = slot_capacity(m);
+
+  for (uint32_t way = 0; way < ways_per_set; way++) {
+    SlotHeader *slot = slot_at(m, set, way);
+
+    // Two attempts: a writer finishing right under a reader is common enough to retry once
+    for (int attempt = 0; attempt < 2; attempt++) {
+      uint64_t before = slot->lock.load(std::memory_order_acquire);
+      if (lock_seq(before) & 1) {
+        continue;
+      }
+
+      if (!slot->used || !same_file(slot->identity, identity)) {
+        break;
+      }
+
+      auto packet = std::make_shared<CachedPacket>();
+      FileIdentity stored = slot->identity;
+      packet->requestFlags = slot->requestFlags;
+      packet->openFlags = slot->openFlags;
+      packet->format = slot->format;
+      packet->handlerFlags = slot->handlerFlags;
+      packet->packetInfo = slot->packetInfo;
+      uint64_t length = slot->dataLength;
+      if (length > capacity) {
+        continue;  // Torn read of a slot being rewritten
+      }
+      packet->serialized.assign(reinterpret_cast<const char *>(slot_data(slot)), length);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->lock.load(std::memory_order_relaxed) != before) {
+        continue;
+      }
+
+      if (stored != identity || packet->requestFlags != openFlags) {
+        return nullptr;
+      }
+
+      slot->referenced.store(1, std::memory_order_relaxed);
+      header(m)->hits.fetch_add(1, std::memory_order_relaxed);
+      return packet;
+    }
+  }
+
+  return nullptr;
+}
+
+void shared_cache_store(const FileIdentity &identity, const CachedPacket &packet) {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  if (m == nullptr || packet.serialized.size() > slot_capacity(m)) {
+    return;
+  }
+
+  uint32_t set = set_for(m, identity);
+
+  // Prefer the file's own slot, then a free one, then whatever the clock hand picks
+  SlotHeader *victim = nullptr;
+  for (uint32_t way = 0; way < ways_per_set && victim == nullptr; way++) {
+    SlotHeader *slot = slot_at(m, set, way);
+    if (slot->used && same_file(slot->identity, identity)) {
+      victim = slot;
+    }
+  }
+  for (uint32_t way = 0; way < ways_per_set && victim == nullptr; way++) {
+    SlotHeader *slot = slot_at(m, set, way);
+    if (!slot->used) {
+      victim = slot;
+    }
+  }
+
+  bool evicting = false;
+  if (victim == nullptr) {
+    SetHand *hand = set_hand(m, set);
+    for (uint32_t step = 0; step < 2 * ways_per_set; step++) {
+      uint32_t way = hand->hand.fetch_add(1, std::memory_order_relaxed) % ways_per_set;
+      SlotHeader *slot = slot_at(m, set, way);
+      if (slot->referenced.exchange(0, std::memory_order_relaxed) == 0) {
+        victim = slot;
+        break;
+      }
+    }
+    if (victim == nullptr) {
+      victim = slot_at(m, set, hand->hand.load(std::memory_order_relaxed) % ways_per_set);
+    }
+    evicting = true;
+  }
+
+  uint64_t word;
+  if (!try_lock_slot(victim, &word)) {
+    // Another process is writing this slot; its entry is as good as ours. A lock
+    // left behind by a dead process is taken over instead of losing the slot for good.
+    uint64_t held = victim->lock.load(std::memory_order_relaxed);
+    if (!(lock_seq(held) & 1) || !owner_is_gone(held) || !steal_slot(victim, held, &word)) {
+      return;
+    }
+  }
+
+  victim->used = 0;
+  victim->identity = identity;
+  victim->requestFlags = packet.requestFlags;
+  victim->openFlags = packet.openFlags;
+  victim->format = packet.format;
+  victim->handlerFlags = packet.handlerFlags;
+  victim->packetInfo = packet.packetInfo;
+  victim->dataLength = packet.serialized.size();
+  memcpy(slot_data(victim), packet.serialized.data(), packet.serialized.size());
+  victim->referenced.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  victim->used = 1;
+
+  if (unlock_slot(victim, word) && evicting) {
+    header(m)->evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void shared_cache_invalidate(const FileIdentity &identity) {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  if (m == nullptr) {
+    return;
+  }
+
+  uint32_t set = set_for(m, identity);
+
+  for (uint32_t way = 0; way < ways_per_set; way++) {
+    SlotHeader *slot = slot_at(m, set, way);
+    if (!slot->used || !same_file(slot->identity, identity)) {
+      continue;
+    }
+
+    // An invalidation must not be skipped the way a store may be. A writer only
+    // holds the lock for one memcpy, so wait for it briefly; a lock whose owner
+    // died, or that outlives the patience (a stopped process, a reused pid), is
+    // taken over. The robbed writer's unlock then fails, and as it sets used last
+    // a slot it still marks used after this holds a complete entry, which the
+    // identity check of a lookup rejects if it is stale.
+    auto deadline = std::chrono::steady_clock::now() + invalidate_patience;
+    uint64_t word;
+    while (!try_lock_slot(slot, &word)) {
+      uint64_t held = slot->lock.load(std::memory_order_relaxed);
+      if ((lock_seq(held) & 1) && (owner_is_gone(held) || std::chrono::steady_clock::now() >= deadline) &&
+          steal_slot(slot, held, &word)) {
+        break;
+      }
+      sched_yield();
+    }
+    if (same_file(slot->identity, identity)) {
+      slot->used = 0;
+    }
+    unlock_slot(slot, word);
+  }
+}
+
+void shared_cache_count_miss() {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  if (m != nullptr) {
+    header(m)->misses.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void shared_cache_clear() {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  if (m == nullptr) {
+    return;
+  }
+
+  uint32_t slots = m->setCount * ways_per_set;
+  for (uint32_t index = 0; index < slots; index++) {
+    SlotHeader *slot = slot_at(m, index / ways_per_set, index % ways_per_set);
+    uint64_t word;
+    if (try_lock_slot(slot, &word)) {
+      slot->used = 0;
+      unlock_slot(slot, word);
+    }
+  }
+
+  header(m)->hits.store(0, std::memory_order_relaxed);
+  header(m)->misses.store(0, std::memory_order_relaxed);
+  header(m)->evictions.store(0, std::memory_order_relaxed);
+}
+
+void shared_cache_stats(SharedCacheStats *stats) {
+  MappingGuard pinned;
+  const SharedMapping *m = pinned.get();
+
+  *stats = SharedCacheStats();
+  if (m == nullptr) {
+    return;
+  }
+
+  uint32_t slots = m->setCount * ways_per_set;
+  for (uint32_t index = 0; index < slots; index++) {
+    SlotHeader *slot = slot_at(m, index / ways_per_set, index % ways_per_set);
+    if (slot->used) {
+      stats->entries++;
+      stats->bytes += std::min<size_t>(slot->dataLength, slot_capacity(m));
+    }
+  }
+
+  stats->hits = header(m)->hits.load(std::memory_order_relaxed);
+  stats->misses = header(m)->misses.load(std::memory_order_relaxed);
+  stats->evictions = header(m)->evictions.load(std::memory_order_relaxed);
+  stats->maxBytes = static_cast<size_t>(slots) * m->slotBytes;
+  stats->slotBytes = m->slotBytes;
+}
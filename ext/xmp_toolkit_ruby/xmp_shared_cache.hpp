@@ -0,0 +1,46 @@
+#ifndef XMP_SHARED_CACHE_HPP
+#define XMP_SHARED_CACHE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "xmp_metadata_cache.hpp"
+
+// Metadata cache backend in a MAP_SHARED file mapping, so forked workers (or
+// unrelated processes using the same path) share one warm cache.
+//
+// The region is a fixed array of slots grouped into 8-way sets. A file's
+// (dev, inode) picks the set; inside a set a clock hand chooses the victim.
+// Every slot is guarded by its own sequence lock: writers take it with a CAS
+// to an odd value, readers copy the slot and retry or give up when the
+// sequence moved. Readers never block writers, and a writer that loses the
+// CAS simply skips the store. The lock word carries the writer's pid, so a
+// lock left by a process that died mid-write is taken over.
+
+struct SharedCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t entries;
+  size_t bytes;
+  size_t maxBytes;
+  size_t slotBytes;
+};
+
+// Maps (creating if needed) the cache file at path. An existing file keeps its
+// geometry, so every process sees the same layout; a file that is not a cache of
+// this version, or whose layout does not fit its size, is refused rather than
+// reset. Returns false and sets error on failure.
+bool shared_cache_open(const char *path, size_t maxBytes, size_t slotBytes, std::string *error);
+void shared_cache_close();
+bool shared_cache_is_open();
+
+std::shared_ptr<const CachedPacket> shared_cache_lookup(const FileIdentity &identity, XMP_OptionBits openFlags);
+void shared_cache_store(const FileIdentity &identity, const CachedPacket &packet);
+void shared_cache_invalidate(const FileIdentity &identity);
+void shared_cache_count_miss();
+void shared_cache_clear();
+void shared_cache_stats(SharedCacheStats *stats);
+
+#endif
@@ -0,0 +1,319 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Bucket i counts calls that took less than 2^i ns (and at least 2^(i-1) ns);
+// the last bucket is open-ended (2^39 ns is about 9 minutes).
+static const int kBucketCount = 40;
+// Distinct file formats tracked; further formats share the last slot.
+static const int kFormatSlots = 32;
+
+static const char *const OPERATION_NAMES[kStatsOperationCount] = {"init",      "open",    "get_xmp", "parse",
+                                                                  "serialize", "put_xmp", "close"};
+static const char *const STRATEGY_NAMES[kStatsStrategyCount] = {nullptr, "smart_handler", "packet_scanning"};
+
+struct Histogram {
+  std::atomic<uint64_t> buckets[kBucketCount];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> totalNanos;
+  std::atomic<uint64_t> maxNanos;
+};
+
+// Plain copy of a Histogram, summed over threads.
+struct HistogramTotals {
+  uint64_t buckets[kBucketCount];
+  uint64_t count;
+  uint64_t errors;
+  uint64_t totalNanos;
+  uint64_t maxNanos;
+};
+
+using Cells = std::atomic<Histogram *>[kStatsOperationCount][kStatsStrategyCount][kFormatSlots];
+
+struct ThreadStats {
+  Cells cells;
+
+  ThreadStats();
+  ~ThreadStats();
+};
+
+// Format of every slot; 0 marks a free slot (kXMP_UnknownFile is "    ", not 0).
+static std::atomic<XMP_FileFormat> format_slots[kFormatSlots];
+
+// Guards the list of live threads and the totals of threads that exited. Only
+// taken when a thread first records, exits, or stats are read or reset.
+static std::mutex registry_mutex;
+static std::vector<ThreadStats *> registry;
+static HistogramTotals *retired = nullptr;  // [kStatsOperationCount][kStatsStrategyCount][kFormatSlots]
+
+static thread_local ThreadStats thread_stats;
+
+// The hook of each Ractor; a Proc can't be called from another one
+static rb_ractor_local_key_t stats_hook_key;
+
+static size_t cell_index(int operation, int strategy, int slot) {
+  return (static_cast<size_t>(operation) * kStatsStrategyCount + strategy) * kFormatSlots + slot;
+}
+
+static const size_t kCellCount = cell_index(kStatsOperationCount, 0, 0);
+
+static void add_histogram(HistogramTotals *totals, const Histogram &histogram) {
+  for (int i = 0; i < kBucketCount; i++) {
+    totals->buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+  }
+  totals->count += histogram.count.load(std::memory_order_relaxed);
+  totals->errors += histogram.errors.load(std::memory_order_relaxed);
+  totals->totalNanos += histogram.totalNanos.load(std::memory_order_relaxed);
+  totals->maxNanos = std::max(totals->maxNanos, histogram.maxNanos.load(std::memory_order_relaxed));
+}
+
+static void clear_histogram(Histogram *histogram) {
+  for (int i = 0; i < kBucketCount; i++) {
+    histogram->buckets[i].store(0, std::memory_order_relaxed);
+  }
+  histogram->count.store(0, std::memory_order_relaxed);
+  histogram->errors.store(0, std::memory_order_relaxed);
+  histogram->totalNanos.store(0, std::memory_order_relaxed);
+  histogram->maxNanos.store(0, std::memory_order_relaxed);
+}
+
+// Calls fn(operation, strategy, slot, histogram) for every histogram the thread created.
+template <typename Fn> static void each_histogram(ThreadStats *stats, Fn fn) {
+  for (int operation = 0; operation < kStatsOperationCount; operation++) {
+    for (int strategy = 0; strategy < kStatsStrategyCount; strategy++) {
+      for (int slot = 0; slot < kFormatSlots; slot++) {
+        Histogram *histogram = stats->cells[operation][strategy][slot].load(std::memory_order_acquire);
+        if (histogram != nullptr) {
+          fn(operation, strategy, slot, histogram);
+        }
+      }
+    }
+  }
+}
+
+ThreadStats::ThreadStats() {
+  for (int operation = 0; operation < kStatsOperationCount; operation++) {
+    for (int strategy = 0; strategy < kStatsStrategyCount; strategy++) {
+      for (int slot = 0; slot < kFormatSlots; slot++) {
+        cells[operation][strategy][slot].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  registry.push_back(this);
+}
+
+// Keeps the numbers of exiting threads in the process totals.
+ThreadStats::~ThreadStats() {
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+
+  if (retired == nullptr) {
+    retired = new HistogramTotals[kCellCount]();
+  }
+
+  each_histogram(this, [](int operation, int strategy, int slot, Histogram *histogram) {
+    add_histogram(&retired[cell_index(operation, strategy, slot)], *histogram);
+    delete histogram;
+  });
+}
+
+static int format_slot(XMP_FileFormat format) {
+  for (int slot = 0; slot < kFormatSlots - 1; slot++) {
+    XMP_FileFormat current = format_slots[slot].load(std::memory_order_acquire);
+    if (current == format) {
+      return slot;
+    }
+    if (current == 0) {
+      XMP_FileFormat expected = 0;
+      if (format_slots[slot].compare_exchange_strong(expected, format) || expected == format) {
+        return slot;
+      }
+    }
+  }
+  return kFormatSlots - 1;
+}
+
+StatsStrategy stats_strategy(XMP_OptionBits openFlags) {
+  if (openFlags & kXMPFiles_OpenUsePacketScanning) {
+    return kStatsPacketScanning;
+  }
+  if (openFlags & kXMPFiles_OpenUseSmartHandler) {
+    return kStatsSmartHandler;
+  }
+  return kStatsNoStrategy;
+}
+
+void stats_record(StatsOperation operation, XMP_FileFormat format, StatsStrategy strategy, uint64_t nanos, bool ok) {
+  std::atomic<Histogram *> &cell = thread_stats.cells[operation][strategy][format_slot(format)];
+
+  // Only this thread creates its histograms; readers see them once published
+  Histogram *histogram = cell.load(std::memory_order_relaxed);
+  if (histogram == nullptr) {
+    histogram = new Histogram();
+    cell.store(histogram, std::memory_order_release);
+  }
+
+  int bucket = nanos == 0 ? 0 : std::min(64 - __builtin_clzll(nanos), kBucketCount - 1);
+  histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  histogram->count.fetch_add(1, std::memory_order_relaxed);
+  histogram->totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+  if (!ok) {
+    histogram->errors.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t max = histogram->maxNanos.load(std::memory_order_relaxed);
+  while (nanos > max && !histogram->maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+  }
+}
+
+static VALUE current_stats_hook() {
+  VALUE hook;
+  return rb_ractor_local_storage_value_lookup(stats_hook_key, &hook) ? hook : Qnil;
+}
+
+static VALUE call_stats_hook(VALUE args) {
+  return rb_proc_call(current_stats_hook(), args);
+}
+
+void StatsTimer::stop(XMP_FileFormat format, StatsStrategy strategy, bool ok) {
+  if (done_) {
+    return;
+  }
+  done_ = true;
+
+  uint64_t nanos = elapsed_nanos();
+  stats_record(operation_, format, strategy, nanos, ok);
+
+  if (NIL_P(current_stats_hook())) {
+    return;
+  }
+
+  VALUE args = rb_ary_new_from_args(5, ID2SYM(rb_intern(OPERATION_NAMES[operation_])), UINT2NUM(format),
+                                    STRATEGY_NAMES[strategy] ? ID2SYM(rb_intern(STRATEGY_NAMES[strategy])) : Qnil,
+                                    DBL2NUM(nanos / 1e9), ok ? Qtrue : Qfalse);
+
+  // A failing subscriber must not break the metadata call it observes
+  int state = 0;
+  rb_protect(call_stats_hook, args, &state);
+  if (state) {
+    VALUE error = rb_errinfo();
+    rb_set_errinfo(Qnil);
+    rb_warn("XmpToolkit stats hook raised %" PRIsVALUE, rb_obj_class(error));
+  }
+}
+
+// Percentile of a histogram as the upper bound of the bucket it falls into.
+static uint64_t bucket_percentile(const HistogramTotals &totals, double fraction) {
+  uint64_t rank = static_cast<uint64_t>(totals.count * fraction + 0.5);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBucketCount; i++) {
+    seen += totals.buckets[i];
+    if (seen >= rank && seen > 0) {
+      return i == kBucketCount - 1 ? totals.maxNanos : std::min(uint64_t(1) << i, totals.maxNanos);
+    }
+  }
+  return totals.maxNanos;
+}
+
+// XmpToolkit.stats
+// One Hash per operation, format and open strategy that was recorded, with
+// "count", "errors", "total_ns", "max_ns", "p50_ns", "p90_ns", "p99_ns" and
+// "buckets" (upper bound in ns => calls).
+VALUE
+xmp_stats(VALUE self) {
+  std::vector<HistogramTotals> totals(kCellCount);
+  XMP_FileFormat formats[kFormatSlots];
+
+  {
+    std::lock_guard<std::mutex> guard(registry_mutex);
+
+    if (retired != nullptr) {
+      std::copy(retired, retired + kCellCount, totals.begin());
+    }
+    for (ThreadStats *stats : registry) {
+      each_histogram(stats, [&totals](int operation, int strategy, int slot, Histogram *histogram) {
+        add_histogram(&totals[cell_index(operation, strategy, slot)], *histogram);
+      });
+    }
+  }
+
+  for (int slot = 0; slot < kFormatSlots; slot++) {
+    formats[slot] = format_slots[slot].load(std::memory_order_acquire);
+  }
+
+  VALUE result = rb_ary_new();
+
+  for (int operation = 0; operation < kStatsOperationCount; operation++) {
+    for (int strategy = 0; strategy < kStatsStrategyCount; strategy++) {
+      for (int slot = 0; slot < kFormatSlots; slot++) {
+        const HistogramTotals &cell = totals[cell_index(operation, strategy, slot)];
+        if (cell.count == 0) {
+          continue;
+        }
+
+        VALUE buckets = rb_hash_new();
+        for (int i = 0; i < kBucketCount; i++) {
+          if (cell.buckets[i] > 0) {
+            rb_hash_aset(buckets, ULL2NUM(uint64_t(1) << i), ULL2NUM(cell.buckets[i]));
+          }
+        }
+
+        VALUE entry = rb_hash_new();
+        rb_hash_aset(entry, rb_str_new_cstr("operation"), ID2SYM(rb_intern(OPERATION_NAMES[operation])));
+        rb_hash_aset(entry, rb_str_new_cstr("format"), UINT2NUM(formats[slot]));
+        rb_hash_aset(entry, rb_str_new_cstr("strategy"),
+                     STRATEGY_NAMES[strategy] ? ID2SYM(rb_intern(STRATEGY_NAMES[strategy])) : Qnil);
+        rb_hash_aset(entry, rb_str_new_cstr("count"), ULL2NUM(cell.count));
+        rb_hash_aset(entry, rb_str_new_cstr("errors"), ULL2NUM(cell.errors));
+        rb_hash_aset(entry, rb_str_new_cstr("total_ns"), ULL2NUM(cell.totalNanos));
+        rb_hash_aset(entry, rb_str_new_cstr("max_ns"), ULL2NUM(cell.maxNanos));
+        rb_hash_aset(entry, rb_str_new_cstr("p50_ns"), ULL2NUM(bucket_percentile(cell, 0.50)));
+        rb_hash_aset(entry, rb_str_new_cstr("p90_ns"), ULL2NUM(bucket_percentile(cell, 0.90)));
+        rb_hash_aset(entry, rb_str_new_cstr("p99_ns"), ULL2NUM(bucket_percentile(cell, 0.99)));
+        rb_hash_aset(entry, rb_str_new_cstr("buckets"), buckets);
+        rb_ary_push(result, entry);
+      }
+    }
+  }
+
+  return result;
+}
+
+VALUE
+xmp_reset_stats(VALUE self) {
+  std::lock_guard<std::mutex> guard(registry_mutex);
+
+  if (retired != nullptr) {
+    std::fill(retired, retired + kCellCount, HistogramTotals());
+  }
+  for (ThreadStats *stats : registry) {
+    each_histogram(stats, [](int, int, int, Histogram *histogram) { clear_histogram(histogram); });
+  }
+
+  return Qtrue;
+}
+
+VALUE
+xmp_stats_hook(VALUE self) { return current_stats_hook(); }
+
+// XmpToolkit.stats_hook = ->(operation, format, strategy, seconds, ok) { ... }
+// Called on the calling thread after every measured operation of the calling
+// Ractor; nil unsubscribes.
+VALUE
+xmp_set_stats_hook(VALUE self, VALUE hook) {
+  if (!NIL_P(hook) && !rb_obj_is_proc(hook)) {
+    rb_raise(rb_eTypeError, "stats hook must be a Proc or nil");
+  }
+
+  rb_ractor_local_storage_value_set(stats_hook_key, hook);
+  return hook;
+}
+
+void stats_hook_init() { stats_hook_key = rb_ractor_local_storage_value_newkey(); }
@@ -0,0 +1,75 @@
+#ifndef XMP_STATS_HPP
+#define XMP_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+
+// Latency histograms of the SDK calls made by the extension, broken down by
+// operation, file format and open strategy. Every thread records into its own
+// histograms with relaxed atomic adds, so recording takes no lock (apart from
+// registering a thread on its first call); the per-thread histograms are only
+// summed up when XmpToolkit.stats is read.
+
+enum StatsOperation {
+  kStatsInit,
+  kStatsOpen,
+  kStatsGetXMP,
+  kStatsParse,
+  kStatsSerialize,
+  kStatsPutXMP,
+  kStatsClose,
+  kStatsOperationCount
+};
+
+enum StatsStrategy { kStatsNoStrategy, kStatsSmartHandler, kStatsPacketScanning, kStatsStrategyCount };
+
+// Open strategy of a file opened with openFlags.
+StatsStrategy stats_strategy(XMP_OptionBits openFlags);
+
+// Adds one call to the calling thread's histogram. Safe without the GVL.
+void stats_record(StatsOperation operation, XMP_FileFormat format, StatsStrategy strategy, uint64_t nanos, bool ok);
+
+// Times one operation. stop() records it and calls the Ruby stats hook, so it
+// needs the GVL and must not be called while holding a lock. A timer that goes
+// out of scope without stop() or cancel() still records, without calling the
+// hook: as an error while a C++ exception unwinds, as a success otherwise (for
+// callers that hold a lock).
+class StatsTimer {
+ public:
+  explicit StatsTimer(StatsOperation operation)
+      : operation_(operation), started_(std::chrono::steady_clock::now()), done_(false) {}
+
+  ~StatsTimer() {
+    if (!done_) {
+      stats_record(operation_, kXMP_UnknownFile, kStatsNoStrategy, elapsed_nanos(), std::uncaught_exceptions() == 0);
+    }
+  }
+
+  StatsTimer(const StatsTimer &) = delete;
+  StatsTimer &operator=(const StatsTimer &) = delete;
+
+  void stop(XMP_FileFormat format = kXMP_UnknownFile, StatsStrategy strategy = kStatsNoStrategy, bool ok = true);
+
+  // Drops the measurement, e.g. when the operation turned out to be a no-op.
+  void cancel() { done_ = true; }
+
+ private:
+  uint64_t elapsed_nanos() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_).count();
+  }
+
+  StatsOperation operation_;
+  std::chrono::steady_clock::time_point started_;
+  bool done_;
+};
+
+VALUE xmp_stats(VALUE self);
+VALUE xmp_reset_stats(VALUE self);
+VALUE xmp_stats_hook(VALUE self);
+VALUE xmp_set_stats_hook(VALUE self, VALUE hook);
+
+// Creates the Ractor local key of the stats hook; called once from Init.
+void stats_hook_init();
+
+#endif
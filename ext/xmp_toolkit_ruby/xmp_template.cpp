@@ -0,0 +1,139 @@
+#include "xmp_toolkit.hpp"
+#include "xmp_stats.hpp"
+#include "xmp_template.hpp"
+
+#include <mutex>
+#include <unordered_set>
+
+// Every allocated template, so the SDK can be terminated without leaving
+// SXMPMeta objects behind that outlive the toolkit.
+static std::mutex templates_mutex;
+static std::unordered_set<XMPTemplate *> live_templates;
+
+static void xmptemplate_free(void *ptr) {
+  XMPTemplate *tmpl = static_cast<XMPTemplate *>(ptr);
+
+  {
+    std::lock_guard<std::mutex> guard(templates_mutex);
+    live_templates.erase(tmpl);
+  }
+
+  delete tmpl;
+}
+
+static size_t xmptemplate_memsize(const void *ptr) {
+  const XMPTemplate *tmpl = static_cast<const XMPTemplate *>(ptr);
+  return sizeof(XMPTemplate) + tmpl->source.capacity();
+}
+
+static const rb_data_type_t xmptemplate_data_type = {"XMPTemplate",
+                                                     {
+                                                         0,
+                                                         xmptemplate_free,
+                                                         xmptemplate_memsize,
+                                                     },
+                                                     0,
+                                                     0,
+                                                     RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE};
+
+XMPTemplate *xmptemplate_get(VALUE obj) {
+  if (!rb_typeddata_is_kind_of(obj, &xmptemplate_data_type)) {
+    return nullptr;
+  }
+
+  return static_cast<XMPTemplate *>(RTYPEDDATA_DATA(obj));
+}
+
+static XMPTemplate *get_template(VALUE self) {
+  XMPTemplate *tmpl;
+  TypedData_Get_Struct(self, XMPTemplate, &xmptemplate_data_type, tmpl);
+  return tmpl;
+}
+
+VALUE
+xmptemplate_allocate(VALUE klass) {
+  XMPTemplate *tmpl = new XMPTemplate();
+  tmpl->flags = kXMPTemplate_AddNewProperties | kXMPTemplate_ReplaceExistingProperties |
+                kXMPTemplate_IncludeInternalProperties;
+
+  {
+    std::lock_guard<std::mutex> guard(templates_mutex);
+    live_templates.insert(tmpl);
+  }
+
+  return TypedData_Wrap_Struct(klass, &xmptemplate_data_type, tmpl);
+}
+
+std::shared_ptr<SXMPMeta> xmptemplate_meta(XMPTemplate *tmpl) {
+  ensure_sdk_initialized();
+
+  std::lock_guard<std::mutex> guard(templates_mutex);
+
+  if (!tmpl->meta) {
+    auto meta = std::make_shared<SXMPMeta>();
+    StatsTimer timer(kStatsParse);  // Recorded when it goes out of scope; no hook under the lock
+    parse_xmp_buffer(meta.get(), tmpl->source.data(), tmpl->source.size());
+    tmpl->meta = meta;
+  }
+
+  return tmpl->meta;
+}
+
+void xmptemplate_release_all() {
+  std::lock_guard<std::mutex> guard(templates_mutex);
+
+  for (XMPTemplate *tmpl : live_templates) {
+    tmpl->meta.reset();
+  }
+}
+
+// XmpTemplate.new(xmp_data, flags: nil)
+// Parses and validates xmp_data right away; flags defaults to the upsert
+// behaviour of XmpWrapper#update_meta.
+VALUE
+xmptemplate_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE rb_xmp_data, kwargs;
+  rb_scan_args(argc, argv, "1:", &rb_xmp_data, &kwargs);
+
+  // Frozen templates may be shared with other Ractors, so they are never reinitialized
+  rb_check_frozen(self);
+  Check_Type(rb_xmp_data, T_STRING);
+
+  ID kw_table[1];
+  kw_table[0] = rb_intern("flags");
+
+  VALUE kw_values[1];
+  rb_get_kwargs(kwargs, kw_table, 0, 1, kw_values);
+
+  XMPTemplate *tmpl = get_template(self);
+  tmpl->source.assign(RSTRING_PTR(rb_xmp_data), RSTRING_LEN(rb_xmp_data));
+
+  if (kw_values[0] != Qundef && !NIL_P(kw_values[0])) {
+    tmpl->flags = NUM2UINT(kw_values[0]);
+  }
+
+  ErrorText failure;
+  try {
+    xmptemplate_meta(tmpl);
+  } catch (const XMP_Error &e) {
+    failure.set(e.GetErrMsg());
+  }
+  if (!failure.empty()) {
+    rb_raise(rb_eArgError, "Invalid XMP template: %s", failure.c_str());
+  }
+
+  rb_obj_freeze(self);
+  return self;
+}
+
+VALUE
+xmptemplate_flags(VALUE self) {
+  const XMPTemplate *tmpl = get_template(self);
+  return UINT2NUM(tmpl->flags);
+}
+
+VALUE
+xmptemplate_source(VALUE self) {
+  const XMPTemplate *tmpl = get_template(self);
+  return rb_str_new(tmpl->source.data(), tmpl->source.size());
+}
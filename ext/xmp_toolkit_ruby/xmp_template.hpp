@@ -0,0 +1,29 @@
+#ifndef XMP_TEMPLATE_HPP
+#define XMP_TEMPLATE_HPP
+
+#include <memory>
+#include <string>
+
+// RDF/XML parsed once and applied to many files through SXMPUtils::ApplyTemplate.
+struct XMPTemplate {
+  std::string source;    // RDF/XML the template was created from
+  std::shared_ptr<SXMPMeta> meta;  // Parsed form, dropped when the SDK terminates and re-parsed on next use
+  XMP_OptionBits flags;            // kXMPTemplate_* bits passed to ApplyTemplate
+};
+
+// Returns the native template of an XmpTemplate instance, or nullptr if obj is not an XmpTemplate.
+XMPTemplate *xmptemplate_get(VALUE obj);
+
+// Returns the parsed metadata of a template, parsing the source again if the SDK was restarted since.
+// The caller shares ownership, so a concurrent release_all or GC of the template does not free it mid-use.
+std::shared_ptr<SXMPMeta> xmptemplate_meta(XMPTemplate *tmpl);
+
+// Drops the parsed metadata of every live template; must run before SXMPMeta::Terminate.
+void xmptemplate_release_all();
+
+VALUE xmptemplate_allocate(VALUE klass);
+VALUE xmptemplate_initialize(int argc, VALUE *argv, VALUE self);
+VALUE xmptemplate_flags(VALUE self);
+VALUE xmptemplate_source(VALUE self);
+
+#endif
@@ -1,129 +1,128 @@
 #include "xmp_toolkit.hpp"
+#include "xmp_future.hpp"
+#include "xmp_namespaces.hpp"
+#include "xmp_sdk_ops.hpp"
+#include "xmp_stats.hpp"
+#include "xmp_template.hpp"
 
 #include <mutex>
 
 static std::mutex sdk_init_mutex;
 static bool sdk_initialized = false;
-static bool terminate_registered = false;
 
-static void terminate_sdk_internal() {
-  std::lock_guard<std::mutex> guard(sdk_init_mutex);
+// with_init blocks running in any thread or Ractor and reads in flight; the last
+// with_init to leave terminates the SDK
+static size_t session_depth = 0;
+
+// Set by a terminate that came while sessions were held; the last one to leave terminates
+static bool terminate_pending = false;
+
+// sdk_init_mutex must be held
+static void terminate_sdk_locked() {
+  terminate_pending = false;
   if (sdk_initialized) {
-    SXMPFiles::Terminate();
-    SXMPMeta::Terminate();
+    xmptemplate_release_all();
+    namespace_cache_clear();
+    sdk_terminate();
     sdk_initialized = false;
   }
 }
 
-// Register termination at Ruby exit
-static void register_terminate_at_exit() {
-  if (terminate_registered) {
-    return;  // Already registered
+// Cancels the reads in flight and waits for them, then terminates the SDK unless
+// sessions are still held, in which case the last one to leave does. Returns
+// whether it terminated now. Needs the GVL.
+static bool terminate_sdk_internal() {
+  future_reads_cancel_and_wait();
+
+  std::lock_guard<std::mutex> guard(sdk_init_mutex);
+  if (session_depth > 0) {
+    terminate_pending = sdk_initialized;
+    return false;
   }
 
-  terminate_registered = true;
+  terminate_sdk_locked();
+  return true;
+}
+
+// sdk_init_mutex must be held; terminate is whether leaving the last session terminates anyway
+static void leave_session_locked(bool terminate) {
+  if (--session_depth == 0 && (terminate || terminate_pending)) {
+    terminate_sdk_locked();
+  }
+}
 
+// Terminates the SDK at Ruby exit; end procs run on the main Ractor, before the
+// threads still in with_init are killed and leave their sessions
+void register_terminate_at_exit() {
   rb_set_end_proc([](VALUE) { terminate_sdk_internal(); }, Qnil);
 }
 
-static void ensure_sdk_initialized(const char *path) {
-  std::lock_guard<std::mutex> guard(sdk_init_mutex);
+// Initializing and counting the session happen under one lock, so a release
+// racing with an acquire can't terminate the SDK in between.
+static void ensure_sdk_initialized(const char *path, bool acquire_session) {
+  ErrorText failure;
 
-  if (sdk_initialized) {
-    return;
-  }
+  {
+    StatsTimer timer(kStatsInit);
+    std::string error;
 
-  try {
-    if (!SXMPMeta::Initialize()) {
-      rb_raise(rb_eRuntimeError, "Failed to initialize XMP Toolkit metadata");
-      return;
-    }
-
-    sdk_initialized = true;
-    register_terminate_at_exit();
+    {
+      std::lock_guard<std::mutex> guard(sdk_init_mutex);
 
-    XMP_OptionBits options = 0;
-    options |= kXMPFiles_ServerMode;
+      if (sdk_initialized) {
+        timer.cancel();
+      } else if (sdk_initialize(path, &error)) {
+        sdk_initialized = true;
 
-    if (path) {
-      if (!SXMPFiles::Initialize(options, path)) {
-        rb_raise(rb_eRuntimeError, "Failed to initialize XMP Files with plugin path");
-        return;
+        namespace_cache_replay();
       }
-    } else {
-      if (!SXMPFiles::Initialize(options)) {
-        rb_raise(rb_eRuntimeError, "Failed to initialize XMP Files without plugin path");
-        return;
+
+      if (sdk_initialized && acquire_session) {
+        session_depth++;
       }
     }
 
-    return;
-  } catch (const XMP_Error &e) {
-    rb_raise(rb_eRuntimeError, "XMP Error during initialization: %s", e.GetErrMsg());
-    return;
-  } catch (const std::exception &e) {
-    rb_raise(rb_eRuntimeError, "C++ exception during initialization: %s", e.what());
-    return;
-  } catch (...) {
-    rb_raise(rb_eRuntimeError, "Unknown error during XMP initialization");
-    return;
+    timer.stop(kXMP_UnknownFile, kStatsNoStrategy, error.empty());
+    if (!error.empty()) {
+      failure.set(error);
+    }
+  }
+
+  // Raised outside the lock, which rb_raise would otherwise leave held, and the objects above
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "%s", failure.c_str());
   }
 }
 
+static void ensure_sdk_initialized(const char *path) { ensure_sdk_initialized(path, false); }
+
 VALUE
 is_sdk_initialized(VALUE self) {
   std::lock_guard<std::mutex> guard(sdk_init_mutex);
   return sdk_initialized ? Qtrue : Qfalse;
 }
 
-void ensure_sdk_initialized() {
-  // Look up XmpToolkitRuby::PLUGINS_PATH if defined
+// XmpToolkitRuby::PLUGINS_PATH if defined. The constant is frozen, so other
+// Ractors can read it too.
+static const char *plugins_path() {
   VALUE xmp_module = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
   if (rb_const_defined(xmp_module, rb_intern("PLUGINS_PATH"))) {
     VALUE plugins_path = rb_const_get(xmp_module, rb_intern("PLUGINS_PATH"));
 
     if (TYPE(plugins_path) == T_STRING) {
-      const char *path = StringValueCStr(plugins_path);
-      ensure_sdk_initialized(path);
-      return;
+      return StringValueCStr(plugins_path);
     }
   }
 
-  ensure_sdk_initialized(nullptr);
-
-  return;
+  return nullptr;
 }
 
-bool xmp_meta_error_callback(void *clientContext, XMP_ErrorSeverity severity, XMP_Int32 cause, XMP_StringPtr message) {
-  const char *sevStr = (severity == kXMPErrSev_Recoverable)      ? "RECOVERABLE"
-                       : (severity == kXMPErrSev_OperationFatal) ? "FATAL OPERATION"
-                       : (severity == kXMPErrSev_FileFatal)      ? "FATAL FILE"
-                       : (severity == kXMPErrSev_ProcessFatal)   ? "FATAL PROCESS"
-                                                                 : "UNKNOWN";
-  std::cerr << "[TXMPMeta " << sevStr << "] "
-            << "Code=0x" << std::hex << cause << std::dec << "  Msg=\"" << (message ? message : "(no detail)")
-            << "\"\n";
-
-  // If it's a recoverable error, return true so XMP can try to continue;
-  // otherwise return false to force an exception back to the caller.
-  return (severity == kXMPErrSev_Recoverable);
-}
+void ensure_sdk_initialized() { ensure_sdk_initialized(plugins_path()); }
 
-bool xmp_file_error_callback(void *clientContext, XMP_StringPtr filePath, XMP_ErrorSeverity severity, XMP_Int32 cause,
-                             XMP_StringPtr message) {
-  const char *sevStr = (severity == kXMPErrSev_Recoverable)      ? "RECOVERABLE"
-                       : (severity == kXMPErrSev_OperationFatal) ? "FATAL OPERATION"
-                       : (severity == kXMPErrSev_FileFatal)      ? "FATAL FILE"
-                       : (severity == kXMPErrSev_ProcessFatal)   ? "FATAL PROCESS"
-                                                                 : "UNKNOWN";
-
-  std::cerr << "[TXMPFiles " << sevStr << "] "
-            << "file=\"" << (filePath ? filePath : "(null)") << "\"  "
-            << "cause=0x" << std::hex << cause << std::dec << "\n"
-            << "    msg=\"" << (message ? message : "(no detail)") << "\"\n";
-
-  // Only attempt recovery if the error is marked recoverable
-  return (severity == kXMPErrSev_Recoverable);
+void parse_xmp_buffer(SXMPMeta *meta, const char *buffer, size_t length) {
+  // The whole packet is in memory, so it is handed to the parser in one call
+  // instead of feeding it through kXMP_ParseMoreBuffers.
+  meta->ParseFromBuffer(buffer, static_cast<XMP_StringLen>(length));
 }
 
 // xmp_initialize(self)
@@ -147,8 +146,58 @@ xmp_initialize(int argc, VALUE *argv, VALUE self) {
   return Qnil;
 }
 
+// XmpToolkit.terminate
+// Cancels the reads of read_async still queued or running, waits for them, and
+// terminates the toolkit. While with_init blocks in other threads and Ractors
+// hold sessions, it is terminated once the last of them leaves instead, so their
+// files and XmpTemplates stay valid; returns false then.
 VALUE
 xmp_terminate(VALUE self) {
-  terminate_sdk_internal();
+  return terminate_sdk_internal() ? Qtrue : Qfalse;
+}
+
+// XmpToolkit.acquire_session(path = nil)
+// Initializes the toolkit unless it is, with path or PLUGINS_PATH, and enters
+// one more session. Sessions are counted per process, so threads and Ractors
+// share one SDK; see release_session.
+VALUE
+xmp_acquire_session(int argc, VALUE *argv, VALUE self) {
+  VALUE rb_path_arg = Qnil;
+
+  rb_scan_args(argc, argv, "01", &rb_path_arg);
+
+  if (rb_path_arg != Qnil) {
+    Check_Type(rb_path_arg, T_STRING);
+    ensure_sdk_initialized(StringValueCStr(rb_path_arg), true);
+  } else {
+    ensure_sdk_initialized(plugins_path(), true);
+  }
+
   return Qnil;
-}
\ No newline at end of file
+}
+
+// XmpToolkit.release_session
+// Leaves a session entered by acquire_session; leaving the last one terminates
+// the toolkit.
+VALUE
+xmp_release_session(VALUE self) {
+  {
+    std::lock_guard<std::mutex> guard(sdk_init_mutex);
+
+    if (session_depth > 0) {
+      leave_session_locked(true);
+      return Qnil;
+    }
+  }
+
+  rb_raise(rb_eRuntimeError, "No XMP Toolkit session to release");
+}
+
+void sdk_session_acquire() { ensure_sdk_initialized(plugins_path(), true); }
+
+void sdk_session_leave() {
+  std::lock_guard<std::mutex> guard(sdk_init_mutex);
+  if (session_depth > 0) {
+    leave_session_locked(false);
+  }
+}
@@ -1,9 +1,11 @@
 #ifndef XMP_TOOLKIT_HPP
 #define XMP_TOOLKIT_HPP
 
+#include <cstdarg>
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 // #define ENABLE_XMP_CPP_INTERFACE 1
@@ -24,6 +26,8 @@
 #include <iostream>
 
 #include <ruby.h>
+#include <ruby/ractor.h>
+#include <ruby/thread.h>
 
 using namespace std;
 
@@ -37,15 +41,129 @@ using namespace std;
 #include "XMP.hpp"
 #include "XMP.incl_cpp"
 
-// TXMPMeta‐style error callback
-bool xmp_meta_error_callback(void *clientContext, XMP_ErrorSeverity severity, XMP_Int32 cause, XMP_StringPtr message);
-
-// TXMPFiles‐style error callback
-bool xmp_file_error_callback(void *clientContext, XMP_StringPtr filePath, XMP_ErrorSeverity severity, XMP_Int32 cause,
-                             XMP_StringPtr message);
-
 void ensure_sdk_initialized();
 
+// rb_raise longjmps: the destructors of C++ objects in the frames it leaves never
+// run, and a raise from a catch block never ends the catch. Code holding such
+// objects copies the message into an ErrorText, closes their scope and raises
+// from outside it.
+class ErrorText {
+ public:
+  void set(const char *message) { format("%s", message); }
+  void set(const std::string &message) { set(message.c_str()); }
+
+  void format(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text_, sizeof(text_), fmt, args);
+    va_end(args);
+  }
+
+  bool empty() const { return text_[0] == '\0'; }
+  const char *c_str() const { return text_; }
+
+ private:
+  char text_[1024] = "";
+};
+
+static_assert(std::is_trivially_destructible<ErrorText>::value, "ErrorText must be safe to longjmp over");
+
+// Terminates the toolkit when Ruby exits; called once from Init.
+void register_terminate_at_exit();
+
+// Enters a session for work that outlives the calling method, like a read on a
+// worker thread, initializing the toolkit with PLUGINS_PATH unless it is.
+void sdk_session_acquire();
+
+// Leaves it; safe on any thread and without the GVL. Unlike release_session this
+// only terminates the toolkit when an XmpToolkit.terminate was deferred to it.
+void sdk_session_leave();
+
+// Parses a complete RDF/XML packet into meta. Throws XMP_Error on malformed input.
+void parse_xmp_buffer(SXMPMeta *meta, const char *buffer, size_t length);
+
+// Runs fn (returning bool) with the GVL released, so other Ruby threads keep
+// running while the SDK reads a file. fn must not touch Ruby objects or memory
+// owned by them. If fn throws, the message is stored in error and false returned.
+template <typename Fn> bool call_without_gvl(Fn fn, std::string *error) {
+  struct Call {
+    Fn *fn;
+    bool result;
+    std::string *error;
+  } call{&fn, false, error};
+
+  rb_thread_call_without_gvl(
+      [](void *data) -> void * {
+        Call *c = static_cast<Call *>(data);
+        try {
+          c->result = (*c->fn)();
+        } catch (const XMP_Error &e) {
+          *c->error = e.GetErrMsg();
+        } catch (const std::exception &e) {
+          *c->error = e.what();
+        }
+        return nullptr;
+      },
+      &call, nullptr, nullptr);
+
+  return call.result;
+}
+
+// As above, but raises an XMP_Error thrown by fn as RuntimeError once the GVL is held again.
+template <typename Fn> bool call_without_gvl(Fn fn) {
+  ErrorText failure;
+  bool result;
+  {
+    std::string error;
+    result = call_without_gvl(fn, &error);
+    if (!error.empty()) {
+      failure.set(error);
+    }
+  }
+
+  if (!failure.empty()) {
+    rb_raise(rb_eRuntimeError, "XMP SDK error: %s", failure.c_str());
+  }
+
+  return result;
+}
+
+// Like call_without_gvl(fn, error), but interruptible: Ruby calls ubf(arg) on
+// Thread#raise, Timeout, Thread#kill and signals, and ubf has to make fn return
+// soon. Pending interrupts are not raised here; the caller cleans up and then
+// calls rb_thread_check_ints(). If an interrupt was already pending, fn is not
+// run and ubf(arg) is called before returning false.
+template <typename Fn> bool call_without_gvl(Fn fn, std::string *error, rb_unblock_function_t *ubf, void *arg) {
+  struct Call {
+    Fn *fn;
+    bool ran;
+    bool result;
+    std::string *error;
+  } call{&fn, false, false, error};
+
+  rb_nogvl(
+      [](void *data) -> void * {
+        Call *c = static_cast<Call *>(data);
+        c->ran = true;
+        try {
+          c->result = (*c->fn)();
+        } catch (const XMP_Error &e) {
+          *c->error = e.GetErrMsg();
+        } catch (const std::exception &e) {
+          *c->error = e.what();
+        }
+        return nullptr;
+      },
+      &call, ubf, arg, RB_NOGVL_INTR_FAIL);
+
+  if (!call.ran) {
+    ubf(arg);
+    *error = "Interrupted";
+  }
+
+  return call.result;
+}
+
 VALUE is_sdk_initialized(VALUE self);
 
 // Initialize SXMPMeta + SXMPFiles, installing callbacks.
@@ -55,4 +173,8 @@ VALUE xmp_initialize(int argc, VALUE *argv, VALUE self);
 // Terminate SXMPFiles + SXMPMeta.
 VALUE xmp_terminate(VALUE self);
 
+// Process wide count of with_init blocks, shared by all threads and Ractors.
+VALUE xmp_acquire_session(int argc, VALUE *argv, VALUE self);
+VALUE xmp_release_session(VALUE self);
+
 #endif
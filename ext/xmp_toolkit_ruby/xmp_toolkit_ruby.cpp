@@ -1,6 +1,20 @@
 // xmp_init.cpp
 
 #include "xmp_toolkit.hpp"
+#include "xmp_error_log.hpp"
+#include "xmp_fiber_offload.hpp"
+#include "xmp_file_queries.hpp"
+#include "xmp_future.hpp"
+#include "xmp_io_accounting.hpp"
+#include "xmp_line_writer.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_metadata_index.hpp"
+#include "xmp_namespaces.hpp"
+#include "xmp_native_memory.hpp"
+#include "xmp_operation_control.hpp"
+#include "xmp_path.hpp"
+#include "xmp_stats.hpp"
+#include "xmp_template.hpp"
 #include "xmp_wrapper.hpp"
 
 #include <ruby.h>
@@ -8,31 +22,168 @@
 // The one and only Init function.  Ruby will look for Init_xmp_toolkit_ruby
 // because we will (in extconf.rb) build this extension as “xmp_toolkit_ruby.so”.
 RUBY_FUNC_EXPORTED "C" void Init_xmp_toolkit_ruby() {
-  SXMPMeta::SetDefaultErrorCallback(xmp_meta_error_callback, nullptr, 0);
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  // Every method is usable from any Ractor: process wide state is guarded
+  // natively, Ruby objects the extension keeps are per object or per Ractor
+  rb_ext_ractor_safe(true);
+#endif
 
-  SXMPFiles::SetDefaultErrorCallback(xmp_file_error_callback, nullptr, 0);
+  // XmpWrapper installs its own log on the objects it creates
+  SXMPMeta::SetDefaultErrorCallback(error_log_meta_callback, nullptr, 0);
+
+  SXMPFiles::SetDefaultErrorCallback(error_log_file_callback, nullptr, 0);
+
+  register_terminate_at_exit();
+  stats_hook_init();
 
   VALUE mXmpToolkitRuby = rb_define_module("XmpToolkitRuby");
   VALUE mXMPToolkit = rb_define_module_under(mXmpToolkitRuby, "XmpToolkit");
 
+  // Reopened by lib/xmp_toolkit_ruby.rb; defined here for the errors raised by the extension
+  VALUE eError = rb_define_class_under(mXmpToolkitRuby, "Error", rb_eStandardError);
+  VALUE eCancelledError = rb_define_class_under(mXmpToolkitRuby, "CancelledError", eError);
+  rb_define_class_under(mXmpToolkitRuby, "DeadlineExceededError", eCancelledError);
+  rb_define_class_under(mXmpToolkitRuby, "BusyError", eError);
+
   rb_define_singleton_method(mXMPToolkit, "initialize_xmp", RUBY_METHOD_FUNC(xmp_initialize), -1);
   rb_define_singleton_method(mXMPToolkit, "terminate", RUBY_METHOD_FUNC(xmp_terminate), 0);
   rb_define_singleton_method(mXMPToolkit, "initialized?", RUBY_METHOD_FUNC(is_sdk_initialized), 0);
+  rb_define_singleton_method(mXMPToolkit, "acquire_session", RUBY_METHOD_FUNC(xmp_acquire_session), -1);
+  rb_define_singleton_method(mXMPToolkit, "release_session", RUBY_METHOD_FUNC(xmp_release_session), 0);
+  rb_define_singleton_method(mXMPToolkit, "stats", RUBY_METHOD_FUNC(xmp_stats), 0);
+  rb_define_singleton_method(mXMPToolkit, "reset_stats", RUBY_METHOD_FUNC(xmp_reset_stats), 0);
+  rb_define_singleton_method(mXMPToolkit, "stats_hook", RUBY_METHOD_FUNC(xmp_stats_hook), 0);
+  rb_define_singleton_method(mXMPToolkit, "stats_hook=", RUBY_METHOD_FUNC(xmp_set_stats_hook), 1);
+  rb_define_singleton_method(mXMPToolkit, "io_accounting", RUBY_METHOD_FUNC(xmp_io_accounting), 0);
+  rb_define_singleton_method(mXMPToolkit, "io_accounting=", RUBY_METHOD_FUNC(xmp_set_io_accounting), 1);
+  rb_define_singleton_method(mXMPToolkit, "io_stats", RUBY_METHOD_FUNC(xmp_io_stats), 0);
+  rb_define_singleton_method(mXMPToolkit, "reset_io_stats", RUBY_METHOD_FUNC(xmp_reset_io_stats), 0);
+  rb_define_singleton_method(mXMPToolkit, "error_log_rate", RUBY_METHOD_FUNC(xmp_error_log_rate), 0);
+  rb_define_singleton_method(mXMPToolkit, "error_log_rate=", RUBY_METHOD_FUNC(xmp_set_error_log_rate), 1);
+  rb_define_singleton_method(mXMPToolkit, "native_memory", RUBY_METHOD_FUNC(xmp_native_memory), 0);
+  rb_define_singleton_method(mXMPToolkit, "heap_stats", RUBY_METHOD_FUNC(xmp_heap_stats), 0);
+  rb_define_singleton_method(mXMPToolkit, "trim_heap", RUBY_METHOD_FUNC(xmp_trim_heap), 0);
+  rb_define_singleton_method(mXMPToolkit, "heap_trim_interval", RUBY_METHOD_FUNC(xmp_heap_trim_interval), 0);
+  rb_define_singleton_method(mXMPToolkit, "heap_trim_interval=", RUBY_METHOD_FUNC(xmp_set_heap_trim_interval), 1);
+  rb_define_singleton_method(mXMPToolkit, "worker_threads", RUBY_METHOD_FUNC(xmp_worker_threads), 0);
+  rb_define_singleton_method(mXMPToolkit, "worker_threads=", RUBY_METHOD_FUNC(xmp_set_worker_threads), 1);
 
   VALUE cXMPWrapper = rb_define_class_under(mXmpToolkitRuby, "XmpWrapper", rb_cObject);
 
   rb_define_alloc_func(cXMPWrapper, xmpwrapper_allocate);
   rb_define_method(cXMPWrapper, "open", RUBY_METHOD_FUNC(xmpwrapper_open_file), -1);
+  rb_define_method(cXMPWrapper, "open_cached", RUBY_METHOD_FUNC(xmpwrapper_open_cached), -1);
   rb_define_method(cXMPWrapper, "file_info", RUBY_METHOD_FUNC(xmp_file_info), 0);
   rb_define_method(cXMPWrapper, "packet_info", RUBY_METHOD_FUNC(xmp_packet_info), 0);
+  rb_define_method(cXMPWrapper, "io_stats", RUBY_METHOD_FUNC(xmpwrapper_io_stats), 0);
+  rb_define_method(cXMPWrapper, "warnings", RUBY_METHOD_FUNC(xmpwrapper_warnings), 0);
   rb_define_method(cXMPWrapper, "meta", RUBY_METHOD_FUNC(xmp_meta), 0);
-  rb_define_method(cXMPWrapper, "property", RUBY_METHOD_FUNC(xmpwrapper_get_property), 2);
+  rb_define_method(cXMPWrapper, "property", RUBY_METHOD_FUNC(xmpwrapper_get_property), -1);
   rb_define_method(cXMPWrapper, "localized_property", RUBY_METHOD_FUNC(xmpwrapper_get_localized_text), -1);
   rb_define_method(cXMPWrapper, "update_meta", RUBY_METHOD_FUNC(xmpwrapper_set_meta), -1);
-  rb_define_method(cXMPWrapper, "update_property", RUBY_METHOD_FUNC(xmpwrapper_set_property), 3);
+  rb_define_method(cXMPWrapper, "apply_template", RUBY_METHOD_FUNC(xmpwrapper_apply_template), -1);
+  rb_define_method(cXMPWrapper, "update_property", RUBY_METHOD_FUNC(xmpwrapper_set_property), -1);
   rb_define_method(cXMPWrapper, "update_localized_property", RUBY_METHOD_FUNC(xmpwrapper_update_localized_text), -1);
+  rb_define_method(cXMPWrapper, "array_items", RUBY_METHOD_FUNC(xmpwrapper_get_array_items), -1);
+  rb_define_method(cXMPWrapper, "update_array_items", RUBY_METHOD_FUNC(xmpwrapper_set_array_items), -1);
+  rb_define_method(cXMPWrapper, "catenated_array_items", RUBY_METHOD_FUNC(xmpwrapper_get_catenated_array_items), -1);
+  rb_define_method(cXMPWrapper, "separate_array_items", RUBY_METHOD_FUNC(xmpwrapper_separate_array_items), -1);
+  rb_define_method(cXMPWrapper, "localized_properties", RUBY_METHOD_FUNC(xmpwrapper_get_localized_texts), -1);
   rb_define_method(cXMPWrapper, "write", RUBY_METHOD_FUNC(write_xmp),
                    0);  // close flushes the file until then the data is not guaranteed to be written
+  rb_define_method(cXMPWrapper, "dirty?", RUBY_METHOD_FUNC(xmpwrapper_is_dirty), 0);
   rb_define_method(cXMPWrapper, "close", RUBY_METHOD_FUNC(xmpwrapper_close_file), 0);
+  rb_define_method(cXMPWrapper, "set_progress", RUBY_METHOD_FUNC(xmpwrapper_set_progress), 2);
+  rb_define_method(cXMPWrapper, "timeout=", RUBY_METHOD_FUNC(xmpwrapper_set_timeout), 1);
+  rb_define_method(cXMPWrapper, "cancellation=", RUBY_METHOD_FUNC(xmpwrapper_set_cancellation), 1);
   rb_define_singleton_method(cXMPWrapper, "register_namespace", RUBY_METHOD_FUNC(register_namespace), 2);
+  rb_define_singleton_method(cXMPWrapper, "register_namespaces", RUBY_METHOD_FUNC(register_namespaces), 1);
+  rb_define_singleton_method(cXMPWrapper, "file_mod_date", RUBY_METHOD_FUNC(xmpfiles_file_mod_date), -1);
+  rb_define_singleton_method(cXMPWrapper, "associated_resources", RUBY_METHOD_FUNC(xmpfiles_associated_resources),
+                             -1);
+  rb_define_singleton_method(cXMPWrapper, "metadata_writable?", RUBY_METHOD_FUNC(xmpfiles_is_metadata_writable), -1);
+  rb_define_singleton_method(cXMPWrapper, "check_file_format", RUBY_METHOD_FUNC(xmpfiles_check_file_format), 1);
+  rb_define_singleton_method(cXMPWrapper, "check_package_format", RUBY_METHOD_FUNC(xmpfiles_check_package_format),
+                             1);
+
+  VALUE cCancellationToken = rb_define_class_under(mXmpToolkitRuby, "CancellationToken", rb_cObject);
+
+  rb_define_alloc_func(cCancellationToken, cancellation_token_allocate);
+  rb_define_method(cCancellationToken, "cancel", RUBY_METHOD_FUNC(cancellation_token_cancel), 0);
+  rb_define_method(cCancellationToken, "cancelled?", RUBY_METHOD_FUNC(cancellation_token_is_cancelled), 0);
+
+  VALUE cXmpFuture = rb_define_class_under(mXmpToolkitRuby, "XmpFuture", rb_cObject);
+
+  rb_undef_alloc_func(cXmpFuture);
+  rb_define_singleton_method(cXmpFuture, "read", RUBY_METHOD_FUNC(xmpfuture_read), -1);
+  rb_define_method(cXmpFuture, "ready?", RUBY_METHOD_FUNC(xmpfuture_is_ready), 0);
+  rb_define_method(cXmpFuture, "wait", RUBY_METHOD_FUNC(xmpfuture_wait), -1);
+  rb_define_method(cXmpFuture, "result", RUBY_METHOD_FUNC(xmpfuture_result), 0);
+  rb_define_method(cXmpFuture, "cancel", RUBY_METHOD_FUNC(xmpfuture_cancel), 0);
+  rb_define_method(cXmpFuture, "path", RUBY_METHOD_FUNC(xmpfuture_path), 0);
+
+  VALUE cCompletionQueue = rb_define_class_under(mXmpToolkitRuby, "CompletionQueue", rb_cObject);
+
+  rb_define_alloc_func(cCompletionQueue, completion_queue_allocate);
+  rb_define_method(cCompletionQueue, "pop", RUBY_METHOD_FUNC(completion_queue_pop), -1);
+  rb_define_method(cCompletionQueue, "shift", RUBY_METHOD_FUNC(completion_queue_pop), -1);
+  rb_define_method(cCompletionQueue, "deq", RUBY_METHOD_FUNC(completion_queue_pop), -1);
+  rb_define_method(cCompletionQueue, "size", RUBY_METHOD_FUNC(completion_queue_size), 0);
+  rb_define_method(cCompletionQueue, "length", RUBY_METHOD_FUNC(completion_queue_size), 0);
+  rb_define_method(cCompletionQueue, "empty?", RUBY_METHOD_FUNC(completion_queue_is_empty), 0);
+  rb_define_method(cCompletionQueue, "close", RUBY_METHOD_FUNC(completion_queue_close), 0);
+  rb_define_method(cCompletionQueue, "closed?", RUBY_METHOD_FUNC(completion_queue_is_closed), 0);
+
+  VALUE mMetadataCache = rb_define_module_under(mXmpToolkitRuby, "MetadataCache");
+
+  rb_define_singleton_method(mMetadataCache, "enable", RUBY_METHOD_FUNC(metadata_cache_enable), -1);
+  rb_define_singleton_method(mMetadataCache, "disable", RUBY_METHOD_FUNC(metadata_cache_disable), 0);
+  rb_define_singleton_method(mMetadataCache, "enabled?", RUBY_METHOD_FUNC(metadata_cache_is_enabled), 0);
+  rb_define_singleton_method(mMetadataCache, "clear", RUBY_METHOD_FUNC(metadata_cache_clear), 0);
+  rb_define_singleton_method(mMetadataCache, "stats", RUBY_METHOD_FUNC(metadata_cache_stats), 0);
+
+  VALUE cLineWriter = rb_define_class_under(mXmpToolkitRuby, "LineWriter", rb_cObject);
+
+  rb_define_alloc_func(cLineWriter, line_writer_allocate);
+  rb_define_method(cLineWriter, "initialize", RUBY_METHOD_FUNC(line_writer_initialize), -1);
+  rb_define_method(cLineWriter, "write_line", RUBY_METHOD_FUNC(line_writer_write_line), 1);
+  rb_define_method(cLineWriter, "<<", RUBY_METHOD_FUNC(line_writer_write_line), 1);
+  rb_define_method(cLineWriter, "flush", RUBY_METHOD_FUNC(line_writer_flush), 0);
+  rb_define_method(cLineWriter, "lines", RUBY_METHOD_FUNC(line_writer_lines), 0);
+  rb_define_method(cLineWriter, "close", RUBY_METHOD_FUNC(line_writer_close), 0);
+
+  VALUE cMetadataIndex = rb_define_class_under(mXmpToolkitRuby, "MetadataIndex", rb_cObject);
+
+  rb_define_alloc_func(cMetadataIndex, metadata_index_allocate);
+  rb_define_method(cMetadataIndex, "initialize", RUBY_METHOD_FUNC(metadata_index_initialize), -1);
+  rb_define_method(cMetadataIndex, "[]", RUBY_METHOD_FUNC(metadata_index_get), 1);
+  rb_define_method(cMetadataIndex, "fresh?", RUBY_METHOD_FUNC(metadata_index_is_fresh), 1);
+  rb_define_method(cMetadataIndex, "store", RUBY_METHOD_FUNC(metadata_index_store), 2);
+  rb_define_method(cMetadataIndex, "delete", RUBY_METHOD_FUNC(metadata_index_delete), 1);
+  rb_define_method(cMetadataIndex, "size", RUBY_METHOD_FUNC(metadata_index_size), 0);
+  rb_define_method(cMetadataIndex, "paths", RUBY_METHOD_FUNC(metadata_index_paths), 0);
+  rb_define_method(cMetadataIndex, "stats", RUBY_METHOD_FUNC(metadata_index_stats), 0);
+  rb_define_method(cMetadataIndex, "compact", RUBY_METHOD_FUNC(metadata_index_compact), 0);
+  rb_define_method(cMetadataIndex, "close", RUBY_METHOD_FUNC(metadata_index_close), 0);
+
+  VALUE cXMPPath = rb_define_class_under(mXmpToolkitRuby, "XmpPath", rb_cObject);
+
+  rb_define_alloc_func(cXMPPath, xmppath_allocate);
+  rb_define_method(cXMPPath, "initialize", RUBY_METHOD_FUNC(xmppath_initialize), 2);
+  rb_define_singleton_method(cXMPPath, "parse", RUBY_METHOD_FUNC(xmppath_parse), 1);
+  rb_define_method(cXMPPath, "array_item", RUBY_METHOD_FUNC(xmppath_array_item), 1);
+  rb_define_method(cXMPPath, "struct_field", RUBY_METHOD_FUNC(xmppath_struct_field), 2);
+  rb_define_method(cXMPPath, "qualifier", RUBY_METHOD_FUNC(xmppath_qualifier), 2);
+  rb_define_method(cXMPPath, "lang_selector", RUBY_METHOD_FUNC(xmppath_lang_selector), 1);
+  rb_define_method(cXMPPath, "schema_ns", RUBY_METHOD_FUNC(xmppath_schema_ns), 0);
+  rb_define_method(cXMPPath, "path", RUBY_METHOD_FUNC(xmppath_path), 0);
+  rb_define_method(cXMPPath, "to_s", RUBY_METHOD_FUNC(xmppath_path), 0);
+  rb_define_method(cXMPPath, "inspect", RUBY_METHOD_FUNC(xmppath_inspect), 0);
+
+  VALUE cXMPTemplate = rb_define_class_under(mXmpToolkitRuby, "XmpTemplate", rb_cObject);
+
+  rb_define_alloc_func(cXMPTemplate, xmptemplate_allocate);
+  rb_define_method(cXMPTemplate, "initialize", RUBY_METHOD_FUNC(xmptemplate_initialize), -1);
+  rb_define_method(cXMPTemplate, "flags", RUBY_METHOD_FUNC(xmptemplate_flags), 0);
+  rb_define_method(cXMPTemplate, "source", RUBY_METHOD_FUNC(xmptemplate_source), 0);
 }
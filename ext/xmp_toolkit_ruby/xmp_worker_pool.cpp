@@ -0,0 +1,105 @@
+#include "xmp_worker_pool.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <pthread.h>
+
+struct WorkerPool {
+  std::mutex mutex;
+  std::condition_variable available;
+  std::deque<std::function<void()>> jobs;
+  size_t limit = std::max(2u, std::thread::hardware_concurrency());
+  size_t threads = 0;
+  size_t idle = 0;
+};
+
+// Heap allocated and never freed: detached workers may still wait on it while
+// the process exits, and a forked child replaces it (see reset_after_fork).
+static WorkerPool *pool = nullptr;
+static std::once_flag pool_once;
+
+// The child of a fork has none of the workers, and the mutex may be held by one
+// of them; the old pool is abandoned rather than touched.
+static void reset_after_fork() {
+  size_t limit = pool->limit;
+  pool = new WorkerPool();
+  pool->limit = limit;
+}
+
+static WorkerPool *worker_pool() {
+  std::call_once(pool_once, []() {
+    pool = new WorkerPool();
+    pthread_atfork(nullptr, nullptr, reset_after_fork);
+  });
+  return pool;
+}
+
+static void worker_main(WorkerPool *self) {
+  std::unique_lock<std::mutex> lock(self->mutex);
+
+  for (;;) {
+    self->idle++;
+    self->available.wait(lock, [self]() { return !self->jobs.empty() || self->threads > self->limit; });
+    self->idle--;
+
+    if (self->jobs.empty()) {
+      self->threads--;
+      return;
+    }
+
+    std::function<void()> job = std::move(self->jobs.front());
+    self->jobs.pop_front();
+
+    lock.unlock();
+    try {
+      job();
+    } catch (...) {
+      // Jobs report their own errors; one that escapes must not end the process
+    }
+    lock.lock();
+  }
+}
+
+bool worker_pool_submit(std::function<void()> job) {
+  WorkerPool *self = worker_pool();
+  std::lock_guard<std::mutex> guard(self->mutex);
+
+  self->jobs.push_back(std::move(job));
+  if (self->idle >= self->jobs.size() || self->threads >= self->limit) {
+    self->available.notify_one();
+    return true;
+  }
+
+  try {
+    std::thread(worker_main, self).detach();
+    self->threads++;
+  } catch (const std::system_error &) {
+    // Out of threads: the job waits for a running worker, or goes back to the
+    // caller if there is none, as nothing may ever come to take it
+    if (self->threads == 0) {
+      self->jobs.pop_back();
+      return false;
+    }
+    self->available.notify_one();
+  }
+  return true;
+}
+
+size_t worker_pool_limit() {
+  WorkerPool *self = worker_pool();
+  std::lock_guard<std::mutex> guard(self->mutex);
+  return self->limit;
+}
+
+void worker_pool_set_limit(size_t limit) {
+  WorkerPool *self = worker_pool();
+  std::lock_guard<std::mutex> guard(self->mutex);
+
+  self->limit = std::max<size_t>(limit, 1);
+  self->available.notify_all();
+}
@@ -0,0 +1,22 @@
+#ifndef XMP_WORKER_POOL_HPP
+#define XMP_WORKER_POOL_HPP
+
+#include <cstddef>
+#include <functional>
+
+// Native threads that run SDK calls on behalf of Ruby threads that must not
+// block on them, like the reactor thread of a Fiber.scheduler. Jobs run outside
+// Ruby and must not touch Ruby objects. Threads are started on demand up to the
+// limit and then kept for later jobs; jobs beyond the limit wait in FIFO order.
+
+// Queues job; it runs on a worker thread as soon as one is free. Returns false,
+// with job dropped, if no thread could be started and none runs to take it.
+bool worker_pool_submit(std::function<void()> job);
+
+// Most threads the pool runs at the same time, by default the number of CPUs
+size_t worker_pool_limit();
+
+// Lowering the limit retires idle threads; busy ones finish their job first.
+void worker_pool_set_limit(size_t limit);
+
+#endif
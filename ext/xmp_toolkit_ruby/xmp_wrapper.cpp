@@ -1,21 +1,54 @@
 #include "xmp_toolkit.hpp"
+#include "xmp_fiber_offload.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_path.hpp"
+#include "xmp_probes.hpp"
+#include "xmp_sdk_ops.hpp"
+#include "xmp_stats.hpp"
+#include "xmp_template.hpp"
 #include "xmp_wrapper.hpp"
 
+#include <cstring>
 #include <mutex>
+#include <utility>
+#include <vector>
 
-static size_t xmpwrapper_memsize(const void *ptr) { return sizeof(XMPWrapper); }
+static size_t xmpwrapper_memsize(const void *ptr) {
+  const XMPWrapper *wrapper = static_cast<const XMPWrapper *>(ptr);
+  return sizeof(XMPWrapper) + wrapper->memory.total();
+}
 
 static void check_wrapper_initialized(XMPWrapper *wrapper) {
+  // Cache hits have no file and create xmpMeta only once a getter needs the parsed tree
+  if (wrapper->cached && wrapper->xmpPacket != nullptr) {
+    return;
+  }
+
   if (wrapper->xmpFile == nullptr || wrapper->xmpMeta == nullptr || wrapper->xmpPacket == nullptr) {
     rb_raise(rb_eRuntimeError, "XMP file or metadata not initialized or file not opened");
   }
 }
 
-static void clean_wrapper(XMPWrapper *wrapper) {
+// closeFile is false once close already tried CloseFile: after a cancelled
+// update the file is dropped without writing it.
+static void clean_wrapper(XMPWrapper *wrapper, bool closeFile = true) {
   if (wrapper->xmpFile) {
-    wrapper->xmpFile->CloseFile();
+    if (closeFile) {
+      wrapper->xmpFile->CloseFile();
+    }
     delete wrapper->xmpFile;
     wrapper->xmpFile = nullptr;
+
+    // CloseFile did the last writes, so the counters are complete once the I/O is gone
+    if (wrapper->fileIO) {
+      wrapper->fileIO.reset();
+      io_accounting_add(wrapper->format, wrapper->openFlags, *wrapper->ioCounters);
+    }
+
+    // CloseFile is where the SDK rewrites the file, so cached versions of it are dropped here
+    if (wrapper->hasFileIdentity && (wrapper->openFlags & kXMPFiles_OpenForUpdate)) {
+      metadata_cache_invalidate(wrapper->fileIdentity);
+    }
   }
   if (wrapper->xmpMeta) {
     delete wrapper->xmpMeta;
@@ -27,6 +60,34 @@ static void clean_wrapper(XMPWrapper *wrapper) {
   }
 
   wrapper->xmpMetaDataLoaded = false;
+  wrapper->dirty = false;
+  wrapper->cached.reset();
+  wrapper->hasFileIdentity = false;
+  wrapper->format = kXMP_UnknownFile;
+  wrapper->filePath.clear();
+  native_memory_update(&wrapper->memory, NativeMemory());
+}
+
+// Re-estimates the native memory of the wrapper after its tree was parsed or
+// written. A growth may run the GC, so this comes last, once the wrapper is consistent.
+static void update_native_memory(XMPWrapper *wrapper) {
+  NativeMemory next;
+  if (wrapper->xmpMeta && wrapper->xmpMetaDataLoaded) {
+    next.meta = meta_memory_estimate(*wrapper->xmpMeta);
+  }
+  if (wrapper->xmpFile) {
+    next.file = kOpenFileBytes;
+    if (wrapper->xmpMetaDataLoaded && wrapper->xmpPacket->length > 0) {
+      next.file += next.meta + wrapper->xmpPacket->length;
+    }
+  }
+
+  native_memory_update(&wrapper->memory, next);
+}
+
+static void xmpwrapper_mark(void *ptr) {
+  XMPWrapper *wrapper = static_cast<XMPWrapper *>(ptr);
+  operation_control_mark(wrapper->control);
 }
 
 static void xmpwrapper_free(void *ptr) {
@@ -40,7 +101,7 @@ static void xmpwrapper_free(void *ptr) {
 
 static const rb_data_type_t xmpwrapper_data_type = {"XMPWrapper",
                                                     {
-                                                        0,
+                                                        xmpwrapper_mark,
                                                         xmpwrapper_free,
                                                         xmpwrapper_memsize,
                                                     },
@@ -55,9 +116,178 @@ xmpwrapper_allocate(VALUE klass) {
   wrapper->xmpFile = nullptr;
   wrapper->xmpPacket = nullptr;
   wrapper->xmpMetaDataLoaded = false;
+  wrapper->dirty = false;
+  wrapper->openFlags = 0;
+  wrapper->format = kXMP_UnknownFile;
+  wrapper->hasFileIdentity = false;
+  wrapper->busy = false;
   return TypedData_Wrap_Struct(klass, &xmpwrapper_data_type, wrapper);
 }
 
+// Runs body(wrapper) with the wrapper marked busy for its whole duration. SDK
+// calls run without the GVL, under a Fiber.scheduler on a worker thread, and
+// progress callables, stats hooks and Warning.warn run Ruby code in between;
+// another thread or fiber, or such a callback, using the same XmpFile meanwhile
+// raises BusyError instead of closing or changing what the call still uses.
+template <typename Body> static VALUE with_wrapper(VALUE self, Body body) {
+  XMPWrapper *wrapper;
+  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
+
+  if (wrapper->busy) {
+    VALUE mXmpToolkitRuby = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
+    rb_raise(rb_const_get(mXmpToolkitRuby, rb_intern("BusyError")), "XmpFile is in use by another operation");
+  }
+
+  struct Call {
+    Body *body;
+    XMPWrapper *wrapper;
+  } call{&body, wrapper};
+
+  wrapper->busy = true;
+  return rb_ensure(
+      [](VALUE arg) -> VALUE {
+        Call *call = reinterpret_cast<Call *>(arg);
+        return (*call->body)(call->wrapper);
+      },
+      reinterpret_cast<VALUE>(&call),
+      [](VALUE arg) -> VALUE {
+        reinterpret_cast<XMPWrapper *>(arg)->busy = false;
+        return Qnil;
+      },
+      reinterpret_cast<VALUE>(wrapper));
+}
+
+// Runs an SDK call on the wrapper's file without the GVL, with its progress
+// callable, timeout and cancellation token in effect. Under a Fiber.scheduler
+// the call runs on a worker thread while the fiber yields. Errors the handler
+// reports about the packet go to the wrapper's log too. Returns fn's result; the
+// caller checks wrapper->control.reason, cleans up, calls error_log_report
+// (Warning.warn may raise) and then operation_raise.
+template <typename Fn> static bool run_operation(XMPWrapper *wrapper, Fn call, ErrorText *failure) {
+  OperationControl *control = &wrapper->control;
+  std::string error;
+  ErrorLog *log = &wrapper->errors;
+  auto fn = [&call, log]() {
+    ErrorLogScope scope(log);
+    return call();
+  };
+
+  if (!operation_begin(control)) {
+    operation_end(control);
+    return false;
+  }
+
+  bool ok;
+  rb_unblock_function_t *ubf = operation_cancellable(*control) ? operation_unblock : nullptr;
+  if (NIL_P(control->progress) && fiber_scheduler_active()) {
+    // The progress proc needs a Ruby thread, so only calls without one leave it
+    int state = 0;
+    VALUE raised = Qnil;
+    ok = call_offloaded(fn, &error, ubf, control, &state, &raised);
+    if (state) {
+      // The fiber was stopped: raised by operation_raise once the caller cleaned up
+      control->interrupted.store(true, std::memory_order_relaxed);
+      control->error = raised;
+      if (RB_SPECIAL_CONST_P(raised) || RB_BUILTIN_TYPE(raised) != T_OBJECT) {
+        control->jumpTag = state;
+      }
+    }
+  } else {
+    ok = ubf ? call_without_gvl(fn, &error, ubf, control) : call_without_gvl(fn, &error);
+  }
+  operation_end(control);
+  if (!error.empty()) {
+    failure->set(error);
+  }
+
+  return ok;
+}
+
+// Resolves the property a getter/setter addresses. argv either starts with an
+// XmpPath or with a namespace URI followed by a property name; returns the
+// number of arguments consumed.
+static int scan_property_ref(int argc, VALUE *argv, const char **ns, const char **prop) {
+  if (argc >= 1) {
+    const XMPPath *path = xmppath_get(argv[0]);
+    if (path != nullptr) {
+      *ns = path->schemaNS.c_str();
+      *prop = path->propPath.c_str();
+      return 1;
+    }
+  }
+
+  if (argc < 2) {
+    rb_raise(rb_eArgError, "expected an XmpPath or a namespace URI and a property name");
+  }
+
+  Check_Type(argv[0], T_STRING);
+  Check_Type(argv[1], T_STRING);
+
+  *ns = StringValueCStr(argv[0]);
+  *prop = StringValueCStr(argv[1]);
+  return 2;
+}
+
+// Alt-text methods take keywords; an optional leading XmpPath replaces the
+// schema_ns: and alt_text_name: keywords.
+static void scan_alt_text_ref(VALUE rb_path, VALUE *kw_values, const char **ns, const char **alt_text_name) {
+  if (!NIL_P(rb_path)) {
+    const XMPPath *path = xmppath_get(rb_path);
+    if (path == nullptr) {
+      rb_raise(rb_eTypeError, "expected an XmpPath");
+    }
+    *ns = path->schemaNS.c_str();
+    *alt_text_name = path->propPath.c_str();
+    return;
+  }
+
+  *ns = StringValueCStr(kw_values[0]);
+  *alt_text_name = StringValueCStr(kw_values[1]);
+}
+
+// Stores what a read-only open just read in the metadata cache, unless the
+// file changed while it was being read.
+static void store_in_metadata_cache(XMPWrapper *wrapper) {
+  if (!wrapper->hasFileIdentity || (wrapper->openFlags & kXMPFiles_OpenForUpdate) || !metadata_cache_enabled()) {
+    return;
+  }
+
+  metadata_cache_count_miss();
+
+  auto packet = std::make_shared<CachedPacket>();
+  packet->requestFlags = wrapper->openFlags;
+  packet->packetInfo = *wrapper->xmpPacket;
+
+  try {
+    if (!wrapper->xmpFile->GetFileInfo(0, &packet->openFlags, &packet->format, &packet->handlerFlags)) {
+      return;
+    }
+  } catch (const XMP_Error &) {
+    return;
+  }
+
+  XMP_PROBE_START(serialize, wrapper->filePath.c_str(), wrapper->format);
+  StatsTimer timer(kStatsSerialize);
+  bool ok = true;
+  try {
+    wrapper->xmpMeta->SerializeToBuffer(&packet->serialized);
+  } catch (const XMP_Error &) {
+    ok = false;
+  }
+  timer.stop(wrapper->format, stats_strategy(wrapper->openFlags), ok);
+  XMP_PROBE_DONE(serialize, wrapper->filePath.c_str(), wrapper->format, packet->serialized.size(), ok);
+  if (!ok) {
+    return;  // Not cacheable; the caller still has the metadata it asked for
+  }
+
+  FileIdentity current;
+  if (!file_identity(wrapper->filePath.c_str(), &current) || current != wrapper->fileIdentity) {
+    return;
+  }
+
+  metadata_cache_store(wrapper->fileIdentity, std::move(packet));
+}
+
 static void get_xmp(XMPWrapper *wrapper) {
   if (wrapper->xmpMetaDataLoaded) {
     return;
@@ -65,24 +295,129 @@ static void get_xmp(XMPWrapper *wrapper) {
 
   check_wrapper_initialized(wrapper);
 
-  bool ok = wrapper->xmpFile->GetXMP(wrapper->xmpMeta, 0, wrapper->xmpPacket);
+  if (wrapper->cached) {
+    ensure_sdk_initialized();
 
-  if (!ok) {
+    if (wrapper->xmpMeta == nullptr) {
+      wrapper->xmpMeta = new SXMPMeta();
+      wrapper->xmpMeta->SetErrorCallback(error_log_meta_callback, &wrapper->errors, 0);
+    }
+
+    XMP_PROBE_START(parse, wrapper->filePath.c_str(), wrapper->format);
+    ErrorText error;
+    {
+      StatsTimer timer(kStatsParse);
+      try {
+        parse_xmp_buffer(wrapper->xmpMeta, wrapper->cached->serialized.data(), wrapper->cached->serialized.size());
+      } catch (const XMP_Error &e) {
+        error.set(e.GetErrMsg());
+      }
+      timer.stop(wrapper->format, kStatsNoStrategy, error.empty());
+    }
+    XMP_PROBE_DONE(parse, wrapper->filePath.c_str(), wrapper->format, wrapper->cached->serialized.size(),
+                   error.empty());
+    error_log_report(&wrapper->errors);
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    wrapper->xmpMetaDataLoaded = true;
+    update_native_memory(wrapper);
+    return;
+  }
+
+  SXMPFiles *file = wrapper->xmpFile;
+  SXMPMeta *meta = wrapper->xmpMeta;
+  XMP_PacketInfo *packet = wrapper->xmpPacket;
+  ErrorText error;
+  bool ok;
+  bool aborted;
+  XMP_PROBE_START(get_xmp, wrapper->filePath.c_str(), wrapper->format);
+  {
+    StatsTimer timer(kStatsGetXMP);
+    ok = run_operation(wrapper, [=]() { return file->GetXMP(meta, 0, packet); }, &error);
+    aborted = wrapper->control.reason != kOperationNotAborted;
+    timer.stop(wrapper->format, stats_strategy(wrapper->openFlags), error.empty() && ok && !aborted);
+  }
+  XMP_PROBE_DONE(get_xmp, wrapper->filePath.c_str(), wrapper->format, ok ? packet->length : 0,
+                 error.empty() && ok && !aborted);
+
+  if (aborted || !error.empty() || !ok) {
     clean_wrapper(wrapper);
+    error_log_report(&wrapper->errors);
+    operation_raise(&wrapper->control);
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
     rb_raise(rb_eRuntimeError, "Failed to get XMP metadata");
   }
 
   wrapper->xmpMetaDataLoaded = true;
+  if (wrapper->fileIO) {
+    wrapper->ioCounters->packetBytes.store(packet->length > 0 ? packet->length : 0, std::memory_order_relaxed);
+  }
+
+  store_in_metadata_cache(wrapper);
+  update_native_memory(wrapper);
+  error_log_report(&wrapper->errors);
 }
 
-VALUE
-xmpwrapper_open_file(int argc, VALUE *argv, VALUE self) {
-  ensure_sdk_initialized();
+// Runs fn, which reads (get) or changes (set) xmpMeta and returns the bytes of
+// the value it moved, between the get or set USDT probes. fn must not raise; an
+// SDK error ends up in *error and the done probe reports it.
+template <typename Fn> static void probe_tree_access(XMPWrapper *wrapper, bool change, ErrorText *error, Fn fn) {
+  int64_t bytes = 0;
 
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
+  if (change) {
+    XMP_PROBE_START(set, wrapper->filePath.c_str(), wrapper->format);
+  } else {
+    XMP_PROBE_START(get, wrapper->filePath.c_str(), wrapper->format);
+  }
+  try {
+    bytes = fn();
+  } catch (const XMP_Error &e) {
+    error->set(e.GetErrMsg());
+  } catch (...) {
+    error->set("unknown error");
+  }
+  if (change) {
+    XMP_PROBE_DONE(set, wrapper->filePath.c_str(), wrapper->format, bytes, error->empty());
+  } else {
+    XMP_PROBE_DONE(get, wrapper->filePath.c_str(), wrapper->format, bytes, error->empty());
+  }
+}
 
-  if (wrapper->xmpFile != nullptr) {
+// Called last by the property setters. A tree that changed since it was read
+// has a new size, which is reported to the GC (see update_native_memory).
+static void mark_dirty_if_changed(XMPWrapper *wrapper, const std::string &before, const char *ns, const char *prop) {
+  if (!wrapper->dirty && !meta_matches_fingerprint(*wrapper->xmpMeta, ns, prop, before)) {
+    wrapper->dirty = true;
+  }
+  if (wrapper->dirty) {
+    update_native_memory(wrapper);
+  }
+}
+
+// probe_tree_access for fn changing the subtree at ns/prop, followed by
+// mark_dirty_if_changed, also when fn failed part way. The fingerprint lives in
+// this frame only, so the caller can raise the error right after.
+template <typename Fn>
+static void change_tree(XMPWrapper *wrapper, const char *ns, const char *prop, ErrorText *error, Fn fn) {
+  std::string before;
+  bool fingerprinted = false;
+  probe_tree_access(wrapper, true, error, [&]() {
+    before = meta_fingerprint(*wrapper->xmpMeta, ns, prop);
+    fingerprinted = true;
+    return fn();
+  });
+  if (fingerprinted) {
+    mark_dirty_if_changed(wrapper, before, ns, prop);
+  }
+}
+
+// Shared argument handling of open and open_cached. Returns the requested open flags.
+static XMP_OptionBits scan_open_args(int argc, VALUE *argv, XMPWrapper *wrapper, const char **filename) {
+  if (wrapper->xmpFile != nullptr || wrapper->cached) {
     rb_raise(rb_eRuntimeError, "File already opened");
   }
 
@@ -90,185 +425,380 @@ xmpwrapper_open_file(int argc, VALUE *argv, VALUE self) {
   VALUE rb_opts_mask = Qnil;
   rb_scan_args(argc, argv, "11", &rb_filename, &rb_opts_mask);
 
-  const char *filename = StringValueCStr(rb_filename);
-
-  // Allocate native objects
-  wrapper->xmpMeta = new SXMPMeta();
-  wrapper->xmpFile = new SXMPFiles();
-  wrapper->xmpPacket = new XMP_PacketInfo();
-
-  XMP_OptionBits opts;
+  *filename = StringValueCStr(rb_filename);
+  error_log_reset(&wrapper->errors, *filename);
 
   if (!NIL_P(rb_opts_mask)) {
     Check_Type(rb_opts_mask, T_FIXNUM);
-    opts = NUM2UINT(rb_opts_mask);
-  } else {
-    opts = kXMPFiles_OpenForRead | kXMPFiles_OpenUseSmartHandler;
+    return NUM2UINT(rb_opts_mask);
   }
 
-  bool ok = wrapper->xmpFile->OpenFile(filename, kXMP_UnknownFile, opts);
-  if (!ok) {
-    clean_wrapper(wrapper);
-    rb_raise(rb_eIOError, "Failed to open file %s, try open_use_packet_scanning instead of open_use_smart_handler",
-             filename);
+  return kXMPFiles_OpenForRead | kXMPFiles_OpenUseSmartHandler;
+}
+
+// Serves a read-only open from the metadata cache without touching the file or the SDK.
+static bool open_from_metadata_cache(XMPWrapper *wrapper, const char *filename, XMP_OptionBits opts) {
+  wrapper->filePath = filename;
+  wrapper->openFlags = opts;
+  wrapper->hasFileIdentity = file_identity(filename, &wrapper->fileIdentity);
+
+  if (!wrapper->hasFileIdentity || (opts & kXMPFiles_OpenForUpdate)) {
+    return false;
   }
 
-  return Qtrue;
+  wrapper->cached = metadata_cache_lookup(wrapper->fileIdentity, opts);
+  if (!wrapper->cached) {
+    return false;
+  }
+
+  wrapper->format = wrapper->cached->format;
+
+  wrapper->xmpPacket = new XMP_PacketInfo(wrapper->cached->packetInfo);
+  return true;
 }
 
+// open_cached(filename, opts = nil)
+// Like open, but only succeeds on a metadata cache hit. Returns false (and
+// leaves the wrapper closed) otherwise, so callers can skip SDK initialization.
 VALUE
-xmp_file_info(VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
+xmpwrapper_open_cached(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    const char *filename;
+    XMP_OptionBits opts = scan_open_args(argc, argv, wrapper, &filename);
+
+    if (open_from_metadata_cache(wrapper, filename, opts)) {
+      return Qtrue;
+    }
 
-  XMP_FileFormat format;
-  XMP_OptionBits openFlags, handlerFlags;
-  bool ok = wrapper->xmpFile->GetFileInfo(0, &openFlags, &format, &handlerFlags);
-  if (!ok) {
     clean_wrapper(wrapper);
-    rb_raise(rb_eRuntimeError, "Failed to get file info");
-    return Qnil;
-  }
+    return Qfalse;
+  });
+}
+
+VALUE
+xmpwrapper_open_file(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    const char *filename;
+    XMP_OptionBits opts = scan_open_args(argc, argv, wrapper, &filename);
+
+    // Warm read-only opens are served from the metadata cache without touching the file
+    if (open_from_metadata_cache(wrapper, filename, opts)) {
+      return Qtrue;
+    }
+
+    ensure_sdk_initialized();
+
+    // Allocate native objects
+    wrapper->xmpMeta = new SXMPMeta();
+    wrapper->xmpFile = new SXMPFiles();
+    wrapper->xmpPacket = new XMP_PacketInfo();
+    operation_control_attach(&wrapper->control, wrapper->xmpFile);
+
+    // Recoverable errors (damaged packets, unknown handlers) go to XmpFile#warnings
+    wrapper->xmpMeta->SetErrorCallback(error_log_meta_callback, &wrapper->errors, 0);
+    wrapper->xmpFile->SetErrorCallback(error_log_file_callback, &wrapper->errors, 0);
+
+    // With I/O accounting the file is opened through a counting XMP_IO. Handlers that
+    // need the path itself (folder based formats, plugins) refuse client I/O, so
+    // those files are opened by path as before, without counters.
+    wrapper->ioCounters.reset();
+    if (io_accounting_enabled()) {
+      auto counters = std::make_shared<IOCounters>();
+      wrapper->fileIO = counting_file_io(filename, opts & kXMPFiles_OpenForUpdate, counters);
+      if (wrapper->fileIO) {
+        wrapper->ioCounters = std::move(counters);
+      }
+    }
+
+    // Handler selection and packet scanning are file I/O; other threads may run meanwhile
+    SXMPFiles *file = wrapper->xmpFile;
+    XMP_IO *clientIO = wrapper->fileIO.get();
+    bool openedByIO = false;
+    ErrorText error;
+    bool ok;
+    bool aborted;
+    XMP_PROBE_START(open, filename, kXMP_UnknownFile);
+    {
+      std::string path = filename;
+      StatsTimer timer(kStatsOpen);
+      ok = run_operation(
+          wrapper,
+          [file, clientIO, &openedByIO, &path, opts]() {
+            if (clientIO != nullptr) {
+              try {
+                openedByIO = file->OpenFile(clientIO, kXMP_UnknownFile, opts);
+              } catch (const XMP_Error &) {
+                openedByIO = false;
+              }
+              if (openedByIO) {
+                return true;
+              }
+            }
+            return file->OpenFile(path.c_str(), kXMP_UnknownFile, opts);
+          },
+          &error);
+      if (!openedByIO) {
+        wrapper->fileIO.reset();
+        wrapper->ioCounters.reset();
+      }
+      aborted = wrapper->control.reason != kOperationNotAborted;
+      if (ok && error.empty() && !aborted) {
+        file->GetFileInfo(0, 0, &wrapper->format, 0);
+      }
+      timer.stop(wrapper->format, stats_strategy(opts), ok && error.empty() && !aborted);
+    }
+    XMP_PROBE_DONE(open, filename, wrapper->format, wrapper->hasFileIdentity ? wrapper->fileIdentity.size : -1,
+                   ok && error.empty() && !aborted);
+    if (aborted || !error.empty() || !ok) {
+      clean_wrapper(wrapper);
+      error_log_report(&wrapper->errors);
+      // Not an IOError, so XmpFile#open doesn't retry with its fallback flags
+      operation_raise(&wrapper->control);
+      // An IOError lets XmpFile#open retry with its fallback flags
+      if (!error.empty()) {
+        rb_raise(rb_eIOError, "Failed to open file %s: %s", filename, error.c_str());
+      }
+      rb_raise(rb_eIOError, "Failed to open file %s, try open_use_packet_scanning instead of open_use_smart_handler",
+               filename);
+    }
+
+    // What the open logged is reported by the next call, so a raising Warning.warn never
+    // leaves an open file behind that XmpFile doesn't know about
+    update_native_memory(wrapper);
+    return Qtrue;
+  });
+}
 
-  VALUE result = rb_hash_new();
+VALUE
+xmp_file_info(VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    XMP_FileFormat format;
+    XMP_OptionBits openFlags, handlerFlags;
+    bool ok = true;
+    if (wrapper->cached) {
+      format = wrapper->cached->format;
+      openFlags = wrapper->cached->openFlags;
+      handlerFlags = wrapper->cached->handlerFlags;
+    } else {
+      XMP_PROBE_START(file_info, wrapper->filePath.c_str(), wrapper->format);
+      ok = wrapper->xmpFile->GetFileInfo(0, &openFlags, &format, &handlerFlags);
+      XMP_PROBE_DONE(file_info, wrapper->filePath.c_str(), wrapper->format, 0, ok);
+    }
+    if (!ok) {
+      clean_wrapper(wrapper);
+      rb_raise(rb_eRuntimeError, "Failed to get file info");
+      return Qnil;
+    }
+
+    VALUE result = rb_hash_new();
 
-  rb_hash_aset(result, rb_str_new_cstr("format"), UINT2NUM(format));
-  rb_hash_aset(result, rb_str_new_cstr("handler_flags"), UINT2NUM(handlerFlags));
-  rb_hash_aset(result, rb_str_new_cstr("open_flags"), UINT2NUM(openFlags));
+    rb_hash_aset(result, rb_str_new_cstr("format"), UINT2NUM(format));
+    rb_hash_aset(result, rb_str_new_cstr("handler_flags"), UINT2NUM(handlerFlags));
+    rb_hash_aset(result, rb_str_new_cstr("open_flags"), UINT2NUM(openFlags));
 
-  return result;
+    return result;
+  });
 }
 
 VALUE xmp_packet_info(VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  get_xmp(wrapper);
+    // A cache hit already carries the packet info; no need to parse the packet for it
+    if (!wrapper->cached) {
+      get_xmp(wrapper);
+    }
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
-  }
+    if (!wrapper->xmpMetaDataLoaded && !wrapper->cached) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
 
-  VALUE result = rb_hash_new();
+    VALUE result = rb_hash_new();
 
-  rb_hash_aset(result, rb_str_new_cstr("offset"), LONG2NUM(wrapper->xmpPacket->offset));
-  rb_hash_aset(result, rb_str_new_cstr("length"), LONG2NUM(wrapper->xmpPacket->length));
-  rb_hash_aset(result, rb_str_new_cstr("pad_size"), LONG2NUM(wrapper->xmpPacket->padSize));
+    rb_hash_aset(result, rb_str_new_cstr("offset"), LONG2NUM(wrapper->xmpPacket->offset));
+    rb_hash_aset(result, rb_str_new_cstr("length"), LONG2NUM(wrapper->xmpPacket->length));
+    rb_hash_aset(result, rb_str_new_cstr("pad_size"), LONG2NUM(wrapper->xmpPacket->padSize));
 
-  rb_hash_aset(result, rb_str_new_cstr("char_form"), UINT2NUM(wrapper->xmpPacket->charForm));
-  rb_hash_aset(result, rb_str_new_cstr("writeable"), wrapper->xmpPacket->writeable ? Qtrue : Qfalse);
-  rb_hash_aset(result, rb_str_new_cstr("has_wrapper"), wrapper->xmpPacket->hasWrapper ? Qtrue : Qfalse);
-  rb_hash_aset(result, rb_str_new_cstr("pad"), UINT2NUM(wrapper->xmpPacket->pad));
+    rb_hash_aset(result, rb_str_new_cstr("char_form"), UINT2NUM(wrapper->xmpPacket->charForm));
+    rb_hash_aset(result, rb_str_new_cstr("writeable"), wrapper->xmpPacket->writeable ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new_cstr("has_wrapper"), wrapper->xmpPacket->hasWrapper ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new_cstr("pad"), UINT2NUM(wrapper->xmpPacket->pad));
 
-  return result;
+    if (wrapper->ioCounters) {
+      rb_hash_aset(result, rb_str_new_cstr("io"), io_counters_hash(*wrapper->ioCounters));
+    }
+
+    return result;
+  });
 }
 
+// io_stats
+// I/O counters of the file opened last, also after close (which is when an
+// update is written), or nil if it was not opened with XmpToolkit.io_accounting.
 VALUE
-xmp_meta(VALUE self) {
+xmpwrapper_io_stats(VALUE self) {
   XMPWrapper *wrapper;
   TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
-
-  get_xmp(wrapper);
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+  if (!wrapper->ioCounters) {
+    return Qnil;
   }
 
-  std::string xmpString;
-  wrapper->xmpMeta->SerializeToBuffer(&xmpString);
-
-  VALUE rb_xmp_data = rb_str_new_cstr(xmpString.c_str());
-
-  return rb_xmp_data;
+  return io_counters_hash(*wrapper->ioCounters);
 }
 
+// warnings
+// Errors the SDK reported for the file opened last, also after close: up to
+// kErrorLogCapacity hashes with "severity", "cause", "path" and "message".
 VALUE
-xmpwrapper_get_property(VALUE self, VALUE rb_ns, VALUE rb_prop) {
+xmpwrapper_warnings(VALUE self) {
   XMPWrapper *wrapper;
   TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
 
-  Check_Type(rb_ns, T_STRING);
-  Check_Type(rb_prop, T_STRING);
+  return error_log_array(&wrapper->errors);
+}
+
+VALUE
+xmp_meta(VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  get_xmp(wrapper);
+    if (wrapper->cached && !wrapper->dirty) {
+      return rb_str_new(wrapper->cached->serialized.data(), wrapper->cached->serialized.size());
+    }
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
-  }
+    get_xmp(wrapper);
 
-  const char *ns = StringValueCStr(rb_ns);
-  const char *prop = StringValueCStr(rb_prop);
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
 
-  std::string property_value;
-  XMP_OptionBits options;
-  bool property_exists = wrapper->xmpMeta->GetProperty(ns, prop, &property_value, &options);
+    std::string xmpString;
+    XMP_PROBE_START(serialize, wrapper->filePath.c_str(), wrapper->format);
+    StatsTimer timer(kStatsSerialize);
+    wrapper->xmpMeta->SerializeToBuffer(&xmpString);
+    timer.stop(wrapper->format, stats_strategy(wrapper->openFlags));
+    XMP_PROBE_DONE(serialize, wrapper->filePath.c_str(), wrapper->format, xmpString.size(), true);
 
-  VALUE result = rb_hash_new();
-  rb_hash_aset(result, rb_str_new_cstr("options"), UINT2NUM(options));
-  rb_hash_aset(result, rb_str_new_cstr("exists"), property_exists ? Qtrue : Qfalse);
-  rb_hash_aset(result, rb_str_new_cstr("value"), rb_str_new_cstr(property_value.c_str()));
+    VALUE rb_xmp_data = rb_str_new_cstr(xmpString.c_str());
 
-  return result;
+    return rb_xmp_data;
+  });
 }
 
 VALUE
-xmpwrapper_get_localized_text(int argc, VALUE *argv, VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
-
-  get_xmp(wrapper);
+xmpwrapper_get_property(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
-  }
-
-  VALUE kwargs;
-  rb_scan_args(argc, argv, ":", &kwargs);
+    const char *ns;
+    const char *prop;
+    int consumed = scan_property_ref(argc, argv, &ns, &prop);
+    rb_check_arity(argc - consumed, 0, 0);
 
-  // Define allowed keywords
-  ID kw_table[4];
+    get_xmp(wrapper);
 
-  kw_table[0] = rb_intern("schema_ns");
-  kw_table[1] = rb_intern("alt_text_name");
-  kw_table[2] = rb_intern("generic_lang");
-  kw_table[3] = rb_intern("specific_lang");
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
 
-  VALUE kw_values[4];
-  kw_values[2] = rb_str_new_cstr("");  // Default for generic_lang
+    XMP_OptionBits options = 0;
+    bool property_exists = false;
+    VALUE rb_value = Qnil;
+    ErrorText error;
+    {
+      std::string property_value;
+      probe_tree_access(wrapper, false, &error, [&]() {
+        property_exists = wrapper->xmpMeta->GetProperty(ns, prop, &property_value, &options);
+        return property_value.size();
+      });
+      rb_value = rb_str_new_cstr(property_value.c_str());
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  rb_get_kwargs(kwargs, kw_table, 3, 1, kw_values);
+    VALUE result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new_cstr("options"), UINT2NUM(options));
+    rb_hash_aset(result, rb_str_new_cstr("exists"), property_exists ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new_cstr("value"), rb_value);
 
-  VALUE schema_ns = kw_values[0];
-  VALUE alt_text_name = kw_values[1];
-  VALUE generic_lang = kw_values[2];  // Will be default if not provided
-  VALUE specific_lang = kw_values[3];
+    return result;
+  });
+}
 
-  if (NIL_P(generic_lang)) generic_lang = rb_str_new_cstr("");
+VALUE
+xmpwrapper_get_localized_text(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  const char *c_schema_ns = StringValueCStr(schema_ns);
-  const char *c_alt_text_name = StringValueCStr(alt_text_name);
-  const char *c_generic_lang = StringValueCStr(generic_lang);
-  const char *c_specific_lang = StringValueCStr(specific_lang);
+    get_xmp(wrapper);
 
-  std::string actual_lang;
-  std::string item_value;
-  XMP_OptionBits options;
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
 
-  bool array_items_exists = wrapper->xmpMeta->GetLocalizedText(c_schema_ns, c_alt_text_name, c_generic_lang,
-                                                               c_specific_lang, &actual_lang, &item_value, &options);
+    VALUE rb_path, kwargs;
+    rb_scan_args(argc, argv, "01:", &rb_path, &kwargs);
+
+    // Define allowed keywords
+    ID kw_table[4];
+
+    kw_table[0] = rb_intern("schema_ns");
+    kw_table[1] = rb_intern("alt_text_name");
+    kw_table[2] = rb_intern("generic_lang");
+    kw_table[3] = rb_intern("specific_lang");
+
+    VALUE kw_values[4];
+    kw_values[2] = rb_str_new_cstr("");  // Default for generic_lang
+
+    // With an XmpPath only the language keywords are accepted
+    int skip = NIL_P(rb_path) ? 0 : 2;
+    rb_get_kwargs(kwargs, kw_table + skip, 3 - skip, 1, kw_values + skip);
+
+    VALUE generic_lang = kw_values[2];  // Will be default if not provided
+    VALUE specific_lang = kw_values[3];
+
+    if (NIL_P(generic_lang)) generic_lang = rb_str_new_cstr("");
+
+    const char *c_schema_ns;
+    const char *c_alt_text_name;
+    scan_alt_text_ref(rb_path, kw_values, &c_schema_ns, &c_alt_text_name);
+    const char *c_generic_lang = StringValueCStr(generic_lang);
+    const char *c_specific_lang = StringValueCStr(specific_lang);
+
+    XMP_OptionBits options = 0;
+    bool array_items_exists = false;
+    VALUE rb_value = Qnil;
+    VALUE rb_actual_lang = Qnil;
+    ErrorText error;
+    {
+      std::string actual_lang;
+      std::string item_value;
+      probe_tree_access(wrapper, false, &error, [&]() {
+        array_items_exists = wrapper->xmpMeta->GetLocalizedText(c_schema_ns, c_alt_text_name, c_generic_lang,
+                                                                c_specific_lang, &actual_lang, &item_value, &options);
+        return item_value.size();
+      });
+      rb_value = rb_str_new_cstr(item_value.c_str());
+      rb_actual_lang = rb_str_new_cstr(actual_lang.c_str());
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  VALUE result = rb_hash_new();
-  rb_hash_aset(result, rb_str_new_cstr("options"), UINT2NUM(options));
-  rb_hash_aset(result, rb_str_new_cstr("exists"), array_items_exists ? Qtrue : Qfalse);
-  rb_hash_aset(result, rb_str_new_cstr("value"), rb_str_new_cstr(item_value.c_str()));
-  rb_hash_aset(result, rb_str_new_cstr("actual_lang"), rb_str_new_cstr(actual_lang.c_str()));
+    VALUE result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new_cstr("options"), UINT2NUM(options));
+    rb_hash_aset(result, rb_str_new_cstr("exists"), array_items_exists ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new_cstr("value"), rb_value);
+    rb_hash_aset(result, rb_str_new_cstr("actual_lang"), rb_actual_lang);
 
-  return result;
+    return result;
+  });
 }
 
 static XMP_DateTime datetime_to_xmp(VALUE rb_value) {
@@ -310,24 +840,9 @@ static XMP_DateTime datetime_to_xmp(VALUE rb_value) {
   return dt;
 }
 
-VALUE
-xmpwrapper_set_meta(int argc, VALUE *argv, VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
-
-  VALUE rb_xmp_data, kwargs;
-  XMP_OptionBits templateFlags =
-      kXMPTemplate_AddNewProperties | kXMPTemplate_ReplaceExistingProperties | kXMPTemplate_IncludeInternalProperties;
-
-  rb_scan_args(argc, argv, "1:", &rb_xmp_data, &kwargs);
-
-  const char *xmpString = NULL;
-  if (!NIL_P(rb_xmp_data)) {
-    Check_Type(rb_xmp_data, T_STRING);
-    xmpString = StringValueCStr(rb_xmp_data);
-  }
-
+// Reads the mode: keyword shared by update_meta and apply_template. Returns
+// true for :override, false for :upsert.
+static bool scan_update_mode(VALUE kwargs) {
   ID kw_table[1];
   kw_table[0] = rb_intern("mode");
 
@@ -348,230 +863,796 @@ xmpwrapper_set_meta(int argc, VALUE *argv, VALUE self) {
     mode_cstr = StringValueCStr(rb_mode_sym);
   }
 
-  bool override;
   if (strcmp(mode_cstr, "upsert") == 0) {
-    override = false;
+    return false;
   } else if (strcmp(mode_cstr, "override") == 0) {
-    override = true;
-  } else {
-    rb_raise(rb_eArgError, "mode must be :upsert or :override (String or Symbol). Got '%s'", mode_cstr);
-    return Qnil;  // unreachable, but for clarity
+    return true;
+  }
+
+  rb_raise(rb_eArgError, "mode must be :upsert or :override (String or Symbol). Got '%s'", mode_cstr);
+  return false;  // unreachable, but for clarity
+}
+
+// Merges source into the file's metadata. xmp:MetadataDate is only stamped
+// when the merge changed anything, so re-applying the same data stays clean.
+static void apply_meta(XMPWrapper *wrapper, const SXMPMeta &source, XMP_OptionBits templateFlags, bool override,
+                       bool stamp) {
+  if (merge_meta(wrapper->xmpMeta, source, templateFlags, override, stamp)) {
+    wrapper->dirty = true;
   }
+}
 
-  get_xmp(wrapper);
+VALUE
+xmpwrapper_set_meta(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    VALUE rb_xmp_data, kwargs;
+    XMP_OptionBits templateFlags =
+        kXMPTemplate_AddNewProperties | kXMPTemplate_ReplaceExistingProperties | kXMPTemplate_IncludeInternalProperties;
 
-  SXMPMeta newMeta;
+    rb_scan_args(argc, argv, "1:", &rb_xmp_data, &kwargs);
 
-  if (xmpString != NULL) {
-    int i;
-    for (i = 0; i < (long)strlen(xmpString) - 10; i += 10) {
-      newMeta.ParseFromBuffer(&xmpString[i], 10, kXMP_ParseMoreBuffers);
+    if (!NIL_P(rb_xmp_data)) {
+      Check_Type(rb_xmp_data, T_STRING);
     }
 
-    newMeta.ParseFromBuffer(&xmpString[i], (XMP_StringLen)strlen(xmpString) - i);
-  }
+    bool override = scan_update_mode(kwargs);
 
-  XMP_DateTime dt;
-  SXMPUtils::CurrentDateTime(&dt);
+    get_xmp(wrapper);
 
-  if (xmpString != NULL) {
-    newMeta.SetProperty_Date(kXMP_NS_XMP, "MetadataDate", dt, 0);
-  }
+    XMP_PROBE_START(update, wrapper->filePath.c_str(), wrapper->format);
+    ErrorText error;
+    try {
+      SXMPMeta newMeta;
 
-  if (override) {
-    wrapper->xmpMeta->Erase();
-  }
+      if (!NIL_P(rb_xmp_data)) {
+        StatsTimer timer(kStatsParse);
+        parse_xmp_buffer(&newMeta, RSTRING_PTR(rb_xmp_data), RSTRING_LEN(rb_xmp_data));
+        timer.stop();
+      }
 
-  SXMPUtils::ApplyTemplate(wrapper->xmpMeta, newMeta, templateFlags);
+      apply_meta(wrapper, newMeta, templateFlags, override, !NIL_P(rb_xmp_data));
+    } catch (const XMP_Error &e) {
+      error.set(e.GetErrMsg());
+    }
+    XMP_PROBE_DONE(update, wrapper->filePath.c_str(), wrapper->format,
+                   NIL_P(rb_xmp_data) ? 0 : RSTRING_LEN(rb_xmp_data), error.empty());
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  return Qnil;
+    if (wrapper->dirty) {
+      update_native_memory(wrapper);
+    }
+    return Qnil;
+  });
 }
 
+// apply_template(template, mode: :upsert)
+// Applies an already parsed XmpTemplate with the kXMPTemplate_* flags it was created with.
 VALUE
-xmpwrapper_set_property(VALUE self, VALUE rb_ns, VALUE rb_prop, VALUE rb_value) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
+xmpwrapper_apply_template(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    VALUE rb_template, kwargs;
+    rb_scan_args(argc, argv, "1:", &rb_template, &kwargs);
 
-  Check_Type(rb_ns, T_STRING);
-  Check_Type(rb_prop, T_STRING);
+    XMPTemplate *tmpl = xmptemplate_get(rb_template);
+    if (tmpl == nullptr) {
+      rb_raise(rb_eTypeError, "expected an XmpTemplate");
+    }
 
-  get_xmp(wrapper);
+    bool override = scan_update_mode(kwargs);
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
-  }
+    get_xmp(wrapper);
+
+    XMP_PROBE_START(update, wrapper->filePath.c_str(), wrapper->format);
+    ErrorText error;
+    try {
+      // Held for the whole apply, so terminating the SDK or collecting the template meanwhile cannot free it
+      std::shared_ptr<SXMPMeta> meta = xmptemplate_meta(tmpl);
+      apply_meta(wrapper, *meta, tmpl->flags, override, true);
+    } catch (const XMP_Error &e) {
+      error.set(e.GetErrMsg());
+    }
+    XMP_PROBE_DONE(update, wrapper->filePath.c_str(), wrapper->format, tmpl->source.size(), error.empty());
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  VALUE mXmpToolkitRuby = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
-  VALUE cXmpValue = rb_const_get(mXmpToolkitRuby, rb_intern("XmpValue"));
+    if (wrapper->dirty) {
+      update_native_memory(wrapper);
+    }
+    return Qnil;
+  });
+}
 
-  const char *ns = StringValueCStr(rb_ns);
-  const char *prop = StringValueCStr(rb_prop);
+VALUE
+xmpwrapper_set_property(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  if (rb_obj_is_kind_of(rb_value, cXmpValue)) {
-    VALUE rb_inner_val = rb_funcall(rb_value, rb_intern("value"), 0);
-    VALUE rb_type_val = rb_funcall(rb_value, rb_intern("type"), 0);
+    const char *ns;
+    const char *prop;
+    int consumed = scan_property_ref(argc, argv, &ns, &prop);
+    rb_check_arity(argc - consumed, 1, 1);
 
-    const char *type_str;
-    if (RB_TYPE_P(rb_type_val, T_SYMBOL)) {
-      VALUE mode_str = rb_sym_to_s(rb_type_val);
-      type_str = StringValueCStr(mode_str);
-    } else {
-      type_str = StringValueCStr(rb_type_val);
+    VALUE rb_value = argv[consumed];
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
     }
 
-    if (strcmp(type_str, "string") == 0) {
-      Check_Type(rb_inner_val, T_STRING);
-      wrapper->xmpMeta->SetProperty(ns, prop, StringValueCStr(rb_inner_val), 0);
-      return Qtrue;
-    } else if (strcmp(type_str, "int") == 0) {
-      Check_Type(rb_inner_val, T_FIXNUM);
-      wrapper->xmpMeta->SetProperty_Int(ns, prop, NUM2INT(rb_inner_val), 0);
-      return Qtrue;
-    } else if (strcmp(type_str, "int64") == 0) {
-      Check_Type(rb_inner_val, T_FIXNUM);
-      wrapper->xmpMeta->SetProperty_Int64(ns, prop, NUM2LL(rb_inner_val), 0);
-      return Qtrue;
-    } else if (strcmp(type_str, "float") == 0) {
-      Check_Type(rb_inner_val, T_FLOAT);
-      wrapper->xmpMeta->SetProperty_Float(ns, prop, NUM2DBL(rb_inner_val), 0);
-      return Qtrue;
-    } else if (strcmp(type_str, "bool") == 0) {
-      wrapper->xmpMeta->SetProperty_Bool(ns, prop, RTEST(rb_inner_val), 0);
-      return Qtrue;
-    } else if (strcmp(type_str, "date") == 0) {
-      wrapper->xmpMeta->SetProperty_Date(ns, prop, datetime_to_xmp(rb_inner_val), 0);
-      return Qtrue;
+    VALUE mXmpToolkitRuby = rb_const_get(rb_cObject, rb_intern("XmpToolkitRuby"));
+    VALUE cXmpValue = rb_const_get(mXmpToolkitRuby, rb_intern("XmpValue"));
+
+    if (rb_obj_is_kind_of(rb_value, cXmpValue)) {
+      VALUE rb_inner_val = rb_funcall(rb_value, rb_intern("value"), 0);
+      VALUE rb_type_val = rb_funcall(rb_value, rb_intern("type"), 0);
+
+      const char *type_str;
+      if (RB_TYPE_P(rb_type_val, T_SYMBOL)) {
+        VALUE mode_str = rb_sym_to_s(rb_type_val);
+        type_str = StringValueCStr(mode_str);
+      } else {
+        type_str = StringValueCStr(rb_type_val);
+      }
+
+      // Values are converted before the SDK call, which must not raise inside probe_tree_access;
+      // only string values report their bytes to the probe.
+      bool handled = true;
+      ErrorText error;
+      if (strcmp(type_str, "string") == 0) {
+        Check_Type(rb_inner_val, T_STRING);
+        const char *value = StringValueCStr(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty(ns, prop, value, 0);
+          return strlen(value);
+        });
+      } else if (strcmp(type_str, "int") == 0) {
+        Check_Type(rb_inner_val, T_FIXNUM);
+        XMP_Int32 value = NUM2INT(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty_Int(ns, prop, value, 0);
+          return 0;
+        });
+      } else if (strcmp(type_str, "int64") == 0) {
+        Check_Type(rb_inner_val, T_FIXNUM);
+        XMP_Int64 value = NUM2LL(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty_Int64(ns, prop, value, 0);
+          return 0;
+        });
+      } else if (strcmp(type_str, "float") == 0) {
+        Check_Type(rb_inner_val, T_FLOAT);
+        double value = NUM2DBL(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty_Float(ns, prop, value, 0);
+          return 0;
+        });
+      } else if (strcmp(type_str, "bool") == 0) {
+        bool value = RTEST(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty_Bool(ns, prop, value, 0);
+          return 0;
+        });
+      } else if (strcmp(type_str, "date") == 0) {
+        XMP_DateTime value = datetime_to_xmp(rb_inner_val);
+        change_tree(wrapper, ns, prop, &error, [&]() {
+          wrapper->xmpMeta->SetProperty_Date(ns, prop, value, 0);
+          return 0;
+        });
+      } else {
+        handled = false;
+      }
+
+      if (handled) {
+        if (!error.empty()) {
+          rb_raise(rb_eRuntimeError, "Failed to set XMP property");
+        }
+        return Qtrue;
+      }
     }
-  }
 
-  const char *val = StringValueCStr(rb_value);
+    const char *val = StringValueCStr(rb_value);
 
-  try {
-    wrapper->xmpMeta->SetProperty(ns, prop, val, 0);
-  } catch (...) {
-    rb_raise(rb_eRuntimeError, "Failed to set XMP property");
-  }
+    ErrorText error;
+    change_tree(wrapper, ns, prop, &error, [&]() {
+      wrapper->xmpMeta->SetProperty(ns, prop, val, 0);
+      return strlen(val);
+    });
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "Failed to set XMP property");
+    }
 
-  return Qtrue;
+    return Qtrue;
+  });
 }
 
 // GetFileInfo() retrieves basic information about an opened file. to be defined
 
 VALUE
 xmpwrapper_update_localized_text(int argc, VALUE *argv, VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
+
+    VALUE rb_path, kwargs;
+    rb_scan_args(argc, argv, "01:", &rb_path, &kwargs);
+
+    // Define allowed keywords
+    ID kw_table[6];
+
+    kw_table[0] = rb_intern("schema_ns");
+    kw_table[1] = rb_intern("alt_text_name");
+    kw_table[2] = rb_intern("generic_lang");
+    kw_table[3] = rb_intern("specific_lang");
+    kw_table[4] = rb_intern("item_value");
+    kw_table[5] = rb_intern("options");
+
+    VALUE kw_values[6];
+    kw_values[2] = rb_str_new_cstr("");  // Default for generic_lang
+    kw_values[5] = INT2NUM(0);           // Default for options
+
+    // Extract keywords from kwargs hash; with an XmpPath only the language and value keywords are accepted
+    int skip = NIL_P(rb_path) ? 0 : 2;
+    rb_get_kwargs(kwargs, kw_table + skip, 4 - skip, 2, kw_values + skip);
+
+    VALUE generic_lang = kw_values[2];  // Will be default if not provided
+    VALUE specific_lang = kw_values[3];
+    VALUE item_value = kw_values[4];
+    VALUE options = kw_values[5];  // Will be default if not provided
+
+    // Provide defaults if needed
+    if (NIL_P(generic_lang)) generic_lang = rb_str_new_cstr("");
+    if (NIL_P(options)) options = INT2NUM(0);
+
+    // Convert Ruby values to C strings / types
+    const char *c_schema_ns;
+    const char *c_alt_text_name;
+    scan_alt_text_ref(rb_path, kw_values, &c_schema_ns, &c_alt_text_name);
+    const char *c_generic_lang = StringValueCStr(generic_lang);
+    const char *c_specific_lang = StringValueCStr(specific_lang);
+    const char *c_item_value = StringValueCStr(item_value);
+    XMP_OptionBits c_options = NUM2UINT(options);
+
+    ErrorText error;
+    change_tree(wrapper, c_schema_ns, c_alt_text_name, &error, [&]() {
+      wrapper->xmpMeta->SetLocalizedText(c_schema_ns, c_alt_text_name, c_generic_lang, c_specific_lang,
+                                         std::string(c_item_value), c_options);
+      return strlen(c_item_value);
+    });
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  get_xmp(wrapper);
+    return Qtrue;
+  });
+}
 
-  if (!wrapper->xmpMetaDataLoaded) {
-    rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+// Maps :bag / :seq / :alt (String or Symbol) to the SDK array form bits.
+// nil keeps the form of an existing array, or creates a bag.
+static XMP_OptionBits array_form_to_xmp(VALUE rb_form) {
+  if (NIL_P(rb_form)) {
+    return kXMP_NoOptions;
   }
 
-  VALUE kwargs;
-  rb_scan_args(argc, argv, ":", &kwargs);
+  const char *form_cstr;
+  if (RB_TYPE_P(rb_form, T_SYMBOL)) {
+    VALUE form_str = rb_sym_to_s(rb_form);
+    form_cstr = StringValueCStr(form_str);
+  } else {
+    form_cstr = StringValueCStr(rb_form);
+  }
 
-  // Define allowed keywords
-  ID kw_table[6];
+  if (strcmp(form_cstr, "bag") == 0) {
+    return kXMP_PropArrayIsUnordered;
+  } else if (strcmp(form_cstr, "seq") == 0) {
+    return kXMP_PropValueIsArray | kXMP_PropArrayIsOrdered;
+  } else if (strcmp(form_cstr, "alt") == 0) {
+    return kXMP_PropValueIsArray | kXMP_PropArrayIsOrdered | kXMP_PropArrayIsAlternate;
+  }
 
-  kw_table[0] = rb_intern("schema_ns");
-  kw_table[1] = rb_intern("alt_text_name");
-  kw_table[2] = rb_intern("generic_lang");
-  kw_table[3] = rb_intern("specific_lang");
-  kw_table[4] = rb_intern("item_value");
-  kw_table[5] = rb_intern("options");
+  rb_raise(rb_eArgError, "form must be :bag, :seq or :alt (String or Symbol). Got '%s'", form_cstr);
+  return kXMP_NoOptions;  // unreachable, but for clarity
+}
 
-  VALUE kw_values[6];
-  kw_values[2] = rb_str_new_cstr("");  // Default for generic_lang
-  kw_values[5] = INT2NUM(0);           // Default for options
+VALUE
+xmpwrapper_get_array_items(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  // Extract keywords from kwargs hash
-  rb_get_kwargs(kwargs, kw_table, 4, 2, kw_values);
+    const char *ns;
+    const char *array_name;
+    int consumed = scan_property_ref(argc, argv, &ns, &array_name);
+    rb_check_arity(argc - consumed, 0, 0);
 
-  VALUE schema_ns = kw_values[0];
-  VALUE alt_text_name = kw_values[1];
-  VALUE generic_lang = kw_values[2];  // Will be default if not provided
-  VALUE specific_lang = kw_values[3];
-  VALUE item_value = kw_values[4];
-  VALUE options = kw_values[5];  // Will be default if not provided
+    get_xmp(wrapper);
 
-  // Provide defaults if needed
-  if (NIL_P(generic_lang)) generic_lang = rb_str_new_cstr("");
-  if (NIL_P(options)) options = INT2NUM(0);
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
 
-  // Convert Ruby values to C strings / types
-  const char *c_schema_ns = StringValueCStr(schema_ns);
-  const char *c_alt_text_name = StringValueCStr(alt_text_name);
-  const char *c_generic_lang = StringValueCStr(generic_lang);
-  const char *c_specific_lang = StringValueCStr(specific_lang);
-  const char *c_item_value = StringValueCStr(item_value);
-  XMP_OptionBits c_options = NUM2UINT(options);
+    XMP_OptionBits options = 0;
+    bool array_exists = false;
+    VALUE rb_items = Qnil;
+    ErrorText error;
+    {
+      std::vector<std::string> items;
+      probe_tree_access(wrapper, false, &error, [&]() {
+        size_t bytes = 0;
+        array_exists = wrapper->xmpMeta->GetProperty(ns, array_name, nullptr, &options);
+
+        if (array_exists && XMP_PropIsArray(options)) {
+          XMP_Index count = wrapper->xmpMeta->CountArrayItems(ns, array_name);
+          items.resize(count);
+          for (XMP_Index i = 1; i <= count; ++i) {
+            wrapper->xmpMeta->GetArrayItem(ns, array_name, i, &items[i - 1], nullptr);
+            bytes += items[i - 1].size();
+          }
+        }
+        return bytes;
+      });
+
+      if (error.empty()) {
+        rb_items = rb_ary_new_capa(items.size());
+        for (const std::string &item : items) {
+          rb_ary_push(rb_items, rb_str_new(item.data(), item.size()));
+        }
+      }
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
 
-  wrapper->xmpMeta->SetLocalizedText(c_schema_ns, c_alt_text_name, c_generic_lang, c_specific_lang,
-                                     std::string(c_item_value), c_options);
+    VALUE result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new_cstr("options"), UINT2NUM(options));
+    rb_hash_aset(result, rb_str_new_cstr("exists"), array_exists ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new_cstr("items"), rb_items);
 
-  return Qtrue;
+    return result;
+  });
 }
 
 VALUE
-register_namespace(VALUE self, VALUE rb_namespaceURI, VALUE rb_suggestedPrefix) {
-  const char *namespaceURI = StringValueCStr(rb_namespaceURI);
-  const char *suggestedPrefix = StringValueCStr(rb_suggestedPrefix);
-  std::string registeredPrefix;
+xmpwrapper_set_array_items(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  ensure_sdk_initialized();
+    const char *ns;
+    const char *array_name;
+    int consumed = scan_property_ref(argc, argv, &ns, &array_name);
 
-  bool isRegistered = SXMPMeta::GetNamespacePrefix(namespaceURI, &registeredPrefix);
+    VALUE rb_items, kwargs;
+    rb_scan_args(argc - consumed, argv + consumed, "1:", &rb_items, &kwargs);
 
-  if (isRegistered) {
-    fprintf(stderr, "Namespace '%s' is already registered with prefix '%s'\n", namespaceURI, registeredPrefix.c_str());
-    return rb_str_new_cstr(registeredPrefix.c_str());
-  }
+    Check_Type(rb_items, T_ARRAY);
 
-  bool isSuggestedPrefix = SXMPMeta::RegisterNamespace(namespaceURI, suggestedPrefix, &registeredPrefix);
+    ID kw_table[1];
+    kw_table[0] = rb_intern("form");
 
-  if (isSuggestedPrefix) {
-    return rb_suggestedPrefix;
-  }
+    VALUE kw_values[1];
+    rb_get_kwargs(kwargs, kw_table, 0, 1, kw_values);
+
+    VALUE rb_form = kw_values[0] == Qundef ? Qnil : kw_values[0];
+    XMP_OptionBits array_form = array_form_to_xmp(rb_form);
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
+
+    // Validate every item up front, types and embedded NULs alike, so a bad item never
+    // leaves a half-written array behind. Nothing runs Ruby code between here and the
+    // loop appending them, so they can't change in between.
+    long items_len = RARRAY_LEN(rb_items);
+    for (long i = 0; i < items_len; ++i) {
+      VALUE rb_item = rb_ary_entry(rb_items, i);
+      Check_Type(rb_item, T_STRING);
+      StringValueCStr(rb_item);
+    }
+
+    ErrorText error;
+    // Marks the wrapper dirty also after a failure, so dirty? never hides a tree that did change
+    change_tree(wrapper, ns, array_name, &error, [&]() {
+      size_t bytes = 0;
+      XMP_OptionBits existing_options = 0;
+      if (wrapper->xmpMeta->GetProperty(ns, array_name, nullptr, &existing_options) && array_form == kXMP_NoOptions &&
+          XMP_PropIsArray(existing_options)) {
+        array_form = existing_options & kXMP_PropArrayFormMask;
+      }
+
+      if (array_form == kXMP_NoOptions) {
+        array_form = kXMP_PropArrayIsUnordered;
+      }
+
+      // The new array is built aside and only replaces the old one once complete, so an
+      // item the SDK refuses leaves the tree as it was
+      SXMPMeta scratch;
+      if (items_len == 0) {
+        // Keep an empty container so the array form survives a round trip
+        scratch.SetProperty(ns, array_name, nullptr, array_form);
+      }
 
-  return rb_str_new_cstr(registeredPrefix.c_str());
+      for (long i = 0; i < items_len; ++i) {
+        VALUE rb_item = rb_ary_entry(rb_items, i);
+        scratch.AppendArrayItem(ns, array_name, array_form, RSTRING_PTR(rb_item), 0);
+        bytes += RSTRING_LEN(rb_item);
+      }
+
+      wrapper->xmpMeta->DeleteProperty(ns, array_name);
+      SXMPUtils::DuplicateSubtree(scratch, wrapper->xmpMeta, ns, array_name);
+      return bytes;
+    });
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    return Qtrue;
+  });
+}
+
+VALUE
+xmpwrapper_get_catenated_array_items(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    const char *ns;
+    const char *array_name;
+    int consumed = scan_property_ref(argc, argv, &ns, &array_name);
+
+    VALUE kwargs;
+    rb_scan_args(argc - consumed, argv + consumed, ":", &kwargs);
+
+    ID kw_table[2];
+    kw_table[0] = rb_intern("separator");
+    kw_table[1] = rb_intern("quotes");
+
+    VALUE kw_values[2];
+    rb_get_kwargs(kwargs, kw_table, 0, 2, kw_values);
+
+    VALUE separator = (kw_values[0] == Qundef || NIL_P(kw_values[0])) ? rb_str_new_cstr("; ") : kw_values[0];
+    VALUE quotes = (kw_values[1] == Qundef || NIL_P(kw_values[1])) ? rb_str_new_cstr("\"") : kw_values[1];
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
+
+    const char *c_separator = StringValueCStr(separator);
+    const char *c_quotes = StringValueCStr(quotes);
+
+    VALUE result = Qnil;
+    ErrorText error;
+    {
+      std::string catenated;
+      probe_tree_access(wrapper, false, &error, [&]() {
+        if (wrapper->xmpMeta->DoesPropertyExist(ns, array_name)) {
+          SXMPUtils::CatenateArrayItems(*(wrapper->xmpMeta), ns, array_name, c_separator, c_quotes, kXMP_NoOptions,
+                                        &catenated);
+        }
+        return catenated.size();
+      });
+      result = rb_str_new(catenated.data(), catenated.size());
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    return result;
+  });
+}
+
+VALUE
+xmpwrapper_separate_array_items(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    const char *ns;
+    const char *array_name;
+    int consumed = scan_property_ref(argc, argv, &ns, &array_name);
+
+    VALUE rb_catenated, kwargs;
+    rb_scan_args(argc - consumed, argv + consumed, "1:", &rb_catenated, &kwargs);
+
+    Check_Type(rb_catenated, T_STRING);
+
+    ID kw_table[2];
+    kw_table[0] = rb_intern("form");
+    kw_table[1] = rb_intern("allow_commas");
+
+    VALUE kw_values[2];
+    rb_get_kwargs(kwargs, kw_table, 0, 2, kw_values);
+
+    XMP_OptionBits options = array_form_to_xmp(kw_values[0] == Qundef ? Qnil : kw_values[0]);
+    if (kw_values[1] != Qundef && RTEST(kw_values[1])) {
+      options |= kXMPUtil_AllowCommas;
+    }
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
+
+    const char *catenated = StringValueCStr(rb_catenated);
+
+    ErrorText error;
+    change_tree(wrapper, ns, array_name, &error, [&]() {
+      SXMPUtils::SeparateArrayItems(wrapper->xmpMeta, ns, array_name, options, catenated);
+      return strlen(catenated);
+    });
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    return Qtrue;
+  });
+}
+
+VALUE
+xmpwrapper_get_localized_texts(int argc, VALUE *argv, VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
+
+    get_xmp(wrapper);
+
+    if (!wrapper->xmpMetaDataLoaded) {
+      rb_raise(rb_eRuntimeError, "No XMP metadata loaded");
+    }
+
+    VALUE rb_path, kwargs;
+    rb_scan_args(argc, argv, "01:", &rb_path, &kwargs);
+
+    ID kw_table[2];
+    kw_table[0] = rb_intern("schema_ns");
+    kw_table[1] = rb_intern("alt_text_name");
+
+    VALUE kw_values[2];
+    int skip = NIL_P(rb_path) ? 0 : 2;
+    rb_get_kwargs(kwargs, kw_table + skip, 2 - skip, 0, kw_values + skip);
+
+    const char *c_schema_ns;
+    const char *c_alt_text_name;
+    scan_alt_text_ref(rb_path, kw_values, &c_schema_ns, &c_alt_text_name);
+
+    VALUE result = rb_hash_new();
+    ErrorText error;
+    {
+      std::vector<std::pair<std::string, std::string>> texts;  // (lang, value)
+      probe_tree_access(wrapper, false, &error, [&]() {
+        size_t bytes = 0;
+        XMP_Index count = wrapper->xmpMeta->CountArrayItems(c_schema_ns, c_alt_text_name);
+
+        std::string item_path;
+        std::string item_value;
+        std::string item_lang;
+        for (XMP_Index i = 1; i <= count; ++i) {
+          item_path.clear();
+          item_value.clear();
+          item_lang.clear();
+
+          SXMPUtils::ComposeArrayItemPath(c_schema_ns, c_alt_text_name, i, &item_path);
+          if (!wrapper->xmpMeta->GetProperty(c_schema_ns, item_path.c_str(), &item_value, nullptr)) {
+            continue;
+          }
+          wrapper->xmpMeta->GetQualifier(c_schema_ns, item_path.c_str(), kXMP_NS_XML, "lang", &item_lang, nullptr);
+
+          bytes += item_value.size();
+          texts.emplace_back(item_lang, item_value);
+        }
+        return bytes;
+      });
+
+      if (error.empty()) {
+        for (const auto &text : texts) {
+          rb_hash_aset(result, rb_str_new(text.first.data(), text.first.size()),
+                       rb_str_new(text.second.data(), text.second.size()));
+        }
+      }
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    return result;
+  });
 }
 
 VALUE
 write_xmp(VALUE self) {
-  XMPWrapper *wrapper;
-  TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
-  check_wrapper_initialized(wrapper);
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+    check_wrapper_initialized(wrapper);
 
-  if (wrapper->xmpFile && wrapper->xmpMeta) {
-    try {
-      if (wrapper->xmpFile->CanPutXMP(*(wrapper->xmpMeta))) {
-        wrapper->xmpFile->PutXMP(*(wrapper->xmpMeta));
-        std::string newBuffer;
-        wrapper->xmpMeta->SerializeToBuffer(&newBuffer);
-      } else {
-        std::string newBuffer;
-        wrapper->xmpMeta->SerializeToBuffer(&newBuffer);
-        rb_raise(rb_eArgError, "Can't update XMP new Data: '%s'", newBuffer.c_str());
+    // Nothing changed since the file was opened or last written: skip PutXMP and the rewrite.
+    // Cache hits come from read-only opens and have no file to write to.
+    if (!wrapper->dirty || wrapper->cached) {
+      return Qfalse;
+    }
+
+    if (wrapper->xmpFile && wrapper->xmpMeta) {
+      ErrorText error;
+      VALUE rejected = Qnil;  // The packet the handler can't take
+      try {
+        if (wrapper->xmpFile->CanPutXMP(*(wrapper->xmpMeta))) {
+          XMP_PROBE_START(put_xmp, wrapper->filePath.c_str(), wrapper->format);
+          StatsTimer timer(kStatsPutXMP);
+          try {
+            wrapper->xmpFile->PutXMP(*(wrapper->xmpMeta));
+          } catch (const XMP_Error &e) {
+            error.set(e.GetErrMsg());
+          }
+          timer.stop(wrapper->format, stats_strategy(wrapper->openFlags), error.empty());
+          XMP_PROBE_DONE(put_xmp, wrapper->filePath.c_str(), wrapper->format, wrapper->xmpPacket->length,
+                         error.empty());
+        } else {
+          std::string newBuffer;
+          wrapper->xmpMeta->SerializeToBuffer(&newBuffer);
+          rejected = rb_str_new(newBuffer.data(), newBuffer.size());
+        }
+      } catch (const XMP_Error &e) {
+        error.set(e.GetErrMsg());
       }
-    } catch (const XMP_Error &e) {
-      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", e.GetErrMsg());
+      if (!error.empty()) {
+        rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+      }
+      if (!NIL_P(rejected)) {
+        rb_raise(rb_eArgError, "Can't update XMP new Data: '%s'", RSTRING_PTR(rejected));
+      }
+      wrapper->dirty = false;
     }
-  }
 
-  return Qtrue;
+    // PutXMP replaced the handler's copy of the tree with the updated one
+    update_native_memory(wrapper);
+    return Qtrue;
+  });
 }
 
 VALUE
-xmpwrapper_close_file(VALUE self) {
+xmpwrapper_is_dirty(VALUE self) {
   XMPWrapper *wrapper;
   TypedData_Get_Struct(self, XMPWrapper, &xmpwrapper_data_type, wrapper);
+  return wrapper->dirty ? Qtrue : Qfalse;
+}
 
-  if (wrapper->xmpFile) {
-    clean_wrapper(wrapper);
-  }
+VALUE
+xmpwrapper_close_file(VALUE self) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    // A cache hit has nothing to close; a wrapper with nothing open doesn't count as a closed file
+    if (wrapper->xmpFile == nullptr) {
+      bool hit = static_cast<bool>(wrapper->cached);
+      clean_wrapper(wrapper);
+      if (hit) {
+        native_memory_file_closed();
+      }
+      return Qtrue;
+    }
+
+    XMP_FileFormat format = wrapper->format;
+    StatsStrategy strategy = stats_strategy(wrapper->openFlags);
+
+    // CloseFile is where updates are written, possibly for a long time: without the
+    // GVL, with progress and cancellation. An update that can be aborted, by the
+    // progress callable or a timeout or token, goes through a temporary file where
+    // the handler supports it, so aborting it leaves the original untouched. One
+    // written in place runs to the end instead, and what aborted it is raised after.
+    SXMPFiles *file = wrapper->xmpFile;
+    bool update = wrapper->openFlags & kXMPFiles_OpenForUpdate;
+    XMP_OptionBits closeFlags = kXMP_NoOptions;
+    XMP_OptionBits handlerFlags = 0;
+    if (update && (operation_cancellable(wrapper->control) || !NIL_P(wrapper->control.progress)) &&
+        file->GetFileInfo(0, 0, 0, &handlerFlags) && (handlerFlags & kXMPFiles_AllowsSafeUpdate)) {
+      closeFlags = kXMPFiles_UpdateSafely;
+    }
+
+    ErrorText error;
+    bool aborted;
+    {
+      std::string path = wrapper->filePath;
+      XMP_PROBE_START(close, path.c_str(), format);
+      StatsTimer timer(kStatsClose);
+      wrapper->control.abortable = !update || closeFlags == kXMPFiles_UpdateSafely;
+      run_operation(
+          wrapper,
+          [file, closeFlags]() {
+            file->CloseFile(closeFlags);
+            return true;
+          },
+          &error);
+      wrapper->control.abortable = true;
+      aborted = wrapper->control.reason != kOperationNotAborted;
+      clean_wrapper(wrapper, false);
+      timer.stop(format, strategy, error.empty() && !aborted);
+      XMP_PROBE_DONE(close, path.c_str(), format,
+                     wrapper->ioCounters ? static_cast<int64_t>(wrapper->ioCounters->bytesWritten.load()) : -1,
+                     error.empty() && !aborted);
+    }
+    native_memory_file_closed();
+    error_log_report(&wrapper->errors);
+
+    if (aborted) {
+      operation_raise(&wrapper->control);
+    }
+    if (!error.empty()) {
+      rb_raise(rb_eRuntimeError, "XMP SDK error: %s", error.c_str());
+    }
+
+    return Qtrue;
+  });
+}
+
+// set_progress(interval, callable)
+// Calls callable with (fraction_done, elapsed, seconds_to_go) at most every
+// interval seconds while an update is written; nil stops the reports. If it
+// raises, the update is aborted, or finished if written in place, and the
+// exception re-raised by the operation.
+VALUE
+xmpwrapper_set_progress(VALUE self, VALUE interval, VALUE callable) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    double seconds = NUM2DBL(interval);
+    if (seconds < 0) {
+      rb_raise(rb_eArgError, "interval must not be negative");
+    }
+    if (!NIL_P(callable) && !rb_respond_to(callable, rb_intern("call"))) {
+      rb_raise(rb_eTypeError, "progress must respond to call");
+    }
+
+    wrapper->control.progress = callable;
+    wrapper->control.progressInterval = static_cast<float>(seconds);
+    if (wrapper->xmpFile) {
+      operation_control_attach(&wrapper->control, wrapper->xmpFile);
+    }
+
+    return callable;
+  });
+}
+
+// timeout = seconds
+// Seconds each open, read and close may take before it is aborted with
+// DeadlineExceededError; nil for no limit.
+VALUE
+xmpwrapper_set_timeout(VALUE self, VALUE seconds) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    double timeout = NIL_P(seconds) ? 0 : NUM2DBL(seconds);
+    if (!NIL_P(seconds) && timeout <= 0) {
+      rb_raise(rb_eArgError, "timeout must be positive");
+    }
+
+    wrapper->control.timeout = timeout;
+    return seconds;
+  });
+}
+
+// cancellation = token
+// Aborts the running and all following operations with CancelledError once the
+// CancellationToken is cancelled; nil removes it.
+VALUE
+xmpwrapper_set_cancellation(VALUE self, VALUE token) {
+  return with_wrapper(self, [&](XMPWrapper *wrapper) -> VALUE {
+
+    std::shared_ptr<std::atomic<bool>> flag;
+    if (!NIL_P(token)) {
+      flag = cancellation_token_flag(token);
+      if (!flag) {
+        rb_raise(rb_eTypeError, "expected a CancellationToken");
+      }
+    }
 
-  return Qtrue;
+    wrapper->control.token = std::move(flag);
+    return token;
+  });
 }
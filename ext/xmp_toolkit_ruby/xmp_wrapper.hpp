@@ -1,35 +1,67 @@
 #ifndef XMP_WRAPPER_HPP
 #define XMP_WRAPPER_HPP
 
-#include <mutex>
+#include <memory>
+#include <string>
+
+#include "xmp_error_log.hpp"
+#include "xmp_io_accounting.hpp"
+#include "xmp_metadata_cache.hpp"
+#include "xmp_native_memory.hpp"
+#include "xmp_operation_control.hpp"
 
 struct XMPWrapper {
   SXMPMeta *xmpMeta;
   SXMPFiles *xmpFile;
   XMP_PacketInfo *xmpPacket;
   bool xmpMetaDataLoaded;
-  std::mutex mutex;  // Protects all mutable members
+  bool dirty;  // Set once a setter actually changed xmpMeta, cleared by write
+  std::string filePath;
+  XMP_OptionBits openFlags;
+  XMP_FileFormat format;      // Format the file was opened as, for XmpToolkit.stats
+  FileIdentity fileIdentity;  // stat(2) taken before the file was opened
+  bool hasFileIdentity;
+  std::shared_ptr<const CachedPacket> cached;  // Set when served from the metadata cache instead of the file
+  std::unique_ptr<XMP_IO> fileIO;              // Counting I/O xmpFile was opened on, with XmpToolkit.io_accounting
+  std::shared_ptr<IOCounters> ioCounters;      // I/O of the last file opened through fileIO; kept after close
+  OperationControl control;                    // Progress callable, timeout and cancellation of the SDK calls
+  ErrorLog errors{kErrorLogCapacity};          // SDK errors of the file opened last; kept after close
+  NativeMemory memory;                         // Estimated heap of xmpMeta and xmpFile, as reported to the GC
+  bool busy;                                   // Set while a method uses the native objects, see with_wrapper
 };
 
 VALUE xmpwrapper_allocate(VALUE klass);
 
-VALUE register_namespace(VALUE self, VALUE rb_namespaceURI, VALUE rb_suggestedPrefix);
-
 VALUE xmpwrapper_open_file(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_open_cached(int argc, VALUE *argv, VALUE self);
 
 VALUE xmp_file_info(VALUE self);
 VALUE xmp_packet_info(VALUE self);
+VALUE xmpwrapper_io_stats(VALUE self);
+VALUE xmpwrapper_warnings(VALUE self);
 
 VALUE xmp_meta(VALUE self);
-VALUE xmpwrapper_get_property(VALUE self, VALUE rb_ns, VALUE rb_prop);
+VALUE xmpwrapper_get_property(int argc, VALUE *argv, VALUE self);
 VALUE xmpwrapper_get_localized_text(int argc, VALUE *argv, VALUE self);
 
 VALUE xmpwrapper_set_meta(int argc, VALUE *argv, VALUE self);
-VALUE xmpwrapper_set_property(VALUE self, VALUE rb_ns, VALUE rb_prop, VALUE rb_value);
+VALUE xmpwrapper_apply_template(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_set_property(int argc, VALUE *argv, VALUE self);
 VALUE xmpwrapper_update_localized_text(int argc, VALUE *argv, VALUE self);
 
+VALUE xmpwrapper_get_array_items(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_set_array_items(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_get_catenated_array_items(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_separate_array_items(int argc, VALUE *argv, VALUE self);
+VALUE xmpwrapper_get_localized_texts(int argc, VALUE *argv, VALUE self);
+
 VALUE write_xmp(VALUE self);
+VALUE xmpwrapper_is_dirty(VALUE self);
 
 VALUE xmpwrapper_close_file(VALUE self);
 
+VALUE xmpwrapper_set_progress(VALUE self, VALUE interval, VALUE callable);
+VALUE xmpwrapper_set_timeout(VALUE self, VALUE seconds);
+VALUE xmpwrapper_set_cancellation(VALUE self, VALUE token);
+
 #endif
\ No newline at end of file
@@ -37,8 +37,14 @@ module XmpToolkitRuby
   require_relative "xmp_toolkit_ruby/namespaces"
   require_relative "xmp_toolkit_ruby/xmp_file_handler_flags"
   require_relative "xmp_toolkit_ruby/xmp_file"
+  require_relative "xmp_toolkit_ruby/xmp_future"
   require_relative "xmp_toolkit_ruby/xmp_value"
   require_relative "xmp_toolkit_ruby/xmp_char_form"
+  require_relative "xmp_toolkit_ruby/xmp_template_flags"
+  require_relative "xmp_toolkit_ruby/metadata_index"
+  require_relative "xmp_toolkit_ruby/directory_scanner"
+  require_relative "xmp_toolkit_ruby/batch_apply"
+  require_relative "xmp_toolkit_ruby/metadata_server"
 
   # The `PLUGINS_PATH` constant defines the directory where the XMP Toolkit
   # should look for its plugins, particularly the PDF handler.
@@ -51,6 +57,8 @@ module XmpToolkitRuby
   # If the platform or architecture is unsupported, a warning will be issued,
   # and the path may be empty, potentially affecting PDF handling capabilities.
   #
+  # The string is frozen, so the toolkit can be initialized from any Ractor.
+  #
   # @return [String] The absolute path to the plugins directory.
   PLUGINS_PATH = if ENV["XMP_TOOLKIT_PLUGINS_PATH"] && !ENV["XMP_TOOLKIT_PLUGINS_PATH"].empty?
                    ENV["XMP_TOOLKIT_PLUGINS_PATH"]
@@ -72,12 +80,23 @@ module XmpToolkitRuby
                      warn "Unsupported platform for PLUGINS_PATH: #{RUBY_PLATFORM}. PDF Handler might not work."
                      "" # Or some other default that makes sense for your application
                    end
-                 end
+                 end.freeze
 
   class Error < StandardError; end
 
   class FileNotFoundError < Error; end
 
+  # Raised by an SDK operation aborted through a CancellationToken, or by
+  # Thread#raise/Timeout on an XmpFile with a timeout or cancellation token.
+  class CancelledError < Error; end
+
+  # Raised by an SDK operation that took longer than the timeout of its XmpFile.
+  class DeadlineExceededError < CancelledError; end
+
+  # Raised when an XmpFile is used while another call on it is still running:
+  # from another thread or fiber, or from its own progress callable.
+  class BusyError < Error; end
+
   class << self
     # Reads XMP metadata from a specified file.
     #
@@ -97,14 +116,19 @@ module XmpToolkitRuby
     #   - `"handler_flags_orig"`: The original numerical handler flags from the toolkit.
     #   Returns an empty hash merged with cleanup and flag mapping results if the native call returns nil.
     # @raise [FileNotFoundError] If the file does not exist, is not readable, or `file_path` is nil.
+    # @see MetadataCache
     def xmp_from_file(file_path)
       check_file! file_path, need_to_read: true, need_to_write: false
 
+      cached = xmp_from_metadata_cache(file_path)
+      return cached if cached
+
       with_init do
         XmpToolkitRuby::XmpFile.with_xmp_file(
           file_path,
           open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler),
-          fallback_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+          fallback_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning),
+          auto_terminate_toolkit: false
         ) do |xmp_file|
           file_info = xmp_file.file_info
           packet_info = xmp_file.packet_info
@@ -115,6 +139,37 @@ module XmpToolkitRuby
       end
     end
 
+    # Starts reading XMP metadata from a file in the background and returns at once.
+    #
+    # The read runs on the native worker pool (see `XmpToolkit.worker_threads`) without
+    # the GVL, so other threads, and fibers of a Fiber scheduler, keep running; at most
+    # `worker_threads` reads run at a time, the others wait for a worker. If no worker
+    # thread can be started at all, the read runs on the calling thread before this
+    # returns. The toolkit is initialized with `PLUGINS_PATH` if it is not, and stays
+    # initialized afterwards; `XmpToolkit.terminate` cancels the reads still in flight
+    # and waits for them first.
+    #
+    # @param file_path [String] The path to the file to read.
+    # @param timeout [Numeric, nil] Seconds the read may take, counted from this call and
+    #   including the wait for a worker; the future then raises DeadlineExceededError.
+    # @param cancellation [CancellationToken, nil] Token that cancels the read, like XmpFuture#cancel.
+    # @param queue [CompletionQueue, nil] Receives the future once its read ended, for
+    #   collecting many reads in the order they finish.
+    # @return [XmpFuture] Its #value is the Hash `xmp_from_file` returns.
+    # @raise [FileNotFoundError] If the file does not exist, is not readable, or `file_path` is nil.
+    # @example Reading a directory, handling files as they finish
+    #   queue = XmpToolkitRuby::CompletionQueue.new
+    #   paths.each { |path| XmpToolkitRuby.read_async(path, queue: queue) }
+    #   paths.size.times do
+    #     future = queue.pop
+    #     puts "#{future.path}: #{future.value["format"]}"
+    #   end
+    def read_async(file_path, timeout: nil, cancellation: nil, queue: nil)
+      check_file! file_path, need_to_read: true, need_to_write: false
+
+      XmpToolkitRuby::XmpFuture.read(file_path, timeout: timeout, cancellation: cancellation, queue: queue)
+    end
+
     # Writes XMP metadata to a specified file.
     #
     # This method checks if the file exists, is readable, and is writable.
@@ -128,21 +183,32 @@ module XmpToolkitRuby
     #   new properties are added, and existing ones may be updated.
     #
     # @param file_path [String] The absolute or relative path to the target file.
-    # @param xmp_data [String] The XMP metadata to write.
-    #   (which will be converted to XML by the native toolkit) or a pre-formatted XML String.
+    # @param xmp_data [String, XmpTemplate] The XMP metadata to write, either as an RDF/XML String or as an
+    #   XmpTemplate that was parsed once and is applied with its own XmpTemplateFlags.
     # @param override [Boolean] (false) If `true`, existing XMP metadata in the
     #   file will be replaced. If `false`, the new data will be upserted (merged).
+    # @param result [Boolean] (true) If `false`, skip reading back the file and packet info and the
+    #   serialized metadata, and only report whether the file changed.
+    # @return [Hash, Boolean] The same hash as {xmp_from_file}, or with `result: false` whether the
+    #   metadata changed and was written.
     # @raise [FileNotFoundError] If the file does not exist, is not readable/writable, or `file_path` is nil.
-    def xmp_to_file(file_path, xmp_data, override: false)
+    def xmp_to_file(file_path, xmp_data, override: false, result: true)
       check_file! file_path, need_to_read: true, need_to_write: true
 
       with_init do
         XmpToolkitRuby::XmpFile.with_xmp_file(
           file_path,
           open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler),
-          fallback_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_packet_scanning)
+          fallback_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_packet_scanning),
+          auto_terminate_toolkit: false
         ) do |xmp_file|
-          xmp_file.update_meta xmp_data, mode: override ? :override : :upsert
+          if xmp_data.is_a?(XmpTemplate)
+            xmp_file.apply_template xmp_data, mode: override ? :override : :upsert
+          else
+            xmp_file.update_meta xmp_data, mode: override ? :override : :upsert
+          end
+
+          next xmp_file.dirty? unless result
 
           file_info = xmp_file.file_info
           packet_info = xmp_file.packet_info
@@ -158,17 +224,22 @@ module XmpToolkitRuby
     # lifecycle of the underlying C++ library resources.
     #
     # This method should wrap any calls to the native `XmpToolkitRuby::XmpToolkit` methods.
+    # Only the last block to finish terminates the toolkit, across all threads and Ractors, so batch jobs
+    # can wrap many `xmp_to_file` calls in one `with_init` block and keep parsed XmpTemplates
+    # alive, and worker threads never see the toolkit terminated under them.
     #
     # @param path [String, nil] (nil) Optional path to the XMP Toolkit plugins directory.
     #   If `nil` or not provided, it defaults to `PLUGINS_PATH`.
     # @yield The block of code to execute while the XMP Toolkit is initialized.
     # @return The result of the yielded block.
     def with_init(path = nil, &block)
-      XmpToolkitRuby::XmpToolkit.initialize_xmp(path || PLUGINS_PATH) unless XmpToolkitRuby.sdk_initialized?
+      XmpToolkitRuby::XmpToolkit.acquire_session(path || PLUGINS_PATH)
 
-      block.call
-    ensure
-      XmpToolkitRuby::XmpToolkit.terminate
+      begin
+        block.call
+      ensure
+        XmpToolkitRuby::XmpToolkit.release_session
+      end
     end
 
     # Checks if the XMP Toolkit SDK has been initialized.
@@ -204,8 +275,44 @@ module XmpToolkitRuby
       end
     end
 
+    # Turns the result of a background read into the Hash `xmp_from_file` returns.
+    #
+    # @param raw [Hash] XmpFuture#result
+    # @return [Hash]
+    # @api private
+    def read_result(raw)
+      {
+        "handler_flags" => XmpToolkitRuby::XmpFileHandlerFlags.flags_for(raw["handler_flags"]),
+        "handler_flags_orig" => raw["handler_flags"],
+        "format" => XmpToolkitRuby::XmpFileFormat.name_for(raw["format"]),
+        "format_orig" => raw["format"],
+        "open_flags" => XmpToolkitRuby::XmpFileOpenFlags.flags_for(raw["open_flags"]),
+        "open_flags_orig" => raw["open_flags"]
+      }.merge(raw["packet_info"] || {}).merge(cleanup_xmp(raw["meta"]))
+    end
+
     private
 
+    # Serves xmp_from_file from the MetadataCache without initializing the toolkit.
+    #
+    # @param file_path [String]
+    # @return [Hash, nil] nil on a cache miss or when the cache is disabled
+    # @api private
+    def xmp_from_metadata_cache(file_path)
+      return unless MetadataCache.enabled?
+
+      xmp_file = XmpToolkitRuby::XmpFile.new(
+        file_path,
+        open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler),
+        fallback_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+      )
+      return unless xmp_file.open_cached
+
+      xmp_file.file_info.merge(xmp_file.packet_info).merge(xmp_file.meta)
+    ensure
+      xmp_file&.close
+    end
+
     # Parses raw XMP data string to extract `xpacket` processing instruction
     # attributes and the core XMP XML content.
     #
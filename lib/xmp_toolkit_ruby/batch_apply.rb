@@ -0,0 +1,228 @@
+# frozen_string_literal: true
+
+require "csv"
+require "etc"
+require "json"
+
+module XmpToolkitRuby
+  # BatchApply writes the metadata corrections of a manifest to many files in
+  # one toolkit session, using a pool of worker threads.
+  #
+  # A manifest is NDJSON (one object per line) or CSV with a header row. Each
+  # entry names a "path" and one kind of edit:
+  #
+  # - "xmp": an RDF/XML fragment merged into the file
+  # - "template": path of an RDF/XML file merged into the file
+  # - "property" and "value": one property given as "prefix:Name", e.g. "dc:format"
+  # - "properties" (NDJSON only): an object of such properties and values
+  #
+  # Relative paths, of files and templates alike, are resolved against the
+  # directory of the manifest, not the current one.
+  #
+  # An optional "mode" of "override" replaces the existing metadata with the
+  # fragment or template instead of merging. All edits of one file are applied
+  # in manifest order with a single open and write, and every distinct fragment,
+  # template and property path is parsed only once.
+  #
+  # @example
+  #   report = File.open("failures.ndjson", "w")
+  #   XmpToolkitRuby::BatchApply.new("fixes.ndjson", workers: 8, failures: report).run
+  #   # => {"files" => 1200, "edits" => 3400, "changed" => 1180, "unchanged" => 15, "failed" => 5, "seconds" => 42.1}
+  class BatchApply
+    UPDATE_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler)
+    UPDATE_SCAN_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_packet_scanning)
+
+    # Raised for manifest entries that cannot be understood.
+    class ManifestError < XmpToolkitRuby::Error; end
+
+    attr_reader :manifest_path, :workers
+
+    # @param manifest_path [String] NDJSON (.ndjson, .jsonl) or CSV (.csv) manifest
+    # @param workers [Integer] Number of threads writing files (default: number of CPUs)
+    # @param failures [IO, nil] Receives one JSON line {"path", "error"} per failed file
+    # @param progress [#call, nil] Called with a Hash of "done", "total", "failed" and
+    #   "files_per_second" after every progress_every files and once at the end
+    # @param progress_every [Integer]
+    def initialize(manifest_path, workers: Etc.nprocessors, failures: nil, progress: nil, progress_every: 100)
+      @manifest_path = manifest_path
+      @workers = [workers.to_i, 1].max
+      @failures = failures
+      @progress = progress
+      @progress_every = [progress_every.to_i, 1].max
+    end
+
+    # Applies the manifest.
+    #
+    # @return [Hash{String=>Numeric}] "files", "edits", "changed", "unchanged", "failed" and "seconds"
+    # @raise [ManifestError] if an entry is malformed; nothing is written in that case
+    def run
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      result = { "files" => 0, "edits" => 0, "changed" => 0, "unchanged" => 0, "failed" => 0 }
+
+      if @failures
+        @failures.flush
+        failure_writer = LineWriter.new(@failures.fileno)
+      end
+
+      XmpToolkitRuby.with_init do
+        edits_by_path = load_manifest
+        result["files"] = edits_by_path.size
+        result["edits"] = edits_by_path.each_value.sum(&:size)
+
+        apply_all(edits_by_path, result, failure_writer, started)
+      end
+
+      result["seconds"] = (Process.clock_gettime(Process::CLOCK_MONOTONIC) - started).round(3)
+      result
+    ensure
+      failure_writer&.close
+    end
+
+    private
+
+    def apply_all(edits_by_path, result, failure_writer, started)
+      queue = Queue.new
+      lock = Mutex.new
+      total = edits_by_path.size
+
+      threads = Array.new(workers) do
+        Thread.new do
+          while (job = queue.pop)
+            path, edits = job
+            outcome, error = apply_file(path, edits)
+
+            lock.synchronize do
+              result[outcome] += 1
+              failure_writer << JSON.generate("path" => path, "error" => error) if error && failure_writer
+
+              done = result["changed"] + result["unchanged"] + result["failed"]
+              report_progress(done, total, result["failed"], started) if (done % @progress_every).zero?
+            end
+          end
+        end
+      end
+
+      begin
+        edits_by_path.each { |path, edits| queue << [path, edits] }
+      ensure
+        queue.close
+        threads.each(&:join)
+      end
+
+      report_progress(total, total, result["failed"], started)
+    end
+
+    # Writes the file only once all of its edits succeeded; otherwise it is closed
+    # without writing, so a failing edit never leaves the earlier ones applied.
+    def apply_file(path, edits)
+      XmpToolkitRuby.check_file!(path, need_to_read: true, need_to_write: true)
+
+      xmp_file = XmpFile.new(path, open_flags: UPDATE_FLAGS, fallback_flags: UPDATE_SCAN_FLAGS)
+      xmp_file.open
+      edits.each { |edit| edit.call(xmp_file) }
+      changed = xmp_file.dirty?
+      xmp_file.write if changed
+      xmp_file.close
+
+      [changed ? "changed" : "unchanged", nil]
+    rescue StandardError => e
+      discard(xmp_file)
+      ["failed", e.message]
+    end
+
+    # Closes a file whose edits failed. Nothing was put into it, so closing leaves it as it was.
+    def discard(xmp_file)
+      xmp_file&.close
+    rescue StandardError
+      nil # The edit's error is the one reported
+    end
+
+    def report_progress(done, total, failed, started)
+      return unless @progress
+
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+      @progress.call("done" => done, "total" => total, "failed" => failed,
+                     "files_per_second" => elapsed.positive? ? (done / elapsed).round(1) : 0.0)
+    end
+
+    # Reads all entries, grouped by path in manifest order, as callables taking an open XmpFile.
+    def load_manifest
+      @templates = {}
+      @paths = {}
+      edits_by_path = Hash.new { |hash, key| hash[key] = [] }
+
+      each_entry.with_index(1) do |entry, line|
+        path = entry["path"]
+        raise ManifestError, "#{manifest_path}:#{line}: missing path" if path.nil? || path.empty?
+
+        edits_by_path[resolve(path)].concat(edits_for(entry, line))
+      end
+
+      edits_by_path
+    end
+
+    def each_entry(&block)
+      return enum_for(:each_entry) unless block
+
+      if File.extname(manifest_path).casecmp?(".csv")
+        CSV.foreach(manifest_path, headers: true) { |row| yield row.to_h }
+      else
+        File.foreach(manifest_path) do |line|
+          next if line.strip.empty?
+
+          yield JSON.parse(line)
+        end
+      end
+    rescue JSON::ParserError, CSV::MalformedCSVError => e
+      raise ManifestError, "#{manifest_path}: #{e.message}"
+    end
+
+    def edits_for(entry, line)
+      mode = entry["mode"].to_s.empty? ? :upsert : entry["mode"].to_sym
+      raise ManifestError, "#{manifest_path}:#{line}: unknown mode #{entry["mode"]}" unless %i[upsert override].include?(mode)
+
+      edits = []
+      edits << template_edit(template_for_xml(entry["xmp"], line), mode) if present?(entry["xmp"])
+      edits << template_edit(template_for_file(entry["template"], line), mode) if present?(entry["template"])
+      edits << property_edit(entry["property"], entry["value"], line) if present?(entry["property"])
+      (entry["properties"] || {}).each { |name, value| edits << property_edit(name, value, line) }
+
+      raise ManifestError, "#{manifest_path}:#{line}: no edit for #{entry["path"]}" if edits.empty?
+
+      edits
+    end
+
+    def present?(value)
+      !value.nil? && !value.to_s.empty?
+    end
+
+    def template_edit(template, mode)
+      ->(xmp_file) { xmp_file.apply_template(template, mode: mode) }
+    end
+
+    def property_edit(name, value, line)
+      xmp_path = @paths[name] ||= XmpPath.parse(name)
+      ->(xmp_file) { xmp_file.update_property(xmp_path, value.to_s) }
+    rescue ArgumentError => e
+      raise ManifestError, "#{manifest_path}:#{line}: #{e.message}"
+    end
+
+    def template_for_xml(xml, line)
+      @templates[[:xml, xml]] ||= XmpTemplate.new(xml)
+    rescue ArgumentError => e
+      raise ManifestError, "#{manifest_path}:#{line}: #{e.message}"
+    end
+
+    def template_for_file(template_path, line)
+      full_path = resolve(template_path)
+      @templates[[:file, full_path]] ||= XmpTemplate.new(File.read(full_path))
+    rescue ArgumentError, SystemCallError => e
+      raise ManifestError, "#{manifest_path}:#{line}: #{e.message}"
+    end
+
+    # Absolute form of a path given in the manifest.
+    def resolve(path)
+      File.expand_path(path, File.dirname(manifest_path))
+    end
+  end
+end
@@ -1,5 +1,6 @@
 # frozen_string_literal: true
 
+require "etc"
 require "thor"
 
 module XmpToolkitRuby
@@ -84,6 +85,118 @@ module XmpToolkitRuby
       raise Thor::Error, "An unexpected error occurred: #{e.message}\n#{e.backtrace.join("\n")}"
     end
 
+    desc "scan DIR", "Scans a directory tree and prints one JSON line per file with its packet info and properties."
+    long_desc <<-LONGDESC
+      Walks DIR recursively, including folder based packages such as P2 or XDCAM,
+      and writes one JSON object per file to stdout (or --output). The toolkit is
+      initialized once and files are opened by --workers threads in parallel.
+
+      Example: xmp_toolkit_ruby scan /mnt/assets --formats JPEG PDF --properties dc:title xmp:CreatorTool
+    LONGDESC
+    method_option :workers, type: :numeric, default: Etc.nprocessors, desc: "Number of worker threads"
+    method_option :include, type: :array, default: ["**/*"], desc: "Globs relative to DIR a file must match"
+    method_option :exclude, type: :array, default: [], desc: "Globs relative to DIR to skip"
+    method_option :formats, type: :array, desc: "Only report these formats, e.g. JPEG PDF P2"
+    method_option :properties, type: :array, default: [], desc: "Properties to report, e.g. dc:title"
+    method_option :output, type: :string, desc: "Write to this file instead of stdout"
+
+    def scan(dir)
+      raise Thor::Error, "Directory not found: #{dir}" unless File.directory?(dir)
+
+      scanner = XmpToolkitRuby::DirectoryScanner.new(dir,
+                                                     workers: options[:workers],
+                                                     include: options[:include],
+                                                     exclude: options[:exclude],
+                                                     formats: options[:formats],
+                                                     properties: options[:properties])
+
+      counts = if options[:output]
+                 File.open(options[:output], "w") { |out| scanner.scan(out) }
+               else
+                 scanner.scan($stdout)
+               end
+
+      warn "Scanned #{counts["files"]} files, #{counts["errors"]} errors"
+    rescue Thor::Error
+      raise
+    rescue StandardError => e
+      raise Thor::Error, "An unexpected error occurred: #{e.message}"
+    end
+
+    desc "apply MANIFEST", "Applies the XMP edits of an NDJSON or CSV manifest to many files in parallel."
+    long_desc <<-LONGDESC
+      Each manifest entry names a "path" and an edit: an "xmp" fragment, a "template"
+      file, a "property"/"value" pair (e.g. dc:format) or, in NDJSON, a "properties"
+      object. Add "mode": "override" to replace instead of merge.
+
+      All edits of one file are applied with a single open and write, fragments and
+      templates are parsed once, and the toolkit stays initialized for the whole run.
+      Files that fail are listed in --failures as JSON lines.
+    LONGDESC
+    method_option :workers, type: :numeric, default: Etc.nprocessors, desc: "Number of worker threads"
+    method_option :failures, type: :string, desc: "Write a JSON line per failed file to this path"
+    method_option :quiet, type: :boolean, default: false, desc: "Don't report progress"
+
+    def apply(manifest)
+      raise Thor::Error, "Manifest not found: #{manifest}" unless File.file?(manifest)
+
+      failures = File.open(options[:failures], "w") if options[:failures]
+      progress = lambda do |status|
+        $stderr.print "\rApplied #{status["done"]}/#{status["total"]} files " \
+                      "(#{status["failed"]} failed, #{status["files_per_second"]} files/s)"
+      end
+
+      result = XmpToolkitRuby::BatchApply.new(manifest,
+                                              workers: options[:workers],
+                                              failures: failures,
+                                              progress: (progress unless options[:quiet])).run
+
+      warn "" unless options[:quiet]
+      warn "#{result["changed"]} changed, #{result["unchanged"]} unchanged, #{result["failed"]} failed " \
+           "(#{result["edits"]} edits in #{result["seconds"]}s)"
+      raise Thor::Error, "#{result["failed"]} files failed" if result["failed"].positive?
+    rescue XmpToolkitRuby::BatchApply::ManifestError => e
+      raise Thor::Error, "Invalid manifest: #{e.message}"
+    rescue Thor::Error
+      raise
+    rescue StandardError => e
+      raise Thor::Error, "An unexpected error occurred: #{e.message}"
+    ensure
+      failures&.close
+    end
+
+    desc "serve", "Answers NDJSON metadata requests on stdin/stdout or a Unix socket, keeping the toolkit warm."
+    long_desc <<-LONGDESC
+      Each request is a JSON line with an "op" (read, read_properties, update or
+      apply_template), a "path" and an optional "id" that is echoed in the response.
+      Requests are handled concurrently by --workers threads and every response is
+      written as soon as it is ready, so responses may arrive out of order.
+
+      With --socket the server listens on a Unix domain socket until it receives
+      INT or TERM; otherwise it serves stdin until end of input.
+    LONGDESC
+    method_option :workers, type: :numeric, default: Etc.nprocessors, desc: "Number of worker threads"
+    method_option :socket, type: :string, desc: "Listen on this Unix domain socket instead of stdin/stdout"
+    method_option :cache_bytes, type: :numeric, desc: "Enable the MetadataCache with this many bytes"
+
+    def serve
+      XmpToolkitRuby::MetadataCache.enable(max_bytes: options[:cache_bytes]) if options[:cache_bytes]
+      server = XmpToolkitRuby::MetadataServer.new(workers: options[:workers])
+
+      if options[:socket]
+        %w[INT TERM].each { |signal| trap(signal) { Thread.new { server.stop } } }
+        served = server.serve_socket(options[:socket])
+      else
+        served = server.serve($stdin, $stdout)
+      end
+
+      warn "Served #{served} requests"
+    rescue Thor::Error
+      raise
+    rescue StandardError => e
+      raise Thor::Error, "An unexpected error occurred: #{e.message}"
+    end
+
     desc "version", "Show xmp_toolkit_ruby version"
 
     def version
@@ -0,0 +1,194 @@
+# frozen_string_literal: true
+
+require "etc"
+require "json"
+
+module XmpToolkitRuby
+  # DirectoryScanner walks a directory tree and reports the XMP of every file
+  # as one JSON object per line, using a pool of worker threads.
+  #
+  # The toolkit is initialized once for the whole scan, and the SDK reads files
+  # without holding the GVL, so the workers open files in parallel. Folder based
+  # packages (P2, XDCAM, AVCHD, ...) are detected with CheckPackageFormat; each
+  # clip is reported once, for the first of its associated resources found.
+  #
+  # @example Scan a tree into an NDJSON file
+  #   File.open("audit.ndjson", "w") do |out|
+  #     XmpToolkitRuby::DirectoryScanner.new("/mnt/assets", workers: 8, formats: %w[JPEG PDF],
+  #                                          properties: ["dc:title", "xmp:CreatorTool"]).scan(out)
+  #   end
+  class DirectoryScanner
+    READ_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)
+    SCAN_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+
+    attr_reader :root, :workers
+
+    # @param root [String] Directory to scan
+    # @param workers [Integer] Number of threads opening files (default: number of CPUs)
+    # @param include [Array<String>] Globs relative to root; a file must match one of them
+    # @param exclude [Array<String>] Globs relative to root; matching files and directories are skipped
+    # @param formats [Array<String, Symbol>, nil] Only report files of these formats, e.g. "JPEG" or :kXMP_JPEGFile
+    # @param properties [Array<String, XmpPath>] Properties to report, e.g. "dc:title"
+    def initialize(root, workers: Etc.nprocessors, include: ["**/*"], exclude: [], formats: nil, properties: [])
+      @root = File.expand_path(root)
+      @workers = [workers.to_i, 1].max
+      @include = Array(include)
+      @exclude = Array(exclude)
+      @formats = formats&.map { |format| format_name(format) }
+      @property_refs = properties
+    end
+
+    # Scans the tree and writes one JSON line per file to output.
+    #
+    # @param output [IO] Destination, written through a native LineWriter
+    # @return [Hash{String=>Integer}] "files" reported and "errors" among them
+    def scan(output = $stdout)
+      output.flush
+      writer = LineWriter.new(output.fileno)
+      counts = { "files" => 0, "errors" => 0 }
+      counts_lock = Mutex.new
+
+      XmpToolkitRuby.with_init do
+        properties = @property_refs.to_h { |ref| [ref.to_s, ref.is_a?(XmpPath) ? ref : XmpPath.parse(ref)] }
+        # Bounded, so the walk stays only a little ahead of the workers on huge trees
+        queue = SizedQueue.new(workers * 4)
+
+        threads = Array.new(workers) do
+          Thread.new do
+            while (target = queue.pop)
+              path, package, error = target
+              next unless error || package || selected_format?(path)
+
+              record = error ? { "path" => path, "error" => error } : scan_file(path, package, properties)
+              writer << JSON.generate(record)
+              counts_lock.synchronize do
+                counts["files"] += 1
+                counts["errors"] += 1 if record.key?("error")
+              end
+            end
+          ensure
+            # A worker that dies must not leave the walk blocked on a full queue; join re-raises its error
+            queue.close
+          end
+        end
+
+        begin
+          each_target { |path, package, error| queue << [path, package, error] }
+        rescue ClosedQueueError
+          nil # A worker died and closed the queue; its error is raised below
+        ensure
+          queue.close
+          # Every worker is done with the SDK before with_init may terminate it
+          errors = threads.filter_map do |thread|
+            thread.join
+            nil
+          rescue StandardError => e
+            e
+          end
+          raise errors.first if errors.any?
+        end
+      end
+
+      counts
+    ensure
+      writer&.close
+    end
+
+    # Yields every file to scan with the package format it belongs to (or nil).
+    # Only files inside packages are checked against the formats here; the
+    # workers check the others, so the walk never waits on format detection.
+    # A directory that cannot be listed is yielded with the reason, and the walk
+    # goes on with its siblings.
+    #
+    # @yieldparam path [String]
+    # @yieldparam package [Symbol, nil]
+    # @yieldparam error [String, nil] Why the directory at path could not be read
+    def each_target(&block)
+      covered = {}
+      walk(root, nil, covered, &block)
+    end
+
+    private
+
+    def walk(dir, package, covered, &block)
+      package ||= package_format(dir)
+
+      begin
+        names = Dir.children(dir).sort
+      rescue SystemCallError => e
+        yield dir, package, e.message
+        return
+      end
+
+      names.each do |name|
+        path = File.join(dir, name)
+        next if excluded?(path)
+
+        if File.directory?(path)
+          walk(path, package, covered, &block) unless File.symlink?(path)
+        elsif File.file?(path) && included?(path)
+          next if package && (!selected_format?(path) || covered_by_package?(path, covered))
+
+          yield path, package
+        end
+      end
+    end
+
+    def package_format(dir)
+      format = XmpFile.package_format(dir)
+      format == :kXMP_UnknownFile ? nil : format
+    end
+
+    # Files of one clip share their associated resources; only the first one is scanned.
+    def covered_by_package?(path, covered)
+      return true if covered.key?(path)
+
+      (XmpFile.associated_resources(path) || []).each { |resource| covered[resource] = true }
+      false
+    end
+
+    def relative(path)
+      path.delete_prefix(File.join(root, ""))
+    end
+
+    def included?(path)
+      @include.any? { |glob| File.fnmatch?(glob, relative(path), File::FNM_PATHNAME | File::FNM_EXTGLOB) }
+    end
+
+    def excluded?(path)
+      @exclude.any? { |glob| File.fnmatch?(glob, relative(path), File::FNM_PATHNAME | File::FNM_EXTGLOB) }
+    end
+
+    def selected_format?(path)
+      @formats.nil? || @formats.include?(XmpFile.file_format(path))
+    end
+
+    def format_name(format)
+      name = format.to_s
+      name.start_with?("kXMP_") ? name.to_sym : :"kXMP_#{name.upcase}File"
+    end
+
+    def scan_file(path, package, properties)
+      record = { "path" => path }
+      record["package"] = package.to_s if package
+
+      xmp_file = XmpFile.new(path, open_flags: READ_FLAGS, fallback_flags: SCAN_FLAGS)
+      xmp_file.open
+
+      file_info = xmp_file.file_info
+      record["format"] = file_info["format"].to_s
+      record["handler_flags"] = file_info["handler_flags_orig"]
+      record["packet_info"] = xmp_file.packet_info
+      record["properties"] = properties.transform_values do |xmp_path|
+        property = xmp_file.property(xmp_path)
+        property["exists"] ? property["value"] : nil
+      end
+
+      record
+    rescue StandardError => e
+      record.merge("error" => e.message)
+    ensure
+      xmp_file&.close
+    end
+  end
+end
@@ -0,0 +1,66 @@
+# frozen_string_literal: true
+
+module XmpToolkitRuby
+  # MetadataIndex keeps the XMP packets of a directory tree in a single
+  # append-only file, so repeated scans only touch the files that changed.
+  #
+  # Each entry is stamped with the file's device, inode, size and modification
+  # time. Opening an index maps the file instead of reading it, and lookups
+  # never open the indexed assets. Records are zlib-compressed when the
+  # extension was built with zlib.
+  #
+  # Only one process may open an index for writing; any number may open it
+  # with +readonly: true+ and see the entries that existed at that moment.
+  # After the writer compacts the index, readers switch to the compacted file
+  # on their next call and then see the entries it holds.
+  #
+  # @example Keep an index of a NAS share up to date
+  #   index = XmpToolkitRuby::MetadataIndex.new("/var/cache/assets.xmpidx")
+  #   index.refresh("/mnt/assets") # => {"checked" => 120000, "updated" => 12, "removed" => 3, "failed" => 0}
+  #   index["/mnt/assets/hero.jpg"] # => "<x:xmpmeta ..."
+  #   index.close
+  class MetadataIndex
+    # Re-extracts the packets of all files below root whose identity changed
+    # since they were stored, and deletes entries of files that are gone.
+    #
+    # @param root [String] Directory to walk
+    # @param pattern [String] Glob relative to root selecting the files to index
+    # @yieldparam path [String] File to extract; the block returns the packet to store.
+    #   Defaults to the cleaned "xmp_data" of XmpToolkitRuby.xmp_from_file.
+    # @return [Hash{String=>Integer}] "checked", "updated", "removed" and "failed" counts
+    def refresh(root, pattern: "**/*", &extract)
+      extract ||= ->(path) { XmpToolkitRuby.xmp_from_file(path)["xmp_data"] }
+      root = File.expand_path(root)
+      result = { "checked" => 0, "updated" => 0, "removed" => 0, "failed" => 0 }
+      seen = {}
+
+      XmpToolkitRuby.with_init do
+        Dir.glob(pattern, base: root) do |relative|
+          path = File.join(root, relative)
+          next unless File.file?(path)
+
+          seen[path] = true
+          result["checked"] += 1
+          next if fresh?(path)
+
+          begin
+            store(path, extract.call(path).to_s)
+            result["updated"] += 1
+          rescue StandardError
+            result["failed"] += 1
+          end
+        end
+      end
+
+      prefix = File.join(root, "")
+      paths.each do |path|
+        next if !path.start_with?(prefix) || seen.key?(path)
+
+        delete(path)
+        result["removed"] += 1
+      end
+
+      result
+    end
+  end
+end
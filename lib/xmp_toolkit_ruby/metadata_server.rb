@@ -0,0 +1,269 @@
+# frozen_string_literal: true
+
+require "etc"
+require "json"
+require "socket"
+
+module XmpToolkitRuby
+  # MetadataServer answers NDJSON metadata requests for other processes, so they
+  # don't pay for a Ruby start and a toolkit initialization per file.
+  #
+  # The toolkit stays initialized while the server runs, and the namespace
+  # registry, parsed templates and property paths and the MetadataCache (when
+  # enabled) stay warm between requests. Templates and paths are kept for the
+  # last +cache_size+ distinct ones used; a template file is parsed again once
+  # its mtime or size changed. Requests are handled by a bounded pool of worker
+  # threads; each response is written as soon as it is ready and carries the
+  # "id" of its request, so responses can arrive out of order.
+  #
+  # Every request is one JSON object with an "op", a "path" and an optional "id":
+  #
+  # - "read": the same Hash as {XmpToolkitRuby.xmp_from_file}
+  # - "read_properties": "properties" is a list of "prefix:Name"; returns their values (nil if missing)
+  # - "update": "properties" is an object of "prefix:Name" => value; returns "changed"
+  # - "apply_template": an "xmp" fragment or a "template" file path, optional "mode"
+  #   of "upsert" (default) or "override"; returns "changed"
+  #
+  # Responses are {"id", "ok" => true, "result"} or {"id", "ok" => false, "error"}.
+  #
+  # @example
+  #   XmpToolkitRuby::MetadataServer.new(workers: 8).serve($stdin, $stdout)
+  #   # <- {"id": 1, "op": "read_properties", "path": "a.jpg", "properties": ["dc:format"]}
+  #   # -> {"id":1,"ok":true,"result":{"dc:format":"image/jpeg"}}
+  class MetadataServer
+    READ_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)
+    READ_SCAN_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+    UPDATE_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler)
+    UPDATE_SCAN_FLAGS = XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_packet_scanning)
+
+    OPERATIONS = %w[read read_properties update apply_template].freeze
+
+    CACHE_SIZE = 256
+
+    # Raised for requests that cannot be understood; reported in the response.
+    class RequestError < XmpToolkitRuby::Error; end
+
+    # One client stream. Its writer is closed once the input ended and every
+    # accepted request was answered.
+    Connection = Struct.new(:writer, :pending, :lock, :done) do
+      def finish_request
+        lock.synchronize do
+          self.pending -= 1
+          done.broadcast if pending.zero?
+        end
+      end
+
+      def wait_until_answered
+        lock.synchronize { done.wait(lock) until pending.zero? }
+      end
+    end
+
+    attr_reader :workers
+
+    # @param workers [Integer] Number of threads handling requests (default: number of CPUs)
+    # @param backlog [Integer] Requests read ahead of the workers; reading pauses when it is full
+    # @param cache_size [Integer] Parsed templates and property paths kept each, least recently used dropped first
+    def initialize(workers: Etc.nprocessors, backlog: nil, cache_size: CACHE_SIZE)
+      @workers = [workers.to_i, 1].max
+      @queue = SizedQueue.new([backlog.to_i, @workers * 4].max)
+      @cache_size = [cache_size.to_i, 1].max
+      @templates = {}
+      @paths = {}
+      @cache_lock = Mutex.new
+      @served = 0
+      @served_lock = Mutex.new
+    end
+
+    # Answers the requests read from input on output until input ends.
+    #
+    # @param input [IO]
+    # @param output [IO]
+    # @return [Integer] Number of requests served
+    def serve(input, output)
+      run_workers do
+        handle_connection(input, output)
+      end
+    end
+
+    # Listens on a Unix domain socket and serves every client connection as a
+    # stream of requests until {#stop} is called.
+    #
+    # @param path [String] Socket path; a stale socket file is replaced
+    # @return [Integer] Number of requests served
+    def serve_socket(path)
+      File.unlink(path) if File.socket?(path)
+      @server = UNIXServer.new(path)
+
+      run_workers do
+        clients = []
+        loop do
+          client = @server.accept
+          clients.select!(&:alive?)
+          clients << Thread.new(client) do |socket|
+            handle_connection(socket, socket)
+          ensure
+            socket.close
+          end
+        rescue IOError, Errno::EBADF
+          break
+        end
+        clients.each(&:join)
+      end
+    ensure
+      File.unlink(path) if File.socket?(path)
+    end
+
+    # Stops {#serve_socket} from accepting clients; connected clients are still answered.
+    def stop
+      @server&.close
+    end
+
+    # Handles one decoded request.
+    #
+    # @param request [Hash]
+    # @return [Object] The "result" of the response
+    # @raise [RequestError, XmpToolkitRuby::Error, StandardError]
+    def call(request)
+      path = request["path"]
+      raise RequestError, "missing path" if path.nil? || path.to_s.empty?
+
+      case request["op"]
+      when "read" then XmpToolkitRuby.xmp_from_file(path)
+      when "read_properties" then read_properties(path, Array(request["properties"]))
+      when "update" then update(path, request["properties"] || {})
+      when "apply_template" then apply_template(path, request)
+      else raise RequestError, "unknown op #{request["op"].inspect}, expected one of #{OPERATIONS.join(", ")}"
+      end
+    end
+
+    private
+
+    def run_workers
+      XmpToolkitRuby.with_init do
+        threads = Array.new(workers) do
+          Thread.new do
+            while (job = @queue.pop)
+              connection, line = job
+              begin
+                connection.writer << respond(line)
+                connection.writer.flush
+              rescue IOError, SystemCallError
+                # The client went away; its remaining responses are dropped
+              ensure
+                connection.finish_request
+              end
+            end
+          end
+        end
+
+        begin
+          yield
+        ensure
+          @queue.close
+          threads.each(&:join)
+        end
+      end
+
+      @served
+    end
+
+    def handle_connection(input, output)
+      output.flush
+      connection = Connection.new(LineWriter.new(output.fileno), 0, Mutex.new, ConditionVariable.new)
+
+      input.each_line do |line|
+        next if line.strip.empty?
+
+        connection.lock.synchronize { connection.pending += 1 }
+        @queue << [connection, line]
+      end
+    ensure
+      if connection
+        connection.wait_until_answered
+        connection.writer.close
+      end
+    end
+
+    def respond(line)
+      request = JSON.parse(line)
+      raise RequestError, "request must be a JSON object" unless request.is_a?(Hash)
+
+      JSON.generate("id" => request["id"], "ok" => true, "result" => call(request))
+    rescue JSON::ParserError => e
+      JSON.generate("id" => nil, "ok" => false, "error" => "invalid JSON: #{e.message}")
+    rescue StandardError => e
+      JSON.generate("id" => request.is_a?(Hash) ? request["id"] : nil, "ok" => false, "error" => e.message)
+    ensure
+      @served_lock.synchronize { @served += 1 }
+    end
+
+    def read_properties(path, names)
+      xmp_paths = names.to_h { |name| [name.to_s, xmp_path(name.to_s)] }
+
+      XmpFile.with_xmp_file(path, open_flags: READ_FLAGS, fallback_flags: READ_SCAN_FLAGS,
+                                  auto_terminate_toolkit: false) do |xmp_file|
+        xmp_paths.transform_values do |path_ref|
+          property = xmp_file.property(path_ref)
+          property["exists"] ? property["value"] : nil
+        end
+      end
+    end
+
+    def update(path, properties)
+      raise RequestError, "properties must be an object" unless properties.is_a?(Hash)
+
+      edits = properties.map { |name, value| [xmp_path(name.to_s), value.to_s] }
+      write(path) { |xmp_file| edits.each { |path_ref, value| xmp_file.update_property(path_ref, value) } }
+    end
+
+    def apply_template(path, request)
+      mode = request["mode"].to_s.empty? ? :upsert : request["mode"].to_sym
+      raise RequestError, "unknown mode #{request["mode"]}" unless %i[upsert override].include?(mode)
+
+      template = if request["xmp"]
+                   cached(@templates, [:xml, request["xmp"]]) { XmpTemplate.new(request["xmp"]) }
+                 elsif request["template"]
+                   full_path = File.expand_path(request["template"])
+                   stat = File.stat(full_path)
+                   cached(@templates, [:file, full_path, stat.mtime, stat.size]) { XmpTemplate.new(File.read(full_path)) }
+                 else
+                   raise RequestError, "apply_template needs xmp or template"
+                 end
+
+      write(path) { |xmp_file| xmp_file.apply_template(template, mode: mode) }
+    end
+
+    def write(path)
+      changed = false
+
+      XmpFile.with_xmp_file(path, open_flags: UPDATE_FLAGS, fallback_flags: UPDATE_SCAN_FLAGS,
+                                  auto_terminate_toolkit: false) do |xmp_file|
+        yield xmp_file
+        changed = xmp_file.dirty?
+      end
+
+      { "changed" => changed }
+    end
+
+    def xmp_path(name)
+      cached(@paths, name) { XmpPath.parse(name) }
+    end
+
+    # Parsing happens outside the lock; two workers may parse the same key once each.
+    # The Hash keeps insertion order, so moving a hit to the end leaves the least
+    # recently used entry first.
+    def cached(cache, key)
+      value = @cache_lock.synchronize do
+        cache[key] = cache.delete(key) if cache.key?(key)
+      end
+      return value if value
+
+      value = yield
+      @cache_lock.synchronize do
+        cache[key] ||= value
+        cache.shift while cache.size > @cache_size
+        cache[key] || value
+      end
+    end
+  end
+end
@@ -74,5 +74,29 @@ module XmpToolkitRuby
 
     XMP_NS_RDF = "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
     XMP_NS_XML = "http://www.w3.org/XML/1998/namespace"
+
+    # Every namespace defined in this module, keyed by URI, with a suggested prefix derived from the
+    # constant name (XMP_NS_PDFUA_ID => "pdfuaid"). Built once at load time and shareable, so any
+    # Ractor can read it.
+    REGISTRATION_TABLE = Ractor.make_shareable(
+      constants.sort.each_with_object({}) do |name, table|
+        uri = const_get(name)
+        next unless name.start_with?("XMP_NS_") && uri.is_a?(String)
+
+        table[uri] ||= name.to_s.delete_prefix("XMP_NS_").delete("_").downcase
+      end
+    )
+
+    class << self
+      # Every namespace defined in this module, keyed by URI, with a suggested prefix derived from the
+      # constant name. Namespaces the SDK already knows keep their prefix.
+      #
+      # @return [Hash{String=>String}]
+      # @example
+      #   XmpToolkitRuby::XmpFile.register_namespaces(XmpToolkitRuby::Namespaces.registration_table)
+      def registration_table
+        REGISTRATION_TABLE
+      end
+    end
   end
 end
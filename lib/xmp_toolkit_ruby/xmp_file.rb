@@ -52,6 +52,63 @@ module XmpToolkitRuby
         XmpWrapper.register_namespace(namespace, suggested_prefix)
       end
 
+      # Register many namespaces at once, e.g. at the start of a batch job.
+      # Already registered namespaces are skipped silently, and the table is
+      # registered again automatically whenever the toolkit is re-initialized.
+      #
+      # @param table [Hash{String=>String}] Namespace URI => suggested prefix
+      #   (default: every namespace in XmpToolkitRuby::Namespaces)
+      # @return [Hash{String=>String}] Namespace URI => prefix registered by the SDK (with trailing colon)
+      def register_namespaces(table = XmpToolkitRuby::Namespaces.registration_table)
+        XmpWrapper.register_namespaces(table)
+      end
+
+      # Newest modification time across all resources of a file, e.g. the
+      # sidecars and clip folders of P2, XDCAM or AVCHD packages. Nothing is
+      # opened or parsed, so this is a cheap way to decide whether to re-extract.
+      #
+      # @param file_path [String] Path exactly as passed to #open
+      # @param format [Symbol, Integer, nil] Format hint from XmpFileFormat
+      # @param force_handler [Boolean] Trust the format hint and skip handler selection
+      # @return [Time, nil] UTC time, or nil if no smart handler supports the file
+      def file_mod_date(file_path, format: nil, force_handler: false)
+        XmpWrapper.file_mod_date(file_path.to_s, format: format_value(format), force_handler: force_handler)
+      end
+
+      # All files and folders belonging to a file's metadata; for folder based
+      # formats the package root comes first.
+      #
+      # @param (see .file_mod_date)
+      # @return [Array<String>, nil] nil if no smart handler supports the file
+      def associated_resources(file_path, format: nil, force_handler: false)
+        XmpWrapper.associated_resources(file_path.to_s, format: format_value(format), force_handler: force_handler)
+      end
+
+      # Whether metadata can be written back without opening the file. Folder
+      # based formats are writable only if every metadata file is.
+      #
+      # @param (see .file_mod_date)
+      # @return [Boolean, nil] nil if no smart handler supports the file
+      def metadata_writable?(file_path, format: nil, force_handler: false)
+        XmpWrapper.metadata_writable?(file_path.to_s, format: format_value(format), force_handler: force_handler)
+      end
+
+      # Format a smart handler would be selected for.
+      #
+      # @param file_path [String]
+      # @return [Symbol] e.g. :kXMP_JPEGFile, :kXMP_UnknownFile without a smart handler
+      def file_format(file_path)
+        XmpToolkitRuby::XmpFileFormat.name_for(XmpWrapper.check_file_format(file_path.to_s))
+      end
+
+      # Format of a package given its top-level folder, e.g. :kXMP_P2File.
+      #
+      # @param folder_path [String]
+      # @return [Symbol] :kXMP_UnknownFile if the folder is no known package
+      def package_format(folder_path)
+        XmpToolkitRuby::XmpFileFormat.name_for(XmpWrapper.check_package_format(folder_path.to_s))
+      end
+
       # Open a file with XMP support, yielding a managed XmpFile instance.
       # This method ensures the XMP toolkit is initialized and terminated,
       # and that the file is closed and written (if modified).
@@ -61,6 +118,8 @@ module XmpToolkitRuby
       # @param plugin_path [String] Directory of XMP SDK plugins (default: PLUGINS_PATH).
       # @param fallback_flags [Integer, nil] Alternate flags if primary fails.
       # @param auto_terminate_toolkit [Boolean] Shutdown toolkit after block (default: true).
+      # @param timeout [Numeric, nil] Seconds each SDK operation may take (see #initialize).
+      # @param cancellation [CancellationToken, nil] Token aborting the SDK operations once cancelled.
       # @yield [xmp_file] Gives an XmpFile instance for metadata operations.
       # @yieldparam xmp_file [XmpFile]
       # @return [void]
@@ -70,7 +129,9 @@ module XmpToolkitRuby
         open_flags: XmpFileOpenFlags::OPEN_FOR_READ,
         plugin_path: XmpToolkitRuby::PLUGINS_PATH,
         fallback_flags: nil,
-        auto_terminate_toolkit: true
+        auto_terminate_toolkit: true,
+        timeout: nil,
+        cancellation: nil
       )
         XmpToolkitRuby.check_file!(file_path,
                                    need_to_read: true,
@@ -80,14 +141,22 @@ module XmpToolkitRuby
 
         xmp_file = new(file_path,
                        open_flags: open_flags,
-                       fallback_flags: fallback_flags)
+                       fallback_flags: fallback_flags,
+                       timeout: timeout,
+                       cancellation: cancellation)
         xmp_file.open
         yield xmp_file
       ensure
-        xmp_file.write if xmp_file && XmpFileOpenFlags.contains?(xmp_file.open_flags, :open_for_update)
+        xmp_file.write if xmp_file&.open? && XmpFileOpenFlags.contains?(xmp_file.open_flags, :open_for_update) && xmp_file.dirty?
         xmp_file&.close
         XmpToolkitRuby::XmpToolkit.terminate if auto_terminate_toolkit && XmpToolkitRuby.sdk_initialized?
       end
+
+      private
+
+      def format_value(format)
+        format.nil? || format.is_a?(Integer) ? format : XmpToolkitRuby::XmpFileFormat.value_for(format)
+      end
     end
 
     # Initialize an XmpFile for a given path.
@@ -95,10 +164,20 @@ module XmpToolkitRuby
     # @param file_path [String,Pathname] Local file path to open.
     # @param open_flags [Integer] XmpFileOpenFlags bitmask (default: OPEN_FOR_READ).
     # @param fallback_flags [Integer,nil] Alternate flags on failure.
+    # @param timeout [Numeric,nil] Seconds each open, read and close may take before it is aborted
+    #   with DeadlineExceededError. The SDK checks it while it scans and copies file data.
+    # @param cancellation [CancellationToken,nil] Aborts the running and all following operations
+    #   with CancelledError once cancelled, from any thread.
     # @raise [ArgumentError] if file_path is not readable.
+    # @note With a timeout or a cancellation token, Thread#raise and Timeout.timeout abort a running
+    #   operation too. Updates that can be aborted are written through a temporary file where the
+    #   handler supports it, so an aborted #close leaves the original file untouched. Where it
+    #   doesn't, the update is written in place and not aborted once it started: #close finishes
+    #   writing and only then raises the timeout or cancellation.
     # @example
     #   XmpFile.new("photo.tif", open_flags: XmpFileOpenFlags::OPEN_FOR_UPDATE)
-    def initialize(file_path, open_flags: XmpFileOpenFlags::OPEN_FOR_READ, fallback_flags: nil)
+    def initialize(file_path, open_flags: XmpFileOpenFlags::OPEN_FOR_READ, fallback_flags: nil, timeout: nil,
+                   cancellation: nil)
       @file_path = file_path.to_s
       raise ArgumentError, "File path '#{@file_path}' must exist and be readable" unless File.readable?(@file_path)
 
@@ -106,6 +185,25 @@ module XmpToolkitRuby
       @fallback_flags = fallback_flags
       @open = false
       @xmp_wrapper = XmpWrapper.new
+      @xmp_wrapper.timeout = timeout if timeout
+      @xmp_wrapper.cancellation = cancellation if cancellation
+    end
+
+    # Report the progress of writing updates, which happens in #close.
+    # Not every file handler reports progress.
+    #
+    # @param interval [Numeric] Minimum seconds between two reports.
+    # @yieldparam fraction_done [Float] 0.0 to 1.0, or 0.0 if unknown.
+    # @yieldparam elapsed [Float] Seconds since the write started.
+    # @yieldparam seconds_to_go [Float] Estimated seconds left, or 0.0 if unknown.
+    # @return [self]
+    # @note An exception raised by the block aborts the write and is re-raised by #close; for an
+    #   update written in place, after the write finished.
+    # @example
+    #   xmp.on_progress(interval: 0.5) { |done, _elapsed, _to_go| puts "#{(done * 100).round}%" }
+    def on_progress(interval: 1.0, &block)
+      @xmp_wrapper.set_progress(interval, block)
+      self
     end
 
     # Open the file for XMP operations.
@@ -131,6 +229,18 @@ module XmpToolkitRuby
       end
     end
 
+    # Open the file from the MetadataCache only, without initializing the toolkit or touching the file.
+    # Tries the open flags first and the fallback flags second.
+    #
+    # @return [Boolean] true on a cache hit, false if the file has to be opened with #open
+    def open_cached
+      return true if open?
+      return false unless MetadataCache.enabled?
+
+      @open = @xmp_wrapper.open_cached(file_path, open_flags) ||
+              (!fallback_flags.nil? && @xmp_wrapper.open_cached(file_path, fallback_flags))
+    end
+
     # @return [Boolean] Whether the file is currently open for XMP operations.
     def open?
       @open
@@ -163,6 +273,28 @@ module XmpToolkitRuby
       @packet_info ||= @xmp_wrapper.packet_info
     end
 
+    # Read/write/seek calls and bytes the SDK handler needed for this file,
+    # including the temporary file of a safe update. Complete only after #close,
+    # which is when updates are written. Requires XmpToolkit.io_accounting = true.
+    #
+    # @return [Hash{String=>Numeric}, nil] "reads", "bytes_read", "writes", "bytes_written", "seeks",
+    #   "packet_bytes" and "write_amplification" (bytes written per packet byte), or nil
+    #   if the file was not opened with I/O accounting
+    def io_stats
+      @xmp_wrapper.io_stats
+    end
+
+    # Errors the SDK reported and recovered from while reading or writing this
+    # file, e.g. a damaged packet or a handler falling back to packet scanning.
+    # Kept after #close; at most 64 are collected, the rest only counted in the
+    # rate limited warnings (see XmpToolkit.error_log_rate).
+    #
+    # @return [Array<Hash{String=>Object}>] "severity" (:recoverable, :operation_fatal,
+    #   :file_fatal or :process_fatal), "cause" (XMP_Error id), "path" and "message"
+    def warnings
+      @xmp_wrapper.warnings
+    end
+
     # Get parsed XMP metadata and packet boundaries.
     #
     # @return [Hash]
@@ -192,15 +324,24 @@ module XmpToolkitRuby
     # rubocop:enable Metrics/AbcSize
 
     # Persist all pending XMP updates to the file.
+    # Files whose metadata did not change are left untouched.
     #
     # @raise [RuntimeError] unless file is open.
-    # @return [void]
+    # @return [Boolean] true if the metadata was written, false if there was nothing to write
     def write
       raise "File not open; cannot write" unless open?
 
       @xmp_wrapper.write
     end
 
+    # Whether any update changed the metadata since the file was opened or last written.
+    # Setters that store a value equal to the current one keep the file clean.
+    #
+    # @return [Boolean]
+    def dirty?
+      open? && @xmp_wrapper.dirty?
+    end
+
     # Bulk update XMP metadata using an RDF/XML string.
     #
     # @param xmp_data [String] Full RDF/XML payload or fragment
@@ -211,15 +352,33 @@ module XmpToolkitRuby
       @xmp_wrapper.update_meta(xmp_data, mode: mode)
     end
 
+    # Apply a pre-parsed XmpTemplate, using the XmpTemplateFlags it was created with.
+    #
+    # @param template [XmpTemplate] Template parsed once and shared across files
+    # @param mode [Symbol] :upsert (default) or :override to erase existing metadata first
+    # @return [void]
+    # @example
+    #   template = XmpTemplate.new(rights_xml, flags: XmpTemplateFlags.bitmask_for(:add_new_properties, :replace_with_delete_empty))
+    #   xmp_file.apply_template(template)
+    def apply_template(template, mode: :upsert)
+      open
+      @xmp_wrapper.apply_template(template, mode: mode)
+    end
+
     # Update a single property in the XMP schema.
     #
-    # @param namespace [String] Schema namespace URI
-    # @param property [String] Qualified property name (without prefix)
-    # @param value [String] New value for the property
+    # The property is addressed either by namespace and name or by a precompiled XmpPath.
+    #
+    # @param property_ref [Array(String, String), Array(XmpPath)] Schema namespace URI and
+    #   property name (without prefix), or a single XmpPath
+    # @param value [String, XmpValue] New value for the property
     # @return [void]
-    def update_property(namespace, property, value)
+    # @example
+    #   xmp_file.update_property(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer", "ACME")
+    #   xmp_file.update_property(XmpPath.parse("pdf:Producer"), "ACME")
+    def update_property(*property_ref, value)
       open
-      @xmp_wrapper.update_property(namespace, property, value)
+      @xmp_wrapper.update_property(*property_ref, value)
     end
 
     # Retrieve the value of a simple XMP property.
@@ -227,13 +386,14 @@ module XmpToolkitRuby
     # This will open the file (if not already open), query the underlying
     # SDK for the given namespace + property, and return whatever value is stored.
     #
-    # @param namespace [String] Namespace URI of the schema (e.g. "http://ns.adobe.com/photoshop/1.0/")
-    # @param property [String] Property name (without prefix), e.g. "CreatorTool"
+    # @param property_ref [Array(String, String), Array(XmpPath)] Namespace URI of the schema
+    #   (e.g. "http://ns.adobe.com/photoshop/1.0/") and property name (without prefix, e.g. "CreatorTool"),
+    #   or a single XmpPath
     # @return [String, nil] The value of the property, or nil if not set
     # @raise [RuntimeError] if the file cannot be opened
-    def property(namespace, property)
+    def property(*property_ref)
       open
-      @xmp_wrapper.property(namespace, property)
+      @xmp_wrapper.property(*property_ref)
     end
 
     # Retrieve a localized (alt-text) value from an XMP array.
@@ -242,18 +402,19 @@ module XmpToolkitRuby
     # `alt_text_name` in the given `schema_ns`, then returns the string
     # matching the requested generic and specific language codes.
     #
+    # @param path [XmpPath, nil] Precompiled path of the alt-text array, replaces schema_ns/alt_text_name
     # @param schema_ns [String] Namespace URI of the alt-text schema
     # @param alt_text_name [String] The name of the localized text array
     # @param generic_lang [String] Base language code (e.g. "en")
     # @param specific_lang [String] Locale variant (e.g. "en-US")
     # @return [String, nil] The localized string for that locale, or nil if not found
     # @raise [RuntimeError] if the file cannot be opened
-    def localized_property(schema_ns:, alt_text_name:, generic_lang:, specific_lang:)
+    def localized_property(path = nil, generic_lang:, specific_lang:, schema_ns: nil, alt_text_name: nil)
       open
 
       @xmp_wrapper.localized_property(
-        schema_ns: schema_ns,
-        alt_text_name: alt_text_name,
+        *path,
+        **alt_text_ref(path, schema_ns, alt_text_name),
         generic_lang: generic_lang,
         specific_lang: specific_lang
       )
@@ -261,6 +422,7 @@ module XmpToolkitRuby
 
     # Update an alternative-text (localized string) property.
     #
+    # @param path [XmpPath, nil] Precompiled path of the alt-text array, replaces schema_ns/alt_text_name
     # @param schema_ns [String] Namespace URI of the alt-text schema
     # @param alt_text_name [String] Name of the alt-text array
     # @param generic_lang [String] Base language (e.g. "en")
@@ -268,11 +430,11 @@ module XmpToolkitRuby
     # @param item_value [String] Localized string value
     # @param options [Integer] Bitmask for array operations (see SDK)
     # @return [void]
-    def update_localized_property(schema_ns:, alt_text_name:, generic_lang:, specific_lang:, item_value:, options:)
+    def update_localized_property(path = nil, generic_lang:, specific_lang:, item_value:, options:, schema_ns: nil, alt_text_name: nil)
       open
       @xmp_wrapper.update_localized_property(
-        schema_ns: schema_ns,
-        alt_text_name: alt_text_name,
+        *path,
+        **alt_text_ref(path, schema_ns, alt_text_name),
         generic_lang: generic_lang,
         specific_lang: specific_lang,
         item_value: item_value,
@@ -280,17 +442,107 @@ module XmpToolkitRuby
       )
     end
 
+    # Retrieve all items of an XMP array (bag, seq or alt) in one call.
+    #
+    # @param property_ref [Array(String, String), Array(XmpPath)] Namespace URI of the schema
+    #   (e.g. XmpToolkitRuby::Namespaces::XMP_NS_DC) and array name (e.g. "subject"), or a single XmpPath
+    # @return [Hash] "exists", "options" and "items" (Array of String, in array order)
+    # @raise [RuntimeError] if the file cannot be opened
+    # @example
+    #   xmp_file.array_property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")["items"]
+    #   # => ["XMP", "Blue Square", "test file"]
+    def array_property(*property_ref)
+      open
+      @xmp_wrapper.array_items(*property_ref)
+    end
+
+    # Replace all items of an XMP array in one call.
+    #
+    # The existing array form is kept unless `form` is given; new arrays are created as bags.
+    # An empty `items` array leaves an empty container behind.
+    #
+    # @param property_ref [Array(String, String), Array(XmpPath)] Namespace URI of the schema and
+    #   array name (e.g. "subject"), or a single XmpPath
+    # @param items [Array<String>] New item values
+    # @param form [Symbol, nil] :bag, :seq or :alt
+    # @return [void]
+    def update_array_property(*property_ref, items, form: nil)
+      open
+      @xmp_wrapper.update_array_items(*property_ref, items, form: form)
+    end
+
+    # Retrieve all items of an XMP array as a single edit string.
+    #
+    # @param property_ref [Array(String, String), Array(XmpPath)] Namespace URI of the schema and
+    #   array name, or a single XmpPath
+    # @param separator [String] String placed between the items (default: "; ")
+    # @param quotes [String] Quote used around items that contain the separator (default: '"')
+    # @return [String] The catenated items, empty if the array does not exist
+    def catenated_array_property(*property_ref, separator: "; ", quotes: '"')
+      open
+      @xmp_wrapper.catenated_array_items(*property_ref, separator: separator, quotes: quotes)
+    end
+
+    # Update an XMP array from an edit string as produced by #catenated_array_property.
+    #
+    # @param property_ref [Array(String, String), Array(XmpPath)] Namespace URI of the schema and
+    #   array name, or a single XmpPath
+    # @param value [String] Items separated by semicolons (or commas if `allow_commas` is set)
+    # @param form [Symbol, nil] :bag, :seq or :alt
+    # @param allow_commas [Boolean] Treat commas as separators as well
+    # @return [void]
+    def separate_array_property(*property_ref, value, form: nil, allow_commas: false)
+      open
+      @xmp_wrapper.separate_array_items(*property_ref, value, form: form, allow_commas: allow_commas)
+    end
+
+    # Retrieve every language alternative of an alt-text array at once.
+    #
+    # @param path [XmpPath, nil] Precompiled path of the alt-text array, replaces schema_ns/alt_text_name
+    # @param schema_ns [String] Namespace URI of the alt-text schema
+    # @param alt_text_name [String] The name of the localized text array
+    # @return [Hash{String=>String}] `xml:lang` value => text, in array order
+    # @example
+    #   xmp_file.localized_properties(schema_ns: XmpToolkitRuby::Namespaces::XMP_NS_DC, alt_text_name: "title")
+    #   # => { "x-default" => "Golden Sample PDF", "de-DE" => "Goldene Beispiel-PDF" }
+    def localized_properties(path = nil, schema_ns: nil, alt_text_name: nil)
+      open
+      @xmp_wrapper.localized_properties(*path, **alt_text_ref(path, schema_ns, alt_text_name))
+    end
+
     # Close the file and clear internal state.
     # @return [void]
+    # @raise [BusyError] if another call on this file is still running; the file then stays open.
     def close
       return unless open?
 
-      @open = false
       @xmp_wrapper.close
+      @open = false
+    rescue BusyError
+      raise
+    rescue StandardError
+      # A failed or aborted close still let go of the file
+      @open = false
+      raise
     end
 
     private
 
+    # Internal helper that forwards schema_ns/alt_text_name only when no XmpPath is given.
+    #
+    # @param path [XmpPath, nil]
+    # @param schema_ns [String, nil]
+    # @param alt_text_name [String, nil]
+    # @return [Hash]
+    # @api private
+    def alt_text_ref(path, schema_ns, alt_text_name)
+      return {} if path
+
+      raise ArgumentError, "schema_ns and alt_text_name are required without an XmpPath" if schema_ns.nil? || alt_text_name.nil?
+
+      { schema_ns: schema_ns, alt_text_name: alt_text_name }
+    end
+
     # Internal helper to map raw handler flags to named symbols.
     #
     # @param handler_flags [Integer,nil]
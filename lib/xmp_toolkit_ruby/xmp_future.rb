@@ -0,0 +1,24 @@
+# frozen_string_literal: true
+
+module XmpToolkitRuby
+  # The pending result of XmpToolkitRuby.read_async. The read runs on a native
+  # worker thread; #ready? polls it, #wait blocks for it with an optional
+  # timeout, and #value returns what XmpToolkitRuby.xmp_from_file would.
+  #
+  # @example
+  #   future = XmpToolkitRuby.read_async("image.jpg", timeout: 5)
+  #   do_other_work
+  #   future.value["xmp_data"]
+  class XmpFuture
+    # Waits for the read and returns its metadata, formatted once and kept.
+    #
+    # @return [Hash] The Hash XmpToolkitRuby.xmp_from_file returns.
+    # @raise [CancelledError] If the read was cancelled.
+    # @raise [DeadlineExceededError] If the read took longer than its timeout.
+    # @raise [IOError] If the SDK could not open the file.
+    # @raise [RuntimeError] If the SDK failed to read it.
+    def value
+      @value ||= XmpToolkitRuby.read_result(result)
+    end
+  end
+end
@@ -0,0 +1,65 @@
+# frozen_string_literal: true
+
+module XmpToolkitRuby
+  module XmpTemplateFlags
+    INCLUDE_INTERNAL_PROPERTIES = 0x0000_0001 # Include internal properties in the template operation
+    REPLACE_EXISTING_PROPERTIES = 0x0000_0002 # Replace existing values with the template values
+    REPLACE_WITH_DELETE_EMPTY = 0x0000_0004 # Replace existing values, delete properties whose template value is empty
+    ADD_NEW_PROPERTIES = 0x0000_0008 # Add properties that only exist in the template
+    CLEAR_UNNAMED_PROPERTIES = 0x0000_0010 # Delete properties that are not named in the template
+
+    FLAGS = {
+      include_internal_properties: INCLUDE_INTERNAL_PROPERTIES,
+      replace_existing_properties: REPLACE_EXISTING_PROPERTIES,
+      replace_with_delete_empty: REPLACE_WITH_DELETE_EMPTY,
+      add_new_properties: ADD_NEW_PROPERTIES,
+      clear_unnamed_properties: CLEAR_UNNAMED_PROPERTIES
+    }.freeze
+
+    FLAGS_BY_VALUE = FLAGS.invert.freeze
+
+    # Flags used by XmpFile#update_meta in :upsert mode and by XmpTemplate when none are given.
+    UPSERT = ADD_NEW_PROPERTIES | REPLACE_EXISTING_PROPERTIES | INCLUDE_INTERNAL_PROPERTIES
+
+    class << self
+      def value_for(name)
+        key = name.is_a?(String) ? name.to_sym : name
+        FLAGS[key]
+      end
+
+      def name_for(hex_value)
+        FLAGS_BY_VALUE[hex_value]
+      end
+
+      def flags_for(bitmask)
+        FLAGS.select { |_, bit| bitmask.anybits?(bit) }.keys
+      end
+
+      def contains?(bitmask, flag)
+        raise ArgumentError, "Invalid flag type: #{flag.class}" unless flag.is_a?(Symbol) || flag.is_a?(String)
+
+        bitmask & value_for(flag) != 0
+      end
+
+      # Takes multiple flag names (symbols or strings) or constants,
+      # returns combined bitmask OR-ing all.
+      #
+      # Example:
+      #   bitmask_for(:add_new_properties, :replace_with_delete_empty)
+      #   bitmask_for(ADD_NEW_PROPERTIES, CLEAR_UNNAMED_PROPERTIES)
+      def bitmask_for(*args)
+        args.reduce(0) do |mask, flag|
+          val = case flag
+                when Symbol, String then value_for(flag)
+                when Integer then flag
+                else
+                  raise ArgumentError, "Invalid flag type: #{flag.class}"
+                end
+          raise ArgumentError, "Unknown flag: #{flag.inspect}" unless val
+
+          mask | val
+        end
+      end
+    end
+  end
+end
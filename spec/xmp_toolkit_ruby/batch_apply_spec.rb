@@ -0,0 +1,59 @@
+# frozen_string_literal: true
+
+require "json"
+require "tmpdir"
+
+RSpec.describe XmpToolkitRuby::BatchApply do
+  let(:dir) { Dir.mktmpdir }
+  let(:files) do
+    %w[a.pdf b.pdf].map do |name|
+      File.join(dir, name).tap { |path| FileUtils.cp(File.expand_path("../fixtures/sample.pdf", __dir__), path) }
+    end
+  end
+  let(:manifest) { File.join(dir, "fixes.ndjson") }
+
+  after do
+    FileUtils.rm_rf(dir)
+  end
+
+  it "coalesces edits per file and reports failures" do
+    File.write(manifest, [
+      { "path" => files[0], "property" => "pdf:Producer", "value" => "ACME PDF" },
+      { "path" => files[0], "properties" => { "pdf:Keywords" => "batch" } },
+      { "path" => files[1], "property" => "pdf:Producer", "value" => "ACME PDF" },
+      { "path" => File.join(dir, "missing.pdf"), "property" => "pdf:Producer", "value" => "ACME PDF" }
+    ].map { |entry| JSON.generate(entry) }.join("\n"))
+    failures = Tempfile.new("failures")
+
+    result = described_class.new(manifest, workers: 2, failures: failures).run
+
+    expect(result).to include("files" => 3, "edits" => 4, "changed" => 2, "failed" => 1)
+    expect(XmpToolkitRuby.xmp_from_file(files[0])["xmp_data"]).to include("ACME PDF", "batch")
+    expect(File.readlines(failures.path).map { |line| JSON.parse(line)["path"] }).to eq([File.join(dir, "missing.pdf")])
+  end
+
+  it "leaves a file untouched when one of its edits fails" do
+    original = File.binread(files[0])
+    File.write(manifest, JSON.generate("path" => files[0], "properties" => { "pdf:Producer" => "ACME PDF", "dc:title" => "flat" }))
+
+    result = described_class.new(manifest).run
+
+    expect(result).to include("files" => 1, "changed" => 0, "failed" => 1)
+    expect(File.binread(files[0])).to eq(original)
+  end
+
+  it "resolves relative paths against the manifest's directory" do
+    File.write(manifest, JSON.generate("path" => File.basename(files[0]), "property" => "pdf:Producer", "value" => "ACME PDF"))
+
+    result = Dir.chdir(Dir.tmpdir) { described_class.new(manifest).run }
+
+    expect(result).to include("files" => 1, "changed" => 1, "failed" => 0)
+    expect(XmpToolkitRuby.xmp_from_file(files[0])["xmp_data"]).to include("ACME PDF")
+  end
+
+  it "rejects malformed entries before writing anything" do
+    File.write(manifest, JSON.generate("path" => files[0], "property" => "nope:Unknown", "value" => "x"))
+
+    expect { described_class.new(manifest).run }.to raise_error(described_class::ManifestError, /nope/)
+  end
+end
@@ -0,0 +1,51 @@
+# frozen_string_literal: true
+
+require "json"
+require "tmpdir"
+
+RSpec.describe XmpToolkitRuby::DirectoryScanner do
+  let(:dir) { Dir.mktmpdir }
+
+  before do
+    FileUtils.mkdir_p(File.join(dir, "docs"))
+    FileUtils.cp(File.expand_path("../fixtures/sample.pdf", __dir__), File.join(dir, "docs", "a.pdf"))
+    FileUtils.cp(File.expand_path("../fixtures/sample.pdf", __dir__), File.join(dir, "docs", "b.pdf"))
+    File.write(File.join(dir, "notes.txt"), "no metadata here")
+  end
+
+  after do
+    FileUtils.rm_rf(dir)
+  end
+
+  it "writes one JSON line per selected file" do
+    output = Tempfile.new("scan")
+    scanner = described_class.new(dir, workers: 2, formats: ["PDF"], properties: ["pdf:Producer"])
+
+    expect(scanner.scan(output)).to eq("files" => 2, "errors" => 0)
+
+    records = File.readlines(output.path).map { |line| JSON.parse(line) }
+    expect(records.map { |record| File.basename(record["path"]) }).to contain_exactly("a.pdf", "b.pdf")
+    expect(records.first).to include("format" => "kXMP_PDFFile", "properties" => include("pdf:Producer"))
+  end
+
+  it "honours exclude globs" do
+    scanner = described_class.new(dir, exclude: ["docs"])
+
+    expect(scanner.enum_for(:each_target).map(&:first)).to eq([File.join(dir, "notes.txt")])
+  end
+
+  it "reports unreadable directories and keeps walking" do
+    skip "root can list any directory" if Process.uid.zero?
+
+    locked = File.join(dir, "locked")
+    FileUtils.mkdir_p(locked)
+    File.chmod(0o000, locked)
+    scanner = described_class.new(dir, exclude: ["docs"])
+
+    targets = scanner.enum_for(:each_target).to_a
+    expect(targets.map(&:first)).to eq([locked, File.join(dir, "notes.txt")])
+    expect(targets.first.last).to match(/Permission denied/)
+  ensure
+    File.chmod(0o700, locked)
+  end
+end
@@ -0,0 +1,119 @@
+# frozen_string_literal: true
+
+require "tempfile"
+
+RSpec.describe "XmpToolkitRuby under a Fiber scheduler" do
+  # Just enough of a scheduler to wait for readable IO, like the reactor of an async server
+  let(:scheduler_class) do
+    Class.new do
+      def initialize
+        @waiting = {}
+        @ready = []
+      end
+
+      def fiber(&block)
+        Fiber.new(blocking: false, &block).tap(&:resume)
+      end
+
+      def io_wait(io, events, _timeout)
+        @waiting[io] = Fiber.current
+        Fiber.yield
+        events
+      end
+
+      def block(_blocker, _timeout = nil)
+        Fiber.yield
+      end
+
+      def unblock(_blocker, fiber)
+        @ready << fiber
+      end
+
+      def kernel_sleep(_duration = nil)
+        @ready << Fiber.current
+        Fiber.yield
+      end
+
+      def close
+        until @waiting.empty? && @ready.empty?
+          @ready.shift.resume until @ready.empty?
+          next if @waiting.empty?
+
+          readable, = IO.select(@waiting.keys)
+          readable.each { |io| @waiting.delete(io).resume }
+        end
+      end
+    end
+  end
+
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  def in_scheduler(scheduler = scheduler_class.new, &block)
+    Thread.new do
+      Fiber.set_scheduler(scheduler)
+      block.call
+    end.join
+  end
+
+  it "keeps several reads in flight on one thread" do
+    producers = []
+    in_flight = 0
+    most_in_flight = 0
+
+    XmpToolkitRuby.with_init do
+      in_scheduler do
+        4.times do
+          Fiber.schedule do
+            in_flight += 1
+            most_in_flight = [most_in_flight, in_flight].max
+            xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+            producers << xmp_file.property(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer")["value"]
+          ensure
+            xmp_file&.close
+            in_flight -= 1
+          end
+        end
+      end
+    end
+
+    expect(producers).to eq(["Skia/PDF m134"] * 4)
+    expect(most_in_flight).to be > 1
+  end
+
+  it "lets a throw out of the wait carry on once the call ended" do
+    thrower = Class.new(scheduler_class) do
+      def io_wait(_io, _events, _timeout)
+        throw :stop
+      end
+    end
+    # Scanning megabytes for the packet keeps the worker busy until the fiber waits
+    padded = Tempfile.new(["padded", File.extname(sample)])
+    padded.write(File.binread(sample), "\0" * (16 << 20))
+    padded.flush
+    flags = XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_packet_scanning)
+    outcome = :not_run
+    xmp_file = nil
+
+    XmpToolkitRuby.with_init do
+      in_scheduler(thrower.new) do
+        Fiber.schedule do
+          xmp_file = XmpToolkitRuby::XmpFile.new(padded.path, open_flags: flags)
+          outcome = catch(:stop) { xmp_file.open }
+        end
+      end
+    end
+
+    expect(outcome).to be_nil
+    expect(xmp_file).not_to be_open
+  end
+
+  it "limits the native worker threads" do
+    limit = XmpToolkitRuby::XmpToolkit.worker_threads
+    XmpToolkitRuby::XmpToolkit.worker_threads = 1
+
+    expect(XmpToolkitRuby::XmpToolkit.worker_threads).to eq(1)
+    expect { XmpToolkitRuby::XmpToolkit.worker_threads = 0 }.to raise_error(ArgumentError)
+  ensure
+    XmpToolkitRuby::XmpToolkit.worker_threads = limit
+  end
+end
@@ -0,0 +1,80 @@
+# frozen_string_literal: true
+
+require "tempfile"
+
+RSpec.describe XmpToolkitRuby::MetadataCache do
+  def fixture_file_clone(filename)
+    orig_file = File.expand_path("../fixtures/#{filename}", __dir__)
+    cloned_file = Tempfile.new(File.basename(orig_file))
+
+    FileUtils.cp(orig_file, cloned_file.path)
+    cloned_file
+  end
+
+  let(:filename) { fixture_file_clone("sample.pdf").path }
+
+  before do
+    described_class.enable
+    described_class.clear
+  end
+
+  after do
+    described_class.disable
+  end
+
+  it "serves repeated reads from the cache" do
+    first = XmpToolkitRuby.xmp_from_file(filename)
+    second = XmpToolkitRuby.xmp_from_file(filename)
+
+    expect(second).to eq(first)
+    expect(described_class.stats).to include("hits" => 1, "misses" => 1, "entries" => 1)
+  end
+
+  it "drops files written through the library" do
+    XmpToolkitRuby.xmp_from_file(filename)
+
+    XmpToolkitRuby::XmpFile.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler)) do |xmp_file|
+      xmp_file.update_property XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer", "ACME PDF"
+    end
+
+    expect(XmpToolkitRuby.xmp_from_file(filename)["xmp_data"]).to include("ACME PDF")
+  end
+
+  it "evicts entries beyond the byte budget" do
+    described_class.enable(max_bytes: 1)
+
+    XmpToolkitRuby.xmp_from_file(filename)
+
+    expect(described_class.stats).to include("entries" => 0, "max_bytes" => 1)
+  end
+
+  context "with a shared region" do
+    let(:shared_path) { Tempfile.new("xmp_cache").path }
+
+    before do
+      described_class.enable(shared_path: shared_path, max_bytes: 1024 * 1024)
+      described_class.clear
+    end
+
+    it "serves reads cached by a forked worker" do
+      pid = fork do
+        XmpToolkitRuby.xmp_from_file(filename)
+        exit!(0)
+      end
+      Process.wait(pid)
+
+      XmpToolkitRuby.xmp_from_file(filename)
+
+      expect(described_class.stats).to include("backend" => "shared", "hits" => 1, "misses" => 1, "entries" => 1)
+    end
+
+    it "refuses a file that is not a cache instead of resetting it" do
+      foreign = Tempfile.new("not_a_cache")
+      foreign.write("precious data " * 64)
+      foreign.flush
+
+      expect { described_class.enable(shared_path: foreign.path) }.to raise_error(RuntimeError, /not a shared metadata cache/)
+      expect(File.read(foreign.path)).to eq("precious data " * 64)
+    end
+  end
+end
@@ -0,0 +1,104 @@
+# frozen_string_literal: true
+
+require "tmpdir"
+
+RSpec.describe XmpToolkitRuby::MetadataIndex do
+  let(:dir) { Dir.mktmpdir }
+  let(:index_path) { File.join(dir, "assets.xmpidx") }
+  let(:assets) { File.join(dir, "assets").tap { |path| FileUtils.mkdir_p(path) } }
+  let(:asset) { File.join(assets, "sample.pdf") }
+
+  before do
+    FileUtils.cp(File.expand_path("../fixtures/sample.pdf", __dir__), asset)
+  end
+
+  after do
+    FileUtils.rm_rf(dir)
+  end
+
+  it "keeps entries across reopening" do
+    index = described_class.new(index_path)
+    index.store(asset, "<x:xmpmeta/>")
+    index.close
+
+    reopened = described_class.new(index_path, readonly: true)
+
+    expect(reopened[asset]).to eq("<x:xmpmeta/>")
+    expect(reopened).to be_fresh(asset)
+  ensure
+    reopened&.close
+  end
+
+  it "re-extracts only changed files on refresh" do
+    index = described_class.new(index_path)
+
+    expect(index.refresh(assets)).to include("checked" => 1, "updated" => 1)
+    expect(index[asset]).to include("x:xmpmeta")
+    expect(index.refresh(assets)).to include("checked" => 1, "updated" => 0)
+
+    FileUtils.rm(asset)
+
+    expect(index.refresh(assets)).to include("removed" => 1)
+    expect(index.size).to eq(0)
+  ensure
+    index.close
+  end
+
+  context "with more than one entry" do
+    let(:other) { File.join(assets, "other.pdf").tap { |path| FileUtils.cp(asset, path) } }
+    let(:packet) { "<x:xmpmeta>#{"<dc:subject>keyword</dc:subject>" * 200}</x:xmpmeta>" }
+
+    it "compresses large packets" do
+      index = described_class.new(index_path)
+      skip "built without zlib" unless index.stats["compression"]
+
+      index.store(asset, packet)
+
+      expect(index.stats["bytes"]).to be < packet.bytesize
+      expect(index[asset]).to eq(packet)
+    ensure
+      index.close
+    end
+
+    it "drops a torn record at the end of the file" do
+      index = described_class.new(index_path)
+      index.store(asset, "<first/>")
+      intact = index.stats["bytes"]
+      index.store(other, "<second/>")
+      index.close
+
+      File.truncate(index_path, File.size(index_path) - 3)
+      reopened = described_class.new(index_path)
+
+      expect(reopened[asset]).to eq("<first/>")
+      expect(reopened[other]).to be_nil
+      expect(File.size(index_path)).to eq(intact)
+
+      reopened.store(other, "<again/>")
+      expect(reopened[other]).to eq("<again/>")
+    ensure
+      reopened&.close
+    end
+
+    it "compacts superseded records, and readers switch to the compacted file" do
+      index = described_class.new(index_path)
+      index.store(asset, "<old/>")
+      index.store(asset, "<new/>")
+      reader = described_class.new(index_path, readonly: true)
+      index.store(other, "<other/>")
+
+      expect(index.stats["garbage_bytes"]).to be > 0
+      expect(reader[other]).to be_nil
+
+      index.compact
+
+      expect(index.stats["garbage_bytes"]).to eq(0)
+      expect(index[asset]).to eq("<new/>")
+      expect(reader[other]).to eq("<other/>")
+      expect(reader.size).to eq(2)
+    ensure
+      reader&.close
+      index.close
+    end
+  end
+end
@@ -0,0 +1,61 @@
+# frozen_string_literal: true
+
+require "json"
+require "stringio"
+require "tmpdir"
+
+RSpec.describe XmpToolkitRuby::MetadataServer do
+  let(:dir) { Dir.mktmpdir }
+  let(:file) { fixture_copy("a.pdf") }
+  let(:other_file) { fixture_copy("b.pdf") }
+
+  after do
+    FileUtils.rm_rf(dir)
+  end
+
+  def fixture_copy(name)
+    File.join(dir, name).tap { |path| FileUtils.cp(File.expand_path("../fixtures/sample.pdf", __dir__), path) }
+  end
+
+  def serve(*requests)
+    input = StringIO.new(requests.map { |request| request.is_a?(String) ? request : JSON.generate(request) }.join("\n"))
+    reader, writer = IO.pipe
+    served = described_class.new(workers: 2).serve(input, writer)
+    writer.close
+
+    [served, reader.each_line.map { |line| JSON.parse(line) }.to_h { |response| [response["id"], response] }]
+  ensure
+    reader&.close
+  end
+
+  it "answers every request with its id" do
+    served, responses = serve(
+      { "id" => 1, "op" => "update", "path" => file, "properties" => { "pdf:Producer" => "ACME PDF" } },
+      { "id" => 2, "op" => "read_properties", "path" => other_file, "properties" => ["dc:nope"] },
+      { "id" => 3, "op" => "frobnicate", "path" => file },
+      "not json"
+    )
+
+    expect(served).to eq(4)
+    expect(responses[1]).to eq("id" => 1, "ok" => true, "result" => { "changed" => true })
+    expect(responses[2]).to eq("id" => 2, "ok" => true, "result" => { "dc:nope" => nil })
+    expect(responses[3]).to include("ok" => false, "error" => /unknown op/)
+    expect(responses[nil]).to include("ok" => false, "error" => /invalid JSON/)
+  end
+
+  it "keeps only the most recently used parsed entries" do
+    server = described_class.new(workers: 1, cache_size: 2)
+    cache = {}
+
+    %w[a b a c].each { |key| server.send(:cached, cache, key) { key.upcase } }
+
+    expect(cache).to eq("a" => "A", "c" => "C")
+  end
+
+  it "reads what it wrote" do
+    serve({ "id" => "w", "op" => "update", "path" => file, "properties" => { "pdf:Producer" => "ACME PDF" } })
+    _, responses = serve({ "id" => "r", "op" => "read_properties", "path" => file, "properties" => ["pdf:Producer"] })
+
+    expect(responses["r"]["result"]).to eq("pdf:Producer" => "ACME PDF")
+  end
+end
@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+RSpec.describe "XmpToolkitRuby in Ractors" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  around do |example|
+    experimental = Warning[:experimental]
+    Warning[:experimental] = false
+    example.run
+  ensure
+    Warning[:experimental] = experimental
+  end
+
+  def ractor_result(ractor)
+    ractor.respond_to?(:value) ? ractor.value : ractor.take
+  end
+
+  it "shares its constants" do
+    expect(Ractor.shareable?(XmpToolkitRuby::PLUGINS_PATH)).to be(true)
+    expect(Ractor.shareable?(XmpToolkitRuby::Namespaces.registration_table)).to be(true)
+    expect(Ractor.shareable?(XmpToolkitRuby::XmpFileOpenFlags::FLAGS)).to be(true)
+    expect(Ractor.shareable?(XmpToolkitRuby::XmpFileFormat::FORMATS)).to be(true)
+  end
+
+  it "shares cancellation tokens and parsed paths" do
+    XmpToolkitRuby.with_init do
+      path = XmpToolkitRuby::XmpPath.new(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer")
+
+      expect(Ractor.shareable?(XmpToolkitRuby::CancellationToken.new)).to be(true)
+      expect(Ractor.shareable?(path)).to be(true)
+    end
+  end
+
+  it "reads the same file in several Ractors" do
+    ractors = Array.new(2) do
+      Ractor.new(sample) do |file_path|
+        XmpToolkitRuby.with_init do
+          xmp_file = XmpToolkitRuby::XmpFile.new(file_path)
+          xmp_file.property(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer")["value"]
+        ensure
+          xmp_file&.close
+        end
+      end
+    end
+
+    expect(ractors.map { |ractor| ractor_result(ractor) }).to all(eq("Skia/PDF m134"))
+  end
+
+  it "keeps the stats hook per Ractor" do
+    XmpToolkitRuby::XmpToolkit.stats_hook = ->(*) {}
+
+    hook = Ractor.new { XmpToolkitRuby::XmpToolkit.stats_hook }
+
+    expect(ractor_result(hook)).to be_nil
+  ensure
+    XmpToolkitRuby::XmpToolkit.stats_hook = nil
+  end
+end
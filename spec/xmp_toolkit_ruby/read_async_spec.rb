@@ -0,0 +1,69 @@
+# frozen_string_literal: true
+
+RSpec.describe "XmpToolkitRuby.read_async" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  def cancelled?(future)
+    future.value
+    false
+  rescue XmpToolkitRuby::CancelledError
+    true
+  end
+
+  it "returns the metadata xmp_from_file reads" do
+    future = XmpToolkitRuby.read_async(sample)
+    expected = XmpToolkitRuby.xmp_from_file(sample)
+
+    expect(future.wait(10)).to be(true)
+    expect(future).to be_ready
+    keys = %w[format handler_flags xmp_data]
+    expect(future.value.slice(*keys)).to eq(expected.slice(*keys))
+  end
+
+  it "delivers completed reads through a CompletionQueue" do
+    queue = XmpToolkitRuby::CompletionQueue.new
+    futures = Array.new(4) { XmpToolkitRuby.read_async(sample, queue: queue) }
+
+    popped = Array.new(4) { queue.pop(timeout: 10) }
+
+    expect(popped).to match_array(futures)
+    expect(queue).to be_empty
+    expect(queue.pop(timeout: 0)).to be_nil
+    expect { queue.pop(true) }.to raise_error(ThreadError)
+  end
+
+  it "raises CancelledError for a cancelled read" do
+    token = XmpToolkitRuby::CancellationToken.new
+    token.cancel
+
+    future = XmpToolkitRuby.read_async(sample, cancellation: token)
+
+    expect { future.value }.to raise_error(XmpToolkitRuby::CancelledError)
+  end
+
+  it "refuses a closed queue" do
+    queue = XmpToolkitRuby::CompletionQueue.new
+    queue.close
+
+    expect(queue.pop).to be_nil
+    expect { XmpToolkitRuby.read_async(sample, queue: queue) }.to raise_error(ClosedQueueError)
+  end
+
+  it "cancels the reads in flight when the toolkit terminates" do
+    threads = XmpToolkitRuby::XmpToolkit.worker_threads
+    XmpToolkitRuby::XmpToolkit.worker_threads = 1
+    futures = Array.new(32) { XmpToolkitRuby.read_async(sample) }
+
+    XmpToolkitRuby::XmpToolkit.terminate
+
+    expect(futures.map(&:ready?)).to all(be(true))
+    expect(futures.count { |future| cancelled?(future) }).to be > 0
+    expect(XmpToolkitRuby).not_to be_sdk_initialized
+  ensure
+    XmpToolkitRuby::XmpToolkit.worker_threads = threads
+  end
+
+  it "checks the file before starting" do
+    expect { XmpToolkitRuby.read_async("missing.pdf") }.to raise_error(XmpToolkitRuby::FileNotFoundError)
+  end
+end
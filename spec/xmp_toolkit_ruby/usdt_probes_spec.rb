@@ -0,0 +1,20 @@
+# frozen_string_literal: true
+
+require "open3"
+
+RSpec.describe "USDT probes" do
+  let(:extension) { $LOADED_FEATURES.find { |feature| feature.end_with?("xmp_toolkit_ruby.so") } }
+
+  it "has a start and a done probe for every SDK operation" do
+    notes, status = Open3.capture2("readelf", "-n", extension)
+    skip "readelf is not available" unless status.success?
+
+    probes = notes.scan(/Provider: xmp_toolkit_ruby\s+Name: (\w+)/).flatten.uniq
+    skip "built without sys/sdt.h" if probes.empty?
+
+    operations = %w[open get_xmp parse serialize update put_xmp close get set file_info]
+    expect(probes).to match_array(operations.flat_map { |op| ["#{op}__start", "#{op}__done"] })
+  rescue Errno::ENOENT
+    skip "readelf is not available"
+  end
+end
@@ -0,0 +1,57 @@
+# frozen_string_literal: true
+
+require "fileutils"
+require "tmpdir"
+
+RSpec.describe "XmpToolkitRuby::XmpFile cancellation" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+  let(:token) { XmpToolkitRuby::CancellationToken.new }
+
+  it "refuses to open a file with a cancelled token" do
+    token.cancel
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample, cancellation: token)
+
+    expect { xmp_file.open }.to raise_error(XmpToolkitRuby::CancelledError)
+    expect(xmp_file).not_to be_open
+  end
+
+  it "drops an update cancelled before it is written" do
+    Dir.mktmpdir do |dir|
+      copy = File.join(dir, "sample.pdf")
+      FileUtils.cp(sample, copy)
+      before = File.binread(copy)
+
+      xmp_file = XmpToolkitRuby::XmpFile.new(copy, open_flags: XmpToolkitRuby::XmpFileOpenFlags::OPEN_FOR_UPDATE,
+                                                   cancellation: token)
+      xmp_file.update_property("http://ns.adobe.com/xap/1.0/", "Label", "cancelled")
+      xmp_file.write
+      token.cancel
+
+      expect { xmp_file.close }.to raise_error(XmpToolkitRuby::CancelledError)
+      expect(File.binread(copy)).to eq(before)
+    end
+  end
+
+  it "writes updates with a timeout and a progress block" do
+    Dir.mktmpdir do |dir|
+      copy = File.join(dir, "sample.pdf")
+      FileUtils.cp(sample, copy)
+
+      xmp_file = XmpToolkitRuby::XmpFile.new(copy, open_flags: XmpToolkitRuby::XmpFileOpenFlags::OPEN_FOR_UPDATE,
+                                                   timeout: 30)
+      reports = []
+      xmp_file.on_progress(interval: 0) { |fraction_done, *| reports << fraction_done }
+      xmp_file.update_property("http://ns.adobe.com/xap/1.0/", "Label", "progress")
+      xmp_file.write
+      xmp_file.close
+
+      expect(reports).to all(be_between(0.0, 1.0))
+      expect(XmpToolkitRuby.xmp_from_file(copy)["xmp_data"]).to include("progress")
+    end
+  end
+
+  it "validates its settings" do
+    expect { XmpToolkitRuby::XmpFile.new(sample, timeout: 0) }.to raise_error(ArgumentError)
+    expect { XmpToolkitRuby::XmpFile.new(sample, cancellation: :token) }.to raise_error(TypeError)
+  end
+end
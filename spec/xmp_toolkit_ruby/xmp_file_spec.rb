@@ -46,6 +46,15 @@ RSpec.describe XmpToolkitRuby::XmpFile do
       expect(xmp["xmp_data"]).to include("part")
     end
 
+    it "raises for an unregistered namespace" do
+      xmp_file.open
+
+      expect do
+        xmp_file.update_property "http://unregistered.example/ns/", "part", "1"
+      end.to raise_error(RuntimeError, "Failed to set XMP property")
+      expect(xmp_file).not_to be_dirty
+    end
+
     context "when using XmpToolkitRuby::XmpValue" do
       it "can handle string values" do
         xmp_file.open
@@ -133,6 +142,43 @@ RSpec.describe XmpToolkitRuby::XmpFile do
     end
   end
 
+  describe "#dirty?" do
+    it "stays clean when a property is set to its current value" do
+      xmp_file.open
+      xmp_file.update_property XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer", "Skia/PDF m134"
+
+      expect(xmp_file.dirty?).to be(false)
+      expect(xmp_file.write).to be(false)
+    end
+
+    it "becomes dirty when a value changes" do
+      xmp_file.open
+      xmp_file.update_property XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer", "ACME PDF"
+
+      expect(xmp_file.dirty?).to be(true)
+      expect(xmp_file.write).to be(true)
+      expect(xmp_file.dirty?).to be(false)
+    end
+  end
+
+  describe ".register_namespaces" do
+    it "registers every known namespace" do
+      prefixes = described_class.register_namespaces
+
+      expect(prefixes).to include(XmpToolkitRuby::Namespaces::XMP_NS_PDFUA_ID => "pdfuaid:",
+                                  XmpToolkitRuby::Namespaces::XMP_NS_DC => "dc:")
+    end
+  end
+
+  describe ".file_mod_date" do
+    it "answers without opening the file" do
+      expect(described_class.file_mod_date(filename)).to be_within(1).of(File.mtime(filename))
+      expect(described_class.associated_resources(filename)).to eq([filename])
+      expect(described_class.metadata_writable?(filename)).to be(true)
+      expect(described_class.file_format(filename)).to eq(:kXMP_PDFFile)
+    end
+  end
+
   describe "#property" do
     it "can retrieve a property" do
       actual_value = nil
@@ -285,6 +331,31 @@ RSpec.describe XmpToolkitRuby::XmpFile do
     end
   end
 
+  describe "#apply_template" do
+    it "deletes properties that are empty in the template" do
+      template_xmp = <<~XMP
+          <x:xmpmeta xmlns:x="adobe:ns:meta/">
+          <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+            <rdf:Description xmlns:pdf="http://ns.adobe.com/pdf/1.3/" rdf:about="">
+               <pdf:Producer></pdf:Producer>
+            </rdf:Description>
+          </rdf:RDF>
+        </x:xmpmeta>
+      XMP
+      template = XmpToolkitRuby::XmpTemplate.new(template_xmp,
+                                                 flags: XmpToolkitRuby::XmpTemplateFlags.bitmask_for(:replace_with_delete_empty))
+
+      xmp_file.open
+      xmp_file.apply_template template
+
+      expect(xmp_file.property(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Producer")).to include("exists" => false)
+    end
+
+    it "rejects malformed templates" do
+      expect { XmpToolkitRuby::XmpTemplate.new("<x:xmpmeta") }.to raise_error(ArgumentError, /Invalid XMP template/)
+    end
+  end
+
   describe "#update_localized_property" do
     it "can set a localized property" do
       xmp_file.open
@@ -305,6 +376,83 @@ RSpec.describe XmpToolkitRuby::XmpFile do
     end
   end
 
+  describe "#update_array_property" do
+    it "replaces all items of an array" do
+      xmp_file.open
+      xmp_file.update_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject", %w[one two]
+      xmp_file.update_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject", %w[alpha beta gamma]
+      xmp_file.write
+      xmp_file.close
+
+      actual_value = nil
+      described_class.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)) do |xmp_file|
+        actual_value = xmp_file.array_property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")
+      end
+
+      expect(actual_value).to include("exists" => true, "items" => %w[alpha beta gamma])
+    end
+
+    it "creates ordered arrays when asked to" do
+      xmp_file.open
+      xmp_file.update_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "creator", ["Jane Doe", "John Doe"], form: :seq
+      xmp_file.write
+      xmp_file.close
+
+      xmp = XmpToolkitRuby.xmp_from_file(filename)
+
+      expect(xmp["xmp_data"]).to include("<rdf:Seq>")
+    end
+
+    it "leaves the array untouched when an item is invalid" do
+      xmp_file.open
+      xmp_file.update_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject", %w[one two]
+
+      expect do
+        xmp_file.update_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject", ["alpha", "be\0ta"]
+      end.to raise_error(ArgumentError)
+      expect(xmp_file.array_property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")["items"]).to eq(%w[one two])
+    end
+  end
+
+  describe "#array_property" do
+    it "reports missing arrays" do
+      actual_value = nil
+      described_class.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)) do |xmp_file|
+        actual_value = xmp_file.array_property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")
+      end
+
+      expect(actual_value).to include("exists" => false, "items" => [])
+    end
+  end
+
+  describe "#separate_array_property" do
+    it "round-trips an edit string" do
+      xmp_file.open
+      xmp_file.separate_array_property XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject", "XMP; Blue Square; test file"
+
+      expect(xmp_file.catenated_array_property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")).to eq("XMP; Blue Square; test file")
+    end
+  end
+
+  describe "#localized_properties" do
+    it "returns every language alternative" do
+      xmp_file.open
+      xmp_file.update_localized_property schema_ns: XmpToolkitRuby::Namespaces::XMP_NS_DC,
+                                         alt_text_name: "title",
+                                         generic_lang: "de",
+                                         specific_lang: "de-DE",
+                                         item_value: "Goldene Beispiel-PDF",
+                                         options: 0
+
+      actual_value = xmp_file.localized_properties(schema_ns: XmpToolkitRuby::Namespaces::XMP_NS_DC, alt_text_name: "title")
+
+      expect(actual_value).to eq({
+        "x-default" => "Golden Sample PDF",
+        "de-DE" => "Goldene Beispiel-PDF"
+      })
+    end
+  end
+
   describe "#file_info" do
     it "returns file information" do
       described_class.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)) do |xmp_file|
@@ -368,6 +516,28 @@ RSpec.describe XmpToolkitRuby::XmpFile do
     end
   end
 
+  describe "#close" do
+    after do
+      XmpToolkitRuby::XmpToolkit.stats_hook = nil
+    end
+
+    it "refuses to close while one of its calls is running" do
+      errors = []
+      xmp_file.open
+      XmpToolkitRuby::XmpToolkit.stats_hook = lambda do |*|
+        xmp_file.close
+      rescue XmpToolkitRuby::BusyError => e
+        errors << e
+      end
+
+      xmp_file.property(XmpToolkitRuby::Namespaces::XMP_NS_DC, "format")
+
+      expect(errors).not_to be_empty
+      expect(xmp_file).to be_open
+      expect(xmp_file.file_info["format"]).to eq(:kXMP_PDFFile)
+    end
+  end
+
   describe ".with_xmp_file" do
     it "initializes the sdk" do
       described_class.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler)) do |_xmp_file|
@@ -0,0 +1,74 @@
+# frozen_string_literal: true
+
+require "tempfile"
+
+RSpec.describe "XmpToolkitRuby::XmpFile#warnings" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+  # BlueSquare.jpg with 70 duplicate dc:format elements in its packet
+  let(:damaged) { File.expand_path("../fixtures/damaged_packet.jpg", __dir__) }
+
+  around do |example|
+    rate = XmpToolkitRuby::XmpToolkit.error_log_rate
+    example.run
+  ensure
+    XmpToolkitRuby::XmpToolkit.error_log_rate = rate
+  end
+
+  it "is empty for an intact file" do
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+    xmp_file.open
+    xmp_file.meta
+    xmp_file.close
+
+    expect(xmp_file.warnings).to eq([])
+  end
+
+  it "is kept after close" do
+    XmpToolkitRuby::XmpToolkit.error_log_rate = 0
+    xmp_file = XmpToolkitRuby::XmpFile.new(damaged)
+    xmp_file.open
+    xmp_file.meta
+    xmp_file.close
+
+    expect(xmp_file.warnings.first).to include("severity" => :recoverable, "cause" => 203, "path" => damaged,
+                                               "message" => "Duplicate property or field node")
+  end
+
+  it "keeps at most 64 entries per file" do
+    XmpToolkitRuby::XmpToolkit.error_log_rate = 0
+    xmp_file = XmpToolkitRuby::XmpFile.new(damaged)
+    xmp_file.open
+    xmp_file.meta
+    xmp_file.close
+
+    expect(xmp_file.warnings.size).to eq(64)
+  end
+
+  it "reports a failed open once it is cleaned up, even if Warning.warn raises" do
+    truncated = Tempfile.new(["truncated", ".jpg"])
+    truncated.write(File.binread(damaged, 100))
+    truncated.flush
+    xmp_file = XmpToolkitRuby::XmpFile.new(truncated.path)
+
+    XmpToolkitRuby.with_init do
+      stderr = $stderr
+      $stderr = Object.new.tap { |io| def io.write(*) = raise("warnings are errors") }
+      expect { xmp_file.open }.to raise_error(RuntimeError, "warnings are errors")
+    ensure
+      $stderr = stderr
+    end
+
+    expect(xmp_file.warnings).to contain_exactly(include("severity" => :file_fatal, "path" => truncated.path))
+    expect(xmp_file).not_to be_open
+  end
+
+  it "changes the warning rate" do
+    XmpToolkitRuby::XmpToolkit.error_log_rate = 0
+
+    expect(XmpToolkitRuby::XmpToolkit.error_log_rate).to eq(0)
+  end
+
+  it "rejects a negative log rate" do
+    expect { XmpToolkitRuby::XmpToolkit.error_log_rate = -1 }.to raise_error(ArgumentError)
+  end
+end
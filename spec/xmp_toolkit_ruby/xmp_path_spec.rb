@@ -0,0 +1,65 @@
+# frozen_string_literal: true
+
+require "tempfile"
+
+RSpec.describe XmpToolkitRuby::XmpPath do
+  def fixture_file_clone(filename)
+    orig_file = File.expand_path("../fixtures/#{filename}", __dir__)
+    cloned_file = Tempfile.new(File.basename(orig_file))
+
+    FileUtils.cp(orig_file, cloned_file.path)
+    cloned_file
+  end
+
+  before do
+    XmpToolkitRuby::XmpToolkit.initialize_xmp
+  end
+
+  after do
+    XmpToolkitRuby::XmpToolkit.terminate
+  end
+
+  describe ".parse" do
+    it "resolves the namespace from the prefix" do
+      path = described_class.parse("dc:title")
+
+      expect(path.schema_ns).to eq(XmpToolkitRuby::Namespaces::XMP_NS_DC)
+      expect(path.path).to eq("dc:title")
+      expect(path).to be_frozen
+    end
+
+    it "rejects unknown prefixes" do
+      expect { described_class.parse("nope:title") }.to raise_error(ArgumentError, /Unknown namespace prefix/)
+    end
+  end
+
+  describe "derived paths" do
+    it "composes array items and language selectors" do
+      subject_path = described_class.new(XmpToolkitRuby::Namespaces::XMP_NS_DC, "subject")
+      title_path = described_class.parse("dc:title")
+
+      expect(subject_path.array_item(2).path).to eq("dc:subject[2]")
+      expect(subject_path.array_item(:last).path).to eq("dc:subject[last()]")
+      expect(title_path.lang_selector("en-US").path).to eq("dc:title[?xml:lang=\"en-US\"]")
+    end
+  end
+
+  describe "usage with XmpFile" do
+    let(:filename) { fixture_file_clone("sample.pdf").path }
+
+    it "reads and writes properties through a precompiled path" do
+      producer = described_class.parse("pdf:Producer")
+
+      XmpToolkitRuby::XmpFile.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_update, :open_use_smart_handler), auto_terminate_toolkit: false) do |xmp_file|
+        xmp_file.update_property(producer, "ACME PDF")
+      end
+
+      actual_value = nil
+      XmpToolkitRuby::XmpFile.with_xmp_file(filename, open_flags: XmpToolkitRuby::XmpFileOpenFlags.bitmask_for(:open_for_read, :open_use_smart_handler), auto_terminate_toolkit: false) do |xmp_file|
+        actual_value = xmp_file.property(producer)
+      end
+
+      expect(actual_value).to include("exists" => true, "value" => "ACME PDF")
+    end
+  end
+end
@@ -0,0 +1,44 @@
+# frozen_string_literal: true
+
+RSpec.describe "XmpToolkitRuby::XmpToolkit heap trimming" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  after do
+    XmpToolkitRuby::XmpToolkit.heap_trim_interval = 0
+  end
+
+  it "reports the process heap" do
+    stats = XmpToolkitRuby::XmpToolkit.heap_stats
+
+    expect(stats.keys).to contain_exactly("rss", "heap", "in_use", "free", "releasable", "fragmentation", "trims")
+    expect(stats["fragmentation"]).to be_nil.or be_between(0, 1)
+  end
+
+  it "trims the heap on demand" do
+    expect(XmpToolkitRuby::XmpToolkit.trim_heap).to be_nil.or be >= 0
+  end
+
+  it "trims after closed files when an interval is set" do
+    skip "malloc_trim is not available" if XmpToolkitRuby::XmpToolkit.trim_heap.nil?
+
+    XmpToolkitRuby::XmpToolkit.heap_trim_interval = 1
+    trims = XmpToolkitRuby::XmpToolkit.heap_stats["trims"]
+
+    3.times { XmpToolkitRuby.xmp_from_file(sample) }
+
+    expect(XmpToolkitRuby::XmpToolkit.heap_stats["trims"]).to eq(trims + 3)
+  end
+
+  it "does not count closing a wrapper with nothing open" do
+    XmpToolkitRuby::XmpToolkit.heap_trim_interval = 1
+    trims = XmpToolkitRuby::XmpToolkit.heap_stats["trims"]
+
+    XmpToolkitRuby::XmpWrapper.new.close
+
+    expect(XmpToolkitRuby::XmpToolkit.heap_stats["trims"]).to eq(trims)
+  end
+
+  it "rejects a negative interval" do
+    expect { XmpToolkitRuby::XmpToolkit.heap_trim_interval = -1 }.to raise_error(ArgumentError)
+  end
+end
@@ -0,0 +1,67 @@
+# frozen_string_literal: true
+
+require "fileutils"
+require "tmpdir"
+
+RSpec.describe "XmpToolkitRuby::XmpToolkit.io_stats" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  before do
+    XmpToolkitRuby::XmpToolkit.reset_io_stats
+    XmpToolkitRuby::XmpToolkit.io_accounting = true
+  end
+
+  after do
+    XmpToolkitRuby::XmpToolkit.io_accounting = false
+  end
+
+  it "counts the reads of a file and reports them with the packet info" do
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+    xmp_file.open
+    io = xmp_file.packet_info["io"]
+    xmp_file.close
+
+    expect(io["reads"]).to be > 0
+    expect(io["bytes_read"]).to be > 0
+    expect(io["writes"]).to eq(0)
+    expect(io["packet_bytes"]).to eq(xmp_file.packet_info["length"])
+    expect(xmp_file.io_stats["bytes_read"]).to be >= io["bytes_read"]
+  end
+
+  it "reports the write amplification of an update" do
+    Dir.mktmpdir do |dir|
+      copy = File.join(dir, "sample.pdf")
+      FileUtils.cp(sample, copy)
+
+      xmp_file = XmpToolkitRuby::XmpFile.new(copy, open_flags: XmpToolkitRuby::XmpFileOpenFlags::OPEN_FOR_UPDATE)
+      xmp_file.update_property("http://ns.adobe.com/xap/1.0/", "Label", "io")
+      xmp_file.write
+      xmp_file.close
+
+      expect(xmp_file.io_stats["bytes_written"]).to be > 0
+      expect(xmp_file.io_stats["write_amplification"]).to be > 0
+    end
+  end
+
+  it "aggregates closed files by format and open strategy" do
+    2.times { XmpToolkitRuby.xmp_from_file(sample) }
+
+    pdf = XmpToolkitRuby::XmpToolkit.io_stats.find do |entry|
+      entry["format"] == XmpToolkitRuby::XmpFileFormat.value_for(:kXMP_PDFFile)
+    end
+
+    expect(pdf).to include("strategy" => :smart_handler, "files" => 2, "writes" => 0)
+    expect(pdf["bytes_read"]).to be > 0
+  end
+
+  it "leaves files opened without accounting uncounted" do
+    XmpToolkitRuby::XmpToolkit.io_accounting = false
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+    xmp_file.open
+
+    expect(xmp_file.io_stats).to be_nil
+    expect(xmp_file.packet_info).not_to have_key("io")
+  ensure
+    xmp_file&.close
+  end
+end
@@ -0,0 +1,44 @@
+# frozen_string_literal: true
+
+require "objspace"
+
+RSpec.describe "XmpToolkitRuby::XmpToolkit.native_memory" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  it "accounts for the tree of an open file until it is closed" do
+    before = XmpToolkitRuby::XmpToolkit.native_memory
+
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+    xmp_file.open
+    xmp_file.meta
+    during = XmpToolkitRuby::XmpToolkit.native_memory
+    wrapper_size = ObjectSpace.memsize_of(xmp_file.instance_variable_get(:@xmp_wrapper))
+    xmp_file.close
+    after = XmpToolkitRuby::XmpToolkit.native_memory
+
+    expect(during["wrappers"]).to eq(before["wrappers"] + 1)
+    expect(during["meta"]).to be > before["meta"]
+    expect(during["file"]).to be > before["file"]
+    expect(wrapper_size).to be >= during["meta"] - before["meta"]
+    expect(after).to include("wrappers" => before["wrappers"], "meta" => before["meta"], "file" => before["file"])
+  end
+
+  it "follows the tree as setters grow it" do
+    xmp_file = XmpToolkitRuby::XmpFile.new(sample)
+    xmp_file.open
+    xmp_file.meta
+    before = XmpToolkitRuby::XmpToolkit.native_memory["meta"]
+
+    xmp_file.update_property(XmpToolkitRuby::Namespaces::XMP_NS_PDF, "Keywords", "x" * 100_000)
+    after = XmpToolkitRuby::XmpToolkit.native_memory["meta"]
+    xmp_file.close
+
+    expect(after).to be >= before + 100_000
+  end
+
+  it "sums the owners up" do
+    memory = XmpToolkitRuby::XmpToolkit.native_memory
+
+    expect(memory["total"]).to eq(memory["meta"] + memory["file"] + memory["metadata_cache"])
+  end
+end
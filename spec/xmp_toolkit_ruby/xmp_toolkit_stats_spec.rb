@@ -0,0 +1,44 @@
+# frozen_string_literal: true
+
+RSpec.describe "XmpToolkitRuby::XmpToolkit.stats" do
+  let(:sample) { File.expand_path("../fixtures/sample.pdf", __dir__) }
+
+  before do
+    XmpToolkitRuby::XmpToolkit.reset_stats
+  end
+
+  after do
+    XmpToolkitRuby::XmpToolkit.stats_hook = nil
+  end
+
+  it "records SDK calls by operation, format and open strategy" do
+    XmpToolkitRuby.xmp_from_file(sample)
+
+    stats = XmpToolkitRuby::XmpToolkit.stats
+    open = stats.find { |entry| entry["operation"] == :open }
+
+    expect(stats.map { |entry| entry["operation"] }).to include(:open, :get_xmp, :serialize, :close)
+    expect(open).to include("format" => XmpToolkitRuby::XmpFileFormat.value_for(:kXMP_PDFFile),
+                            "strategy" => :smart_handler, "count" => 1, "errors" => 0)
+    expect(open["buckets"].values.sum).to eq(1)
+  end
+
+  it "notifies the stats hook" do
+    events = []
+    XmpToolkitRuby::XmpToolkit.stats_hook = lambda do |operation, _format, strategy, seconds, ok|
+      events << [operation, strategy, seconds, ok]
+    end
+
+    XmpToolkitRuby.xmp_from_file(sample)
+
+    expect(events.map(&:first)).to include(:open, :close)
+    expect(events).to all(satisfy { |_, _, seconds, ok| seconds >= 0 && ok })
+  end
+
+  it "resets" do
+    XmpToolkitRuby.xmp_from_file(sample)
+    XmpToolkitRuby::XmpToolkit.reset_stats
+
+    expect(XmpToolkitRuby::XmpToolkit.stats).to be_empty
+  end
+end
@@ -265,6 +265,37 @@ RSpec.describe XmpToolkitRuby do
     expect(XmpToolkitRuby::XmpFileFormat.name_for(xmp["format_orig"])).to eq(:kXMP_PNGFile)
   end
 
+  it "applies one parsed template to several files" do
+    template_xmp = <<~XMP
+        <x:xmpmeta xmlns:x="adobe:ns:meta/">
+        <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+          <rdf:Description xmlns:xmpRights="http://ns.adobe.com/xap/1.0/rights/" rdf:about="">
+             <xmpRights:Marked>True</xmpRights:Marked>
+          </rdf:Description>
+        </rdf:RDF>
+      </x:xmpmeta>
+    XMP
+    files = Array.new(2) { fixture_file_clone("sample.pdf") }
+
+    described_class.with_init do
+      template = XmpToolkitRuby::XmpTemplate.new(template_xmp)
+      files.each { |file| described_class.xmp_to_file file.path, template }
+    end
+
+    files.each do |file|
+      expect(described_class.xmp_from_file(file.path)["xmp_data"]).to include("<xmpRights:Marked>True</xmpRights:Marked>")
+    end
+  end
+
+  it "defers terminate until the last with_init block finishes" do
+    described_class.with_init do
+      expect(XmpToolkitRuby::XmpToolkit.terminate).to be(false)
+      expect(described_class).to be_sdk_initialized
+    end
+
+    expect(described_class).not_to be_sdk_initialized
+  end
+
   it "detects the correct handler flags" do
     xmp = described_class.xmp_from_file(xmp_toolkit_fixture_file("BlueSquare.png"))
 